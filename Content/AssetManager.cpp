@@ -3,47 +3,168 @@
 #include <Content/Mesh.hpp>
 #include <Content/Texture.hpp>
 #include <Content/Shader.hpp>
+#include <Stratum/ShaderCompiler.hpp>
+#include <Util/Profiler.hpp>
 
 using namespace std;
 
-AssetManager::AssetManager(Device* device) : mDevice(device) {}
+AssetManager::AssetManager(Device* device, JobSystem* jobSystem) : mDevice(device), mJobSystem(jobSystem), mUploadsPerFrame(4), mCompressTextures(false) {
+	uint8_t white[4] { 0xFF, 0xFF, 0xFF, 0xFF };
+	mPlaceholderTexture = new Texture("Placeholder Texture", mDevice, white, sizeof(white), 1, 1, 1, VK_FORMAT_R8G8B8A8_UNORM, 1);
+	mPlaceholderMesh = Mesh::CreateCube("Placeholder Mesh", mDevice, .5f);
+}
 AssetManager::~AssetManager() {
+	// Decode jobs reference loads, let them finish first
+	for (auto& load : mPending)
+		mJobSystem->Wait(&load->mDecode);
+	mPending.clear();
+	mLoading.clear();
+
 	for (auto& asset : mAssets)
 		delete asset.second;
+	safe_delete(mPlaceholderTexture);
+	safe_delete(mPlaceholderMesh);
+}
+
+template<class T, class Data, class DecodeFunc, class CreateFunc>
+AssetHandle<T> AssetManager::LoadAsync(const string& key, T* placeholder, DecodeFunc decode, CreateFunc create) {
+	AssetHandle<T> handle;
+	handle.mPlaceholder = placeholder;
+
+	lock_guard<mutex> lock(mMutex);
+	auto it = mAssets.find(key);
+	if (it != mAssets.end()) {
+		handle.mAsset = (T*)it->second;
+		return handle;
+	}
+
+	shared_ptr<AssetLoad>& load = mLoading[key];
+	if (!load) {
+		load = make_shared<AssetLoad>();
+		load->mKey = key;
+
+		shared_ptr<Data> data = make_shared<Data>();
+		load->mCreate = [data, create]() -> Asset* { return create(*data); };
+
+		shared_ptr<AssetLoad> l = load;
+		mJobSystem->Schedule([l, data, decode]() {
+			PROFILER_BEGIN("Decode Asset");
+			if (!decode(*data)) l->mFailed = true;
+			PROFILER_END;
+		}, &l->mDecode);
+		mPending.push_back(load);
+	}
+	handle.mLoad = load;
+	return handle;
+}
+
+void AssetManager::Finish(const shared_ptr<AssetLoad>& load) {
+	mJobSystem->Wait(&load->mDecode);
+
+	lock_guard<mutex> createLock(load->mMutex);
+	if (!load->mCreate) return; // finished by another thread
+
+	Asset* asset = load->mFailed ? nullptr : load->mCreate();
+	load->mCreate = nullptr;
+	{
+		lock_guard<mutex> lock(mMutex);
+		if (asset) mAssets[load->mKey] = asset;
+		// Failed loads are forgotten, so the next request tries again
+		mLoading.erase(load->mKey);
+	}
+	load->mAsset.store(asset, memory_order_release);
+}
+
+void AssetManager::Update() {
+	PROFILER_BEGIN("Finish Asset Loads");
+	vector<shared_ptr<AssetLoad>> ready;
+	{
+		lock_guard<mutex> lock(mMutex);
+		for (auto it = mPending.begin(); it != mPending.end() && ready.size() < mUploadsPerFrame;) {
+			if ((*it)->mDecode.Done()) {
+				ready.push_back(*it);
+				it = mPending.erase(it);
+			} else
+				it++;
+		}
+	}
+	for (auto& load : ready)
+		Finish(load);
+	PROFILER_END;
+}
+
+AssetHandle<Shader> AssetManager::LoadShaderAsync(const string& filename) {
+	return LoadAsync<Shader, ShaderFile>(filename, nullptr,
+		[filename](ShaderFile& data) { return Shader::Decode(filename, data); },
+		[this, filename](ShaderFile& data) { return new Shader(filename, mDevice, move(data)); });
+}
+AssetHandle<Texture> AssetManager::LoadTextureAsync(const string& filename, bool srgb) {
+	bool compress = mCompressTextures && mDevice->TextureCompressionBC();
+	bool decompress = !mDevice->TextureCompressionBC();
+	return LoadAsync<Texture, TextureData>(filename, mPlaceholderTexture,
+		[this, filename, srgb, compress, decompress](TextureData& data) {
+			if (!Texture::Decode(filename, srgb, data, compress, mJobSystem)) return false;
+			// .ktx2 and .dds files may be block compressed, decode them here instead of on the loading thread
+			if (decompress && BlockCompression::IsBlockCompressed(data.mFormat) && !Texture::Decompress(data)) {
+				fprintf_color(COLOR_RED, stderr, "Device doesn't support BC textures, and %s can't be decoded: %s\n", FormatToString(data.mFormat), filename.c_str());
+				return false;
+			}
+			return true;
+		},
+		[this, filename](TextureData& data) { return new Texture(filename, mDevice, data); });
+}
+AssetHandle<Texture> AssetManager::LoadCubemapAsync(const string& posx, const string& negx, const string& posy, const string& negy, const string& posz, const string& negz, bool srgb) {
+	return LoadAsync<Texture, TextureData>(negx + posx + negy + posy + negz + posz, mPlaceholderTexture,
+		[=](TextureData& data) { return Texture::Decode(posx, negx, posy, negy, posz, negz, srgb, data); },
+		[this, negx](TextureData& data) { return new Texture(negx + " Cube", mDevice, data); });
+}
+AssetHandle<Mesh> AssetManager::LoadMeshAsync(const string& filename, float scale) {
+	return LoadAsync<Mesh, MeshData>(filename, mPlaceholderMesh,
+		[filename, scale](MeshData& data) { return Mesh::Decode(filename, scale, data); },
+		[this, filename](MeshData& data) { return new Mesh(filename, mDevice, data); });
+}
+AssetHandle<Font> AssetManager::LoadFontAsync(const string& filename, uint32_t pixelHeight) {
+	return LoadAsync<Font, FontData>(filename + to_string(pixelHeight), nullptr,
+		[filename, pixelHeight](FontData& data) { return Font::Decode(filename, (float)pixelHeight, 1.f / pixelHeight, data); },
+		[this, filename](FontData& data) { return new Font(filename, mDevice, data); });
 }
 
 Shader* AssetManager::LoadShader(const string& filename) {
-	mMutex.lock();
-	Asset*& asset = mAssets[filename];
-	if (!asset) asset = new Shader(filename, mDevice, filename);
-	mMutex.unlock();
-	return (Shader*)asset;
+	Shader* shader = Wait(LoadShaderAsync(filename));
+	if (!shader) throw;
+	return shader;
 }
 Texture* AssetManager::LoadTexture(const string& filename, bool srgb) {
-	mMutex.lock();
-	Asset*& asset = mAssets[filename];
-	if (!asset) asset = new Texture(filename, mDevice, filename, srgb);
-	mMutex.unlock();
-	return (Texture*)asset;
+	Texture* texture = Wait(LoadTextureAsync(filename, srgb));
+	if (!texture) throw;
+	return texture;
 }
 Texture* AssetManager::LoadCubemap(const string& posx, const string& negx, const string& posy, const string& negy, const string& posz, const string& negz, bool srgb) {
-	mMutex.lock();
-	Asset*& asset = mAssets[negx + posx + negy + posy + negz + posz];
-	if (!asset) asset = new Texture(negx + " Cube", mDevice, posx, negx, posy, negy, posz, negz, srgb);
-	mMutex.unlock();
-	return (Texture*)asset;
+	Texture* texture = Wait(LoadCubemapAsync(posx, negx, posy, negy, posz, negz, srgb));
+	if (!texture) throw;
+	return texture;
 }
 Mesh* AssetManager::LoadMesh(const string& filename, float scale) {
-	mMutex.lock();
-	Asset*& asset = mAssets[filename];
-	if (!asset) asset = new Mesh(filename, mDevice, filename, scale);
-	mMutex.unlock();
-	return (Mesh*)asset;
+	Mesh* mesh = Wait(LoadMeshAsync(filename, scale));
+	if (!mesh) throw;
+	return mesh;
 }
 Font* AssetManager::LoadFont(const string& filename, uint32_t pixelHeight) {
-	mMutex.lock();
-	Asset*& asset = mAssets[filename + to_string(pixelHeight)];
-	if (!asset) asset = new Font(filename, mDevice, filename, (float)pixelHeight, 1.f / pixelHeight);
-	mMutex.unlock();
-	return (Font*)asset;
+	Font* font = Wait(LoadFontAsync(filename, pixelHeight));
+	if (!font) throw;
+	return font;
+}
+
+uint32_t AssetManager::PrewarmPipelines(const vector<PipelineKey>& keys, RenderPass* renderPass) {
+	uint32_t count = 0;
+	for (const PipelineKey& key : keys) {
+		if (key.mRenderPass != renderPass->Hash()) continue;
+		Shader* shader = Wait(LoadShaderAsync(key.mShader));
+		if (!shader) continue;
+		GraphicsShader* variant = shader->GetGraphics((PassType)key.mPass, shader->File().ParseKeywords(key.mKeywords));
+		if (!variant) continue;
+		variant->Prewarm(renderPass, key);
+		count++;
+	}
+	return count;
 }
\ No newline at end of file
@@ -1,15 +1,65 @@
 #pragma once
 
 #include <Core/Device.hpp>
+#include <Core/JobSystem.hpp>
 #include <Util/Util.hpp>
 #include <Content/Asset.hpp>
 
 class Font;
 class Mesh;
+class RenderPass;
 class Shader;
 class Texture;
 class Instance;
 
+/// State of one asynchronous load, shared by every AssetHandle that requested the same asset
+struct AssetLoad {
+	std::string mKey;
+	// Set once the asset has been created
+	std::atomic<Asset*> mAsset;
+	// Set by the decode job if the file couldn't be read
+	std::atomic<bool> mFailed;
+	// Reaches zero when the decode job finishes
+	JobCounter mDecode;
+	// Creates the asset from the decoded data. Cleared once the load finishes
+	std::function<Asset*()> mCreate;
+	// Held while creating the asset, so only one thread creates it
+	std::mutex mMutex;
+
+	inline AssetLoad() : mAsset(nullptr), mFailed(false) {}
+};
+
+/// Handle to an asset requested with one of the AssetManager::Load*Async functions.
+/// Get() returns a placeholder (which may be nullptr) until the asset has been decoded and created
+template<class T>
+class AssetHandle {
+public:
+	inline AssetHandle() : mAsset(nullptr), mPlaceholder(nullptr) {}
+
+	inline bool Ready() const { return mAsset || (mLoad && mLoad->mAsset.load(std::memory_order_acquire)); }
+	inline bool Failed() const { return !mAsset && mLoad && mLoad->mFailed.load(std::memory_order_acquire); }
+
+	inline T* Get() const {
+		if (mAsset) return mAsset;
+		if (mLoad)
+			if (Asset* asset = mLoad->mAsset.load(std::memory_order_acquire))
+				return (T*)asset;
+		return mPlaceholder;
+	}
+	inline operator T*() const { return Get(); }
+	inline T* operator->() const { return Get(); }
+
+private:
+	friend class AssetManager;
+	// Set if the asset was already loaded when it was requested
+	T* mAsset;
+	T* mPlaceholder;
+	std::shared_ptr<AssetLoad> mLoad;
+};
+
+/// Loads and caches assets by filename. The Load* functions block until the asset is created.
+/// The Load*Async functions decode files on the JobSystem and create GPU resources during Update(), a few per frame.
+/// Concurrent requests for the same asset share one load
 class AssetManager {
 public:
 	ENGINE_EXPORT ~AssetManager();
@@ -20,11 +70,61 @@ public:
 	ENGINE_EXPORT Mesh*		LoadMesh	(const std::string& filename, float scale = 1.f);
 	ENGINE_EXPORT Font*		LoadFont	(const std::string& filename, uint32_t pixelHeight);
 
+	/// Shaders have no placeholder, Get() returns nullptr until the shader is ready
+	ENGINE_EXPORT AssetHandle<Shader>	LoadShaderAsync	(const std::string& filename);
+	/// Get() returns a 1x1 white texture until the texture is ready
+	ENGINE_EXPORT AssetHandle<Texture>	LoadTextureAsync(const std::string& filename, bool srgb = true);
+	ENGINE_EXPORT AssetHandle<Texture>	LoadCubemapAsync(const std::string& posx, const std::string& negx, const std::string& posy, const std::string& negy, const std::string& posz, const std::string& negz, bool srgb = true);
+	/// Get() returns a unit cube until the mesh is ready
+	ENGINE_EXPORT AssetHandle<Mesh>		LoadMeshAsync	(const std::string& filename, float scale = 1.f);
+	/// Fonts have no placeholder, Get() returns nullptr until the font is ready
+	ENGINE_EXPORT AssetHandle<Font>		LoadFontAsync	(const std::string& filename, uint32_t pixelHeight);
+
+	/// Blocks until an asynchronous load finishes, creating the asset on the calling thread if it hasn't been created yet.
+	/// Returns nullptr if the load failed
+	template<class T>
+	inline T* Wait(const AssetHandle<T>& handle) {
+		if (handle.mAsset || !handle.mLoad) return handle.mAsset;
+		Finish(handle.mLoad);
+		return (T*)handle.mLoad->mAsset.load(std::memory_order_acquire);
+	}
+
+	/// Creates the pipelines in keys that were recorded for renderPass, see Device::RecordedPipelines(). Loads the shaders they use.
+	/// With Device::AsyncPipelineCompilation() on, this only schedules the pipelines. Returns the number of keys that matched
+	ENGINE_EXPORT uint32_t PrewarmPipelines(const std::vector<PipelineKey>& keys, RenderPass* renderPass);
+
+	/// Maximum number of decoded assets that Update() creates each frame
+	inline uint32_t UploadsPerFrame() const { return mUploadsPerFrame; }
+	inline void UploadsPerFrame(uint32_t n) { mUploadsPerFrame = n; }
+	/// Block compress textures loaded from now on, see Texture::Decode(). Off by default since the first load of each image is slower.
+	/// Ignored if the device doesn't support BC formats
+	inline bool CompressTextures() const { return mCompressTextures; }
+	inline void CompressTextures(bool c) { mCompressTextures = c; }
+
 private:
 	friend class Stratum;
-	ENGINE_EXPORT AssetManager(Device* device);
+	ENGINE_EXPORT AssetManager(Device* device, JobSystem* jobSystem);
+
+	/// Creates the assets of finished decode jobs, up to mUploadsPerFrame of them. Called once per frame by Stratum
+	ENGINE_EXPORT void Update();
+	/// Waits for a load's decode job, then creates the asset if no other thread has
+	ENGINE_EXPORT void Finish(const std::shared_ptr<AssetLoad>& load);
+	/// Returns the cached asset for key, joins the load already in flight for it, or starts a new one
+	template<class T, class Data, class DecodeFunc, class CreateFunc>
+	AssetHandle<T> LoadAsync(const std::string& key, T* placeholder, DecodeFunc decode, CreateFunc create);
 
 	Device* mDevice;
+	JobSystem* mJobSystem;
+	uint32_t mUploadsPerFrame;
+	bool mCompressTextures;
+
+	Texture* mPlaceholderTexture;
+	Mesh* mPlaceholderMesh;
+
 	std::unordered_map<std::string, Asset*> mAssets;
+	// Loads in flight, by key
+	std::unordered_map<std::string, std::shared_ptr<AssetLoad>> mLoading;
+	// Asynchronous loads that Update() hasn't finished yet, in request order
+	std::vector<std::shared_ptr<AssetLoad>> mPending;
 	std::mutex mMutex;
 };
\ No newline at end of file
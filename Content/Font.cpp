@@ -11,13 +11,12 @@
 
 using namespace std;
 
-Font::Font(const string& name, Device* device, const string& filename, float pixelSize, float scale)
-	: mName(name), mTexture(nullptr), mPixelSize(pixelSize), mAscender(0), mDescender(0), mLineSpace(0) {
-
-	memset(mGlyphs, 0, sizeof(FontGlyph) * 0xFF);
+bool Font::Decode(const string& filename, float pixelSize, float scale, FontData& data) {
+	memset(data.mGlyphs, 0, sizeof(FontGlyph) * 0xFF);
+	data.mPixelSize = pixelSize;
 
 	string file;
-	ReadFile(filename, file);
+	if (!ReadFile(filename, file)) return false;
 
 	stbtt_fontinfo font;
 	stbtt_InitFont(&font, (const unsigned char*)file.data(), 0);
@@ -27,9 +26,9 @@ Font::Font(const string& name, Device* device, const string& filename, float pix
 	int ascend, descend, space;
 	stbtt_GetFontVMetrics(&font, &ascend, &descend, &space);
 
-	mAscender = ascend * fontScale * scale;
-	mDescender = descend * fontScale * scale;
-	mLineSpace = space * fontScale * scale;
+	data.mAscender = ascend * fontScale * scale;
+	data.mDescender = descend * fontScale * scale;
+	data.mLineSpace = space * fontScale * scale;
 
 	struct GlyphBitmap {
 		unsigned char* data;
@@ -44,7 +43,7 @@ Font::Font(const string& name, Device* device, const string& filename, float pix
 	uint32_t maxWidth = 0;
 
 	for (uint32_t c = 0; c < 0xFF; c++) {
-		FontGlyph& g = mGlyphs[c];
+		FontGlyph& g = data.mGlyphs[c];
 		g.mCharacter = c;
 
 		int advance, lsb;
@@ -158,9 +157,11 @@ Font::Font(const string& name, Device* device, const string& filename, float pix
 	packedSize.x++;
 	packedSize.y++;
 	
-	VkDeviceSize imageSize = packedSize.x * packedSize.y * 4;
-	uint8_t* pixels = new uint8_t[imageSize];
-	memset(pixels, 0xFF, imageSize);
+	data.mWidth = packedSize.x;
+	data.mHeight = packedSize.y;
+	data.mPixels.resize(packedSize.x * packedSize.y * 4);
+	uint8_t* pixels = data.mPixels.data();
+	memset(pixels, 0xFF, data.mPixels.size());
 
 	// zero alpha channel
 	for (uint32_t x = 0; x < packedSize.x; x++)
@@ -172,8 +173,8 @@ Font::Font(const string& name, Device* device, const string& filename, float pix
 		p.rect.extent.width -= PADDING;
 		p.rect.extent.height -= PADDING;
 
-		mGlyphs[p.glyph].mUV = float2((float)p.rect.offset.x, (float)p.rect.offset.y) / float2(packedSize);
-		mGlyphs[p.glyph].mUVSize = float2((float)p.rect.extent.width, (float)p.rect.extent.height) / float2(packedSize);
+		data.mGlyphs[p.glyph].mUV = float2((float)p.rect.offset.x, (float)p.rect.offset.y) / float2(packedSize);
+		data.mGlyphs[p.glyph].mUVSize = float2((float)p.rect.extent.width, (float)p.rect.extent.height) / float2(packedSize);
 
 		for (uint32_t x = 0; x < p.rect.extent.width; x++)
 			for (uint32_t y = 0; y < p.rect.extent.height; y++) {
@@ -182,12 +183,30 @@ Font::Font(const string& name, Device* device, const string& filename, float pix
 			}
 	}
 
-	mTexture = new ::Texture(mName + " Texture", device, pixels, imageSize, packedSize.x, packedSize.y, 1, VK_FORMAT_R8G8B8A8_UNORM, 0);
-
-	delete[] pixels;
-
 	for (auto& g : bitmaps)
 		stbtt_FreeBitmap(g.data, font.userdata);
+	return true;
+}
+
+Font::Font(const string& name, Device* device, const string& filename, float pixelSize, float scale)
+	: mName(name), mTexture(nullptr), mPixelSize(pixelSize), mAscender(0), mDescender(0), mLineSpace(0) {
+	// FontData is too large for the stack
+	shared_ptr<FontData> data = make_shared<FontData>();
+	if (!Decode(filename, pixelSize, scale, *data)) throw;
+	Create(device, *data);
+}
+Font::Font(const string& name, Device* device, const FontData& data)
+	: mName(name), mTexture(nullptr), mPixelSize(data.mPixelSize), mAscender(0), mDescender(0), mLineSpace(0) {
+	Create(device, data);
+}
+
+void Font::Create(Device* device, const FontData& data) {
+	memcpy(mGlyphs, data.mGlyphs, sizeof(FontGlyph) * 0xFF);
+	mPixelSize = data.mPixelSize;
+	mAscender = data.mAscender;
+	mDescender = data.mDescender;
+	mLineSpace = data.mLineSpace;
+	mTexture = new ::Texture(mName + " Texture", device, (void*)data.mPixels.data(), data.mPixels.size(), data.mWidth, data.mHeight, 1, VK_FORMAT_R8G8B8A8_UNORM, 0);
 }
 Font::~Font() {
 	safe_delete(mTexture)
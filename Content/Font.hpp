@@ -28,6 +28,19 @@ enum TextAnchor {
 	TEXT_ANCHOR_MIN, TEXT_ANCHOR_MID, TEXT_ANCHOR_MAX
 };
 
+/// Glyph metrics and atlas pixels rasterized on the CPU by Font::Decode, which doesn't need a Device
+struct FontData {
+	FontGlyph mGlyphs[0xFF];
+	float mPixelSize;
+	float mAscender;
+	float mDescender;
+	float mLineSpace;
+	// RGBA8 glyph atlas, with glyph coverage in the alpha channel
+	std::vector<uint8_t> mPixels;
+	uint32_t mWidth;
+	uint32_t mHeight;
+};
+
 class Font : public Asset {
 public:
 	const std::string mName;
@@ -46,9 +59,14 @@ public:
 	inline float Ascender() const { return mAscender; };
 	inline float Descender() const { return mDescender; };
 
+	/// Rasterizes the first 255 codepoints of a font file into an atlas. Returns false and prints an error if the file can't be read
+	ENGINE_EXPORT static bool Decode(const std::string& filename, float pixelSize, float scale, FontData& data);
+
 private:
 	friend class AssetManager;
 	ENGINE_EXPORT Font(const std::string& name, Device* device, const std::string& filename, float pixelSize, float scale);
+	ENGINE_EXPORT Font(const std::string& name, Device* device, const FontData& data);
+	ENGINE_EXPORT void Create(Device* device, const FontData& data);
 
 	float mPixelSize;
 	float mAscender;
@@ -3,15 +3,23 @@
 #include <Scene/Camera.hpp>
 #include <Scene/Scene.hpp>
 #include <Content/AssetManager.hpp>
+#include <Util/IdPool.hpp>
 #include <Util/Profiler.hpp>
 
+#include <atomic>
+
 using namespace std;
 
+// Sort ids are packed into 16 bits of MeshRenderer::BatchKey(), reusing them keeps them unique while fewer than 65536 materials exist
+static IdPool gSortIds;
+static const PropertyID gCameraID = PropertyToID("Camera");
+
 Material::Material(const string& name, ::Shader* shader)
-	: mName(name), mShader(shader), mDevice(shader->Device()), mCullMode(VK_CULL_MODE_FLAG_BITS_MAX_ENUM), mBlendMode(BLEND_MODE_MAX_ENUM), mRenderQueue(~0), mPassMask(PASS_MASK_MAX_ENUM) {}
+	: mName(name), mShader(shader), mDevice(shader->Device()), mSortId(gSortIds.Acquire()), mCullMode(VK_CULL_MODE_FLAG_BITS_MAX_ENUM), mBlendMode(BLEND_MODE_MAX_ENUM), mRenderQueue(~0), mPassMask(PASS_MASK_MAX_ENUM), mKeywordMask(0) {}
 Material::Material(const string& name, shared_ptr<::Shader> shader)
-	: mName(name), mShader(shader), mDevice(shader->Device()), mCullMode(VK_CULL_MODE_FLAG_BITS_MAX_ENUM), mBlendMode(BLEND_MODE_MAX_ENUM), mRenderQueue(~0), mPassMask(PASS_MASK_MAX_ENUM) {}
+	: mName(name), mShader(shader), mDevice(shader->Device()), mSortId(gSortIds.Acquire()), mCullMode(VK_CULL_MODE_FLAG_BITS_MAX_ENUM), mBlendMode(BLEND_MODE_MAX_ENUM), mRenderQueue(~0), mPassMask(PASS_MASK_MAX_ENUM), mKeywordMask(0) {}
 Material::~Material() {
+	gSortIds.Release(mSortId);
 	for (auto& kp : mVariantData) {
 		for (uint32_t i = 0; i < mDevice->MaxFramesInFlight(); i++)
 			safe_delete(kp.second->mDescriptorSets[i]);
@@ -24,6 +32,7 @@ Material::~Material() {
 void Material::EnableKeyword(const string& kw) {
 	if (mShaderKeywords.count(kw)) return;
 	mShaderKeywords.insert(kw);
+	mKeywordMask |= Shader()->KeywordBit(kw);
 	for (auto& d : mVariantData) {
 		memset(d.second->mDirty, true, sizeof(bool) * mDevice->MaxFramesInFlight());
 		d.second->mShaderVariant = nullptr;
@@ -32,22 +41,23 @@ void Material::EnableKeyword(const string& kw) {
 void Material::DisableKeyword(const string& kw) {
 	if (!mShaderKeywords.count(kw)) return;
 	mShaderKeywords.erase(kw);
+	mKeywordMask &= ~Shader()->KeywordBit(kw);
 	for (auto& d : mVariantData) {
 		memset(d.second->mDirty, true, sizeof(bool) * mDevice->MaxFramesInFlight());
 		d.second->mShaderVariant = nullptr;
 	}
 }
 
-void Material::SetUniformBuffer(const string& name, VkDeviceSize offset, VkDeviceSize range, std::shared_ptr<Buffer> param) {
-	if (!mUniformBuffers.count(name)) {
-		auto& p = mUniformBuffers[name];
+void Material::SetUniformBuffer(PropertyID id, VkDeviceSize offset, VkDeviceSize range, std::shared_ptr<Buffer> param) {
+	if (!mUniformBuffers.count(id)) {
+		auto& p = mUniformBuffers[id];
 		p.mBuffer = param;
 		p.mOffset = offset;
 		p.mRange = range;
 		for (auto& d : mVariantData)
 			memset(d.second->mDirty, true, sizeof(bool) * mDevice->MaxFramesInFlight());
 	} else {
-		auto& p = mUniformBuffers[name];
+		auto& p = mUniformBuffers[id];
 		if (p.mBuffer.index() != 0 || get<shared_ptr<Buffer>>(p.mBuffer) != param || p.mOffset != offset || p.mRange != range) {
 			p.mBuffer = param;
 			p.mOffset = offset;
@@ -57,16 +67,16 @@ void Material::SetUniformBuffer(const string& name, VkDeviceSize offset, VkDevic
 		}
 	}
 }
-void Material::SetUniformBuffer(const string& name, VkDeviceSize offset, VkDeviceSize range, Buffer* param) {
-	if (!mUniformBuffers.count(name)) {
-		auto& p = mUniformBuffers[name];
+void Material::SetUniformBuffer(PropertyID id, VkDeviceSize offset, VkDeviceSize range, Buffer* param) {
+	if (!mUniformBuffers.count(id)) {
+		auto& p = mUniformBuffers[id];
 		p.mBuffer = param;
 		p.mOffset = offset;
 		p.mRange = range;
 		for (auto& d : mVariantData)
 			memset(d.second->mDirty, true, sizeof(bool) * mDevice->MaxFramesInFlight());
 	} else {
-		auto& p = mUniformBuffers[name];
+		auto& p = mUniformBuffers[id];
 		if (p.mBuffer.index() != 1 || get<Buffer*>(p.mBuffer) != param || p.mOffset != offset || p.mRange != range) {
 			p.mBuffer = param;
 			p.mOffset = offset;
@@ -77,8 +87,8 @@ void Material::SetUniformBuffer(const string& name, VkDeviceSize offset, VkDevic
 	}
 }
 
-void Material::SetParameter(const string& name, const MaterialParameter& param) {
-	MaterialParameter& p = mParameters[name];
+void Material::SetParameter(PropertyID id, const MaterialParameter& param) {
+	MaterialParameter& p = mParameters[id];
 	if (p != param) {
 		p = param;
 		if (param.index() < 4) // push constants dont make descriptors dirty
@@ -86,16 +96,16 @@ void Material::SetParameter(const string& name, const MaterialParameter& param)
 				memset(d.second->mDirty, true, sizeof(bool) * mDevice->MaxFramesInFlight());
 	}
 }
-void Material::SetParameter(const string& name, uint32_t index, shared_ptr<Texture> param) {
-	auto& p = mArrayParameters[name][index];
+void Material::SetParameter(PropertyID id, uint32_t index, shared_ptr<Texture> param) {
+	auto& p = mArrayParameters[id][index];
 	if (p.index() != 0 || get<shared_ptr<Texture>>(p) != param) {
 		p = param;
 		for (auto& d : mVariantData)
 			memset(d.second->mDirty, true, sizeof(bool) * mDevice->MaxFramesInFlight());
 	}
 }
-void Material::SetParameter(const string& name, uint32_t index, Texture* param) {
-	auto& p = mArrayParameters[name][index];
+void Material::SetParameter(PropertyID id, uint32_t index, Texture* param) {
+	auto& p = mArrayParameters[id][index];
 	if (p.index() != 1 || get<Texture*>(p) != param) {
 		p = param;
 		for (auto& d : mVariantData)
@@ -104,8 +114,16 @@ void Material::SetParameter(const string& name, uint32_t index, Texture* param)
 }
 
 Material::VariantData* Material::GetData(PassType pass) {
+	{
+		shared_lock lock(mVariantMutex);
+		auto it = mVariantData.find(pass);
+		if (it != mVariantData.end() && it->second->mShaderVariant) return it->second;
+	}
+
+	// Renderers can be drawn on several threads at once, so variants are created under an exclusive lock
+	unique_lock lock(mVariantMutex);
 	if (mVariantData.count(pass) == 0) {
-		GraphicsShader* shader = Shader()->GetGraphics(pass, mShaderKeywords);
+		GraphicsShader* shader = Shader()->GetGraphics(pass, mKeywordMask);
 		if (!shader) return nullptr;
 
 		VariantData* data = new VariantData();
@@ -119,7 +137,7 @@ Material::VariantData* Material::GetData(PassType pass) {
 	}
 
 	auto& data = mVariantData.at(pass);
-	if (!data->mShaderVariant) data->mShaderVariant = Shader()->GetGraphics(pass, mShaderKeywords);
+	if (!data->mShaderVariant) data->mShaderVariant = Shader()->GetGraphics(pass, mKeywordMask);
 	return data;
 }
 GraphicsShader* Material::GetShader(PassType pass) {
@@ -130,6 +148,7 @@ void Material::SetDescriptorParameters(CommandBuffer* commandBuffer, Camera* cam
 	GraphicsShader* shader = data->mShaderVariant;
 	if (shader->mDescriptorSetLayouts.size() > PER_MATERIAL && shader->mDescriptorBindings.size()) {
 		uint32_t frameContextIndex = commandBuffer->Device()->FrameContextIndex();
+		lock_guard lock(mDescriptorMutex);
 		DescriptorSet*& ds = data->mDescriptorSets[frameContextIndex];
 		if (!ds || (ds->Layout() != shader->mDescriptorSetLayouts[PER_MATERIAL])) {
 			safe_delete(ds);
@@ -142,11 +161,10 @@ void Material::SetDescriptorParameters(CommandBuffer* commandBuffer, Camera* cam
 			PROFILER_BEGIN("Write Descriptor Sets");
 			for (auto& m : mParameters) {
 				if (m.second.index() > 4) continue;
-				if (shader->mDescriptorBindings.count(m.first) == 0) continue;
-				auto& bindings = shader->mDescriptorBindings.at(m.first);
-				if (bindings.first != PER_MATERIAL) continue;
+				const auto* bindings = shader->DescriptorBinding(m.first);
+				if (!bindings || bindings->first != PER_MATERIAL) continue;
 
-				auto binding = bindings.second;
+				auto binding = bindings->second;
 
 				switch (m.second.index()) {
 				case 0:
@@ -165,31 +183,29 @@ void Material::SetDescriptorParameters(CommandBuffer* commandBuffer, Camera* cam
 			}
 
 			for (auto& m : mArrayParameters) {
-				if (shader->mDescriptorBindings.count(m.first) == 0) continue;
-				auto& bindings = shader->mDescriptorBindings.at(m.first);
-				if (bindings.first != PER_MATERIAL) continue;
+				const auto* bindings = shader->DescriptorBinding(m.first);
+				if (!bindings || bindings->first != PER_MATERIAL) continue;
 
 				for (auto& p : m.second) {
-					if (p.first >= bindings.second.descriptorCount) continue;
+					if (p.first >= bindings->second.descriptorCount) continue;
 					Texture* t = p.second.index() == 0 ? get<shared_ptr<Texture>>(p.second).get() : get<Texture*>(p.second);
-					ds->CreateSampledTextureDescriptor(t, p.first, bindings.second.binding);
+					ds->CreateSampledTextureDescriptor(t, p.first, bindings->second.binding);
 				}
 
 			}
 
 			for (auto& m : mUniformBuffers) {
-				if (shader->mDescriptorBindings.count(m.first) == 0) continue;
-				auto& bindings = shader->mDescriptorBindings.at(m.first);
-				if (bindings.first != PER_MATERIAL) continue;
+				const auto* bindings = shader->DescriptorBinding(m.first);
+				if (!bindings || bindings->first != PER_MATERIAL) continue;
 
-				auto binding = bindings.second;
+				auto binding = bindings->second;
 
 				switch (m.second.mBuffer.index()) {
 				case 0:
-					ds->CreateUniformBufferDescriptor(get<Buffer*>(m.second.mBuffer), m.second.mOffset, m.second.mRange, binding.binding);
+					ds->CreateUniformBufferDescriptor(get<shared_ptr<Buffer>>(m.second.mBuffer).get(), m.second.mOffset, m.second.mRange, binding.binding);
 					break;
 				case 1:
-					ds->CreateUniformBufferDescriptor(get<shared_ptr<Buffer>>(m.second.mBuffer).get(), m.second.mOffset, m.second.mRange, binding.binding);
+					ds->CreateUniformBufferDescriptor(get<Buffer*>(m.second.mBuffer), m.second.mOffset, m.second.mRange, binding.binding);
 					break;
 				}
 			}
@@ -204,9 +220,9 @@ void Material::SetDescriptorParameters(CommandBuffer* commandBuffer, Camera* cam
 		PROFILER_END;
 	}
 
-	if (camera && shader->mDescriptorSetLayouts.size() > PER_CAMERA && shader->mDescriptorBindings.count("Camera")) {
-		auto binding = shader->mDescriptorBindings.at("Camera");
-		vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shader->mPipelineLayout, PER_CAMERA, 1, *camera->DescriptorSet(binding.second.stageFlags), 0, nullptr);
+	if (camera && shader->mDescriptorSetLayouts.size() > PER_CAMERA) {
+		if (const auto* binding = shader->DescriptorBinding(gCameraID))
+			vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shader->mPipelineLayout, PER_CAMERA, 1, *camera->DescriptorSet(binding->second.stageFlags), 0, nullptr);
 	}
 }
 void Material::SetPushConstantParameters(CommandBuffer* commandBuffer, Camera* camera, VariantData* data) {
@@ -215,8 +231,9 @@ void Material::SetPushConstantParameters(CommandBuffer* commandBuffer, Camera* c
 	GraphicsShader* shader = data->mShaderVariant;
 	for (auto& m : mParameters) {
 		if (m.second.index() < 4) continue;
-		if (shader->mPushConstants.count(m.first) == 0) continue;
-		auto& range = shader->mPushConstants.at(m.first);
+		const VkPushConstantRange* pushConstant = shader->PushConstantRange(m.first);
+		if (!pushConstant) continue;
+		const VkPushConstantRange& range = *pushConstant;
 
 		union pvalue {
 			float4 fvalue;
@@ -42,6 +42,9 @@ public:
 	inline void PassMask(PassType p) { mPassMask = p; }
 	inline PassType PassMask() { return mPassMask == PASS_MASK_MAX_ENUM ? Shader()->PassMask() : mPassMask; }
 
+	/// Small id unique among live materials, used in render list sort keys. Ids of destroyed materials are reused
+	inline uint32_t SortId() const { return mSortId; }
+
 	inline void RenderQueue(uint32_t q) { mRenderQueue = q; }
 	inline uint32_t RenderQueue() const { return mRenderQueue == ~0 ? Shader()->RenderQueue() : mRenderQueue; }
 
@@ -51,15 +54,26 @@ public:
 	inline void BlendMode(::BlendMode c) { mBlendMode = c; }
 	inline ::BlendMode BlendMode() const { return mBlendMode; }
 
-	ENGINE_EXPORT void SetUniformBuffer(const std::string& name, VkDeviceSize offset, VkDeviceSize range, std::shared_ptr<Buffer> param);
-	ENGINE_EXPORT void SetUniformBuffer(const std::string& name, VkDeviceSize offset, VkDeviceSize range, Buffer* param);
+	/// Parameters are stored by PropertyID. The overloads taking a name call PropertyToID() each time, so hot code should get the ID once
+	ENGINE_EXPORT void SetUniformBuffer(PropertyID id, VkDeviceSize offset, VkDeviceSize range, std::shared_ptr<Buffer> param);
+	ENGINE_EXPORT void SetUniformBuffer(PropertyID id, VkDeviceSize offset, VkDeviceSize range, Buffer* param);
+
+	ENGINE_EXPORT void SetParameter(PropertyID id, uint32_t index, Texture* param);
+	ENGINE_EXPORT void SetParameter(PropertyID id, uint32_t index, std::shared_ptr<Texture> param);
+	ENGINE_EXPORT void SetParameter(PropertyID id, const MaterialParameter& param);
+
+	inline MaterialParameter GetParameter(PropertyID id) { return mParameters.at(id); }
+	inline std::variant<std::shared_ptr<Texture>, Texture*> GetParameter(PropertyID id, uint32_t index) { return mArrayParameters.at(id).at(index); }
+
+	inline void SetUniformBuffer(const std::string& name, VkDeviceSize offset, VkDeviceSize range, std::shared_ptr<Buffer> param) { SetUniformBuffer(PropertyToID(name), offset, range, param); }
+	inline void SetUniformBuffer(const std::string& name, VkDeviceSize offset, VkDeviceSize range, Buffer* param) { SetUniformBuffer(PropertyToID(name), offset, range, param); }
 
-	ENGINE_EXPORT void SetParameter(const std::string& name, uint32_t index, Texture* param);
-	ENGINE_EXPORT void SetParameter(const std::string& name, uint32_t index, std::shared_ptr<Texture> param);
-	ENGINE_EXPORT void SetParameter(const std::string& name, const MaterialParameter& param);
+	inline void SetParameter(const std::string& name, uint32_t index, Texture* param) { SetParameter(PropertyToID(name), index, param); }
+	inline void SetParameter(const std::string& name, uint32_t index, std::shared_ptr<Texture> param) { SetParameter(PropertyToID(name), index, param); }
+	inline void SetParameter(const std::string& name, const MaterialParameter& param) { SetParameter(PropertyToID(name), param); }
 
-	inline MaterialParameter GetParameter(const std::string& name) { return mParameters.at(name); }
-	inline std::variant<std::shared_ptr<Texture>, Texture*> GetParameter(const std::string& name, uint32_t index) { return mArrayParameters.at(name).at(index);  }
+	inline MaterialParameter GetParameter(const std::string& name) { return GetParameter(PropertyToID(name)); }
+	inline std::variant<std::shared_ptr<Texture>, Texture*> GetParameter(const std::string& name, uint32_t index) { return GetParameter(PropertyToID(name), index); }
 
 	ENGINE_EXPORT void EnableKeyword(const std::string& kw);
 	ENGINE_EXPORT void DisableKeyword(const std::string& kw);
@@ -78,9 +92,12 @@ private:
 	ENGINE_EXPORT VariantData* GetData(PassType pass);
 
 	Device* mDevice;
+	uint32_t mSortId;
 
 	std::variant<::Shader*, std::shared_ptr<::Shader>> mShader;
 	std::set<std::string> mShaderKeywords;
+	// Bits of mShaderKeywords in the shader's keyword table, used to look up variants
+	uint64_t mKeywordMask;
 	VkCullModeFlags mCullMode;
 	::BlendMode mBlendMode;
 
@@ -93,9 +110,12 @@ private:
 		VkDeviceSize mRange;
 	};
 
-	std::unordered_map<std::string, UniformBufferParameter> mUniformBuffers;
-	std::unordered_map<std::string, MaterialParameter> mParameters;
-	std::unordered_map<std::string, std::unordered_map<uint32_t, std::variant<std::shared_ptr<Texture>, Texture*>>> mArrayParameters;
+	std::unordered_map<PropertyID, UniformBufferParameter> mUniformBuffers;
+	std::unordered_map<PropertyID, MaterialParameter> mParameters;
+	std::unordered_map<PropertyID, std::unordered_map<uint32_t, std::variant<std::shared_ptr<Texture>, Texture*>>> mArrayParameters;
 
 	std::unordered_map<PassType, VariantData*> mVariantData;
+	std::shared_mutex mVariantMutex;
+	// Guards the per-frame descriptor sets and their dirty flags
+	std::mutex mDescriptorMutex;
 };
\ No newline at end of file
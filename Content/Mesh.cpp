@@ -1,10 +1,14 @@
 #include <Content/Mesh.hpp>
 
+#include <atomic>
 #include <regex>
 #include <thread>
 #include <shared_mutex>
 
+#include <Content/MeshCache.hpp>
 #include <Core/Device.hpp>
+#include <Util/IdPool.hpp>
+#include <Util/MappedFile.hpp>
 #include <Util/Util.hpp>
 
 #include <assimp/scene.h>
@@ -16,6 +20,9 @@
 
 using namespace std;
 
+// Sort ids are packed into 16 bits of MeshRenderer::BatchKey(), reusing them keeps them unique while fewer than 65536 meshes exist
+static IdPool gSortIds;
+
 const ::VertexInput StdVertex::VertexInput {
 	{
 		{
@@ -155,18 +162,35 @@ inline Bone* AddBone(AnimationRig& rig, aiNode* node, const aiScene* scene, aiNo
 	return bone;
 }
 
-Mesh::Mesh(const string& name) : mName(name), mVertexInput(nullptr), mBvh(nullptr), mIndexCount(0), mVertexCount(0), mBaseVertex(0), mVertexSize(0), mBaseIndex(0), mIndexType(VK_INDEX_TYPE_UINT16) {}
-Mesh::Mesh(const string& name, ::Device* device, const string& filename, float scale)
-	: mName(name), mVertexInput(nullptr), mBvh(nullptr), mBaseVertex(0), mBaseIndex(0), mTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST) {
+Mesh::Mesh(const string& name) : mName(name), mSortId(gSortIds.Acquire()), mVertexInput(nullptr), mBvh(nullptr), mIndexCount(0), mVertexCount(0), mBaseVertex(0), mVertexSize(0), mBaseIndex(0), mIndexType(VK_INDEX_TYPE_UINT16) {}
+bool Mesh::Decode(const string& filename, float scale, MeshData& data, const string& cacheFile) {
+	string cachePath = cacheFile.empty() ? filename + ".meshcache" : cacheFile;
+
+	// Hash the source files so an edited model invalidates its cache
+	uint64_t hash = MeshCache::HashSource(filename);
+
+	if (hash && MeshCache::Read(cachePath, hash, scale, data)) return true;
+	if (!Import(filename, scale, data)) return false;
+	if (hash && !MeshCache::Write(cachePath, hash, scale, data))
+		fprintf_color(COLOR_YELLOW, stderr, "Failed to write %s\n", cachePath.c_str());
+	return true;
+}
 
+bool Mesh::Import(const string& filename, float scale, MeshData& data) {
 	const aiScene* scene = aiImportFile(filename.c_str(), aiProcessPreset_TargetRealtime_MaxQuality | aiProcess_FlipUVs | aiProcess_MakeLeftHanded);
 	if (!scene) {
 		fprintf_color(COLOR_RED, stderr, "Failed to open %s: %s\n", filename.c_str(), aiGetErrorString());
-		throw;
+		return false;
 	}
-	vector<StdVertex> vertices;
-	vector<uint16_t> indices16;
-	vector<uint32_t> indices32;
+	vector<StdVertex>& vertices = data.mVertexStorage;
+	vector<uint16_t>& indices16 = data.mIndexStorage16;
+	vector<uint32_t>& indices32 = data.mIndexStorage32;
+	vertices.clear();
+	indices16.clear();
+	indices32.clear();
+	data.mWeightStorage.clear();
+	data.mMapping.reset();
+	safe_delete(data.mBvh);
 	float3 mn, mx;
 
 	vector<AIWeight> weights;
@@ -310,54 +334,73 @@ Mesh::Mesh(const string& name, ::Device* device, const string& filename, float s
 			//mAnimations.emplace(anim->mName.C_Str(), new Animation(anim, bonesByName, scale));
 		}
 
-		vector<VertexWeight> vertexWeights(vertices.size());
+		data.mWeightStorage.resize(vertices.size());
 		for (uint32_t i = 0; i < vertices.size(); i++) {
 			weights[i].NormalizeWeights();
 			for (unsigned int j = 0; j < 4; j++) {
 				if (bonesByName.count(weights[i].bones[j])) {
-					vertexWeights[i].Indices[j] = bonesByName.at(weights[i].bones[j]);
-					vertexWeights[i].Weights[j] = weights[i].weights[j];
+					data.mWeightStorage[i].Indices[j] = bonesByName.at(weights[i].bones[j]);
+					data.mWeightStorage[i].Weights[j] = weights[i].weights[j];
 				}
 			}
 		}
-
-		mWeightBuffer = make_shared<Buffer>(mName + " Weights", device, vertexWeights.size() * sizeof(VertexWeight), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	}
-	
-	if (use32bit) {
-		mIndexCount = (uint32_t)indices32.size();
-		mIndexType = VK_INDEX_TYPE_UINT32;
-	} else {
-		mIndexCount = (uint32_t)indices16.size();
-		mIndexType = VK_INDEX_TYPE_UINT16;
 	}
 
 	aiReleaseImport(scene);
 
-	mVertexCount = (uint32_t)vertices.size();
-	mBounds = AABB(mn, mx);
-	mVertexSize = sizeof(StdVertex);
-	mVertexInput = &StdVertex::VertexInput;
+	data.mVertices = vertices.data();
+	data.mVertexCount = (uint32_t)vertices.size();
+	data.mIndices = use32bit ? (const void*)indices32.data() : (const void*)indices16.data();
+	data.mIndexCount = (uint32_t)(use32bit ? indices32.size() : indices16.size());
+	data.mIndexType = use32bit ? VK_INDEX_TYPE_UINT32 : VK_INDEX_TYPE_UINT16;
+	data.mWeights = data.mWeightStorage.size() ? data.mWeightStorage.data() : nullptr;
+	data.mBounds = AABB(mn, mx);
 
-	mBvh = new TriangleBvh2();
-	if (use32bit)
-		mBvh->Build(vertices.data(), 0, vertexCount, sizeof(StdVertex), indices32.data(), indices32.size(), VK_INDEX_TYPE_UINT32);
-	else
-		mBvh->Build(vertices.data(), 0, vertexCount, sizeof(StdVertex), indices16.data(), indices16.size(), VK_INDEX_TYPE_UINT16);
-
-	if (!uniqueBones.size())
-		mWeightBuffer = nullptr;
-	mVertexBuffer = make_shared<Buffer>(name + " Vertex Buffer", device, vertices.data(), sizeof(StdVertex) * vertices.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	data.mBvh = new TriangleBvh2();
 	if (use32bit)
-		mIndexBuffer = make_shared<Buffer>(name + " Index Buffer", device, indices32.data(), sizeof(uint32_t) * indices32.size(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+		data.mBvh->Build(vertices.data(), 0, vertexCount, sizeof(StdVertex), indices32.data(), indices32.size(), VK_INDEX_TYPE_UINT32);
 	else
-		mIndexBuffer = make_shared<Buffer>(name + " Index Buffer", device, indices16.data(), sizeof(uint16_t) * indices16.size(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+		data.mBvh->Build(vertices.data(), 0, vertexCount, sizeof(StdVertex), indices16.data(), indices16.size(), VK_INDEX_TYPE_UINT16);
 
 	printf("Loaded %s / %d verts %d tris / %.2fx%.2fx%.2f\n", filename.c_str(), (int)vertices.size(), (int)(use32bit ? indices32.size() : indices16.size()) / 3, mx.x - mn.x, mx.y - mn.y, mx.z - mn.z);
+	return true;
+}
+
+Mesh::Mesh(const string& name, ::Device* device, const string& filename, float scale)
+	: mName(name), mSortId(gSortIds.Acquire()), mVertexInput(nullptr), mBvh(nullptr), mBaseVertex(0), mBaseIndex(0), mTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST) {
+	MeshData data;
+	if (!Decode(filename, scale, data)) throw;
+	Create(device, data);
+}
+Mesh::Mesh(const string& name, ::Device* device, MeshData& data)
+	: mName(name), mSortId(gSortIds.Acquire()), mVertexInput(nullptr), mBvh(nullptr), mBaseVertex(0), mBaseIndex(0), mTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST) {
+	Create(device, data);
+}
+
+void Mesh::Create(::Device* device, MeshData& data) {
+	mIndexType = data.mIndexType;
+	mIndexCount = data.mIndexCount;
+	mVertexCount = data.mVertexCount;
+	mBounds = data.mBounds;
+	mVertexSize = sizeof(StdVertex);
+	mVertexInput = &StdVertex::VertexInput;
+
+	mBvh = data.mBvh;
+	data.mBvh = nullptr;
+
+	uint32_t indexSize = mIndexType == VK_INDEX_TYPE_UINT32 ? sizeof(uint32_t) : sizeof(uint16_t);
+
+	// The data may point straight into a memory-mapped MeshCache, in which case the upload reads from the mapping
+	if (data.mWeights)
+		mWeightBuffer = make_shared<Buffer>(mName + " Weights", device, mVertexCount * sizeof(VertexWeight), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	else
+		mWeightBuffer = nullptr;
+	mVertexBuffer = make_shared<Buffer>(mName + " Vertex Buffer", device, data.mVertices, sizeof(StdVertex) * mVertexCount, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	mIndexBuffer = make_shared<Buffer>(mName + " Index Buffer", device, data.mIndices, indexSize * mIndexCount, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
 }
 Mesh::Mesh(const string& name, ::Device* device, const AABB& bounds, TriangleBvh2* bvh, shared_ptr<Buffer> vertexBuffer, shared_ptr<Buffer> indexBuffer,
 	uint32_t baseVertex, uint32_t vertexCount, uint32_t baseIndex, uint32_t indexCount, const ::VertexInput* vertexInput, VkIndexType indexType, VkPrimitiveTopology topology)
-	: mName(name), mVertexInput(vertexInput), mBvh(bvh), mBaseIndex(baseIndex), mIndexCount(indexCount), mIndexType(indexType), mBaseVertex(baseVertex), mVertexCount(vertexCount), mBounds(bounds), mTopology(topology) {
+	: mName(name), mSortId(gSortIds.Acquire()), mVertexInput(vertexInput), mBvh(bvh), mBaseIndex(baseIndex), mIndexCount(indexCount), mIndexType(indexType), mBaseVertex(baseVertex), mVertexCount(vertexCount), mBounds(bounds), mTopology(topology) {
 	
 	mVertexBuffer = vertexBuffer;
 	mIndexBuffer = indexBuffer;
@@ -368,7 +411,7 @@ Mesh::Mesh(const string& name, ::Device* device, const AABB& bounds, TriangleBvh
 }
 Mesh::Mesh(const string& name, ::Device* device, const AABB& bounds, TriangleBvh2* bvh, shared_ptr<Buffer> vertexBuffer, shared_ptr<Buffer> indexBuffer, shared_ptr<Buffer> weightBuffer,
 	uint32_t baseVertex, uint32_t vertexCount, uint32_t baseIndex, uint32_t indexCount, const ::VertexInput* vertexInput, VkIndexType indexType, VkPrimitiveTopology topology)
-	: mName(name), mVertexInput(vertexInput), mBvh(bvh), mBaseIndex(baseIndex), mIndexCount(indexCount), mIndexType(indexType), mBaseVertex(baseVertex), mVertexCount(vertexCount), mBounds(bounds), mTopology(topology) {
+	: mName(name), mSortId(gSortIds.Acquire()), mVertexInput(vertexInput), mBvh(bvh), mBaseIndex(baseIndex), mIndexCount(indexCount), mIndexType(indexType), mBaseVertex(baseVertex), mVertexCount(vertexCount), mBounds(bounds), mTopology(topology) {
 
 	mVertexBuffer = vertexBuffer;
 	mIndexBuffer = indexBuffer;
@@ -378,7 +421,7 @@ Mesh::Mesh(const string& name, ::Device* device, const AABB& bounds, TriangleBvh
 		mVertexSize = max(mVertexSize, a.offset + FormatSize(a.format));
 }
 Mesh::Mesh(const string& name, ::Device* device, const void* vertices, const void* indices, uint32_t vertexCount, uint32_t vertexSize, uint32_t indexCount, const ::VertexInput* vertexInput, VkIndexType indexType, VkPrimitiveTopology topology)
-	: mName(name), mVertexInput(vertexInput), mBvh(nullptr), mIndexCount(indexCount), mIndexType(indexType), mVertexCount(vertexCount), mVertexSize(vertexSize), mBaseVertex(0), mBaseIndex(0), mTopology(topology) {
+	: mName(name), mSortId(gSortIds.Acquire()), mVertexInput(vertexInput), mBvh(nullptr), mIndexCount(indexCount), mIndexType(indexType), mVertexCount(vertexCount), mVertexSize(vertexSize), mBaseVertex(0), mBaseIndex(0), mTopology(topology) {
 	
 	float3 mn, mx;
 	for (uint32_t i = 0; i < indexCount; i++) {
@@ -409,7 +452,7 @@ Mesh::Mesh(const string& name, ::Device* device, const void* vertices, const voi
 	mIndexBuffer  = make_shared<Buffer>(name + " Index Buffer", device, indices, indexSize * indexCount, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
 }
 Mesh::Mesh(const string& name, ::Device* device, const void* vertices, const VertexWeight* weights, const vector<pair<string, const void*>>&  shapeKeys, const void* indices, uint32_t vertexCount, uint32_t vertexSize, uint32_t indexCount, const ::VertexInput* vertexInput, VkIndexType indexType, VkPrimitiveTopology topology)
-	: mName(name), mVertexInput(vertexInput), mBvh(nullptr), mIndexCount(indexCount), mIndexType(indexType), mVertexCount(vertexCount), mVertexSize(vertexSize), mBaseVertex(0), mBaseIndex(0), mTopology(topology) {
+	: mName(name), mSortId(gSortIds.Acquire()), mVertexInput(vertexInput), mBvh(nullptr), mIndexCount(indexCount), mIndexType(indexType), mVertexCount(vertexCount), mVertexSize(vertexSize), mBaseVertex(0), mBaseIndex(0), mTopology(topology) {
 
 	float3 mn, mx;
 	for (uint32_t i = 0; i < indexCount; i++) {
@@ -511,6 +554,7 @@ bool Mesh::Intersect(const Ray& ray, float* t, bool any) {
 }
 
 Mesh::~Mesh() {
+	gSortIds.Release(mSortId);
 	for (auto kp : mAnimations)
 		safe_delete(kp.second);
 	safe_delete(mBvh);
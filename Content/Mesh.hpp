@@ -25,6 +25,36 @@ struct StdVertex {
 };
 #pragma pack(pop)
 
+class MappedFile;
+
+/// Vertices and indices imported on the CPU by Mesh::Decode, which doesn't need a Device.
+/// The arrays point either into the storage vectors below, or into a memory-mapped MeshCache file
+struct MeshData {
+	const StdVertex* mVertices;
+	uint32_t mVertexCount;
+	// uint16_t or uint32_t, depending on mIndexType
+	const void* mIndices;
+	uint32_t mIndexCount;
+	VkIndexType mIndexType;
+	AABB mBounds;
+	// One weight per vertex if the mesh has bones, nullptr otherwise
+	const VertexWeight* mWeights;
+	// Built from the vertices and indices. The Mesh created from this data takes ownership of it
+	TriangleBvh2* mBvh;
+
+	// Backing memory for the arrays above
+	std::vector<StdVertex> mVertexStorage;
+	std::vector<uint16_t> mIndexStorage16;
+	std::vector<uint32_t> mIndexStorage32;
+	std::vector<VertexWeight> mWeightStorage;
+	std::shared_ptr<MappedFile> mMapping;
+
+	inline MeshData() : mVertices(nullptr), mVertexCount(0), mIndices(nullptr), mIndexCount(0), mIndexType(VK_INDEX_TYPE_UINT16), mWeights(nullptr), mBvh(nullptr) {}
+	inline ~MeshData() { safe_delete(mBvh); }
+	MeshData(const MeshData&) = delete;
+	MeshData& operator=(const MeshData&) = delete;
+};
+
 class Bone : public virtual Object {
 public:
 	uint32_t mBoneIndex;
@@ -68,6 +98,12 @@ public:
 	// Creates a plane facing the positive z axis, using StdVertex vertices
 	ENGINE_EXPORT static Mesh* CreatePlane(const std::string& name, Device* device, float size = 1.f);
 
+	/// Imports a model file, merging all of its triangle meshes. Returns false and prints an error if the file can't be imported.
+	/// Reads cacheFile instead of importing if it is up to date, and writes it after importing otherwise. An empty cacheFile uses filename.meshcache
+	ENGINE_EXPORT static bool Decode(const std::string& filename, float scale, MeshData& data, const std::string& cacheFile = "");
+	/// Imports a model file with assimp, ignoring the MeshCache
+	ENGINE_EXPORT static bool Import(const std::string& filename, float scale, MeshData& data);
+
 	inline std::shared_ptr<Buffer> VertexBuffer() const { return mVertexBuffer; }
 	inline std::shared_ptr<Buffer> IndexBuffer () const { return mIndexBuffer; }
 	inline std::shared_ptr<Buffer> WeightBuffer() const { return mWeightBuffer; }
@@ -88,12 +124,18 @@ public:
 
 	inline AABB Bounds() const { return mBounds; }
 	inline void Bounds(const AABB& b) { mBounds = b; }
+	/// Small id unique among live meshes, used in render list sort keys. Ids of destroyed meshes are reused
+	inline uint32_t SortId() const { return mSortId; }
 
 private:
 	friend class AssetManager;
 	ENGINE_EXPORT Mesh(const std::string& name, ::Device* device, const std::string& filename, float scale = 1.f);
+	/// Takes ownership of data.mBvh
+	ENGINE_EXPORT Mesh(const std::string& name, ::Device* device, MeshData& data);
+	ENGINE_EXPORT void Create(::Device* device, MeshData& data);
 
 	TriangleBvh2* mBvh;
+	uint32_t mSortId;
 
 	const ::VertexInput* mVertexInput;
 	uint32_t mBaseVertex;
@@ -0,0 +1,201 @@
+#include <Content/MeshCache.hpp>
+#include <Util/MappedFile.hpp>
+
+using namespace std;
+
+// TriangleBvh2::Intersect traverses with a 256 entry stack, which holds at most one node more than the depth
+#define MESH_CACHE_MAX_DEPTH 255
+
+inline uint64_t AlignOffset(uint64_t offset) { return (offset + 15) & ~(uint64_t)15; }
+
+uint64_t MeshCache::Hash(const void* data, size_t size) {
+	return HashBytes(data, size);
+}
+
+// The "uri" strings in a .gltf, which name its buffers and images relative to the file. Embedded data: URIs are skipped, they are hashed with the file
+inline vector<string> GltfUris(const char* text, size_t size) {
+	vector<string> uris;
+	const char* end = text + size;
+	for (const char* c = text; c + 5 < end; c++) {
+		if (memcmp(c, "\"uri\"", 5) != 0) continue;
+		c += 5;
+		while (c < end && (isspace(*c) || *c == ':')) c++;
+		if (c >= end || *c != '"') continue;
+		string uri;
+		for (c++; c < end && *c != '"'; c++) {
+			if (*c == '\\' && c + 1 < end) c++;
+			// Percent-encoded characters, usually spaces
+			if (*c == '%' && c + 2 < end && isxdigit(c[1]) && isxdigit(c[2])) {
+				uri += (char)stoi(string(c + 1, 2), nullptr, 16);
+				c += 2;
+			} else
+				uri += *c;
+		}
+		if (uri.compare(0, 5, "data:") != 0) uris.push_back(uri);
+	}
+	return uris;
+}
+
+uint64_t MeshCache::HashSource(const string& filename) {
+	MappedFile source(filename);
+	if (!source.Valid()) return 0;
+	uint64_t hash = Hash(source.Data(), source.Size());
+
+	// Vertex data of a .gltf lives in separate files, so an edited .bin has to invalidate the cache too
+	if (fs::path(filename).extension() == ".gltf") {
+		fs::path directory = fs::path(filename).parent_path();
+		for (const string& uri : GltfUris((const char*)source.Data(), source.Size())) {
+			MappedFile file((directory / uri).string());
+			// Missing files hash differently from present ones, so creating one later invalidates the cache
+			hash = file.Valid() ? HashBytes(file.Data(), file.Size(), hash) : HashBytes(uri.data(), uri.size(), hash ^ 0x9E3779B97F4A7C15ull);
+		}
+	}
+	return hash ? hash : 1;
+}
+
+bool MeshCache::Write(const string& filename, uint64_t sourceHash, float scale, const MeshData& data) {
+	if (!data.mBvh) return false;
+	const vector<TriangleBvh2::Node>& nodes = data.mBvh->Nodes();
+	const vector<uint3>& triangles = data.mBvh->Triangles();
+	uint32_t indexSize = data.mIndexType == VK_INDEX_TYPE_UINT32 ? sizeof(uint32_t) : sizeof(uint16_t);
+
+	MeshCacheHeader header = {};
+	header.mMagic = Magic;
+	header.mVersion = Version;
+	header.mSourceHash = sourceHash;
+	header.mScale = scale;
+	header.mIndexType = (uint32_t)data.mIndexType;
+	header.mVertexSize = sizeof(StdVertex);
+	header.mNodeSize = sizeof(TriangleBvh2::Node);
+	header.mVertexCount = data.mVertexCount;
+	header.mIndexCount = data.mIndexCount;
+	header.mWeightCount = data.mWeights ? data.mVertexCount : 0;
+	header.mNodeCount = (uint32_t)nodes.size();
+	header.mTriangleCount = (uint32_t)triangles.size();
+	header.mBoundsMin = data.mBounds.mMin;
+	header.mBoundsMax = data.mBounds.mMax;
+
+	header.mVertexOffset   = AlignOffset(sizeof(MeshCacheHeader));
+	header.mIndexOffset    = AlignOffset(header.mVertexOffset + (uint64_t)header.mVertexCount * sizeof(StdVertex));
+	header.mWeightOffset   = AlignOffset(header.mIndexOffset + (uint64_t)header.mIndexCount * indexSize);
+	header.mNodeOffset     = AlignOffset(header.mWeightOffset + (uint64_t)header.mWeightCount * sizeof(VertexWeight));
+	header.mTriangleOffset = AlignOffset(header.mNodeOffset + (uint64_t)header.mNodeCount * sizeof(TriangleBvh2::Node));
+	header.mFileSize = header.mTriangleOffset + (uint64_t)header.mTriangleCount * sizeof(uint3);
+
+	// Another process loading the same mesh may read the cache while it is written
+	string tmpFile = filename + ".tmp";
+	FILE* file = fopen(tmpFile.c_str(), "wb");
+	if (!file) return false;
+
+	uint64_t position = 0;
+	bool ok = true;
+	auto write = [&](uint64_t offset, const void* src, uint64_t size) {
+		static const uint8_t padding[16] {};
+		if (ok && offset > position) ok = fwrite(padding, 1, (size_t)(offset - position), file) == offset - position;
+		if (ok && size) ok = fwrite(src, 1, (size_t)size, file) == size;
+		position = offset + size;
+	};
+	write(0, &header, sizeof(MeshCacheHeader));
+	write(header.mVertexOffset, data.mVertices, (uint64_t)header.mVertexCount * sizeof(StdVertex));
+	write(header.mIndexOffset, data.mIndices, (uint64_t)header.mIndexCount * indexSize);
+	write(header.mWeightOffset, data.mWeights, (uint64_t)header.mWeightCount * sizeof(VertexWeight));
+	write(header.mNodeOffset, nodes.data(), (uint64_t)header.mNodeCount * sizeof(TriangleBvh2::Node));
+	write(header.mTriangleOffset, triangles.data(), (uint64_t)header.mTriangleCount * sizeof(uint3));
+	if (fclose(file) != 0) ok = false;
+
+	// Don't leave a truncated file behind, Read() would reject it anyway
+	if (!ok) {
+		remove(tmpFile.c_str());
+		return false;
+	}
+	error_code error;
+	fs::rename(tmpFile, filename, error);
+	if (error) {
+		remove(tmpFile.c_str());
+		return false;
+	}
+	return true;
+}
+
+// The hash only says the source didn't change, so check everything that is used to index another array:
+// a truncated or hand edited file would otherwise make TriangleBvh2::Intersect and the index buffer read outside the mapping
+inline bool ValidContents(const MeshCacheHeader& header, const uint8_t* base) {
+	if (header.mIndexType == VK_INDEX_TYPE_UINT32) {
+		const uint32_t* indices = (const uint32_t*)(base + header.mIndexOffset);
+		for (uint32_t i = 0; i < header.mIndexCount; i++)
+			if (indices[i] >= header.mVertexCount) return false;
+	} else {
+		const uint16_t* indices = (const uint16_t*)(base + header.mIndexOffset);
+		for (uint32_t i = 0; i < header.mIndexCount; i++)
+			if (indices[i] >= header.mVertexCount) return false;
+	}
+
+	const uint3* triangles = (const uint3*)(base + header.mTriangleOffset);
+	for (uint32_t i = 0; i < header.mTriangleCount; i++)
+		if (triangles[i].x >= header.mVertexCount || triangles[i].y >= header.mVertexCount || triangles[i].z >= header.mVertexCount) return false;
+
+	// Children come after their parent and every node but the root has exactly one parent, so the nodes form a tree.
+	// Its depth must fit the traversal stack in TriangleBvh2::Intersect
+	if (header.mNodeCount == 0) return header.mTriangleCount == 0;
+	const TriangleBvh2::Node* nodes = (const TriangleBvh2::Node*)(base + header.mNodeOffset);
+	vector<uint32_t> depth(header.mNodeCount, 0);
+	vector<bool> referenced(header.mNodeCount, false);
+	referenced[0] = true;
+	for (uint32_t i = 0; i < header.mNodeCount; i++) {
+		const TriangleBvh2::Node& node = nodes[i];
+		if (!referenced[i] || depth[i] >= MESH_CACHE_MAX_DEPTH) return false;
+		if (node.mRightOffset == 0) {
+			if ((uint64_t)node.mStartIndex + node.mCount > header.mTriangleCount) return false;
+			continue;
+		}
+		uint64_t right = (uint64_t)i + node.mRightOffset;
+		if (node.mRightOffset < 2 || right >= header.mNodeCount || referenced[i + 1] || referenced[right]) return false;
+		referenced[i + 1] = referenced[right] = true;
+		depth[i + 1] = depth[right] = depth[i] + 1;
+	}
+	return true;
+}
+
+bool MeshCache::Read(const string& filename, uint64_t sourceHash, float scale, MeshData& data) {
+	shared_ptr<MappedFile> file = make_shared<MappedFile>(filename);
+	if (!file->Valid() || file->Size() < sizeof(MeshCacheHeader)) return false;
+
+	MeshCacheHeader header;
+	memcpy(&header, file->Data(), sizeof(MeshCacheHeader));
+	if (header.mMagic != Magic || header.mVersion != Version || header.mSourceHash != sourceHash || header.mScale != scale) return false;
+	if (header.mVertexSize != sizeof(StdVertex) || header.mNodeSize != sizeof(TriangleBvh2::Node) || header.mFileSize != file->Size()) return false;
+	if (header.mIndexType != VK_INDEX_TYPE_UINT16 && header.mIndexType != VK_INDEX_TYPE_UINT32) return false;
+	if (header.mWeightCount != 0 && header.mWeightCount != header.mVertexCount) return false;
+
+	uint32_t indexSize = header.mIndexType == VK_INDEX_TYPE_UINT32 ? sizeof(uint32_t) : sizeof(uint16_t);
+	auto inFile = [&](uint64_t offset, uint64_t size) { return offset % 16 == 0 && offset <= header.mFileSize && size <= header.mFileSize - offset; };
+	if (!inFile(header.mVertexOffset, (uint64_t)header.mVertexCount * sizeof(StdVertex)) ||
+		!inFile(header.mIndexOffset, (uint64_t)header.mIndexCount * indexSize) ||
+		!inFile(header.mWeightOffset, (uint64_t)header.mWeightCount * sizeof(VertexWeight)) ||
+		!inFile(header.mNodeOffset, (uint64_t)header.mNodeCount * sizeof(TriangleBvh2::Node)) ||
+		!inFile(header.mTriangleOffset, (uint64_t)header.mTriangleCount * sizeof(uint3))) return false;
+
+	const uint8_t* base = file->Data();
+	if (!ValidContents(header, base)) return false;
+
+	data.mVertexStorage.clear();
+	data.mIndexStorage16.clear();
+	data.mIndexStorage32.clear();
+	data.mWeightStorage.clear();
+	safe_delete(data.mBvh);
+
+	data.mVertices = (const StdVertex*)(base + header.mVertexOffset);
+	data.mVertexCount = header.mVertexCount;
+	data.mIndices = base + header.mIndexOffset;
+	data.mIndexCount = header.mIndexCount;
+	data.mIndexType = (VkIndexType)header.mIndexType;
+	data.mWeights = header.mWeightCount ? (const VertexWeight*)(base + header.mWeightOffset) : nullptr;
+	data.mBounds = AABB(header.mBoundsMin, header.mBoundsMax);
+
+	data.mBvh = new TriangleBvh2();
+	data.mBvh->Assign((const TriangleBvh2::Node*)(base + header.mNodeOffset), header.mNodeCount,
+		(const uint3*)(base + header.mTriangleOffset), header.mTriangleCount, data.mVertices, data.mVertexCount, sizeof(StdVertex));
+
+	data.mMapping = file;
+	return true;
+}
\ No newline at end of file
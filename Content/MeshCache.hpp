@@ -0,0 +1,53 @@
+#pragma once
+
+#include <Content/Mesh.hpp>
+
+/// Header of a .meshcache file. The arrays follow it in the order listed, each at a 16-byte aligned offset from the start of the file,
+/// so a mapped file can be used in place
+struct MeshCacheHeader {
+	uint32_t mMagic;
+	uint32_t mVersion;
+	// Hash of the source file's contents, a different hash means the cache is stale
+	uint64_t mSourceHash;
+	float mScale;
+	uint32_t mIndexType;
+	// Structure sizes the file was written with, to reject files from builds with a different layout
+	uint32_t mVertexSize;
+	uint32_t mNodeSize;
+
+	uint32_t mVertexCount;
+	uint32_t mIndexCount;
+	// 0 or mVertexCount
+	uint32_t mWeightCount;
+	uint32_t mNodeCount;
+	uint32_t mTriangleCount;
+	float3 mBoundsMin;
+	float3 mBoundsMax;
+
+	uint64_t mVertexOffset;
+	uint64_t mIndexOffset;
+	uint64_t mWeightOffset;
+	uint64_t mNodeOffset;
+	uint64_t mTriangleOffset;
+	uint64_t mFileSize;
+};
+
+/// Binary cache of imported meshes, written next to the source file so later loads skip assimp and the BVH build.
+/// Stores the StdVertex vertices, indices, bone weights and the TriangleBvh2 nodes
+class MeshCache {
+public:
+	static const uint32_t Magic = 0x434D5453; // STMC
+	/// Increment when the layout of the file changes
+	static const uint32_t Version = 1;
+
+	/// 64-bit hash of a block of memory, used to detect changes to source files
+	ENGINE_EXPORT static uint64_t Hash(const void* data, size_t size);
+	/// Hash of a model file and every file it references, such as the .bin buffers of a .gltf. Returns 0 if filename can't be read
+	ENGINE_EXPORT static uint64_t HashSource(const std::string& filename);
+
+	/// Writes data, which must have a BVH, to filename. Writes a temporary file and renames it over filename, so readers never see a partial file.
+	/// Returns false if the file couldn't be written
+	ENGINE_EXPORT static bool Write(const std::string& filename, uint64_t sourceHash, float scale, const MeshData& data);
+	/// Maps filename and points data's arrays into the mapping. Returns false if the file is missing, stale or invalid
+	ENGINE_EXPORT static bool Read(const std::string& filename, uint64_t sourceHash, float scale, MeshData& data);
+};
\ No newline at end of file
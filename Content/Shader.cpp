@@ -1,5 +1,6 @@
 #include <Content/Shader.hpp>
 #include <Stratum/ShaderCompiler.hpp>
+#include <Util/Profiler.hpp>
 
 #include <string>
 
@@ -14,184 +15,28 @@ bool PipelineInstance::operator==(const PipelineInstance& rhs) const {
 		mPolygonMode == rhs.mPolygonMode;
 }
 
-Shader::Shader(const string& name, ::Device* device, const string& filename)
-	: mName(name), mDevice(device), mViewportState({}), mRasterizationState({}), mDynamicState({}), mBlendMode(BLEND_MODE_OPAQUE), mDepthStencilState({}), mPassMask(PASS_MAIN) {
-	ifstream file(filename, ios::binary);
-	if (!file.is_open()) {
+bool Shader::Decode(const string& filename, ShaderFile& file) {
+	if (!file.Open(filename)) {
 		fprintf_color(COLOR_RED_BOLD, stderr, "Could not load shader: %s\n", filename.c_str());
-		throw;
+		return false;
 	}
+	return true;
+}
 
-	CompiledShader compiled(file);
-
-	// create shader modules
-	uint32_t mc = 1;
-	fprintf_color(COLOR_GREEN, stderr, "%s: Compiling shader modules  %d/%d", filename.c_str(), mc, (uint32_t)compiled.mModules.size());
-	vector<VkShaderModule> modules;
-	for (SpirvModule& sm : compiled.mModules) {
-		VkShaderModuleCreateInfo module = {};
-		module.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-		module.codeSize = sm.mSpirv.size() * sizeof(uint32_t);
-		module.pCode = sm.mSpirv.data();
-		VkShaderModule m;
-		vkCreateShaderModule(*mDevice, &module, nullptr, &m);
-		modules.push_back(m);
-		mc++;
-		fprintf_color(COLOR_GREEN, stderr, "\r%s: Compiling shader modules  %d/%d", filename.c_str(), mc, (uint32_t)compiled.mModules.size());
-	}
-	fprintf_color(COLOR_GREEN, stderr, "\r%s: Compiled %d shader modules                \n", filename.c_str(), (uint32_t)compiled.mModules.size());
-
-	mPassMask = (PassType)0;
-
-	// Read shader variants
-	// A variant is a shader compiled with a unique set of keywords
-	mc = 1;
-	fprintf_color(COLOR_GREEN, stderr, "%s: Reading variants  %d/%d", filename.c_str(), mc, (uint32_t)compiled.mVariants.size());
-	for (uint32_t v = 0; v < compiled.mVariants.size(); v++) {
-		set<string> keywords;
-
-		// Read keywords for this variant
-		for (uint32_t i = 0; i < compiled.mVariants[v].mKeywords.size(); i++) {
-			string keyword = compiled.mVariants[v].mKeywords[i];
-			keywords.insert(keyword);
-			mKeywords.insert(keyword);
-		}
-
-		// Make unique keyword string by appending the keywords in alphabetical order
-		string kw = "";
-		for (const auto& k : keywords)
-			kw += k + " ";
-
-		mPassMask = (PassType)(mPassMask | compiled.mVariants[v].mPass);
-
-		ShaderVariant* var;
-
-		if (compiled.mVariants[v].mPass == 0) {
-			// compute shader
-			ComputeShader*& cv = mComputeVariants[compiled.mVariants[v].mEntryPoints[0]][kw];
-			if (!cv) cv = new ComputeShader();
-
-			cv->mEntryPoint = compiled.mVariants[v].mEntryPoints[0];
-
-			cv->mStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-			cv->mStage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-			cv->mStage.pName = cv->mEntryPoint.c_str();
-			cv->mStage.module = modules[compiled.mVariants[v].mModules[0]];
-
-			cv->mWorkgroupSize = compiled.mVariants[v].mWorkgroupSize;
-
-			var = cv;
-		} else {
-			// graphics shader
-			GraphicsShader*& gv = mGraphicsVariants[compiled.mVariants[v].mPass][kw];
-			if (!gv) gv = new GraphicsShader();
-
-			gv->mShader = this;
-			gv->mEntryPoints[0] = compiled.mVariants[v].mEntryPoints[0];
-			gv->mEntryPoints[1] = compiled.mVariants[v].mEntryPoints[1];
-
-			gv->mStages[0] = {};
-			gv->mStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-			gv->mStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
-			gv->mStages[0].pName = gv->mEntryPoints[0].c_str();
-			gv->mStages[0].module = modules[compiled.mVariants[v].mModules[0]];
-
-			gv->mStages[1] = {};
-			gv->mStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-			gv->mStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-			gv->mStages[1].pName = gv->mEntryPoints[1].c_str();
-			gv->mStages[1].module = modules[compiled.mVariants[v].mModules[1]];
-
-			var = gv;
-		}
-
-		var->mDescriptorBindings = compiled.mVariants[v].mDescriptorBindings;
-		var->mPushConstants = compiled.mVariants[v].mPushConstants;
-
-		// create DescriptorSetLayout bindings
-		// bindings[descriptorset][binding] = VkDescriptorSetLayoutBinding
-		vector<vector<VkDescriptorSetLayoutBinding>> bindings;
-		vector<vector<VkDescriptorBindingFlagsEXT>> bindingFlags;
-		for (auto& b : var->mDescriptorBindings) {
-			if (bindings.size() <= b.second.first) bindings.resize((size_t)b.second.first + 1);
-			if (bindingFlags.size() <= b.second.first) bindingFlags.resize((size_t)b.second.first + 1);
-
-			bindings[b.second.first].push_back(b.second.second);
-			bindingFlags[b.second.first].push_back(b.second.second.descriptorCount > 1 ? VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT : 0);
-
-			// read static samplers
-			for (const auto& s : compiled.mVariants[v].mStaticSamplers) {
-				if (b.first == s.first) {
-					Sampler* sampler = new Sampler(mName + " " + b.first, mDevice, s.second);
-					b.second.second.pImmutableSamplers = &sampler->VkSampler();
-					bindings[b.second.first].back().pImmutableSamplers = &sampler->VkSampler();
-					mStaticSamplers.push_back(sampler);
-				}
-			}
-		}
-
-		// create DescriptorSetLayouts
-		var->mDescriptorSetLayouts.resize(bindings.size());
-		for (uint32_t b = 0; b < bindings.size(); b++) {			
-			VkDescriptorSetLayoutBindingFlagsCreateInfoEXT extendedInfo = {};
-			extendedInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
-			extendedInfo.bindingCount = (uint32_t)bindingFlags[b].size();
-			extendedInfo.pBindingFlags = bindingFlags[b].data();
-
-			VkDescriptorSetLayoutCreateInfo descriptorSetLayout = {};
-			descriptorSetLayout.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-			descriptorSetLayout.pNext = &extendedInfo;
-			descriptorSetLayout.bindingCount = (uint32_t)bindings[b].size();
-			descriptorSetLayout.pBindings = bindings[b].data();
-			vkCreateDescriptorSetLayout(*mDevice, &descriptorSetLayout, nullptr, &var->mDescriptorSetLayouts[b]);
-			mDevice->SetObjectName(var->mDescriptorSetLayouts[b], mName + " DescriptorSetLayout", VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT);
-		}
-
-		// Create PipelineLayout
-		vector<VkPushConstantRange> constants;
-		unordered_map<VkShaderStageFlags, uint2> ranges;
-		for (const auto& b : var->mPushConstants) {
-			if (ranges.count(b.second.stageFlags) == 0)
-				ranges[b.second.stageFlags] = uint2(b.second.offset, b.second.offset + b.second.size);
-			else {
-				ranges[b.second.stageFlags].x = min(ranges[b.second.stageFlags].x, b.second.offset);
-				ranges[b.second.stageFlags].y = max(ranges[b.second.stageFlags].y, b.second.offset + b.second.size);
-			}
-		}
-		for (auto r : ranges) {
-			constants.push_back({});
-			constants.back().stageFlags = r.first;
-			constants.back().offset = r.second.x;
-			constants.back().size = r.second.y - r.second.x;
-		}
-
-		VkPipelineLayoutCreateInfo layout = {};
-		layout.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-		layout.setLayoutCount = (uint32_t)var->mDescriptorSetLayouts.size();
-		layout.pSetLayouts = var->mDescriptorSetLayouts.data();
-		layout.pushConstantRangeCount = (uint32_t)constants.size();
-		layout.pPushConstantRanges = constants.data();
-		vkCreatePipelineLayout(*mDevice, &layout, nullptr, &var->mPipelineLayout);
-		mDevice->SetObjectName(var->mPipelineLayout, mName + " PipelineLayout", VK_OBJECT_TYPE_PIPELINE_LAYOUT);
-
-		// Create compute pipeline
-		if (compiled.mVariants[v].mPass == 0) {
-			ComputeShader* cv = dynamic_cast<ComputeShader*>(var);
-			VkComputePipelineCreateInfo pipeline = {};
-			pipeline.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-			pipeline.stage = cv->mStage;
-			pipeline.layout = cv->mPipelineLayout;
-			pipeline.basePipelineIndex = -1;
-			pipeline.basePipelineHandle = VK_NULL_HANDLE;
-			vkCreateComputePipelines(*mDevice, mDevice->PipelineCache(), 1, &pipeline, nullptr, &cv->mPipeline);
-			mDevice->SetObjectName(cv->mPipeline, mName, VK_OBJECT_TYPE_PIPELINE);
-		}
-		
+Shader::Shader(const string& name, ::Device* device, const string& filename)
+	: mName(name), mDevice(device), mViewportState({}), mRasterizationState({}), mDynamicState({}), mBlendMode(BLEND_MODE_OPAQUE), mDepthStencilState({}), mPassMask(PASS_MAIN) {
+	if (!Decode(filename, mFile)) throw;
+	Create();
+}
+Shader::Shader(const string& name, ::Device* device, ShaderFile&& file)
+	: mName(name), mDevice(device), mFile(move(file)), mViewportState({}), mRasterizationState({}), mDynamicState({}), mBlendMode(BLEND_MODE_OPAQUE), mDepthStencilState({}), mPassMask(PASS_MAIN) {
+	Create();
+}
 
-		mc++;
-		fprintf_color(COLOR_GREEN, stderr, "\r%s: Reading variants  %d/%d", filename.c_str(), mc, (uint32_t)compiled.mVariants.size());
-	}
-	fprintf_color(COLOR_GREEN, stderr, "\r%s: Read %d variants                  \n", filename.c_str(), (uint32_t)compiled.mVariants.size());
+void Shader::Create() {
+	// Variants and their modules are created when they are first requested, see GetGraphics() and GetCompute()
+	mPassMask = mFile.PassMask();
+	mModules.resize(mFile.ModuleCount(), VK_NULL_HANDLE);
 
 	mViewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 	mViewportState.viewportCount = 1;
@@ -209,39 +54,184 @@ Shader::Shader(const string& name, ::Device* device, const string& filename)
 	mDynamicState.dynamicStateCount = (uint32_t)mDynamicStates.size();
 	mDynamicState.pDynamicStates = mDynamicStates.data();
 
-	mRenderQueue = compiled.mRenderQueue;
-	mColorMask = compiled.mColorMask;
-	mRasterizationState.cullMode = compiled.mCullMode;
-	mRasterizationState.polygonMode = compiled.mFillMode;
-	mBlendMode = compiled.mBlendMode;
-	mDepthStencilState = compiled.mDepthStencilState;
+	const StmHeader& header = mFile.Header();
+	mRenderQueue = header.mRenderQueue;
+	mColorMask = header.mColorMask;
+	mRasterizationState.cullMode = header.mCullMode;
+	mRasterizationState.polygonMode = header.mFillMode;
+	mBlendMode = header.mBlendMode;
+	mDepthStencilState = header.mDepthStencilState;
+}
+VkShaderModule Shader::GetModule(uint32_t index) const {
+	if (!mModules[index]) {
+		VkShaderModuleCreateInfo module = {};
+		module.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		module.codeSize = mFile.ModuleSize(index) * sizeof(uint32_t);
+		module.pCode = mFile.ModuleCode(index);
+		vkCreateShaderModule(*mDevice, &module, nullptr, &mModules[index]);
+	}
+	return mModules[index];
 }
+
+ShaderVariant* Shader::CreateVariant(const CompiledVariant& compiled, uint64_t keywords) const {
+	ShaderVariant* var;
+	if (compiled.mPass == 0) {
+		// compute shader
+		ComputeShader* cv = new ComputeShader();
+		cv->mEntryPoint = compiled.mEntryPoints[0];
+
+		cv->mStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		cv->mStage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		cv->mStage.pName = cv->mEntryPoint.c_str();
+		cv->mStage.module = GetModule(compiled.mModules[0]);
+
+		cv->mWorkgroupSize = compiled.mWorkgroupSize;
+
+		var = cv;
+	} else {
+		// graphics shader
+		GraphicsShader* gv = new GraphicsShader();
+		gv->mShader = const_cast<Shader*>(this);
+		gv->mPass = compiled.mPass;
+		gv->mKeywordMask = keywords;
+		// Recorded in PipelineKeys, which must stay valid when keywords are added and their bits change
+		gv->mKeywords = mFile.KeywordString(keywords);
+		gv->mEntryPoints[0] = compiled.mEntryPoints[0];
+		gv->mEntryPoints[1] = compiled.mEntryPoints[1];
+
+		gv->mStages[0] = {};
+		gv->mStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		gv->mStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+		gv->mStages[0].pName = gv->mEntryPoints[0].c_str();
+		gv->mStages[0].module = GetModule(compiled.mModules[0]);
+
+		gv->mStages[1] = {};
+		gv->mStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		gv->mStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+		gv->mStages[1].pName = gv->mEntryPoints[1].c_str();
+		gv->mStages[1].module = GetModule(compiled.mModules[1]);
+
+		var = gv;
+	}
+
+	var->mDescriptorBindings = compiled.mDescriptorBindings;
+	var->mPushConstants = compiled.mPushConstants;
+
+	// create DescriptorSetLayout bindings
+	// bindings[descriptorset][binding] = VkDescriptorSetLayoutBinding
+	vector<vector<VkDescriptorSetLayoutBinding>> bindings;
+	vector<vector<VkDescriptorBindingFlagsEXT>> bindingFlags;
+	for (auto& b : var->mDescriptorBindings) {
+		if (bindings.size() <= b.second.first) bindings.resize((size_t)b.second.first + 1);
+		if (bindingFlags.size() <= b.second.first) bindingFlags.resize((size_t)b.second.first + 1);
+
+		bindings[b.second.first].push_back(b.second.second);
+		bindingFlags[b.second.first].push_back(b.second.second.descriptorCount > 1 ? VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT : 0);
+
+		// read static samplers
+		for (const auto& s : compiled.mStaticSamplers) {
+			if (b.first == s.first) {
+				Sampler* sampler = new Sampler(mName + " " + b.first, mDevice, s.second);
+				b.second.second.pImmutableSamplers = &sampler->VkSampler();
+				bindings[b.second.first].back().pImmutableSamplers = &sampler->VkSampler();
+				mStaticSamplers.push_back(sampler);
+			}
+		}
+	}
+
+	// After the static samplers are set, so the tables have them too
+	var->ResolveProperties();
+
+	// create DescriptorSetLayouts
+	var->mDescriptorSetLayouts.resize(bindings.size());
+	for (uint32_t b = 0; b < bindings.size(); b++) {			
+		VkDescriptorSetLayoutBindingFlagsCreateInfoEXT extendedInfo = {};
+		extendedInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+		extendedInfo.bindingCount = (uint32_t)bindingFlags[b].size();
+		extendedInfo.pBindingFlags = bindingFlags[b].data();
+
+		VkDescriptorSetLayoutCreateInfo descriptorSetLayout = {};
+		descriptorSetLayout.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		descriptorSetLayout.pNext = &extendedInfo;
+		descriptorSetLayout.bindingCount = (uint32_t)bindings[b].size();
+		descriptorSetLayout.pBindings = bindings[b].data();
+		vkCreateDescriptorSetLayout(*mDevice, &descriptorSetLayout, nullptr, &var->mDescriptorSetLayouts[b]);
+		mDevice->SetObjectName(var->mDescriptorSetLayouts[b], mName + " DescriptorSetLayout", VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT);
+	}
+
+	// Create PipelineLayout
+	vector<VkPushConstantRange> constants;
+	unordered_map<VkShaderStageFlags, uint2> ranges;
+	for (const auto& b : var->mPushConstants) {
+		if (ranges.count(b.second.stageFlags) == 0)
+			ranges[b.second.stageFlags] = uint2(b.second.offset, b.second.offset + b.second.size);
+		else {
+			ranges[b.second.stageFlags].x = min(ranges[b.second.stageFlags].x, b.second.offset);
+			ranges[b.second.stageFlags].y = max(ranges[b.second.stageFlags].y, b.second.offset + b.second.size);
+		}
+	}
+	for (auto r : ranges) {
+		constants.push_back({});
+		constants.back().stageFlags = r.first;
+		constants.back().offset = r.second.x;
+		constants.back().size = r.second.y - r.second.x;
+	}
+
+	VkPipelineLayoutCreateInfo layout = {};
+	layout.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	layout.setLayoutCount = (uint32_t)var->mDescriptorSetLayouts.size();
+	layout.pSetLayouts = var->mDescriptorSetLayouts.data();
+	layout.pushConstantRangeCount = (uint32_t)constants.size();
+	layout.pPushConstantRanges = constants.data();
+	vkCreatePipelineLayout(*mDevice, &layout, nullptr, &var->mPipelineLayout);
+	mDevice->SetObjectName(var->mPipelineLayout, mName + " PipelineLayout", VK_OBJECT_TYPE_PIPELINE_LAYOUT);
+
+	// Create compute pipeline
+	if (compiled.mPass == 0) {
+		ComputeShader* cv = dynamic_cast<ComputeShader*>(var);
+		VkComputePipelineCreateInfo pipeline = {};
+		pipeline.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipeline.stage = cv->mStage;
+		pipeline.layout = cv->mPipelineLayout;
+		pipeline.basePipelineIndex = -1;
+		pipeline.basePipelineHandle = VK_NULL_HANDLE;
+		vkCreateComputePipelines(*mDevice, mDevice->PipelineCache(), 1, &pipeline, nullptr, &cv->mPipeline);
+		mDevice->SetObjectName(cv->mPipeline, mName, VK_OBJECT_TYPE_PIPELINE);
+	}
+	return var;
+}
+
 Shader::~Shader() {
+	// Pipelines still compiling write to mPipelines
+	mDevice->WaitForPipelines();
+
 	for (auto& g : mStaticSamplers)
 		safe_delete(g);
 
 	for (auto& g : mGraphicsVariants) {
 		for (auto& v : g.second) {
+			if (!v.second) continue;
 			for (auto& s : v.second->mPipelines)
-				vkDestroyPipeline(*mDevice, s.second, nullptr);
+				if (s.second) vkDestroyPipeline(*mDevice, s.second, nullptr);
 			for (auto& s : v.second->mDescriptorSetLayouts)
 				vkDestroyDescriptorSetLayout(*mDevice, s, nullptr);
 			vkDestroyPipelineLayout(*mDevice, v.second->mPipelineLayout, nullptr);
-			for (auto& s : v.second->mStages)
-				vkDestroyShaderModule(*mDevice, s.module, nullptr);
 			safe_delete(v.second);
 		}
 	}
 	for (auto& s : mComputeVariants) {
 		for (auto& v : s.second) {
+			if (!v.second) continue;
 			for (auto& l : v.second->mDescriptorSetLayouts)
 				vkDestroyDescriptorSetLayout(*mDevice, l, nullptr);
 			vkDestroyPipeline(*mDevice, v.second->mPipeline, nullptr);
 			vkDestroyPipelineLayout(*mDevice, v.second->mPipelineLayout, nullptr);
-			vkDestroyShaderModule(*mDevice, v.second->mStage.module, nullptr);
 			safe_delete(v.second);
 		}
 	}
+	// Variants share modules
+	for (VkShaderModule m : mModules)
+		if (m) vkDestroyShaderModule(*mDevice, m, nullptr);
 }
 
 VkPipeline GraphicsShader::GetPipeline(RenderPass* renderPass, const VertexInput* vertexInput, VkPrimitiveTopology topology, VkCullModeFlags cullMode, BlendMode blendMode, VkPolygonMode polyMode) {
@@ -250,158 +240,246 @@ VkPipeline GraphicsShader::GetPipeline(RenderPass* renderPass, const VertexInput
 	VkPolygonMode poly = polyMode == VK_POLYGON_MODE_MAX_ENUM ? mShader->mRasterizationState.polygonMode : polyMode;
 	PipelineInstance instance(*renderPass, vertexInput, topology, cull, blendMode, poly);
 
+	{
+		shared_lock lock(mPipelineMutex);
+		auto it = mPipelines.find(instance);
+		if (it != mPipelines.end()) return it->second;
+	}
+
+	// Command buffers can be recorded on several threads, so pipelines are created under an exclusive lock
+	unique_lock lock(mPipelineMutex);
 	if (mPipelines.count(instance))
 		return mPipelines.at(instance);
-	else {
-		VkPipelineColorBlendAttachmentState bs = {};
-		bs.colorWriteMask = mShader->mColorMask;
-		switch (blend) {
-		case BLEND_MODE_OPAQUE:
-			bs.blendEnable = VK_FALSE;
-			bs.colorBlendOp = VK_BLEND_OP_ADD;
-			bs.alphaBlendOp = VK_BLEND_OP_ADD;
-			bs.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-			bs.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
-			bs.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-			bs.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-			break;
-		case BLEND_MODE_ALPHA:
-			bs.blendEnable = VK_TRUE;
-			bs.colorBlendOp = VK_BLEND_OP_ADD;
-			bs.alphaBlendOp = VK_BLEND_OP_ADD;
-			bs.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
-			bs.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
-			bs.srcAlphaBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
-			bs.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
-			break;
-		case BLEND_MODE_ADDITIVE:
-			bs.blendEnable = VK_TRUE;
-			bs.colorBlendOp = VK_BLEND_OP_ADD;
-			bs.alphaBlendOp = VK_BLEND_OP_ADD;
-			bs.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-			bs.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
-			bs.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-			bs.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-			break;
-		case BLEND_MODE_MULTIPLY:
-			bs.blendEnable = VK_TRUE;
-			bs.colorBlendOp = VK_BLEND_OP_MULTIPLY_EXT;
-			bs.alphaBlendOp = VK_BLEND_OP_MULTIPLY_EXT;
-			bs.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-			bs.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
-			bs.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-			bs.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-			break;
-		}
-		vector<VkPipelineColorBlendAttachmentState> blendAttachmentStates(renderPass->ColorAttachmentCount());
-		for (uint32_t i = 0; i < blendAttachmentStates.size(); i++) blendAttachmentStates[i] = bs;
-
-		VkPipelineRasterizationStateCreateInfo rasterState = mShader->mRasterizationState;
-		if (cullMode != VK_CULL_MODE_FLAG_BITS_MAX_ENUM) rasterState.cullMode = cullMode;
-		if (polyMode != VK_POLYGON_MODE_MAX_ENUM) rasterState.polygonMode = polyMode;
-
-		VkPipelineColorBlendStateCreateInfo blendState = {};
-		blendState.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-		blendState.attachmentCount = (uint32_t)blendAttachmentStates.size();
-		blendState.pAttachments = blendAttachmentStates.data();
-
-		VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = {};
-		inputAssemblyState.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-		inputAssemblyState.topology = topology;
-		inputAssemblyState.primitiveRestartEnable = VK_FALSE;
-
-		VkPipelineVertexInputStateCreateInfo vinput = {};
-		vinput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-		if (vertexInput) {
-			vinput.vertexBindingDescriptionCount = (uint32_t)vertexInput->mBindings.size();
-			vinput.pVertexBindingDescriptions = vertexInput->mBindings.data();
-			vinput.vertexAttributeDescriptionCount = (uint32_t)vertexInput->mAttributes.size();
-			vinput.pVertexAttributeDescriptions = vertexInput->mAttributes.data();
-		} else {
-			vinput.vertexBindingDescriptionCount = 0;
-			vinput.pVertexBindingDescriptions = nullptr;
-			vinput.vertexAttributeDescriptionCount = 0;
-			vinput.pVertexAttributeDescriptions = nullptr;
-		}
 
-		VkPipelineMultisampleStateCreateInfo multisampleState = {};
-		multisampleState.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-		multisampleState.sampleShadingEnable = VK_FALSE;
-		multisampleState.rasterizationSamples = renderPass->RasterizationSamples();
-
-		VkGraphicsPipelineCreateInfo info = {};
-		info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-		info.stageCount = 2;
-		info.pStages = mStages;
-		info.pInputAssemblyState = &inputAssemblyState;
-		info.pVertexInputState = &vinput;
-		info.pTessellationState = nullptr;
-		info.pViewportState = &mShader->mViewportState;
-		info.pRasterizationState = &rasterState;
-		info.pMultisampleState = &multisampleState;
-		info.pDepthStencilState = &mShader->mDepthStencilState;
-		info.pColorBlendState = &blendState;
-		info.pDynamicState = &mShader->mDynamicState;
-		info.layout = mPipelineLayout;
-		info.basePipelineIndex = -1;
-		info.basePipelineHandle = VK_NULL_HANDLE;
-		info.renderPass = *renderPass;
-
-		#pragma region print
-		const char* cullstr = "";
-		if (cullMode == VK_CULL_MODE_NONE) cullstr = "VK_CULL_MODE_NONE";
-		if (cullMode & VK_CULL_MODE_BACK_BIT) cullstr = "VK_CULL_MODE_BACK";
-		if (cullMode & VK_CULL_MODE_FRONT_BIT) cullstr = "VK_CULL_MODE_FRONT";
-		if (cullMode == VK_CULL_MODE_FRONT_AND_BACK) cullstr = "VK_CULL_MODE_FRONT_AND_BACK";
-
-		const char* blendstr = "";
-		switch (blend) {
-		case BLEND_MODE_OPAQUE: blendstr = "Opaque"; break;
-		case BLEND_MODE_ALPHA:  blendstr = "Alpha"; break;
-		case BLEND_MODE_ADDITIVE: blendstr = "Additive"; break;
-		case BLEND_MODE_MULTIPLY: blendstr = "Multiply"; break;
-		}
+	::Device* device = mShader->mDevice;
 
-		string kw = "";
-		for (const auto& p : mShader->mGraphicsVariants)
-			for (const auto& k : p.second)
-				if (k.second == this) {
-					kw = k.first;
-					break;
-				}
-		printf_color(COLOR_CYAN, "%s [%s]: Generating graphics pipeline %s %s %s\n", mShader->mName.c_str(), kw.c_str(), blendstr, cullstr, TopologyToString(topology));
-		#pragma endregion
-
-		VkPipeline p;
-		vkCreateGraphicsPipelines(*mShader->mDevice, mShader->mDevice->PipelineCache(), 1, &info, nullptr, &p);
-		mShader->mDevice->SetObjectName(p, mShader->mName + " Variant", VK_OBJECT_TYPE_PIPELINE);
+	PipelineKey key = {};
+	key.mShader = mShader->mName;
+	key.mPass = (uint32_t)mPass;
+	key.mKeywords = mKeywords;
+	key.mRenderPass = renderPass->Hash();
+	if (vertexInput) {
+		key.mBindings = vertexInput->mBindings;
+		key.mAttributes = vertexInput->mAttributes;
+	}
+	key.mTopology = (uint32_t)topology;
+	key.mCullMode = (uint32_t)cullMode;
+	key.mBlendMode = (uint32_t)blendMode;
+	key.mPolygonMode = (uint32_t)polyMode;
+	device->RecordPipeline(key);
+
+	if (!device->AsyncPipelineCompilation()) {
+		VkPipeline p = CreatePipeline(*renderPass, renderPass->ColorAttachmentCount(), renderPass->RasterizationSamples(), vertexInput, topology, cull, blend, poly);
 		mPipelines.emplace(instance, p);
-
 		return p;
 	}
+
+	// Insert a null pipeline so the draw is skipped until the pipeline is compiled on a background thread.
+	// Values in an unordered_map stay where they are when it rehashes, so the job can write to the slot directly
+	VkPipeline* slot = &mPipelines.emplace(instance, VK_NULL_HANDLE).first->second;
+	shared_ptr<VertexInput> input = vertexInput ? make_shared<VertexInput>(*vertexInput) : nullptr;
+	VkRenderPass vkRenderPass = *renderPass;
+	uint32_t colorAttachmentCount = renderPass->ColorAttachmentCount();
+	VkSampleCountFlagBits samples = renderPass->RasterizationSamples();
+	// The job locks mPipelineMutex itself
+	lock.unlock();
+	device->CompilePipelineAsync([=]() {
+		VkPipeline p = CreatePipeline(vkRenderPass, colorAttachmentCount, samples, input.get(), topology, cull, blend, poly);
+		unique_lock lock(mPipelineMutex);
+		*slot = p;
+	});
+	return VK_NULL_HANDLE;
+}
+VkPipeline GraphicsShader::Prewarm(RenderPass* renderPass, const PipelineKey& key) {
+	const VertexInput* vertexInput = nullptr;
+	if (key.mBindings.size() || key.mAttributes.size()) {
+		VertexInput* input = new VertexInput(key.mBindings, key.mAttributes);
+		{
+			unique_lock lock(mPipelineMutex);
+			mPrewarmInputs.emplace_back(input);
+		}
+		vertexInput = input;
+	}
+	return GetPipeline(renderPass, vertexInput, (VkPrimitiveTopology)key.mTopology, (VkCullModeFlags)key.mCullMode, (BlendMode)key.mBlendMode, (VkPolygonMode)key.mPolygonMode);
 }
+VkPipeline GraphicsShader::CreatePipeline(VkRenderPass renderPass, uint32_t colorAttachmentCount, VkSampleCountFlagBits samples, const VertexInput* vertexInput, VkPrimitiveTopology topology, VkCullModeFlags cullMode, BlendMode blendMode, VkPolygonMode polyMode) {
+	VkPipelineColorBlendAttachmentState bs = {};
+	bs.colorWriteMask = mShader->mColorMask;
+	switch (blendMode) {
+	case BLEND_MODE_OPAQUE:
+		bs.blendEnable = VK_FALSE;
+		bs.colorBlendOp = VK_BLEND_OP_ADD;
+		bs.alphaBlendOp = VK_BLEND_OP_ADD;
+		bs.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		bs.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+		bs.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		bs.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+		break;
+	case BLEND_MODE_ALPHA:
+		bs.blendEnable = VK_TRUE;
+		bs.colorBlendOp = VK_BLEND_OP_ADD;
+		bs.alphaBlendOp = VK_BLEND_OP_ADD;
+		bs.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+		bs.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+		bs.srcAlphaBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+		bs.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+		break;
+	case BLEND_MODE_ADDITIVE:
+		bs.blendEnable = VK_TRUE;
+		bs.colorBlendOp = VK_BLEND_OP_ADD;
+		bs.alphaBlendOp = VK_BLEND_OP_ADD;
+		bs.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		bs.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		bs.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		bs.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		break;
+	case BLEND_MODE_MULTIPLY:
+		bs.blendEnable = VK_TRUE;
+		bs.colorBlendOp = VK_BLEND_OP_MULTIPLY_EXT;
+		bs.alphaBlendOp = VK_BLEND_OP_MULTIPLY_EXT;
+		bs.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		bs.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		bs.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		bs.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		break;
+	}
+	vector<VkPipelineColorBlendAttachmentState> blendAttachmentStates(colorAttachmentCount);
+	for (uint32_t i = 0; i < blendAttachmentStates.size(); i++) blendAttachmentStates[i] = bs;
+
+	VkPipelineRasterizationStateCreateInfo rasterState = mShader->mRasterizationState;
+	rasterState.cullMode = cullMode;
+	rasterState.polygonMode = polyMode;
+
+	VkPipelineColorBlendStateCreateInfo blendState = {};
+	blendState.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	blendState.attachmentCount = (uint32_t)blendAttachmentStates.size();
+	blendState.pAttachments = blendAttachmentStates.data();
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = {};
+	inputAssemblyState.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssemblyState.topology = topology;
+	inputAssemblyState.primitiveRestartEnable = VK_FALSE;
+
+	VkPipelineVertexInputStateCreateInfo vinput = {};
+	vinput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	if (vertexInput) {
+		vinput.vertexBindingDescriptionCount = (uint32_t)vertexInput->mBindings.size();
+		vinput.pVertexBindingDescriptions = vertexInput->mBindings.data();
+		vinput.vertexAttributeDescriptionCount = (uint32_t)vertexInput->mAttributes.size();
+		vinput.pVertexAttributeDescriptions = vertexInput->mAttributes.data();
+	} else {
+		vinput.vertexBindingDescriptionCount = 0;
+		vinput.pVertexBindingDescriptions = nullptr;
+		vinput.vertexAttributeDescriptionCount = 0;
+		vinput.pVertexAttributeDescriptions = nullptr;
+	}
 
-GraphicsShader* Shader::GetGraphics(PassType pass, const set<string>& keywords) const {
-	if (!mGraphicsVariants.count(pass)) return nullptr;
-	const auto& v = mGraphicsVariants.at(pass);
+	VkPipelineMultisampleStateCreateInfo multisampleState = {};
+	multisampleState.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampleState.sampleShadingEnable = VK_FALSE;
+	multisampleState.rasterizationSamples = samples;
+
+	VkGraphicsPipelineCreateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	info.stageCount = 2;
+	info.pStages = mStages;
+	info.pInputAssemblyState = &inputAssemblyState;
+	info.pVertexInputState = &vinput;
+	info.pTessellationState = nullptr;
+	info.pViewportState = &mShader->mViewportState;
+	info.pRasterizationState = &rasterState;
+	info.pMultisampleState = &multisampleState;
+	info.pDepthStencilState = &mShader->mDepthStencilState;
+	info.pColorBlendState = &blendState;
+	info.pDynamicState = &mShader->mDynamicState;
+	info.layout = mPipelineLayout;
+	info.basePipelineIndex = -1;
+	info.basePipelineHandle = VK_NULL_HANDLE;
+	info.renderPass = renderPass;
+
+	#pragma region print
+	const char* cullstr = "";
+	if (cullMode == VK_CULL_MODE_NONE) cullstr = "VK_CULL_MODE_NONE";
+	if (cullMode & VK_CULL_MODE_BACK_BIT) cullstr = "VK_CULL_MODE_BACK";
+	if (cullMode & VK_CULL_MODE_FRONT_BIT) cullstr = "VK_CULL_MODE_FRONT";
+	if (cullMode == VK_CULL_MODE_FRONT_AND_BACK) cullstr = "VK_CULL_MODE_FRONT_AND_BACK";
+
+	const char* blendstr = "";
+	switch (blendMode) {
+	case BLEND_MODE_OPAQUE: blendstr = "Opaque"; break;
+	case BLEND_MODE_ALPHA:  blendstr = "Alpha"; break;
+	case BLEND_MODE_ADDITIVE: blendstr = "Additive"; break;
+	case BLEND_MODE_MULTIPLY: blendstr = "Multiply"; break;
+	}
 
-	string kw = "";
-	for (const auto& k : keywords)
-		if (mKeywords.count(k))
-			kw += k + " ";
+	printf_color(COLOR_CYAN, "%s [%s]: Generating graphics pipeline %s %s %s\n", mShader->mName.c_str(), mKeywords.c_str(), blendstr, cullstr, TopologyToString(topology));
+	#pragma endregion
 
-	if (!v.count(kw)) return nullptr;
-	return v.at(kw);
+	VkPipeline p;
+	vkCreateGraphicsPipelines(*mShader->mDevice, mShader->mDevice->PipelineCache(), 1, &info, nullptr, &p);
+	mShader->mDevice->SetObjectName(p, mShader->mName + " Variant", VK_OBJECT_TYPE_PIPELINE);
+	return p;
 }
-ComputeShader* Shader::GetCompute(const string& kernel, const set<string>& keywords) const {
-	if (!mComputeVariants.count(kernel)) return nullptr;
-	auto& k = mComputeVariants.at(kernel);
 
-	string kw = "";
-	for (const auto& k : keywords)
-		if (mKeywords.count(k))
-			kw += k + " ";
+GraphicsShader* Shader::GetGraphics(PassType pass, uint64_t keywords) const {
+	{
+		shared_lock lock(mVariantMutex);
+		auto p = mGraphicsVariants.find(pass);
+		if (p != mGraphicsVariants.end()) {
+			auto v = p->second.find(keywords);
+			if (v != p->second.end()) return v->second;
+		}
+	}
+
+	// Command buffers can be recorded on several threads, so variants are created under an exclusive lock
+	unique_lock lock(mVariantMutex);
+	auto& variants = mGraphicsVariants[pass];
+	auto v = variants.find(keywords);
+	if (v != variants.end()) return v->second;
+
+	CompiledVariant compiled;
+	GraphicsShader* variant = nullptr;
+	if (mFile.FindVariant(pass, "", keywords, compiled)) {
+		PROFILER_BEGIN("Create shader variant");
+		variant = (GraphicsShader*)CreateVariant(compiled, keywords);
+		PROFILER_END;
+	}
+	variants.emplace(keywords, variant);
+	return variant;
+}
+ComputeShader* Shader::GetCompute(const string& kernel, uint64_t keywords) const {
+	{
+		shared_lock lock(mVariantMutex);
+		auto p = mComputeVariants.find(kernel);
+		if (p != mComputeVariants.end()) {
+			auto v = p->second.find(keywords);
+			if (v != p->second.end()) return v->second;
+		}
+	}
 
-	if (!k.count(kw)) return nullptr;
-	return k.at(kw);
+	unique_lock lock(mVariantMutex);
+	auto& variants = mComputeVariants[kernel];
+	auto v = variants.find(keywords);
+	if (v != variants.end()) return v->second;
+
+	CompiledVariant compiled;
+	ComputeShader* variant = nullptr;
+	if (mFile.FindVariant((PassType)0, kernel, keywords, compiled)) {
+		PROFILER_BEGIN("Create shader variant");
+		variant = (ComputeShader*)CreateVariant(compiled, keywords);
+		PROFILER_END;
+	}
+	variants.emplace(keywords, variant);
+	return variant;
+}
+uint32_t Shader::VariantCount() const {
+	shared_lock lock(mVariantMutex);
+	uint32_t count = 0;
+	for (const auto& p : mGraphicsVariants)
+		for (const auto& v : p.second)
+			if (v.second) count++;
+	for (const auto& p : mComputeVariants)
+		for (const auto& v : p.second)
+			if (v.second) count++;
+	return count;
 }
\ No newline at end of file
@@ -1,9 +1,13 @@
 #pragma once
 
+#include <shared_mutex>
+
 #include <Content/Asset.hpp>
+#include <Content/ShaderFile.hpp>
 #include <Core/Instance.hpp>
 #include <Core/Sampler.hpp>
 #include <Core/RenderPass.hpp>
+#include <Util/PropertyID.hpp>
 
 class Shader;
 
@@ -43,9 +47,43 @@ public:
 	std::vector<VkDescriptorSetLayout> mDescriptorSetLayouts;
 	std::unordered_map<std::string, std::pair<uint32_t, VkDescriptorSetLayoutBinding>> mDescriptorBindings; // descriptorset, binding
 	std::unordered_map<std::string, VkPushConstantRange> mPushConstants;
+	// mDescriptorBindings and mPushConstants with their PropertyIDs
+	std::vector<std::pair<PropertyID, std::pair<uint32_t, VkDescriptorSetLayoutBinding>>> mDescriptorBindingIDs;
+	std::vector<std::pair<PropertyID, VkPushConstantRange>> mPushConstantIDs;
+	// Index into the tables above plus one, by PropertyID. 0 or past the end if the variant doesn't use the property
+	std::vector<uint16_t> mDescriptorBindingSlots;
+	std::vector<uint16_t> mPushConstantSlots;
 
 	inline ShaderVariant() : mPipelineLayout(VK_NULL_HANDLE) {}
 	inline virtual ~ShaderVariant() {}
+
+	/// The descriptor set and binding of a descriptor, or nullptr if the variant doesn't use it
+	inline const std::pair<uint32_t, VkDescriptorSetLayoutBinding>* DescriptorBinding(PropertyID id) const {
+		return id < mDescriptorBindingSlots.size() && mDescriptorBindingSlots[id] ? &mDescriptorBindingIDs[mDescriptorBindingSlots[id] - 1].second : nullptr;
+	}
+	/// The range of a push constant, or nullptr if the variant doesn't use it
+	inline const VkPushConstantRange* PushConstantRange(PropertyID id) const {
+		return id < mPushConstantSlots.size() && mPushConstantSlots[id] ? &mPushConstantIDs[mPushConstantSlots[id] - 1].second : nullptr;
+	}
+
+	/// Builds the PropertyID tables from mDescriptorBindings and mPushConstants.
+	/// Properties named after this get higher IDs, which are past the end of the slot tables
+	inline void ResolveProperties() {
+		mDescriptorBindingIDs.clear();
+		mPushConstantIDs.clear();
+		for (const auto& b : mDescriptorBindings) mDescriptorBindingIDs.emplace_back(PropertyToID(b.first), b.second);
+		for (const auto& p : mPushConstants) mPushConstantIDs.emplace_back(PropertyToID(p.first), p.second);
+		mDescriptorBindingSlots.clear();
+		mPushConstantSlots.clear();
+		for (uint32_t i = 0; i < mDescriptorBindingIDs.size(); i++) {
+			if (mDescriptorBindingSlots.size() <= mDescriptorBindingIDs[i].first) mDescriptorBindingSlots.resize(mDescriptorBindingIDs[i].first + 1);
+			mDescriptorBindingSlots[mDescriptorBindingIDs[i].first] = (uint16_t)(i + 1);
+		}
+		for (uint32_t i = 0; i < mPushConstantIDs.size(); i++) {
+			if (mPushConstantSlots.size() <= mPushConstantIDs[i].first) mPushConstantSlots.resize(mPushConstantIDs[i].first + 1);
+			mPushConstantSlots[mPushConstantIDs[i].first] = (uint16_t)(i + 1);
+		}
+	}
 };
 class ComputeShader : public ShaderVariant {
 public:
@@ -61,14 +99,29 @@ public:
 	std::string mEntryPoints[2];
 	VkPipelineShaderStageCreateInfo mStages[2];
 	std::unordered_map<PipelineInstance, VkPipeline> mPipelines;
+	std::shared_mutex mPipelineMutex;
 	Shader* mShader;
+	PassType mPass;
+	uint64_t mKeywordMask;
+	std::string mKeywords;
 
-	inline GraphicsShader() : ShaderVariant() { mShader = nullptr; mStages[0] = {}; mStages[1] = {}; }
+	inline GraphicsShader() : ShaderVariant() { mShader = nullptr; mPass = (PassType)0; mKeywordMask = 0; mStages[0] = {}; mStages[1] = {}; }
+	/// Returns the pipeline for these states, creating it if needed. When Device::AsyncPipelineCompilation() is on, a new pipeline is
+	/// compiled on a background thread and VK_NULL_HANDLE is returned until it is ready, so the caller should skip the draw
 	ENGINE_EXPORT VkPipeline GetPipeline(RenderPass* renderPass, const VertexInput* vertexInput,
 		VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
 		VkCullModeFlags cullMode = VK_CULL_MODE_FLAG_BITS_MAX_ENUM,
 		BlendMode blendMode = BLEND_MODE_MAX_ENUM,
 		VkPolygonMode polyMode = VK_POLYGON_MODE_MAX_ENUM);
+	/// Calls GetPipeline() with the states in key, which must have been recorded for this variant and renderPass
+	ENGINE_EXPORT VkPipeline Prewarm(RenderPass* renderPass, const PipelineKey& key);
+
+private:
+	ENGINE_EXPORT VkPipeline CreatePipeline(VkRenderPass renderPass, uint32_t colorAttachmentCount, VkSampleCountFlagBits samples, const VertexInput* vertexInput,
+		VkPrimitiveTopology topology, VkCullModeFlags cullMode, BlendMode blendMode, VkPolygonMode polyMode);
+
+	// Vertex inputs of prewarmed pipelines, which mPipelines points to
+	std::vector<std::unique_ptr<VertexInput>> mPrewarmInputs;
 };
 
 class Shader : public Asset {
@@ -77,24 +130,44 @@ public:
 
 	ENGINE_EXPORT ~Shader() override;
 
-	/// Returns a shader variant for a specific pass and set of keywords, or nullptr if none exists
-	ENGINE_EXPORT GraphicsShader* GetGraphics(PassType pass, const std::set<std::string>& keywords) const;
-	/// Returns a shader variant for a specific kernel and set of keywords, or nullptr if none exists
-	ENGINE_EXPORT ComputeShader* GetCompute(const std::string& kernel, const std::set<std::string>& keywords) const;
+	/// Returns a shader variant for a specific pass and keyword mask (see KeywordMask()), or nullptr if none exists.
+	/// Variants are created from the .stm file the first time they are requested
+	ENGINE_EXPORT GraphicsShader* GetGraphics(PassType pass, uint64_t keywords) const;
+	/// Returns a shader variant for a specific kernel and keyword mask, or nullptr if none exists
+	ENGINE_EXPORT ComputeShader* GetCompute(const std::string& kernel, uint64_t keywords) const;
+	inline GraphicsShader* GetGraphics(PassType pass, const std::set<std::string>& keywords) const { return GetGraphics(pass, KeywordMask(keywords)); }
+	inline ComputeShader* GetCompute(const std::string& kernel, const std::set<std::string>& keywords) const { return GetCompute(kernel, KeywordMask(keywords)); }
+
+	/// Each keyword the shader's variants use has a bit. Returns 0 for other keywords
+	inline uint64_t KeywordBit(const std::string& keyword) const { return mFile.KeywordBit(keyword); }
+	/// Combines the bits of keywords, ignoring keywords no variant uses
+	inline uint64_t KeywordMask(const std::set<std::string>& keywords) const { return mFile.KeywordMask(keywords); }
+	inline const ShaderFile& File() const { return mFile; }
+	/// Number of variants created so far, out of the file's ShaderFile::VariantCount()
+	ENGINE_EXPORT uint32_t VariantCount() const;
 
 	inline ::Device* Device() const { return mDevice; }
 	inline PassType PassMask() const { return mPassMask; }
 	inline uint32_t RenderQueue() const { return mRenderQueue; }
 
+	/// Maps a compiled .stm file. Returns false and prints an error if the file can't be opened or is invalid
+	ENGINE_EXPORT static bool Decode(const std::string& filename, ShaderFile& file);
+
 private:
 	friend class GraphicsShader;
 	friend class AssetManager;
 	ENGINE_EXPORT Shader(const std::string& name, ::Device* device, const std::string& filename);
+	ENGINE_EXPORT Shader(const std::string& name, ::Device* device, ShaderFile&& file);
+	ENGINE_EXPORT void Create();
+	/// Creates the variant described by compiled. Called with mVariantMutex locked
+	ENGINE_EXPORT ShaderVariant* CreateVariant(const CompiledVariant& compiled, uint64_t keywords) const;
+	/// Creates a module the first time a variant uses it. Called with mVariantMutex locked
+	ENGINE_EXPORT VkShaderModule GetModule(uint32_t index) const;
 
 	::Device* mDevice;
+	ShaderFile mFile;
 
 	friend class GraphicsShader;
-	std::set<std::string> mKeywords;
 
 	PassType mPassMask;
 	VkColorComponentFlags mColorMask;
@@ -106,7 +179,10 @@ private:
 	VkPipelineDynamicStateCreateInfo mDynamicState;
 	std::vector<VkDynamicState> mDynamicStates;
 
-	std::unordered_map<std::string, std::unordered_map<std::string, ComputeShader*>> mComputeVariants;
-	std::unordered_map<PassType, std::unordered_map<std::string, GraphicsShader*>> mGraphicsVariants;
-	std::vector<Sampler*> mStaticSamplers;
+	// Variants and modules created so far. Variants that don't exist are stored as nullptr, so the file is only searched once for them
+	mutable std::shared_mutex mVariantMutex;
+	mutable std::unordered_map<std::string, std::unordered_map<uint64_t, ComputeShader*>> mComputeVariants;
+	mutable std::unordered_map<PassType, std::unordered_map<uint64_t, GraphicsShader*>> mGraphicsVariants;
+	mutable std::vector<VkShaderModule> mModules;
+	mutable std::vector<Sampler*> mStaticSamplers;
 };
\ No newline at end of file
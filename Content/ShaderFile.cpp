@@ -0,0 +1,104 @@
+#include <Content/ShaderFile.hpp>
+
+using namespace std;
+
+ShaderFile::ShaderFile() : mData(nullptr), mSize(0), mHeader(nullptr), mModules(nullptr), mVariants(nullptr), mPassMask((PassType)0) {}
+
+bool ShaderFile::Open(const string& filename) {
+	mFile = make_unique<MappedFile>(filename);
+	if (mFile->Valid() && Open(mFile->Data(), mFile->Size())) return true;
+	mFile.reset();
+	return false;
+}
+bool ShaderFile::Open(const uint8_t* data, size_t size) {
+	mHeader = nullptr;
+	mKeywords.clear();
+	mKeywordBits.clear();
+	mPassMask = (PassType)0;
+	if (size < sizeof(StmHeader)) return false;
+
+	const StmHeader* header = (const StmHeader*)data;
+	if (header->mMagic != STM_MAGIC || header->mVersion != STM_VERSION) return false;
+
+	// Every table and everything they point to must lie inside the file
+	auto inside = [size](uint64_t offset, uint64_t length) { return offset <= size && length <= size - offset; };
+	if (header->mModuleTable % 8 || header->mVariantTable % 8) return false;
+	if (!inside(header->mModuleTable, (uint64_t)header->mModuleCount * sizeof(StmModuleEntry))) return false;
+	if (!inside(header->mVariantTable, (uint64_t)header->mVariantCount * sizeof(StmVariantEntry))) return false;
+
+	const StmModuleEntry* modules = (const StmModuleEntry*)(data + header->mModuleTable);
+	for (uint32_t i = 0; i < header->mModuleCount; i++)
+		if (modules[i].mOffset % 4 || modules[i].mSize > size / 4 || !inside(modules[i].mOffset, modules[i].mSize * 4)) return false;
+
+	const StmVariantEntry* variants = (const StmVariantEntry*)(data + header->mVariantTable);
+	PassType passMask = (PassType)0;
+	for (uint32_t i = 0; i < header->mVariantCount; i++) {
+		if (!inside(variants[i].mOffset, variants[i].mSize)) return false;
+		if (i && variants[i].mKey < variants[i - 1].mKey) return false;
+		passMask = (PassType)(passMask | variants[i].mPass);
+	}
+
+	if (header->mKeywordTable > size || header->mKeywordCount > STM_MAX_KEYWORDS) return false;
+	StmReader keywords(data + header->mKeywordTable, size - (size_t)header->mKeywordTable);
+	for (uint32_t i = 0; i < header->mKeywordCount; i++) {
+		string kw;
+		if (!keywords.Read(kw)) {
+			mKeywords.clear();
+			mKeywordBits.clear();
+			return false;
+		}
+		mKeywordBits.emplace(kw, i);
+		mKeywords.push_back(kw);
+	}
+
+	mData = data;
+	mSize = size;
+	mHeader = header;
+	mModules = modules;
+	mVariants = variants;
+	mPassMask = passMask;
+	return true;
+}
+
+uint64_t ShaderFile::KeywordMask(const set<string>& keywords) const {
+	uint64_t mask = 0;
+	for (const string& kw : keywords)
+		mask |= KeywordBit(kw);
+	return mask;
+}
+uint64_t ShaderFile::ParseKeywords(const string& keywords) const {
+	uint64_t mask = 0;
+	size_t start = 0;
+	for (size_t end; (end = keywords.find(' ', start)) != string::npos; start = end + 1)
+		mask |= KeywordBit(keywords.substr(start, end - start));
+	if (start < keywords.size()) mask |= KeywordBit(keywords.substr(start));
+	return mask;
+}
+string ShaderFile::KeywordString(uint64_t keywords) const {
+	// mKeywords is sorted, so this matches StmKeywordString()
+	string kw = "";
+	for (uint32_t i = 0; i < mKeywords.size(); i++)
+		if (keywords & (1ull << i))
+			kw += mKeywords[i] + " ";
+	return kw;
+}
+
+bool ShaderFile::FindVariant(PassType pass, const string& kernel, uint64_t keywords, CompiledVariant& variant) const {
+	uint64_t key = StmVariantKey(pass, kernel, keywords);
+	const StmVariantEntry* end = mVariants + mHeader->mVariantCount;
+	const StmVariantEntry* first = lower_bound(mVariants, end, key, [](const StmVariantEntry& e, uint64_t k) { return e.mKey < k; });
+
+	// Different variants can share a key, check what each one actually is. The last match wins, like when every variant was read in order
+	bool found = false;
+	for (const StmVariantEntry* e = first; e != end && e->mKey == key; e++) {
+		if (e->mPass != pass || e->mKeywords != keywords) continue;
+		CompiledVariant v;
+		StmReader reader(mData + e->mOffset, (size_t)e->mSize);
+		if (!v.Read(reader)) continue;
+		if (v.mPass != pass || (!pass && v.mEntryPoints[0] != kernel)) continue;
+		if (v.mModules[0] >= mHeader->mModuleCount || (pass && v.mModules[1] >= mHeader->mModuleCount)) continue;
+		variant = move(v);
+		found = true;
+	}
+	return found;
+}
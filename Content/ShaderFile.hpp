@@ -0,0 +1,57 @@
+#pragma once
+
+#include <Stratum/ShaderCompiler.hpp>
+#include <Util/MappedFile.hpp>
+
+/// A compiled .stm file, mapped into memory. Opening it only validates the header and tables; variants are looked up in the variant table
+/// and parsed when they are requested, and module SPIR-V is read in place. Independent of any VkDevice
+class ShaderFile {
+public:
+	ENGINE_EXPORT ShaderFile();
+	ShaderFile(ShaderFile&&) = default;
+	ShaderFile& operator=(ShaderFile&&) = default;
+
+	/// Maps filename. Returns false if it can't be opened or isn't a valid .stm file
+	ENGINE_EXPORT bool Open(const std::string& filename);
+	/// Uses a file already in memory, which must stay alive and unchanged while the ShaderFile is used. Returns false if it isn't a valid .stm file
+	ENGINE_EXPORT bool Open(const uint8_t* data, size_t size);
+
+	inline bool Valid() const { return mHeader != nullptr; }
+	inline const StmHeader& Header() const { return *mHeader; }
+	/// Every keyword used by any variant. Keyword i is bit i of keyword masks
+	inline const std::vector<std::string>& Keywords() const { return mKeywords; }
+	/// The bit of a keyword, or 0 if no variant uses it
+	inline uint64_t KeywordBit(const std::string& keyword) const {
+		auto it = mKeywordBits.find(keyword);
+		return it == mKeywordBits.end() ? 0 : 1ull << it->second;
+	}
+	/// Mask of the keywords in keywords that some variant uses, the others are ignored
+	ENGINE_EXPORT uint64_t KeywordMask(const std::set<std::string>& keywords) const;
+	/// Mask of a keyword string made by StmKeywordString(), such as PipelineKey::mKeywords
+	ENGINE_EXPORT uint64_t ParseKeywords(const std::string& keywords) const;
+	/// The keyword string of a mask, see StmKeywordString()
+	ENGINE_EXPORT std::string KeywordString(uint64_t keywords) const;
+	/// Passes with at least one variant
+	inline PassType PassMask() const { return mPassMask; }
+	inline uint32_t ModuleCount() const { return mHeader->mModuleCount; }
+	inline uint32_t VariantCount() const { return mHeader->mVariantCount; }
+
+	/// Parses the variant for pass and a keyword mask, where kernel is the entry point of a compute variant (pass 0). Returns false if there is no such variant
+	ENGINE_EXPORT bool FindVariant(PassType pass, const std::string& kernel, uint64_t keywords, CompiledVariant& variant) const;
+	/// The SPIR-V of a module, pointing into the file
+	inline const uint32_t* ModuleCode(uint32_t index) const { return (const uint32_t*)(mData + mModules[index].mOffset); }
+	/// Size of a module, in words
+	inline size_t ModuleSize(uint32_t index) const { return (size_t)mModules[index].mSize; }
+
+private:
+	std::unique_ptr<MappedFile> mFile;
+	const uint8_t* mData;
+	size_t mSize;
+
+	const StmHeader* mHeader;
+	const StmModuleEntry* mModules;
+	const StmVariantEntry* mVariants;
+	std::vector<std::string> mKeywords;
+	std::unordered_map<std::string, uint32_t> mKeywordBits;
+	PassType mPassMask;
+};
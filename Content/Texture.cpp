@@ -1,18 +1,25 @@
+#include <atomic>
 #include <cmath>
 
 #include <Content/Texture.hpp>
+#include <Content/TextureFile.hpp>
 
 #include <Core/Buffer.hpp>
 #include <Core/CommandBuffer.hpp>
+#include <Util/MappedFile.hpp>
+#include <Util/Profiler.hpp>
 #include <Util/Util.hpp>
 #include <ThirdParty/stb_image.h>
 
 using namespace std;
 
-uint8_t* load(const string& filename, bool srgb, uint32_t& pixelSize, int32_t& x, int32_t& y, int32_t& channels, VkFormat& format) {
+static atomic<uint64_t> gNextId(1);
+
+// Decodes one image into the end of data.mPixels
+bool load(const string& filename, bool srgb, TextureData& data) {
 	uint8_t* pixels = nullptr;
-	pixelSize = 0;
-	x, y, channels;
+	uint32_t pixelSize = 0;
+	int32_t x, y, channels;
 	stbi_info(filename.c_str(), &x, &y, &channels);
 
 	int desiredChannels = 4;
@@ -30,10 +37,11 @@ uint8_t* load(const string& filename, bool srgb, uint32_t& pixelSize, int32_t& x
 	}
 	if (!pixels) {
 		fprintf_color(COLOR_RED_BOLD, stderr, "Failed to load image: %s\n", filename.c_str());
-		throw;
+		return false;
 	}
 	if (desiredChannels > 0) channels = desiredChannels;
 
+	VkFormat format;
 	if (srgb) {
 		const VkFormat formatMap[4] {
 			VK_FORMAT_R8_SRGB, VK_FORMAT_R8G8_SRGB, VK_FORMAT_R8G8B8_UNORM, VK_FORMAT_R8G8B8A8_UNORM,
@@ -49,81 +57,219 @@ uint8_t* load(const string& filename, bool srgb, uint32_t& pixelSize, int32_t& x
 		format = formatMap[pixelSize - 1][channels - 1];
 	}
 
-	return pixels;
-}
-
-Texture::Texture(const string& name, Device* device, const string& filename, bool srgb) : mName(name), mDevice(device), mMemory({}) {
-	int32_t x, y, channels;
-	uint32_t size;
-	uint8_t* pixels = load(filename, srgb, size, x, y, channels, mFormat);
+	size_t layerSize = (size_t)x * (size_t)y * pixelSize * channels;
+	if (data.mArrayLayers && (data.mWidth != (uint32_t)x || data.mHeight != (uint32_t)y || data.mFormat != format)) {
+		fprintf_color(COLOR_RED_BOLD, stderr, "Image size or format mismatch: %s\n", filename.c_str());
+		stbi_image_free(pixels);
+		return false;
+	}
 
-	mWidth = x;
-	mHeight = y;
-	mDepth = 1;
-	mArrayLayers = 1;
-	mMipLevels = (uint32_t)std::floor(std::log2(std::max(mWidth, mHeight))) + 1;
-	mSampleCount = VK_SAMPLE_COUNT_1_BIT;
-	mTiling = VK_IMAGE_TILING_OPTIMAL;
-	mUsage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-	mMemoryProperties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	data.mWidth = x;
+	data.mHeight = y;
+	data.mChannelSize = pixelSize;
+	data.mChannels = channels;
+	data.mFormat = format;
+	data.mMipLevels = 1;
+	data.mArrayLayers++;
 
-	CreateImage();
-	CreateImageView(VK_IMAGE_ASPECT_COLOR_BIT);
+	size_t offset = data.mPixels.size();
+	data.mPixels.resize(offset + layerSize);
+	memcpy(data.mPixels.data() + offset, pixels, layerSize);
 
-	VkBufferImageCopy copyRegion = {};
-	copyRegion.bufferOffset = 0;
-	copyRegion.bufferRowLength = 0;
-	copyRegion.bufferImageHeight = 0;
-	copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	copyRegion.imageSubresource.mipLevel = 0;
-	copyRegion.imageSubresource.baseArrayLayer = 0;
-	copyRegion.imageSubresource.layerCount = 1;
-	copyRegion.imageOffset = { 0, 0, 0 };
-	copyRegion.imageExtent = { mWidth, mHeight, 1 };
+	stbi_image_free(pixels);
+	return true;
+}
 
-	VkDeviceSize dataSize = mWidth * mHeight * size * channels;
+bool Texture::Decode(const string& filename, bool srgb, TextureData& data, bool compress, JobSystem* jobSystem) {
+	data = {};
+	uint64_t hash = 0;
+	if (TextureFile::IsTextureFile(filename)) {
+		if (TextureFile::Read(filename, data, hash)) return true;
+		fprintf_color(COLOR_RED_BOLD, stderr, "Failed to load image: %s\n", filename.c_str());
+		return false;
+	}
+	// Compress() only takes 8-bit images, don't hash the ones that never get a cache file
+	if (!compress || stbi_is_16_bit(filename.c_str()) || stbi_is_hdr(filename.c_str())) return load(filename, srgb, data);
+
+	// Hash the source file so an edited image invalidates its cache
+	string cacheFile = filename + ".ktx2";
+	{
+		MappedFile source(filename);
+		if (source.Valid()) hash = HashBytes(&srgb, sizeof(bool), HashBytes(source.Data(), source.Size()));
+	}
+	uint64_t cachedHash;
+	if (hash && TextureFile::Read(cacheFile, data, cachedHash) && cachedHash == hash) return true;
+
+	data = {};
+	if (!load(filename, srgb, data)) return false;
+	if (Compress(data, jobSystem) && hash && !TextureFile::Write(cacheFile, data, hash))
+		fprintf_color(COLOR_YELLOW, stderr, "Failed to write %s\n", cacheFile.c_str());
+	return true;
+}
+bool Texture::Decode(const string& px, const string& nx, const string& py, const string& ny, const string& pz, const string& nz, bool srgb, TextureData& data) {
+	data = {};
+	return
+		load(px, srgb, data) && load(nx, srgb, data) &&
+		load(py, srgb, data) && load(ny, srgb, data) &&
+		load(pz, srgb, data) && load(nz, srgb, data);
+}
 
-	Buffer uploadBuffer(name + " Copy", mDevice, pixels, dataSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+bool Texture::Compress(TextureData& data, JobSystem* jobSystem) {
+	if (data.mMipLevels > 1 || (data.mFormat != VK_FORMAT_R8G8B8A8_UNORM && data.mFormat != VK_FORMAT_R8G8B8A8_SRGB)) return false;
+	PROFILER_BEGIN("Compress Texture");
+	bool srgb = data.mFormat == VK_FORMAT_R8G8B8A8_SRGB;
+
+	// Opaque images only need BC1's 4 bits per pixel
+	bool opaque = true;
+	for (size_t i = 3; i < data.mPixels.size() && opaque; i += 4)
+		opaque = data.mPixels[i] == 0xFF;
+	TextureData compressed = data;
+	if (opaque)
+		compressed.mFormat = srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+	else
+		compressed.mFormat = srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+	compressed.mMipLevels = (uint32_t)std::floor(std::log2(std::max(data.mWidth, data.mHeight))) + 1;
+	compressed.mChannels = 0;
+	compressed.mChannelSize = 0;
+
+	vector<size_t> levelOffsets(compressed.mMipLevels);
+	size_t total = 0;
+	for (uint32_t level = 0; level < compressed.mMipLevels; level++) {
+		levelOffsets[level] = total;
+		total += compressed.LevelSize(level);
+	}
+	compressed.mPixels.resize(total);
+
+	// The GPU can't blit block compressed images, so each layer's mip chain is made here
+	size_t layerSize = (size_t)data.mWidth * data.mHeight * 4;
+	vector<uint8_t> level, next;
+	for (uint32_t layer = 0; layer < data.mArrayLayers; layer++) {
+		level.assign(data.mPixels.begin() + layer * layerSize, data.mPixels.begin() + (layer + 1) * layerSize);
+		uint32_t width = data.mWidth, height = data.mHeight;
+		for (uint32_t i = 0; i < compressed.mMipLevels; i++) {
+			size_t imageSize = BlockCompression::ImageSize(compressed.mFormat, width, height);
+			BlockCompression::Encode(compressed.mFormat, level.data(), width, height, compressed.mPixels.data() + levelOffsets[i] + layer * imageSize, jobSystem);
+			if (i + 1 == compressed.mMipLevels) break;
+			next.resize((size_t)max(width / 2, 1u) * max(height / 2, 1u) * 4);
+			BlockCompression::Downsample(level.data(), width, height, next.data());
+			swap(level, next);
+			width = max(width / 2, 1u);
+			height = max(height / 2, 1u);
+		}
+	}
+	data = move(compressed);
+	PROFILER_END;
+	return true;
+}
 
-	auto commandBuffer = mDevice->GetCommandBuffer();
-	TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, commandBuffer.get());
-	vkCmdCopyBufferToImage(*commandBuffer, uploadBuffer, mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
-	GenerateMipMaps(commandBuffer.get());
-	mDevice->Execute(commandBuffer, false)->Wait();
+bool Texture::Decompress(TextureData& data) {
+	if (!BlockCompression::IsBlockCompressed(data.mFormat)) return false;
+	PROFILER_BEGIN("Decompress Texture");
+	TextureData decoded = data;
+	switch (data.mFormat) {
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		decoded.mFormat = VK_FORMAT_R8G8B8A8_SRGB;
+		break;
+	default:
+		decoded.mFormat = VK_FORMAT_R8G8B8A8_UNORM;
+		break;
+	}
+	decoded.mChannels = 4;
+	decoded.mChannelSize = 1;
 
-	stbi_image_free(pixels);
+	size_t srcTotal = 0, total = 0;
+	for (uint32_t level = 0; level < data.mMipLevels; level++) {
+		srcTotal += data.LevelSize(level);
+		total += decoded.LevelSize(level);
+	}
+	if (data.mPixels.size() < srcTotal) {
+		PROFILER_END;
+		return false;
+	}
+	decoded.mPixels.resize(total);
+
+	const uint8_t* src = data.mPixels.data();
+	uint8_t* dst = decoded.mPixels.data();
+	for (uint32_t level = 0; level < data.mMipLevels; level++) {
+		uint32_t width = max(data.mWidth >> level, 1u), height = max(data.mHeight >> level, 1u);
+		size_t srcSize = BlockCompression::ImageSize(data.mFormat, width, height);
+		size_t dstSize = (size_t)width * height * 4;
+		for (uint32_t layer = 0; layer < data.mArrayLayers; layer++) {
+			if (!BlockCompression::Decode(data.mFormat, src, width, height, dst)) {
+				PROFILER_END;
+				return false;
+			}
+			src += srcSize;
+			dst += dstSize;
+		}
+	}
+	data = move(decoded);
+	PROFILER_END;
+	return true;
+}
 
+Texture::Texture(const string& name, Device* device, const string& filename, bool srgb) : mName(name), mDevice(device), mMemory({}), mPendingUpload(0) {
+	TextureData data;
+	if (!Decode(filename, srgb, data)) throw;
+	Upload(data);
 	//printf("Loaded %s: %dx%d %s\n", filename.c_str(), mWidth, mHeight, FormatToString(mFormat));
 }
 Texture::Texture(const string& name, Device* device, const string& px, const string& nx, const string& py, const string& ny, const string& pz, const string& nz, bool srgb)
-	: mName(name), mDevice(device), mMemory({}) {
-	int32_t x, y, channels;
-	uint32_t size;
-	
-	uint8_t* pixels[6]{
-		load(px, srgb, size, x, y, channels, mFormat),
-		load(nx, srgb, size, x, y, channels, mFormat),
-		load(py, srgb, size, x, y, channels, mFormat),
-		load(ny, srgb, size, x, y, channels, mFormat),
-		load(pz, srgb, size, x, y, channels, mFormat),
-		load(nz, srgb, size, x, y, channels, mFormat)
-	};
-
-	mWidth = x;
-	mHeight = y;
+	: mName(name), mDevice(device), mMemory({}), mPendingUpload(0) {
+	TextureData data;
+	if (!Decode(px, nx, py, ny, pz, nz, srgb, data)) throw;
+	Upload(data);
+	//printf("Loaded Cubemap %s: %dx%d %s\n", nx.c_str(), mWidth, mHeight, FormatToString(mFormat));
+}
+Texture::Texture(const string& name, Device* device, const TextureData& data) : mName(name), mDevice(device), mMemory({}), mPendingUpload(0) {
+	Upload(data);
+}
+
+void Texture::Upload(const TextureData& data) {
+	mWidth = data.mWidth;
+	mHeight = data.mHeight;
 	mDepth = 1;
-	mArrayLayers = 6;
-	mMipLevels = (uint32_t)std::floor(std::log2(std::max(mWidth, mHeight))) + 1;
+	mArrayLayers = data.mArrayLayers;
+	mFormat = data.mFormat;
 	mSampleCount = VK_SAMPLE_COUNT_1_BIT;
 	mTiling = VK_IMAGE_TILING_OPTIMAL;
-	mUsage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
 	mMemoryProperties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
 
+	// Block compressed data and data with mip levels is uploaded as it is, otherwise the GPU generates the mip chain
+	bool compressed = BlockCompression::IsBlockCompressed(mFormat);
+	if (compressed && !mDevice->TextureCompressionBC()) {
+		// AssetManager decompresses while decoding, this covers data created any other way
+		TextureData decoded = data;
+		if (!Decompress(decoded)) {
+			fprintf_color(COLOR_RED, stderr, "Device doesn't support BC textures, and %s can't be decoded: %s\n", FormatToString(mFormat), mName.c_str());
+			throw runtime_error("Unsupported texture format");
+		}
+		Upload(decoded);
+		return;
+	}
+	if (compressed || data.mMipLevels > 1) {
+		mMipLevels = std::max(data.mMipLevels, 1u);
+		mUsage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+		CreateImage();
+		CreateImageView(VK_IMAGE_ASPECT_COLOR_BIT);
+		UploadLevels(data);
+		return;
+	}
+
+	mMipLevels = (uint32_t)std::floor(std::log2(std::max(mWidth, mHeight))) + 1;
+	mUsage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+
 	CreateImage();
 	CreateImageView(VK_IMAGE_ASPECT_COLOR_BIT);
 
+	UploadContext upload = mDevice->BeginUpload(data.mPixels.size(), UploadAlignment());
+	memcpy(upload.mMapped, data.mPixels.data(), data.mPixels.size());
+
 	VkBufferImageCopy copyRegion = {};
-	copyRegion.bufferOffset = 0;
+	copyRegion.bufferOffset = upload.mOffset;
 	copyRegion.bufferRowLength = 0;
 	copyRegion.bufferImageHeight = 0;
 	copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -133,28 +279,53 @@ Texture::Texture(const string& name, Device* device, const string& px, const str
 	copyRegion.imageOffset = { 0, 0, 0 };
 	copyRegion.imageExtent = { mWidth, mHeight, 1 };
 
-	VkDeviceSize dataSize = mWidth * mHeight * size * channels;
-
-	auto commandBuffer = mDevice->GetCommandBuffer();
-	TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, commandBuffer.get());
-	
-	Buffer uploadBuffer(name + " Copy", mDevice, dataSize * mArrayLayers, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	for (uint32_t j = 0; j < mArrayLayers; j++)
-		memcpy((uint8_t*)uploadBuffer.MappedData() + j * dataSize, pixels[j], dataSize);
-
-	vkCmdCopyBufferToImage(*commandBuffer, uploadBuffer, mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
-
-	GenerateMipMaps(commandBuffer.get());
-	mDevice->Execute(commandBuffer, false)->Wait();
-
-	for (uint32_t i = 0; i < 6; i++)
-		stbi_image_free(pixels[i]);
+	// Copy on the transfer queue, then generate the mip maps on the graphics queue since the transfer queue can't blit
+	TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, upload.mTransfer);
+	vkCmdCopyBufferToImage(*upload.mTransfer, *upload.mBuffer, mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+	mDevice->TransferImageOwnership(upload, mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, { VK_IMAGE_ASPECT_COLOR_BIT, 0, mMipLevels, 0, mArrayLayers });
+	GenerateMipMaps(upload.mGraphics);
+	mPendingUpload = upload.mToken;
+	mDevice->EndUpload(upload);
+}
+void Texture::UploadLevels(const TextureData& data) {
+	// Levels are tightly packed in data, but each copy must start at a multiple of the texel or block size
+	VkDeviceSize alignment = UploadAlignment();
+	VkDeviceSize size = 0;
+	for (uint32_t level = 0; level < mMipLevels; level++)
+		size = (size + alignment - 1) / alignment * alignment + data.LevelSize(level);
+
+	UploadContext upload = mDevice->BeginUpload(size, alignment);
+	vector<VkBufferImageCopy> regions(mMipLevels);
+	size_t src = 0;
+	VkDeviceSize dst = 0;
+	for (uint32_t level = 0; level < mMipLevels; level++) {
+		size_t levelSize = data.LevelSize(level);
+		dst = (dst + alignment - 1) / alignment * alignment;
+		memcpy((uint8_t*)upload.mMapped + dst, data.mPixels.data() + src, levelSize);
+
+		VkBufferImageCopy& region = regions[level];
+		region = {};
+		region.bufferOffset = upload.mOffset + dst;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = level;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = mArrayLayers;
+		region.imageOffset = { 0, 0, 0 };
+		region.imageExtent = { std::max(mWidth >> level, 1u), std::max(mHeight >> level, 1u), 1 };
+		src += levelSize;
+		dst += levelSize;
+	}
 
-	//printf("Loaded Cubemap %s: %dx%d %s\n", nx.c_str(), mWidth, mHeight, FormatToString(mFormat));
+	TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, upload.mTransfer);
+	vkCmdCopyBufferToImage(*upload.mTransfer, *upload.mBuffer, mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)regions.size(), regions.data());
+	mDevice->TransferImageOwnership(upload, mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, { VK_IMAGE_ASPECT_COLOR_BIT, 0, mMipLevels, 0, mArrayLayers });
+	TransitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, upload.mGraphics);
+	mPendingUpload = upload.mToken;
+	mDevice->EndUpload(upload);
 }
 
 Texture::Texture(const string& name, Device* device, void* pixels, VkDeviceSize imageSize, uint32_t width, uint32_t height, uint32_t depth, VkFormat format, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties)
-	: mName(name), mDevice(device), mWidth(width), mHeight(height), mDepth(depth), mArrayLayers(1), mMipLevels(mipLevels), mFormat(format), mSampleCount(numSamples), mTiling(tiling), mUsage(usage), mMemoryProperties(properties), mMemory({}) {
+	: mName(name), mDevice(device), mWidth(width), mHeight(height), mDepth(depth), mArrayLayers(1), mMipLevels(mipLevels), mFormat(format), mSampleCount(numSamples), mTiling(tiling), mUsage(usage), mMemoryProperties(properties), mMemory({}), mPendingUpload(0) {
 	
 	if (mipLevels == 0) mMipLevels = (uint32_t)std::floor(std::log2(std::max(mWidth, mHeight))) + 1;
 	if (mMipLevels > 1) mUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
@@ -164,8 +335,11 @@ Texture::Texture(const string& name, Device* device, void* pixels, VkDeviceSize
 		CreateImage();
 		CreateImageView(VK_IMAGE_ASPECT_COLOR_BIT);
 
+		UploadContext upload = mDevice->BeginUpload(imageSize, UploadAlignment());
+		memcpy(upload.mMapped, pixels, imageSize);
+
 		VkBufferImageCopy copyRegion = {};
-		copyRegion.bufferOffset = 0;
+		copyRegion.bufferOffset = upload.mOffset;
 		copyRegion.bufferRowLength = 0;
 		copyRegion.bufferImageHeight = 0;
 		copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -175,17 +349,16 @@ Texture::Texture(const string& name, Device* device, void* pixels, VkDeviceSize
 		copyRegion.imageOffset = { 0, 0, 0 };
 		copyRegion.imageExtent = { mWidth, mHeight, mDepth };
 
-		Buffer uploadBuffer(name + " Copy", mDevice, pixels, imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-		auto commandBuffer = mDevice->GetCommandBuffer();
-		TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, commandBuffer.get());
-		vkCmdCopyBufferToImage(*commandBuffer, uploadBuffer, mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+		TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, upload.mTransfer);
+		vkCmdCopyBufferToImage(*upload.mTransfer, *upload.mBuffer, mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+		mDevice->TransferImageOwnership(upload, mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, { VK_IMAGE_ASPECT_COLOR_BIT, 0, mMipLevels, 0, mArrayLayers });
 
 		if (mMipLevels > 1)
-			GenerateMipMaps(commandBuffer.get());
+			GenerateMipMaps(upload.mGraphics);
 		else
-			TransitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, ((mUsage & VK_IMAGE_USAGE_STORAGE_BIT) != 0) ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, commandBuffer.get());
-		mDevice->Execute(commandBuffer, false)->Wait();
+			TransitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, ((mUsage & VK_IMAGE_USAGE_STORAGE_BIT) != 0) ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, upload.mGraphics);
+		mPendingUpload = upload.mToken;
+		mDevice->EndUpload(upload);
 	} else {
 		CreateImage();
 		CreateImageView(VK_IMAGE_ASPECT_COLOR_BIT);
@@ -193,7 +366,7 @@ Texture::Texture(const string& name, Device* device, void* pixels, VkDeviceSize
 }
 
 Texture::Texture(const string& name, Device* device, uint32_t width, uint32_t height, uint32_t depth, VkFormat format, VkSampleCountFlagBits numSamples, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties)
-	: mName(name), mDevice(device), mWidth(width), mHeight(height), mDepth(depth), mArrayLayers(1), mMipLevels(1), mFormat(format), mSampleCount(numSamples), mTiling(tiling), mUsage(usage), mMemoryProperties(properties), mMemory({}) {
+	: mName(name), mDevice(device), mWidth(width), mHeight(height), mDepth(depth), mArrayLayers(1), mMipLevels(1), mFormat(format), mSampleCount(numSamples), mTiling(tiling), mUsage(usage), mMemoryProperties(properties), mMemory({}), mPendingUpload(0) {
 
 	CreateImage();
 
@@ -216,6 +389,7 @@ Texture::Texture(const string& name, Device* device, uint32_t width, uint32_t he
 }
 
 Texture::~Texture() {
+	mDevice->WaitForUpload(mPendingUpload);
 	vkDestroyImage(*mDevice, mImage, nullptr);
 	vkDestroyImageView(*mDevice, mView, nullptr);
 	mDevice->FreeMemory(mMemory);
@@ -336,6 +510,7 @@ void Texture::CreateImageView(VkImageAspectFlags aspectFlags) {
 	viewInfo.image = mImage;
 
 	ThrowIfFailed(vkCreateImageView(*mDevice, &viewInfo, nullptr, &mView), "vkCreateImageView failed for " + mName);
+	mId = gNextId++;
 	mDevice->SetObjectName(mView, mName + " View", VK_OBJECT_TYPE_IMAGE_VIEW);
 }
 
@@ -3,8 +3,31 @@
 #include <Content/Asset.hpp>
 #include <Core/Device.hpp>
 #include <Core/Sampler.hpp>
+#include <Util/BlockCompression.hpp>
 #include <Util/Util.hpp>
 
+class JobSystem;
+
+/// Pixels decoded on the CPU by Texture::Decode, which doesn't need a Device
+struct TextureData {
+	// Tightly packed pixels of every array layer, one mip level after another
+	std::vector<uint8_t> mPixels;
+	uint32_t mWidth;
+	uint32_t mHeight;
+	uint32_t mArrayLayers;
+	// Mip levels in mPixels. With 1 level of an uncompressed format, the GPU generates the rest of the mip chain
+	uint32_t mMipLevels;
+	// Size of one channel in bytes, 0 for block compressed formats
+	uint32_t mChannelSize;
+	uint32_t mChannels;
+	VkFormat mFormat;
+
+	/// Bytes of every array layer of mip level level
+	inline size_t LevelSize(uint32_t level) const {
+		return BlockCompression::ImageSize(mFormat, std::max(mWidth >> level, 1u), std::max(mHeight >> level, 1u)) * mArrayLayers;
+	}
+};
+
 class Texture : public Asset {
 public:
 	const std::string mName;
@@ -30,6 +53,10 @@ public:
 
 	inline VkImage Image() const { return mImage; }
 	inline VkImageView View() const { return mView; }
+	/// Unique for every VkImageView this Texture creates, see Buffer::Id()
+	inline uint64_t Id() const { return mId; }
+	/// Token of the upload batch that writes the texture's pixels, see Device::BeginUpload. 0 if the texture was created without pixels
+	inline UploadToken PendingUpload() const { return mPendingUpload; }
 
 	ENGINE_EXPORT static void TransitionImageLayout(VkImage image, VkFormat format, uint32_t mipLevels, VkImageLayout oldLayout, VkImageLayout newLayout, CommandBuffer* commandBuffer);
 	ENGINE_EXPORT void TransitionImageLayout(VkImageLayout oldLayout, VkImageLayout newLayout, CommandBuffer* commandBuffer);
@@ -39,10 +66,24 @@ public:
 	// Texture must be in VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
 	ENGINE_EXPORT void GenerateMipMaps(CommandBuffer* commandBuffer);
 
+	/// Decodes an image file. Returns false and prints an error if the file can't be read.
+	/// .ktx2 and .dds files keep their own format and mip levels. With compress, other 8-bit images are block compressed by Compress()
+	/// and cached in filename + ".ktx2", which later calls read instead while the source file is unchanged
+	ENGINE_EXPORT static bool Decode(const std::string& filename, bool srgb, TextureData& data, bool compress = false, JobSystem* jobSystem = nullptr);
+	/// Decodes 6 image files of the same size and format into the layers of a cubemap
+	ENGINE_EXPORT static bool Decode(const std::string& px, const std::string& nx, const std::string& py, const std::string& ny, const std::string& pz, const std::string& nz, bool srgb, TextureData& data);
+	/// Replaces RGBA8 data with a full mip chain compressed to BC1 if every pixel is opaque, or BC7 otherwise.
+	/// Returns false and leaves data unchanged for other formats, or data that already has mip levels
+	ENGINE_EXPORT static bool Compress(TextureData& data, JobSystem* jobSystem = nullptr);
+	/// Replaces block compressed data with RGBA8 data with the same mip levels, for devices without BC support.
+	/// Returns false and leaves data unchanged for formats BlockCompression::DecodeBlock() doesn't handle, such as BC2 and BC6H
+	ENGINE_EXPORT static bool Decompress(TextureData& data);
+
 private:
 	friend class AssetManager;
 	ENGINE_EXPORT Texture(const std::string& name, Device* device, const std::string& filename, bool srgb = true);
 	ENGINE_EXPORT Texture(const std::string& name, Device* device, const std::string& px, const std::string& nx, const std::string& py, const std::string& ny, const std::string& pz, const std::string& nz, bool srgb = true);
+	ENGINE_EXPORT Texture(const std::string& name, Device* device, const TextureData& data);
 
 	Device* mDevice;
 	DeviceMemoryAllocation mMemory;
@@ -63,7 +104,18 @@ private:
 
 	VkImage mImage;
 	VkImageView mView;
+	uint64_t mId;
+	UploadToken mPendingUpload;
 
+	ENGINE_EXPORT void Upload(const TextureData& data);
+	/// Copies every mip level in data, for data the GPU can't generate mip levels for
+	ENGINE_EXPORT void UploadLevels(const TextureData& data);
+	/// Staging offset alignment for copies to this texture, a multiple of 4 and of the texel or block size
+	inline VkDeviceSize UploadAlignment() const {
+		VkDeviceSize texel = BlockCompression::IsBlockCompressed(mFormat) ? BlockCompression::BlockSize(mFormat) : FormatSize(mFormat);
+		if (texel == 0 || (texel & (texel - 1)) == 0) return std::max<VkDeviceSize>(texel, 16);
+		return texel % 4 == 0 ? texel : texel % 2 == 0 ? texel * 2 : texel * 4;
+	}
 	ENGINE_EXPORT void CreateImage();
 	ENGINE_EXPORT void CreateImageView(VkImageAspectFlags flags);
 };
\ No newline at end of file
@@ -0,0 +1,443 @@
+#include <Content/TextureFile.hpp>
+#include <Util/MappedFile.hpp>
+
+using namespace std;
+
+#define KTX2_HEADER_SIZE 80
+#define KTX2_LEVEL_INDEX_SIZE 24
+#define KTX2_SOURCE_HASH_KEY "StratumSourceHash"
+#define KTX2_WRITER "Stratum"
+
+#define DDS_HEADER_SIZE 128
+#define DDS_DX10_HEADER_SIZE 20
+
+// Limits on the dimensions and layers a file header may claim, so the size arithmetic below can't overflow
+#define TEXTURE_MAX_DIMENSION 65536u
+#define TEXTURE_MAX_LAYERS 65536u
+
+static const uint8_t gKtx2Identifier[12] { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+template<typename T>
+inline T ReadValue(const uint8_t* p) {
+	T value;
+	memcpy(&value, p, sizeof(T));
+	return value;
+}
+template<typename T>
+inline void WriteValue(vector<uint8_t>& dst, T value) {
+	size_t offset = dst.size();
+	dst.resize(offset + sizeof(T));
+	memcpy(dst.data() + offset, &value, sizeof(T));
+}
+inline uint32_t FourCC(const char* s) { return (uint32_t)s[0] | ((uint32_t)s[1] << 8) | ((uint32_t)s[2] << 16) | ((uint32_t)s[3] << 24); }
+
+// Fills in the channel fields of data, which are 0 for block compressed formats. False if the size of format isn't known
+inline bool SetChannels(TextureData& data, uint32_t channelSize) {
+	if (BlockCompression::IsBlockCompressed(data.mFormat)) {
+		data.mChannels = 0;
+		data.mChannelSize = 0;
+		return true;
+	}
+	uint32_t texel = (uint32_t)FormatSize(data.mFormat);
+	if (texel == 0 || channelSize == 0 || texel % channelSize) return false;
+	data.mChannels = texel / channelSize;
+	data.mChannelSize = channelSize;
+	return true;
+}
+
+bool TextureFile::IsTextureFile(const string& filename) {
+	string extension = fs::path(filename).extension().string();
+	for (char& c : extension) c = (char)tolower(c);
+	return extension == ".ktx2" || extension == ".dds";
+}
+
+bool TextureFile::DecodeKtx2(const uint8_t* file, size_t size, TextureData& data, uint64_t& sourceHash) {
+	data = {};
+	sourceHash = 0;
+	if (size < KTX2_HEADER_SIZE || memcmp(file, gKtx2Identifier, sizeof(gKtx2Identifier))) return false;
+
+	VkFormat format = (VkFormat)ReadValue<uint32_t>(file + 12);
+	uint32_t typeSize = ReadValue<uint32_t>(file + 16);
+	uint32_t width = ReadValue<uint32_t>(file + 20);
+	uint32_t height = ReadValue<uint32_t>(file + 24);
+	uint32_t depth = ReadValue<uint32_t>(file + 28);
+	uint32_t layerCount = ReadValue<uint32_t>(file + 32);
+	uint32_t faceCount = ReadValue<uint32_t>(file + 36);
+	uint32_t levelCount = ReadValue<uint32_t>(file + 40);
+	uint32_t supercompression = ReadValue<uint32_t>(file + 44);
+	uint32_t kvdOffset = ReadValue<uint32_t>(file + 56);
+	uint32_t kvdLength = ReadValue<uint32_t>(file + 60);
+
+	if (format == VK_FORMAT_UNDEFINED || supercompression != 0 || depth > 1 || width == 0) return false;
+	if (faceCount != 1 && faceCount != 6) return false;
+	if (width > TEXTURE_MAX_DIMENSION || height > TEXTURE_MAX_DIMENSION || (uint64_t)max(layerCount, 1u) * faceCount > TEXTURE_MAX_LAYERS) return false;
+	// 0 levels asks the loader to generate the mip chain, which the GPU does for a single level
+	levelCount = max(levelCount, 1u);
+	if (levelCount > 32 || KTX2_HEADER_SIZE + (size_t)levelCount * KTX2_LEVEL_INDEX_SIZE > size) return false;
+
+	data.mWidth = width;
+	data.mHeight = max(height, 1u);
+	data.mArrayLayers = max(layerCount, 1u) * faceCount;
+	data.mMipLevels = levelCount;
+	data.mFormat = format;
+	if (!SetChannels(data, typeSize)) {
+		data = {};
+		return false;
+	}
+
+	// Every level must be inside the file before anything is allocated, so a forged header can't request more memory than the file holds
+	uint64_t total = 0;
+	for (uint32_t level = 0; level < levelCount; level++) {
+		const uint8_t* index = file + KTX2_HEADER_SIZE + (size_t)level * KTX2_LEVEL_INDEX_SIZE;
+		uint64_t byteOffset = ReadValue<uint64_t>(index);
+		uint64_t byteLength = ReadValue<uint64_t>(index + 8);
+		uint64_t levelSize = data.LevelSize(level);
+		if (byteLength < levelSize || byteOffset > size || byteLength > size - byteOffset) {
+			data = {};
+			return false;
+		}
+		total += levelSize;
+	}
+	if (total > size) {
+		data = {};
+		return false;
+	}
+	data.mPixels.resize((size_t)total);
+
+	// Each level holds its layers and faces in the same order as Vulkan array layers
+	size_t offset = 0;
+	for (uint32_t level = 0; level < levelCount; level++) {
+		uint64_t byteOffset = ReadValue<uint64_t>(file + KTX2_HEADER_SIZE + (size_t)level * KTX2_LEVEL_INDEX_SIZE);
+		size_t levelSize = data.LevelSize(level);
+		memcpy(data.mPixels.data() + offset, file + byteOffset, levelSize);
+		offset += levelSize;
+	}
+
+	// Key/value entries are a length, a null terminated key and a value, padded to 4 bytes
+	if ((uint64_t)kvdOffset + kvdLength <= size) {
+		const uint8_t* kvd = file + kvdOffset;
+		for (uint32_t position = 0; position + 4 <= kvdLength;) {
+			uint32_t length = ReadValue<uint32_t>(kvd + position);
+			if (length > kvdLength - position - 4) break;
+			const char* key = (const char*)kvd + position + 4;
+			size_t keyLength = strnlen(key, length);
+			if (keyLength == sizeof(KTX2_SOURCE_HASH_KEY) - 1 && keyLength + 1 + sizeof(uint64_t) == length && !memcmp(key, KTX2_SOURCE_HASH_KEY, keyLength))
+				sourceHash = ReadValue<uint64_t>((const uint8_t*)key + keyLength + 1);
+			position += 4 + ((length + 3) & ~3u);
+		}
+	}
+	return true;
+}
+
+// Maps a DXGI_FORMAT from a DX10 header to the VkFormat with the same layout
+inline VkFormat DxgiFormat(uint32_t dxgi) {
+	switch (dxgi) {
+	case 2:  return VK_FORMAT_R32G32B32A32_SFLOAT;
+	case 10: return VK_FORMAT_R16G16B16A16_SFLOAT;
+	case 11: return VK_FORMAT_R16G16B16A16_UNORM;
+	case 28: return VK_FORMAT_R8G8B8A8_UNORM;
+	case 29: return VK_FORMAT_R8G8B8A8_SRGB;
+	case 71: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	case 72: return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+	case 74: return VK_FORMAT_BC2_UNORM_BLOCK;
+	case 75: return VK_FORMAT_BC2_SRGB_BLOCK;
+	case 77: return VK_FORMAT_BC3_UNORM_BLOCK;
+	case 78: return VK_FORMAT_BC3_SRGB_BLOCK;
+	case 80: return VK_FORMAT_BC4_UNORM_BLOCK;
+	case 81: return VK_FORMAT_BC4_SNORM_BLOCK;
+	case 83: return VK_FORMAT_BC5_UNORM_BLOCK;
+	case 84: return VK_FORMAT_BC5_SNORM_BLOCK;
+	case 87: return VK_FORMAT_B8G8R8A8_UNORM;
+	case 91: return VK_FORMAT_B8G8R8A8_SRGB;
+	case 95: return VK_FORMAT_BC6H_UFLOAT_BLOCK;
+	case 96: return VK_FORMAT_BC6H_SFLOAT_BLOCK;
+	case 98: return VK_FORMAT_BC7_UNORM_BLOCK;
+	case 99: return VK_FORMAT_BC7_SRGB_BLOCK;
+	default: return VK_FORMAT_UNDEFINED;
+	}
+}
+// Maps the pixel format of a DDS header without a DX10 header
+inline VkFormat DdsPixelFormat(const uint8_t* pixelFormat, uint32_t& channelSize) {
+	uint32_t flags = ReadValue<uint32_t>(pixelFormat + 4);
+	uint32_t fourCC = ReadValue<uint32_t>(pixelFormat + 8);
+	uint32_t bitCount = ReadValue<uint32_t>(pixelFormat + 12);
+	uint32_t r = ReadValue<uint32_t>(pixelFormat + 16);
+	uint32_t b = ReadValue<uint32_t>(pixelFormat + 24);
+	uint32_t a = ReadValue<uint32_t>(pixelFormat + 28);
+	channelSize = 1;
+	if (flags & 0x4) { // DDPF_FOURCC
+		if (fourCC == FourCC("DXT1")) return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+		if (fourCC == FourCC("DXT2") || fourCC == FourCC("DXT3")) return VK_FORMAT_BC2_UNORM_BLOCK;
+		if (fourCC == FourCC("DXT4") || fourCC == FourCC("DXT5")) return VK_FORMAT_BC3_UNORM_BLOCK;
+		if (fourCC == FourCC("ATI1") || fourCC == FourCC("BC4U")) return VK_FORMAT_BC4_UNORM_BLOCK;
+		if (fourCC == FourCC("BC4S")) return VK_FORMAT_BC4_SNORM_BLOCK;
+		if (fourCC == FourCC("ATI2") || fourCC == FourCC("BC5U")) return VK_FORMAT_BC5_UNORM_BLOCK;
+		if (fourCC == FourCC("BC5S")) return VK_FORMAT_BC5_SNORM_BLOCK;
+		// D3DFORMAT values
+		channelSize = fourCC == 116 ? 4 : 2;
+		if (fourCC == 36) return VK_FORMAT_R16G16B16A16_UNORM;
+		if (fourCC == 113) return VK_FORMAT_R16G16B16A16_SFLOAT;
+		if (fourCC == 116) return VK_FORMAT_R32G32B32A32_SFLOAT;
+		return VK_FORMAT_UNDEFINED;
+	}
+	if ((flags & 0x40) && (flags & 0x1) && bitCount == 32 && a == 0xFF000000) { // DDPF_RGB | DDPF_ALPHAPIXELS
+		if (r == 0xFF && b == 0xFF0000) return VK_FORMAT_R8G8B8A8_UNORM;
+		if (r == 0xFF0000 && b == 0xFF) return VK_FORMAT_B8G8R8A8_UNORM;
+	}
+	return VK_FORMAT_UNDEFINED;
+}
+
+bool TextureFile::DecodeDds(const uint8_t* file, size_t size, TextureData& data) {
+	data = {};
+	if (size < DDS_HEADER_SIZE || ReadValue<uint32_t>(file) != FourCC("DDS ") || ReadValue<uint32_t>(file + 4) != 124) return false;
+
+	uint32_t flags = ReadValue<uint32_t>(file + 8);
+	uint32_t height = ReadValue<uint32_t>(file + 12);
+	uint32_t width = ReadValue<uint32_t>(file + 16);
+	uint32_t mipCount = (flags & 0x20000) ? ReadValue<uint32_t>(file + 28) : 1; // DDSD_MIPMAPCOUNT
+	uint32_t caps2 = ReadValue<uint32_t>(file + 112);
+	const uint8_t* pixelFormat = file + 76;
+
+	uint32_t channelSize = 1;
+	uint32_t layers = (caps2 & 0x200) ? 6 : 1; // DDSCAPS2_CUBEMAP
+	size_t dataOffset = DDS_HEADER_SIZE;
+	if (ReadValue<uint32_t>(pixelFormat + 4) & 0x4 && ReadValue<uint32_t>(pixelFormat + 8) == FourCC("DX10")) {
+		if (size < DDS_HEADER_SIZE + DDS_DX10_HEADER_SIZE) return false;
+		const uint8_t* dx10 = file + DDS_HEADER_SIZE;
+		data.mFormat = DxgiFormat(ReadValue<uint32_t>(dx10));
+		uint32_t dimension = ReadValue<uint32_t>(dx10 + 4);
+		uint32_t miscFlag = ReadValue<uint32_t>(dx10 + 8);
+		uint32_t arraySize = max(ReadValue<uint32_t>(dx10 + 12), 1u);
+		if (dimension != 3) return false; // D3D10_RESOURCE_DIMENSION_TEXTURE2D
+		if (arraySize > TEXTURE_MAX_LAYERS / 6) return false;
+		layers = arraySize * ((miscFlag & 0x4) ? 6 : 1); // D3D10_RESOURCE_MISC_TEXTURECUBE
+		// Every uncompressed format DxgiFormat() maps has 4 channels
+		channelSize = (uint32_t)FormatSize(data.mFormat) / 4;
+		dataOffset += DDS_DX10_HEADER_SIZE;
+	} else {
+		if (flags & 0x800000) return false; // DDSD_DEPTH, volume textures
+		data.mFormat = DdsPixelFormat(pixelFormat, channelSize);
+	}
+	if (data.mFormat == VK_FORMAT_UNDEFINED || width == 0 || height == 0) return false;
+	if (width > TEXTURE_MAX_DIMENSION || height > TEXTURE_MAX_DIMENSION) {
+		data = {};
+		return false;
+	}
+
+	data.mWidth = width;
+	data.mHeight = height;
+	data.mArrayLayers = layers;
+	data.mMipLevels = min(max(mipCount, 1u), 32u);
+	if (!SetChannels(data, channelSize)) {
+		data = {};
+		return false;
+	}
+
+	// DDS stores each layer's mip chain in turn, TextureData stores each level's layers in turn.
+	// The dimensions and layers are bounded above, so these 64-bit sums can't overflow
+	vector<size_t> imageSizes(data.mMipLevels);
+	vector<size_t> levelOffsets(data.mMipLevels);
+	uint64_t total = 0;
+	for (uint32_t level = 0; level < data.mMipLevels; level++) {
+		imageSizes[level] = BlockCompression::ImageSize(data.mFormat, max(width >> level, 1u), max(height >> level, 1u));
+		levelOffsets[level] = (size_t)total;
+		total += (uint64_t)imageSizes[level] * layers;
+	}
+	if (dataOffset > size || total > size - dataOffset) {
+		data = {};
+		return false;
+	}
+	data.mPixels.resize((size_t)total);
+	const uint8_t* src = file + dataOffset;
+	for (uint32_t layer = 0; layer < layers; layer++)
+		for (uint32_t level = 0; level < data.mMipLevels; level++) {
+			memcpy(data.mPixels.data() + levelOffsets[level] + layer * imageSizes[level], src, imageSizes[level]);
+			src += imageSizes[level];
+		}
+	return true;
+}
+
+// Appends a basic data format descriptor block for data's format. Readers identify the format by vkFormat, so samples of
+// uncompressed formats assume the channels are in RGBA order
+inline void WriteDfd(vector<uint8_t>& dst, const TextureData& data) {
+	struct Sample { uint16_t mBitOffset; uint8_t mBitLength; uint8_t mChannelType; uint32_t mUpper; };
+	vector<Sample> samples;
+	uint8_t colorModel = 1; // KHR_DF_MODEL_RGBSDA
+	uint8_t blockDimension = 0;
+	uint32_t bytesPlane0 = (uint32_t)FormatSize(data.mFormat);
+	bool srgb = false;
+
+	switch (data.mFormat) {
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC2_SRGB_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+	case VK_FORMAT_B8G8R8A8_SRGB:
+	case VK_FORMAT_R8G8B8_SRGB:
+	case VK_FORMAT_R8G8_SRGB:
+	case VK_FORMAT_R8_SRGB:
+		srgb = true;
+		break;
+	default:
+		break;
+	}
+
+	// Channel ids: 0 red or color, 1 green, 2 blue, 15 alpha
+	switch (data.mFormat) {
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+		colorModel = 128;
+		samples.push_back({ 0, 63, 0, ~0u });
+		break;
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+		colorModel = 128;
+		samples.push_back({ 0, 63, 1, ~0u });
+		break;
+	case VK_FORMAT_BC2_UNORM_BLOCK:
+	case VK_FORMAT_BC2_SRGB_BLOCK:
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+		colorModel = (data.mFormat == VK_FORMAT_BC2_UNORM_BLOCK || data.mFormat == VK_FORMAT_BC2_SRGB_BLOCK) ? 129 : 130;
+		samples.push_back({ 0, 63, 15 | 0x10, ~0u });
+		samples.push_back({ 64, 63, 0, ~0u });
+		break;
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+	case VK_FORMAT_BC4_SNORM_BLOCK:
+		colorModel = 131;
+		samples.push_back({ 0, 63, 0, ~0u });
+		break;
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC5_SNORM_BLOCK:
+		colorModel = 132;
+		samples.push_back({ 0, 63, 0, ~0u });
+		samples.push_back({ 64, 63, 1, ~0u });
+		break;
+	case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+	case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+		colorModel = 133;
+		samples.push_back({ 0, 127, 0 | 0x80, 0x3F800000 });
+		break;
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		colorModel = 134;
+		samples.push_back({ 0, 127, 0, ~0u });
+		break;
+	default: {
+		static const uint8_t channelIds[4] { 0, 1, 2, 15 };
+		uint32_t bits = data.mChannelSize * 8;
+		bool isFloat = data.mChannelSize == 4 || data.mFormat == VK_FORMAT_R16G16B16A16_SFLOAT;
+		uint32_t upper = isFloat ? 0x3F800000 : bits == 32 ? ~0u : (1u << bits) - 1;
+		for (uint32_t c = 0; c < data.mChannels && c < 4; c++) {
+			uint8_t type = channelIds[c] | (isFloat ? 0xC0 : 0) | (srgb && c == 3 ? 0x10 : 0);
+			samples.push_back({ (uint16_t)(c * bits), (uint8_t)(bits - 1), type, upper });
+		}
+		break;
+	}
+	}
+	if (BlockCompression::IsBlockCompressed(data.mFormat)) {
+		blockDimension = 3;
+		bytesPlane0 = BlockCompression::BlockSize(data.mFormat);
+	}
+
+	uint32_t blockSize = 24 + 16 * (uint32_t)samples.size();
+	WriteValue<uint32_t>(dst, 4 + blockSize); // dfdTotalSize
+	WriteValue<uint32_t>(dst, 0); // vendorId, descriptorType
+	WriteValue<uint16_t>(dst, 2); // versionNumber
+	WriteValue<uint16_t>(dst, (uint16_t)blockSize);
+	WriteValue<uint8_t>(dst, colorModel);
+	WriteValue<uint8_t>(dst, 1); // KHR_DF_PRIMARIES_BT709
+	WriteValue<uint8_t>(dst, srgb ? 2 : 1); // KHR_DF_TRANSFER_SRGB or LINEAR
+	WriteValue<uint8_t>(dst, 0); // straight alpha
+	for (uint32_t i = 0; i < 2; i++) WriteValue<uint8_t>(dst, blockDimension);
+	for (uint32_t i = 0; i < 2; i++) WriteValue<uint8_t>(dst, 0);
+	WriteValue<uint32_t>(dst, bytesPlane0);
+	WriteValue<uint32_t>(dst, 0);
+	for (const Sample& s : samples) {
+		WriteValue<uint16_t>(dst, s.mBitOffset);
+		WriteValue<uint8_t>(dst, s.mBitLength);
+		WriteValue<uint8_t>(dst, s.mChannelType);
+		WriteValue<uint32_t>(dst, 0); // sample position
+		WriteValue<uint32_t>(dst, 0); // lower
+		WriteValue<uint32_t>(dst, s.mUpper);
+	}
+}
+inline void WriteKeyValue(vector<uint8_t>& dst, const char* key, const void* value, uint32_t valueSize) {
+	uint32_t keySize = (uint32_t)strlen(key) + 1;
+	WriteValue<uint32_t>(dst, keySize + valueSize);
+	size_t offset = dst.size();
+	dst.resize(offset + keySize + valueSize);
+	memcpy(dst.data() + offset, key, keySize);
+	memcpy(dst.data() + offset + keySize, value, valueSize);
+	dst.resize((dst.size() + 3) & ~(size_t)3);
+}
+
+vector<uint8_t> TextureFile::EncodeKtx2(const TextureData& data, uint64_t sourceHash) {
+	uint32_t levels = max(data.mMipLevels, 1u);
+	bool cube = data.mArrayLayers == 6;
+	bool compressed = BlockCompression::IsBlockCompressed(data.mFormat);
+
+	vector<uint8_t> dst(KTX2_HEADER_SIZE + (size_t)levels * KTX2_LEVEL_INDEX_SIZE);
+	uint32_t dfdOffset = (uint32_t)dst.size();
+	WriteDfd(dst, data);
+	uint32_t kvdOffset = (uint32_t)dst.size();
+	// Keys are sorted
+	WriteKeyValue(dst, "KTXwriter", KTX2_WRITER, sizeof(KTX2_WRITER));
+	if (sourceHash) WriteKeyValue(dst, KTX2_SOURCE_HASH_KEY, &sourceHash, sizeof(uint64_t));
+	uint32_t kvdLength = (uint32_t)dst.size() - kvdOffset;
+
+	memcpy(dst.data(), gKtx2Identifier, sizeof(gKtx2Identifier));
+	uint32_t header[9] {
+		(uint32_t)data.mFormat, compressed ? 1 : data.mChannelSize,
+		data.mWidth, data.mHeight, 0,
+		cube ? 0 : (data.mArrayLayers > 1 ? data.mArrayLayers : 0), cube ? 6u : 1u,
+		levels, 0
+	};
+	memcpy(dst.data() + 12, header, sizeof(header));
+	uint32_t index[4] { dfdOffset, kvdOffset - dfdOffset, kvdOffset, kvdLength };
+	memcpy(dst.data() + 48, index, sizeof(index));
+
+	// Levels are stored smallest first, each aligned to the texel or block size and 4
+	vector<size_t> srcOffsets(levels);
+	for (uint32_t level = 1; level < levels; level++) srcOffsets[level] = srcOffsets[level - 1] + data.LevelSize(level - 1);
+	size_t texel = compressed ? BlockCompression::BlockSize(data.mFormat) : (size_t)FormatSize(data.mFormat);
+	size_t alignment = texel ? texel : 4;
+	while (alignment % 4) alignment += texel;
+	for (uint32_t i = 0; i < levels; i++) {
+		uint32_t level = levels - 1 - i;
+		size_t levelSize = data.LevelSize(level);
+		size_t offset = (dst.size() + alignment - 1) / alignment * alignment;
+		dst.resize(offset + levelSize);
+		memcpy(dst.data() + offset, data.mPixels.data() + srcOffsets[level], levelSize);
+		uint64_t levelIndex[3] { offset, levelSize, levelSize };
+		memcpy(dst.data() + KTX2_HEADER_SIZE + (size_t)level * KTX2_LEVEL_INDEX_SIZE, levelIndex, sizeof(levelIndex));
+	}
+	return dst;
+}
+
+bool TextureFile::Read(const string& filename, TextureData& data, uint64_t& sourceHash) {
+	MappedFile file(filename);
+	if (!file.Valid()) return false;
+	sourceHash = 0;
+	if (file.Size() >= sizeof(gKtx2Identifier) && !memcmp(file.Data(), gKtx2Identifier, sizeof(gKtx2Identifier)))
+		return DecodeKtx2(file.Data(), file.Size(), data, sourceHash);
+	return DecodeDds(file.Data(), file.Size(), data);
+}
+bool TextureFile::Write(const string& filename, const TextureData& data, uint64_t sourceHash) {
+	vector<uint8_t> bytes = EncodeKtx2(data, sourceHash);
+	string tmpFile = filename + ".tmp";
+	FILE* file = fopen(tmpFile.c_str(), "wb");
+	if (!file) return false;
+	bool ok = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+	if (fclose(file) != 0) ok = false;
+	// Don't leave a truncated file behind, and only replace filename once the new file is complete
+	error_code error;
+	if (ok) fs::rename(tmpFile, filename, error);
+	if (!ok || error) {
+		remove(tmpFile.c_str());
+		return false;
+	}
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <Content/Texture.hpp>
+
+/// Reads KTX2 and DDS files and writes KTX2 files, with their mip levels and any block compressed format. Independent of any VkDevice.
+/// Decoded data holds every mip level the file has, see TextureData::mMipLevels
+class TextureFile {
+public:
+	/// True if filename ends in .ktx2 or .dds
+	ENGINE_EXPORT static bool IsTextureFile(const std::string& filename);
+
+	/// Parses a KTX2 file. sourceHash is the hash Write() stored with the file, or 0.
+	/// Returns false for invalid files, supercompressed files and 3D textures
+	ENGINE_EXPORT static bool DecodeKtx2(const uint8_t* file, size_t size, TextureData& data, uint64_t& sourceHash);
+	/// Parses a DDS file, with or without a DX10 header. Returns false for invalid files and formats with no equivalent VkFormat
+	ENGINE_EXPORT static bool DecodeDds(const uint8_t* file, size_t size, TextureData& data);
+	/// Serializes data as a KTX2 file, storing sourceHash in its key/value data if it isn't 0
+	ENGINE_EXPORT static std::vector<uint8_t> EncodeKtx2(const TextureData& data, uint64_t sourceHash = 0);
+
+	/// Reads a KTX2 or DDS file, whichever its contents are. Returns false if the file is missing or invalid
+	ENGINE_EXPORT static bool Read(const std::string& filename, TextureData& data, uint64_t& sourceHash);
+	/// Writes data to a KTX2 file through a temporary file renamed over filename, so readers never see a partial file. Returns false if the file couldn't be written
+	ENGINE_EXPORT static bool Write(const std::string& filename, const TextureData& data, uint64_t sourceHash = 0);
+};
\ No newline at end of file
@@ -1,52 +1,57 @@
 #include <Core/Buffer.hpp>
 #include <Util/Util.hpp>
 
+#include <atomic>
 #include <cstring>
 
 using namespace std;
 
+static atomic<uint64_t> gNextId(1);
+
 Buffer::Buffer(const std::string& name, ::Device* device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties)
-	: mName(name), mDevice(device), mSize(size), mUsageFlags(usage), mMemoryProperties(properties), mBuffer(VK_NULL_HANDLE), mMemory({}) {
+	: mName(name), mDevice(device), mSize(size), mUsageFlags(usage), mMemoryProperties(properties), mBuffer(VK_NULL_HANDLE), mMemory({}), mPendingUpload(0) {
 	Allocate();
 }
 Buffer::Buffer(const std::string& name, ::Device* device, const void* data, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties)
-	: mName(name), mDevice(device), mSize(size), mUsageFlags(usage), mMemoryProperties(properties), mBuffer(VK_NULL_HANDLE), mMemory({}) {
+	: mName(name), mDevice(device), mSize(size), mUsageFlags(usage), mMemoryProperties(properties), mBuffer(VK_NULL_HANDLE), mMemory({}), mPendingUpload(0) {
 	if ((properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) == 0)
 		mUsageFlags |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 	Allocate();
 	Upload(data, size);
 }
 Buffer::Buffer(const Buffer& src)
-	: mName(src.mName), mDevice(src.mDevice), mSize(0), mUsageFlags(src.mUsageFlags | VK_BUFFER_USAGE_TRANSFER_DST_BIT), mMemoryProperties(src.mMemoryProperties), mBuffer(VK_NULL_HANDLE), mMemory({}) {
+	: mName(src.mName), mDevice(src.mDevice), mSize(0), mUsageFlags(src.mUsageFlags | VK_BUFFER_USAGE_TRANSFER_DST_BIT), mMemoryProperties(src.mMemoryProperties), mBuffer(VK_NULL_HANDLE), mMemory({}), mPendingUpload(0) {
 	CopyFrom(src);
 }
 Buffer::~Buffer() {
+	mDevice->WaitForUpload(mPendingUpload);
 	if (mBuffer != VK_NULL_HANDLE) vkDestroyBuffer(*mDevice, mBuffer, nullptr);
 	mDevice->FreeMemory(mMemory);
 }
 
-void Buffer::Upload(const void* data, VkDeviceSize size) {
-	if (!data) return;
+UploadToken Buffer::Upload(const void* data, VkDeviceSize size) {
+	if (!data || !size) return 0;
 	if (size > mSize) throw runtime_error("Data size out of bounds");
 	if (mMemoryProperties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
 		memcpy(MappedData(), data, size);
-	} else {
-		if ((mUsageFlags & VK_BUFFER_USAGE_TRANSFER_DST_BIT) == 0) {
-			mUsageFlags |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-			
-			if (mBuffer) vkDestroyBuffer(*mDevice, mBuffer, nullptr);
-			mDevice->FreeMemory(mMemory);
-			mSize = size;
-			Allocate();
-		}
-		Buffer uploadBuffer(mName + " upload", mDevice, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-		memcpy(uploadBuffer.MappedData(), data, size);
-		CopyFrom(uploadBuffer);
+		return 0;
 	}
+	if ((mUsageFlags & VK_BUFFER_USAGE_TRANSFER_DST_BIT) == 0) {
+		mUsageFlags |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		
+		mDevice->WaitForUpload(mPendingUpload);
+		if (mBuffer) vkDestroyBuffer(*mDevice, mBuffer, nullptr);
+		mDevice->FreeMemory(mMemory);
+		mSize = size;
+		Allocate();
+	}
+	mPendingUpload = mDevice->UploadBuffer(this, 0, data, size);
+	return mPendingUpload;
 }
 
 void Buffer::CopyFrom(const Buffer& other) {
 	if (mSize != other.mSize) {
+		mDevice->WaitForUpload(mPendingUpload);
 		if (mBuffer) vkDestroyBuffer(*mDevice, mBuffer, nullptr);
 		mDevice->FreeMemory(mMemory);
 		mSize = other.mSize;
@@ -75,6 +80,8 @@ void Buffer::CopyFrom(const Buffer& other) {
 }
 
 void Buffer::Allocate(){
+	mId = gNextId++;
+
 	VkBufferCreateInfo bufferInfo = {};
 	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 	bufferInfo.size = mSize;
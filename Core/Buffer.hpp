@@ -12,7 +12,11 @@ public:
 	ENGINE_EXPORT Buffer(const Buffer& src);
 	ENGINE_EXPORT ~Buffer();
 
-	ENGINE_EXPORT void Upload(const void* data, VkDeviceSize size);
+	/// Copies data into the buffer. Device local buffers are written by the device's next upload batch, see Device::BeginUpload,
+	/// so this returns without waiting; commands executed afterwards see the data. Returns the batch's token, or 0 if the data was written directly
+	ENGINE_EXPORT UploadToken Upload(const void* data, VkDeviceSize size);
+	/// Token of the last upload to this buffer
+	inline UploadToken PendingUpload() const { return mPendingUpload; }
 
 	inline void* MappedData() const { return mMemory.mMapped; }
 
@@ -26,11 +30,15 @@ public:
 
 	inline ::Device* Device() const { return mDevice; }
 	inline operator VkBuffer() const { return mBuffer; }
+	/// Unique for every VkBuffer this Buffer creates, so caches keyed by it can't mistake a new buffer that reuses a destroyed one's handle for the old one
+	inline uint64_t Id() const { return mId; }
 
 private:
 	::Device* mDevice;
 	VkBuffer mBuffer;
+	uint64_t mId;
 	DeviceMemoryAllocation mMemory;
+	UploadToken mPendingUpload;
 
 	VkDeviceSize mSize;
 
@@ -13,6 +13,9 @@
 
 using namespace std;
 
+static const PropertyID gCameraID = PropertyToID("Camera");
+static const PropertyID gStereoEyeID = PropertyToID("StereoEye");
+
 Fence::Fence(Device* device) : mDevice(device) {
 	VkFenceCreateInfo fenceInfo = {};
 	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
@@ -45,16 +48,17 @@ Semaphore::~Semaphore() {
 	vkDestroySemaphore(*mDevice, mSemaphore, nullptr);
 }
 
-CommandBuffer::CommandBuffer(::Device* device, VkCommandPool commandPool, const string& name)
-	: mDevice(device), mCommandPool(commandPool), mCurrentRenderPass(nullptr), mCurrentMaterial(nullptr), mCurrentPipeline(VK_NULL_HANDLE), mTriangleCount(0), mCurrentIndexBuffer(nullptr) {
+CommandBuffer::CommandBuffer(::Device* device, VkCommandPool commandPool, const string& name, VkCommandBufferLevel level)
+	: mDevice(device), mCommandPool(commandPool), mLevel(level), mCurrentRenderPass(nullptr), mCurrentMaterial(nullptr), mCurrentPipeline(VK_NULL_HANDLE), mTriangleCount(0), mCurrentIndexBuffer(nullptr) {
 	VkCommandBufferAllocateInfo allocInfo = {};
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	allocInfo.commandPool = mCommandPool;
-	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.level = mLevel;
 	allocInfo.commandBufferCount = 1;
 	ThrowIfFailed(vkAllocateCommandBuffers(*mDevice, &allocInfo, &mCommandBuffer), "vkAllocateCommandBuffers failed");
 	mDevice->SetObjectName(mCommandBuffer, name, VK_OBJECT_TYPE_COMMAND_BUFFER);
 
+	if (Secondary()) return;
 	mSignalFence = make_shared<Fence>(device);
 	mDevice->SetObjectName(mSignalFence->operator VkFence(), name, VK_OBJECT_TYPE_FENCE);
 }
@@ -79,8 +83,13 @@ void CommandBuffer::Reset(const string& name) {
 	vkResetCommandBuffer(mCommandBuffer, 0);
 	mDevice->SetObjectName(mCommandBuffer, name, VK_OBJECT_TYPE_COMMAND_BUFFER);
 	
-	mSignalFence->Reset();
-	mDevice->SetObjectName(*mSignalFence, name + " Fence", VK_OBJECT_TYPE_FENCE);
+	if (Secondary())
+		mSignalFence.reset();
+	else {
+		mSignalFence->Reset();
+		mDevice->SetObjectName(*mSignalFence, name + " Fence", VK_OBJECT_TYPE_FENCE);
+	}
+	mSecondaryCommandBuffers.clear();
 
 	mCurrentRenderPass = nullptr;
 	mCurrentCamera = nullptr;
@@ -91,7 +100,29 @@ void CommandBuffer::Reset(const string& name) {
 	mCurrentVertexBuffers.clear();
 }
 
-void CommandBuffer::BeginRenderPass(RenderPass* renderPass, const VkExtent2D& bufferSize, VkFramebuffer frameBuffer, VkClearValue* clearValues, uint32_t clearValueCount) {
+void CommandBuffer::End() {
+	ThrowIfFailed(vkEndCommandBuffer(mCommandBuffer), "vkEndCommandBuffer failed");
+}
+void CommandBuffer::ExecuteCommands(const vector<shared_ptr<CommandBuffer>>& commandBuffers) {
+	if (commandBuffers.empty()) return;
+	vector<VkCommandBuffer> buffers(commandBuffers.size());
+	for (uint32_t i = 0; i < commandBuffers.size(); i++) {
+		buffers[i] = *commandBuffers[i];
+		commandBuffers[i]->mSignalFence = mSignalFence;
+		mTriangleCount += commandBuffers[i]->mTriangleCount;
+		mSecondaryCommandBuffers.push_back(commandBuffers[i]);
+	}
+	vkCmdExecuteCommands(mCommandBuffer, (uint32_t)buffers.size(), buffers.data());
+
+	// Bound state is undefined after executing secondary command buffers
+	mCurrentCamera = nullptr;
+	mCurrentMaterial = nullptr;
+	mCurrentIndexBuffer = nullptr;
+	mCurrentVertexBuffers.clear();
+	mCurrentPipeline = VK_NULL_HANDLE;
+}
+
+void CommandBuffer::BeginRenderPass(RenderPass* renderPass, const VkExtent2D& bufferSize, VkFramebuffer frameBuffer, VkClearValue* clearValues, uint32_t clearValueCount, VkSubpassContents contents) {
 	VkRenderPassBeginInfo info = {};
 	info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 	info.renderPass = *renderPass;
@@ -99,7 +130,7 @@ void CommandBuffer::BeginRenderPass(RenderPass* renderPass, const VkExtent2D& bu
 	info.pClearValues = clearValues;
 	info.renderArea = { { 0, 0 }, bufferSize };
 	info.framebuffer = frameBuffer;
-	vkCmdBeginRenderPass(*this, &info, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdBeginRenderPass(*this, &info, contents);
 
 	mCurrentRenderPass = renderPass;
 
@@ -115,33 +146,37 @@ void CommandBuffer::EndRenderPass() {
 	mCurrentPipeline = VK_NULL_HANDLE;
 }
 
-bool CommandBuffer::PushConstant(ShaderVariant* shader, const std::string& name, const void* value) {
-	if (shader->mPushConstants.count(name) == 0) return false;
-	VkPushConstantRange range = shader->mPushConstants.at(name);
-	vkCmdPushConstants(*this, shader->mPipelineLayout, range.stageFlags, range.offset, range.size, value);
+bool CommandBuffer::PushConstant(ShaderVariant* shader, PropertyID id, const void* value) {
+	const VkPushConstantRange* range = shader->PushConstantRange(id);
+	if (!range) return false;
+	vkCmdPushConstants(*this, shader->mPipelineLayout, range->stageFlags, range->offset, range->size, value);
 	return true;
 }
 VkPipelineLayout CommandBuffer::BindShader(GraphicsShader* shader, PassType pass, const VertexInput* input, Camera* camera, VkPrimitiveTopology topology, VkCullModeFlags cullMode, BlendMode blendMode, VkPolygonMode polyMode) {
 	VkPipeline pipeline = shader->GetPipeline(mCurrentRenderPass, input, topology, cullMode, blendMode, polyMode);
+	// Still compiling in the background
+	if (!pipeline) return VK_NULL_HANDLE;
 	if (mCurrentPipeline == pipeline) {
 		if (mCurrentCamera != camera && camera) {
 			mCurrentCamera = camera;
-			if (mCurrentRenderPass && camera && shader->mDescriptorBindings.count("Camera"))
-				vkCmdBindDescriptorSets(*this, VK_PIPELINE_BIND_POINT_GRAPHICS, shader->mPipelineLayout, PER_CAMERA, 1, *camera->DescriptorSet(shader->mDescriptorBindings.at("Camera").second.stageFlags), 0, nullptr);
+			const auto* binding = shader->DescriptorBinding(gCameraID);
+			if (mCurrentRenderPass && binding)
+				vkCmdBindDescriptorSets(*this, VK_PIPELINE_BIND_POINT_GRAPHICS, shader->mPipelineLayout, PER_CAMERA, 1, *camera->DescriptorSet(binding->second.stageFlags), 0, nullptr);
 			
 			uint32_t eye = 0;
-			PushConstant(shader, "StereoEye", &eye);
+			PushConstant(shader, gStereoEyeID, &eye);
 		}
 		return shader->mPipelineLayout;
 	}
 	mCurrentPipeline = pipeline;
 	vkCmdBindPipeline(*this, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
 	if (camera) {
-		if (mCurrentRenderPass && shader->mDescriptorBindings.count("Camera"))
-			vkCmdBindDescriptorSets(*this, VK_PIPELINE_BIND_POINT_GRAPHICS, shader->mPipelineLayout, PER_CAMERA, 1, *camera->DescriptorSet(shader->mDescriptorBindings.at("Camera").second.stageFlags), 0, nullptr);
+		const auto* binding = shader->DescriptorBinding(gCameraID);
+		if (mCurrentRenderPass && binding)
+			vkCmdBindDescriptorSets(*this, VK_PIPELINE_BIND_POINT_GRAPHICS, shader->mPipelineLayout, PER_CAMERA, 1, *camera->DescriptorSet(binding->second.stageFlags), 0, nullptr);
 		mCurrentCamera = camera;
 		uint32_t eye = 0;
-		PushConstant(shader, "StereoEye", &eye);
+		PushConstant(shader, gStereoEyeID, &eye);
 	}
 	mCurrentMaterial = nullptr;
 	return shader->mPipelineLayout;
@@ -154,6 +189,7 @@ VkPipelineLayout CommandBuffer::BindMaterial(Material* material, PassType pass,
 	if (cullMode == VK_CULL_MODE_FLAG_BITS_MAX_ENUM) cullMode = material->CullMode();
 
 	VkPipeline pipeline = shader->GetPipeline(mCurrentRenderPass, input, topology, cullMode, blendMode, polyMode);
+	if (!pipeline) return VK_NULL_HANDLE;
 
 	if (pipeline != mCurrentPipeline && mCurrentCamera == camera && mCurrentMaterial == material) return shader->mPipelineLayout;
 
@@ -174,7 +210,7 @@ VkPipelineLayout CommandBuffer::BindMaterial(Material* material, PassType pass,
 	
 	material->SetPushConstantParameters(this, camera, data);
 	uint32_t eye = 0;
-	PushConstant(data->mShaderVariant, "StereoEye", &eye);
+	PushConstant(data->mShaderVariant, gStereoEyeID, &eye);
 
 	return shader->mPipelineLayout;
 }
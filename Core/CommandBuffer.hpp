@@ -1,6 +1,7 @@
 #pragma once
 
 #include <Util/Util.hpp>
+#include <Util/PropertyID.hpp>
 
 #ifdef ENABLE_DEBUG_LAYERS
 #define BEGIN_CMD_REGION(cmd, label) cmd->BeginLabel(label)
@@ -55,18 +56,28 @@ public:
 	ENGINE_EXPORT void Reset(const std::string& name = "Command Buffer");
 
 	inline RenderPass* CurrentRenderPass() const { return mCurrentRenderPass; }
+	inline bool Secondary() const { return mLevel == VK_COMMAND_BUFFER_LEVEL_SECONDARY; }
 
-	ENGINE_EXPORT bool PushConstant(ShaderVariant* shader, const std::string& name, const void* value);
+	/// Finishes recording a secondary command buffer (see Device::GetSecondaryCommandBuffer). Must be called on the thread that recorded it
+	ENGINE_EXPORT void End();
+	/// Executes ended secondary command buffers inside the current render pass, which must have been begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS.
+	/// They are kept alive and recycled once this command buffer finishes executing
+	ENGINE_EXPORT void ExecuteCommands(const std::vector<std::shared_ptr<CommandBuffer>>& commandBuffers);
+
+	/// Pushes value to the push constant id, reading the size of the push constant. Returns false if shader doesn't use it
+	ENGINE_EXPORT bool PushConstant(ShaderVariant* shader, PropertyID id, const void* value);
+	inline bool PushConstant(ShaderVariant* shader, const std::string& name, const void* value) { return PushConstant(shader, PropertyToID(name), value); }
 
 	/// Binds a shader
-	/// If camera is not nullptr, attempts to bind the camera's uniform buffer to a descriptor named 'Camera'
+	/// If camera is not nullptr, attempts to bind the camera's uniform buffer to a descriptor named 'Camera'.
+	/// Returns VK_NULL_HANDLE if the pipeline is still compiling, see Device::AsyncPipelineCompilation()
 	ENGINE_EXPORT VkPipelineLayout BindShader(GraphicsShader* shader, PassType pass, const VertexInput* input, Camera* camera = nullptr,
 		VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
 		VkCullModeFlags cullMode = VK_CULL_MODE_FLAG_BITS_MAX_ENUM,
 		BlendMode blendMode = BLEND_MODE_MAX_ENUM,
 		VkPolygonMode polyMode = VK_POLYGON_MODE_MAX_ENUM);
 
-	/// Binds a material and sets its parameters
+	/// Binds a material and sets its parameters. Returns VK_NULL_HANDLE if the material has no variant for pass or its pipeline is still compiling
 	ENGINE_EXPORT VkPipelineLayout BindMaterial(Material* material, PassType pass, const VertexInput* input, Camera* camera = nullptr,
 		VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
 		VkCullModeFlags cullMode = VK_CULL_MODE_FLAG_BITS_MAX_ENUM,
@@ -76,7 +87,7 @@ public:
 	ENGINE_EXPORT void BindVertexBuffer(Buffer* buffer, uint32_t index, VkDeviceSize offset);
 	ENGINE_EXPORT void BindIndexBuffer(Buffer* buffer, VkDeviceSize offset, VkIndexType indexType);
 
-	ENGINE_EXPORT void BeginRenderPass(RenderPass* renderPass, const VkExtent2D& bufferSize, VkFramebuffer frameBuffer, VkClearValue* clearValues, uint32_t clearValueCount);
+	ENGINE_EXPORT void BeginRenderPass(RenderPass* renderPass, const VkExtent2D& bufferSize, VkFramebuffer frameBuffer, VkClearValue* clearValues, uint32_t clearValueCount, VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE);
 	ENGINE_EXPORT void EndRenderPass();
 
 	inline ::Device* Device() const { return mDevice; }
@@ -85,12 +96,16 @@ public:
 
 private:
 	friend class Device;
-	ENGINE_EXPORT CommandBuffer(::Device* device, VkCommandPool commandPool, const std::string& name = "Command Buffer");
+	ENGINE_EXPORT CommandBuffer(::Device* device, VkCommandPool commandPool, const std::string& name = "Command Buffer", VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY);
 	::Device* mDevice;
 	VkCommandBuffer mCommandBuffer;
 	VkCommandPool mCommandPool;
+	VkCommandBufferLevel mLevel;
+	// Secondary command buffers share the fence of the primary command buffer that executed them
 	std::shared_ptr<Fence> mSignalFence;
 	std::shared_ptr<Semaphore> mSignalSemaphore;
+	// Secondary command buffers executed by this one, handed back to the device in Device::Execute
+	std::vector<std::shared_ptr<CommandBuffer>> mSecondaryCommandBuffers;
 
 	std::unordered_map<uint32_t, Buffer*> mCurrentVertexBuffers;
 	Buffer* mCurrentIndexBuffer;
@@ -292,6 +292,99 @@ void DescriptorSet::CreateSamplerDescriptor(Sampler* sampler, uint32_t binding)
 	mPendingImages.push_back(info);
 }
 
+void DescriptorSet::WriteBuffer(VkDescriptorType type, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range, uint32_t binding, uint32_t index) {
+	uint64_t idx = (uint64_t)binding | ((uint64_t)index << 32);
+	if (mCurrent.count(idx)) {
+		const VkWriteDescriptorSet& c = mCurrent.at(idx);
+		if (c.descriptorType == type &&
+			c.pBufferInfo->buffer == buffer &&
+			c.pBufferInfo->offset == offset &&
+			c.pBufferInfo->range == range) return;
+	}
+
+	VkDescriptorBufferInfo* info;
+	if (mBufferInfoPool.empty())
+		info = new VkDescriptorBufferInfo();
+	else {
+		info = mBufferInfoPool.front();
+		mBufferInfoPool.pop();
+	}
+	info->buffer = buffer;
+	info->offset = offset;
+	info->range = range;
+
+	VkWriteDescriptorSet write = {};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = mDescriptorSet;
+	write.dstBinding = binding;
+	write.dstArrayElement = index;
+	write.pBufferInfo = info;
+	write.descriptorType = type;
+	write.descriptorCount = 1;
+	mPending.push_back(write);
+	mPendingBuffers.push_back(info);
+}
+void DescriptorSet::WriteImage(VkDescriptorType type, VkImageView view, VkSampler sampler, VkImageLayout layout, uint32_t binding, uint32_t index) {
+	uint64_t idx = (uint64_t)binding | ((uint64_t)index << 32);
+	if (mCurrent.count(idx)) {
+		const VkWriteDescriptorSet& c = mCurrent.at(idx);
+		if (c.descriptorType == type &&
+			c.pImageInfo->imageLayout == layout &&
+			c.pImageInfo->imageView == view &&
+			c.pImageInfo->sampler == sampler) return;
+	}
+
+	VkDescriptorImageInfo* info;
+	if (mImageInfoPool.empty())
+		info = new VkDescriptorImageInfo();
+	else {
+		info = mImageInfoPool.front();
+		mImageInfoPool.pop();
+	}
+	info->imageLayout = layout;
+	info->imageView = view;
+	info->sampler = sampler;
+
+	VkWriteDescriptorSet write = {};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = mDescriptorSet;
+	write.dstBinding = binding;
+	write.dstArrayElement = index;
+	write.pImageInfo = info;
+	write.descriptorType = type;
+	write.descriptorCount = 1;
+	mPending.push_back(write);
+	mPendingImages.push_back(info);
+}
+
+void DescriptorSet::Write(const DescriptorKey& key) {
+	for (const DescriptorKey::Entry& e : key.mEntries) {
+		switch ((VkDescriptorType)e.mType) {
+		case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+		case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+			WriteBuffer((VkDescriptorType)e.mType, (VkBuffer)e.mHandle, e.mOffset, e.mRange, e.mBinding, e.mIndex);
+			break;
+		default:
+			WriteImage((VkDescriptorType)e.mType, (VkImageView)e.mHandle, (VkSampler)e.mSampler, (VkImageLayout)e.mImageLayout, e.mBinding, e.mIndex);
+			break;
+		}
+	}
+	FlushWrites();
+}
+
+/*static*/ void DescriptorSet::AddStorageBufferDescriptor(DescriptorKey& key, Buffer* buffer, VkDeviceSize offset, VkDeviceSize range, uint32_t binding, uint32_t index) {
+	key.AddBuffer(binding, index, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, (uint64_t)(VkBuffer)*buffer, buffer->Id(), offset, range);
+}
+/*static*/ void DescriptorSet::AddUniformBufferDescriptor(DescriptorKey& key, Buffer* buffer, VkDeviceSize offset, VkDeviceSize range, uint32_t binding) {
+	key.AddBuffer(binding, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, (uint64_t)(VkBuffer)*buffer, buffer->Id(), offset, range);
+}
+/*static*/ void DescriptorSet::AddSampledTextureDescriptor(DescriptorKey& key, Texture* texture, uint32_t binding, uint32_t index, VkImageLayout layout) {
+	key.AddImage(binding, index, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, (uint64_t)texture->View(), texture->Id(), 0, layout);
+}
+/*static*/ void DescriptorSet::AddStorageTextureDescriptor(DescriptorKey& key, Texture* texture, uint32_t binding, uint32_t index, VkImageLayout layout) {
+	key.AddImage(binding, index, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, (uint64_t)texture->View(), texture->Id(), 0, layout);
+}
+
 void DescriptorSet::FlushWrites() {
 	if (mPending.empty()) return;
 
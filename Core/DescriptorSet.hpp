@@ -1,5 +1,6 @@
 #pragma once
 
+#include <Util/DescriptorCache.hpp>
 #include <Util/Util.hpp>
 
 class Device;
@@ -24,13 +25,24 @@ public:
 	
 	ENGINE_EXPORT void CreateSamplerDescriptor(Sampler* sampler, uint32_t binding);
 
+	/// Writes the descriptors in key, see Device::GetCachedDescriptorSet
+	ENGINE_EXPORT void Write(const DescriptorKey& key);
 	ENGINE_EXPORT void FlushWrites();
 
+	/// Add descriptors to a DescriptorKey, matching what the Create*Descriptor functions write
+	ENGINE_EXPORT static void AddStorageBufferDescriptor(DescriptorKey& key, Buffer* buffer, VkDeviceSize offset, VkDeviceSize range, uint32_t binding, uint32_t index = 0);
+	ENGINE_EXPORT static void AddUniformBufferDescriptor(DescriptorKey& key, Buffer* buffer, VkDeviceSize offset, VkDeviceSize range, uint32_t binding);
+	ENGINE_EXPORT static void AddSampledTextureDescriptor(DescriptorKey& key, Texture* texture, uint32_t binding, uint32_t index = 0, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	ENGINE_EXPORT static void AddStorageTextureDescriptor(DescriptorKey& key, Texture* texture, uint32_t binding, uint32_t index = 0, VkImageLayout layout = VK_IMAGE_LAYOUT_GENERAL);
+
 	inline VkDescriptorSetLayout Layout() const { return mLayout; }
 	inline operator const VkDescriptorSet*() const { return &mDescriptorSet; }
 	inline operator VkDescriptorSet() const { return mDescriptorSet; }
 
 private:
+	ENGINE_EXPORT void WriteBuffer(VkDescriptorType type, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range, uint32_t binding, uint32_t index);
+	ENGINE_EXPORT void WriteImage(VkDescriptorType type, VkImageView view, VkSampler sampler, VkImageLayout layout, uint32_t binding, uint32_t index);
+
 	std::unordered_map<uint64_t, VkWriteDescriptorSet> mCurrent;
 
 	std::vector<VkWriteDescriptorSet> mPending;
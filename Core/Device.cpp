@@ -8,10 +8,17 @@
 
 #define PRINT_VK_ALLOCATIONS
 
-// 4kb blocks
-#define MEM_BLOCK_SIZE (4*1024)
-// 128mb min allocation
+// 512mb min allocation
 #define MEM_MIN_ALLOC (512*1024*1024)
+// 4mb min per-frame linear allocator
+#define FRAME_MEM_MIN_SIZE (4*1024*1024)
+// Pipeline cache and recorded pipelines are saved as PIPELINE_CACHE_FILE<device index>.cache and .keys
+#define PIPELINE_CACHE_FILE "pipelines"
+#define PIPELINE_COMPILE_THREADS 2
+// 64mb staging ring for uploads, larger uploads get their own staging buffer
+#define UPLOAD_RING_SIZE (64*1024*1024)
+#define UPLOAD_RING_MAX_ALLOC (UPLOAD_RING_SIZE/4)
+#define FRAME_MEM_USAGE (VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT)
 
 using namespace std;
 
@@ -59,39 +66,89 @@ void Device::FrameContext::Reset() {
 	mSemaphores.clear();
 
 	PROFILER_BEGIN("Clear old buffers");
-	for (auto it = mTempBuffers.begin(); it != mTempBuffers.end();) {
-		if (it->second == 1) {
-			safe_delete(it->first);
-			it = mTempBuffers.erase(it);
+	for (auto& kp : mThreadContexts) {
+		ThreadContext& context = kp.second;
+		for (auto it = context.mTempBuffers.begin(); it != context.mTempBuffers.end();) {
+			if (--it->second == 0) {
+				safe_delete(it->first);
+				it = context.mTempBuffers.erase(it);
+			} else
+				it++;
 		}
 
-		it->second--;
-		it++;
+		for (Buffer* b : context.mTempBuffersInUse)
+			context.mTempBuffers.push_back(make_pair(b, 8));
+		context.mTempBuffersInUse.clear();
+
+		for (auto& sets : context.mTempDescriptorSets)
+			sets.second.mUsed = 0;
 	}
 	PROFILER_END;
 
-	for (Buffer* b : mTempBuffersInUse)
-		mTempBuffers.push_back(make_pair(b, 8));
-	for (DescriptorSet* ds : mTempDescriptorSetsInUse)
-		mTempDescriptorSets[ds->Layout()].push_back(make_pair(ds, 8));
+	PROFILER_BEGIN("Evict descriptor sets");
+	DescriptorCacheStats stats;
+	vector<DescriptorSet*> evicted;
+	for (auto& kp : mThreadContexts) {
+		ThreadContext& context = kp.second;
+		stats += context.mDescriptorCache.Stats();
+		context.mDescriptorCache.ResetStats();
+		context.mDescriptorCache.Advance(evicted);
+		for (DescriptorSet* ds : evicted)
+			context.mFreeDescriptorSets[ds->Layout()].push_back(ds);
+		evicted.clear();
+	}
+	PROFILER_COUNT("Descriptor Cache Hits", stats.mHits);
+	PROFILER_COUNT("Descriptor Cache Misses", stats.mMisses);
+	mDescriptorCacheStats.mHits += stats.mHits;
+	mDescriptorCacheStats.mMisses += stats.mMisses;
+	mDescriptorCacheStats.mEvictions += stats.mEvictions;
+	mDescriptorCacheStats.mSize = stats.mSize;
+	PROFILER_END;
 
-	mTempBuffersInUse.clear();
-	mTempDescriptorSetsInUse.clear();
+	// Grow the frame buffer to fit everything that overflowed it this frame
+	if (VkDeviceSize overflow = mFrameMemoryOverflow.exchange(0)) {
+		VkDeviceSize size = FRAME_MEM_MIN_SIZE;
+		while (size < mFrameAllocator.Used() + overflow) size *= 2;
+		safe_delete(mFrameBuffer);
+		mFrameBuffer = new Buffer("Frame Memory", mDevice, size, FRAME_MEM_USAGE, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		mFrameAllocator.Reset(size);
+	} else
+		mFrameAllocator.Reset();
 }
 Device::FrameContext::~FrameContext() {
+	mFrameMemoryOverflow = 0;
 	Reset();
-	for (auto b : mTempBuffers)
-		safe_delete(b.first);
-	for (auto kp : mTempDescriptorSets)
-		while (kp.second.size()) {
-			auto front = kp.second.begin();
-			safe_delete(front->first);
-			kp.second.erase(front);
-		}
+	safe_delete(mFrameBuffer);
+	for (auto& kp : mThreadContexts) {
+		for (auto b : kp.second.mTempBuffers)
+			safe_delete(b.first);
+		for (auto& sets : kp.second.mTempDescriptorSets)
+			for (DescriptorSet* ds : sets.second.mSets)
+				safe_delete(ds);
+		vector<DescriptorSet*> cached;
+		kp.second.mDescriptorCache.Clear(cached);
+		for (DescriptorSet* ds : cached)
+			safe_delete(ds);
+		for (auto& sets : kp.second.mFreeDescriptorSets)
+			for (DescriptorSet* ds : sets.second)
+				safe_delete(ds);
+	}
+}
+Device::ThreadContext* Device::FrameContext::CurrentThreadContext() {
+	thread::id id = this_thread::get_id();
+	{
+		shared_lock lock(mThreadContextMutex);
+		auto it = mThreadContexts.find(id);
+		if (it != mThreadContexts.end()) return &it->second;
+	}
+	// References to unordered_map elements stay valid when other threads insert theirs
+	unique_lock lock(mThreadContextMutex);
+	return &mThreadContexts[id];
 }
 
 Device::Device(::Instance* instance, VkPhysicalDevice physicalDevice, uint32_t physicalDeviceIndex, uint32_t graphicsQueueFamily, uint32_t presentQueueFamily, const set<string>& deviceExtensions, vector<const char*> validationLayers)
-	: mInstance(instance), mFrameContexts(nullptr), mGraphicsQueueFamily(graphicsQueueFamily), mPresentQueueFamily(presentQueueFamily), mFrameContextIndex(0), mDescriptorSetCount(0) {
+	: mInstance(instance), mFrameContexts(nullptr), mGraphicsQueueFamily(graphicsQueueFamily), mPresentQueueFamily(presentQueueFamily), mFrameContextIndex(0), mDescriptorSetCount(0),
+	mAsyncPipelineCompilation(false), mPipelineJobs(nullptr), mTransferQueueFamily(graphicsQueueFamily), mTextureCompressionBC(false), mUploadRing(nullptr), mOpenUpload(nullptr), mNextUploadToken(0), mCompletedUploads(0) {
 
 	#ifdef ENABLE_DEBUG_LAYERS
 	SetDebugUtilsObjectNameEXT = (PFN_vkSetDebugUtilsObjectNameEXT)vkGetInstanceProcAddr(*instance, "vkSetDebugUtilsObjectNameEXT");
@@ -108,7 +165,24 @@ Device::Device(::Instance* instance, VkPhysicalDevice physicalDevice, uint32_t p
 		deviceExts.push_back(s.c_str());
 
 	#pragma region get queue info
-	set<uint32_t> uniqueQueueFamilies{ mGraphicsQueueFamily, mPresentQueueFamily };
+	// Uploads go to a transfer-only family if there is one (usually the copy engines), otherwise to any family without graphics.
+	// Only families that can copy to any texel are used, so copy regions don't need to respect a granularity
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(mPhysicalDevice, &queueFamilyCount, nullptr);
+	vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(mPhysicalDevice, &queueFamilyCount, queueFamilies.data());
+	for (uint32_t i = 0; i < queueFamilyCount; i++) {
+		const VkQueueFamilyProperties& family = queueFamilies[i];
+		const VkExtent3D& granularity = family.minImageTransferGranularity;
+		if (!family.queueCount || (family.queueFlags & VK_QUEUE_GRAPHICS_BIT) || granularity.width > 1 || granularity.height > 1 || granularity.depth > 1) continue;
+		if ((family.queueFlags & VK_QUEUE_COMPUTE_BIT) == 0) {
+			mTransferQueueFamily = i;
+			break;
+		}
+		if (mTransferQueueFamily == mGraphicsQueueFamily) mTransferQueueFamily = i;
+	}
+
+	set<uint32_t> uniqueQueueFamilies{ mGraphicsQueueFamily, mPresentQueueFamily, mTransferQueueFamily };
 	vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 	float queuePriority = 1.0f;
 	for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -129,6 +203,11 @@ Device::Device(::Instance* instance, VkPhysicalDevice physicalDevice, uint32_t p
 	deviceFeatures.shaderStorageImageExtendedFormats = VK_TRUE;
 	deviceFeatures.sparseBinding = VK_TRUE;
 	deviceFeatures.shaderImageGatherExtended = VK_TRUE;
+	// Block compressed textures are optional. Without them textures aren't compressed on load, and BC1/3/4/5/7 files are decoded to RGBA8
+	VkPhysicalDeviceFeatures supportedFeatures = {};
+	vkGetPhysicalDeviceFeatures(mPhysicalDevice, &supportedFeatures);
+	deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+	mTextureCompressionBC = supportedFeatures.textureCompressionBC == VK_TRUE;
 
 	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = {};
 	indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
@@ -153,17 +232,46 @@ Device::Device(::Instance* instance, VkPhysicalDevice physicalDevice, uint32_t p
 	string name = "Device " + to_string(properties.deviceID) + ": " + properties.deviceName;
 	SetObjectName(mDevice, name, VK_OBJECT_TYPE_DEVICE);
 	mLimits = properties.limits;
+	vkGetPhysicalDeviceMemoryProperties(mPhysicalDevice, &mMemoryProperties);
 
 	vkGetDeviceQueue(mDevice, mGraphicsQueueFamily, 0, &mGraphicsQueue);
 	vkGetDeviceQueue(mDevice, mPresentQueueFamily, 0, &mPresentQueue);
 	SetObjectName(mGraphicsQueue, name + " Graphics Queue", VK_OBJECT_TYPE_QUEUE);
 	SetObjectName(mPresentQueue, name + " Present Queue", VK_OBJECT_TYPE_QUEUE);
+	if (DedicatedTransferQueue()) {
+		vkGetDeviceQueue(mDevice, mTransferQueueFamily, 0, &mTransferQueue);
+		SetObjectName(mTransferQueue, name + " Transfer Queue", VK_OBJECT_TYPE_QUEUE);
+	} else
+		mTransferQueue = mGraphicsQueue;
+
+	uint32_t uploadFamilies[2] { mGraphicsQueueFamily, mTransferQueueFamily };
+	for (uint32_t i = 0; i < 2; i++) {
+		VkCommandPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.queueFamilyIndex = uploadFamilies[i];
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		ThrowIfFailed(vkCreateCommandPool(mDevice, &poolInfo, nullptr, &mUploadCommandPools[i]), "vkCreateCommandPool failed");
+		SetObjectName(mUploadCommandPools[i], name + (i ? " Transfer" : " Graphics") + " Upload Command Pool", VK_OBJECT_TYPE_COMMAND_POOL);
+	}
 	#pragma endregion
 
 	#pragma region PipelineCache and DesriptorPool
+	// Pipelines from previous runs, if the cache was written by this device and driver
+	mPipelineCacheHeader = PipelineCacheFile::Header(properties);
+	string cacheFile = PIPELINE_CACHE_FILE + to_string(mPhysicalDeviceIndex);
+	vector<uint8_t> cacheData;
+	if (PipelineCacheFile::Read(cacheFile + ".cache", mPipelineCacheHeader, cacheData))
+		printf("Loaded %s.cache (%llu KiB)\n", cacheFile.c_str(), (unsigned long long)cacheData.size() / 1024);
+
 	VkPipelineCacheCreateInfo cache = {};
 	cache.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cache.initialDataSize = cacheData.size();
+	cache.pInitialData = cacheData.data();
 	vkCreatePipelineCache(mDevice, &cache, nullptr, &mPipelineCache);
+
+	PipelineCacheFile::ReadKeys(cacheFile + ".keys", mPipelineKeys);
+	for (const PipelineKey& k : mPipelineKeys)
+		mPipelineKeyStrings.insert(k.Serialize());
 	
 	VkDescriptorPoolSize type_count[5] {
 		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,			min(4096u, mLimits.maxDescriptorSetUniformBuffers) },
@@ -185,20 +293,38 @@ Device::Device(::Instance* instance, VkPhysicalDevice physicalDevice, uint32_t p
 	#pragma endregion
 }
 Device::~Device() {
+	WaitForPipelines();
+	safe_delete(mPipelineJobs);
 	Flush();
+	for (UploadBatch* b : mFreeUploads)
+		delete b;
+	safe_delete(mUploadRing);
+	for (uint32_t i = 0; i < 2; i++)
+		vkDestroyCommandPool(mDevice, mUploadCommandPools[i], nullptr);
 	safe_delete_array(mFrameContexts);
 	vkDestroyDescriptorPool(mDevice, mDescriptorPool, nullptr);
+
+	string cacheFile = PIPELINE_CACHE_FILE + to_string(mPhysicalDeviceIndex);
+	size_t cacheSize = 0;
+	if (vkGetPipelineCacheData(mDevice, mPipelineCache, &cacheSize, nullptr) == VK_SUCCESS && cacheSize) {
+		vector<uint8_t> cacheData(cacheSize);
+		if (vkGetPipelineCacheData(mDevice, mPipelineCache, &cacheSize, cacheData.data()) == VK_SUCCESS &&
+			!PipelineCacheFile::Write(cacheFile + ".cache", mPipelineCacheHeader, cacheData.data(), cacheSize))
+			fprintf_color(COLOR_RED, stderr, "Failed to write %s.cache\n", cacheFile.c_str());
+	}
+	if (mPipelineKeys.size() && !PipelineCacheFile::WriteKeys(cacheFile + ".keys", mPipelineKeys))
+		fprintf_color(COLOR_RED, stderr, "Failed to write %s.keys\n", cacheFile.c_str());
 	vkDestroyPipelineCache(mDevice, mPipelineCache, nullptr);
-	for (auto& p : mCommandBuffers)
-		vkDestroyCommandPool(mDevice, p.first, nullptr);
+	mSecondaryCommandBuffers.clear();
+	for (auto& p : mCommandPools)
+		vkDestroyCommandPool(mDevice, p.second, nullptr);
 	
-	for (auto kp : mMemoryAllocations) {
-		for (uint32_t i = 0; i < kp.second.size(); i++) {
-			for (auto it = kp.second[i].mAllocations.begin(); it != kp.second[i].mAllocations.begin(); it++)
-				fprintf_color(COLOR_RED_BOLD, stderr, "Device memory leak detected. Tag: %s\n", it->mTag.c_str());
-			vkFreeMemory(mDevice, kp.second[i].mMemory, nullptr);
+	for (uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++)
+		for (Allocation& a : mMemoryPools[i].mAllocations) {
+			if (!a.mAllocator.Empty())
+				fprintf_color(COLOR_RED_BOLD, stderr, "Device memory leak detected: %u allocations (%llu B) of type %u\n", a.mAllocator.AllocationCount(), (unsigned long long)a.mAllocator.Used(), i);
+			vkFreeMemory(mDevice, a.mMemory, nullptr);
 		}
-	}
 
 	vkDestroyDevice(mDevice, nullptr);
 }
@@ -219,7 +345,10 @@ VkSampleCountFlagBits Device::GetMaxUsableSampleCount() {
 }
 
 void Device::Flush() {
+	FlushUploads();
 	vkDeviceWaitIdle(mDevice);
+	// Retires every upload, so buffers and textures deleted below don't wait for them with mCommandPoolMutex locked
+	FlushUploads();
 	lock_guard lock(mCommandPoolMutex);
 	for (auto& p : mCommandBuffers) {
 		while (p.second.size()) {
@@ -231,6 +360,35 @@ void Device::Flush() {
 		mFrameContexts[i].Reset();
 }
 
+void Device::AsyncPipelineCompilation(bool v) {
+	// The threads exist before the flag is set, so threads that see the flag always find them
+	if (v && !mPipelineJobs) mPipelineJobs = new JobSystem(PIPELINE_COMPILE_THREADS);
+	mAsyncPipelineCompilation = v;
+}
+void Device::CompilePipelineAsync(function<void()> job) {
+	JobSystem* jobs = mPipelineJobs;
+	// Without the compilation threads, compile on the calling thread
+	if (!jobs) {
+		job();
+		return;
+	}
+	jobs->Schedule(job, &mPipelineCompiles);
+}
+void Device::WaitForPipelines() {
+	JobSystem* jobs = mPipelineJobs;
+	if (jobs) jobs->Wait(&mPipelineCompiles);
+}
+void Device::RecordPipeline(const PipelineKey& key) {
+	string s = key.Serialize();
+	lock_guard lock(mPipelineKeyMutex);
+	if (mPipelineKeyStrings.insert(s).second)
+		mPipelineKeys.push_back(key);
+}
+vector<PipelineKey> Device::RecordedPipelines() {
+	lock_guard lock(mPipelineKeyMutex);
+	return mPipelineKeys;
+}
+
 void Device::SetObjectName(void* object, const string& name, VkObjectType type) const {
 	#ifdef ENABLE_DEBUG_LAYERS
 	VkDebugUtilsObjectNameInfoEXT info = {};
@@ -242,100 +400,24 @@ void Device::SetObjectName(void* object, const string& name, VkObjectType type)
 	#endif
 }
 
-bool Device::Allocation::SubAllocate(const VkMemoryRequirements& requirements, DeviceMemoryAllocation& allocation, const string& tag) {
-if (mAvailable.empty()) return false;
-
-	VkDeviceSize blockSize = 0;
-	VkDeviceSize memLocation = 0;
-	VkDeviceSize memSize = 0;
-
-	// find smallest block that can fit the allocation
-	auto block = mAvailable.end();
-	for (auto it = mAvailable.begin(); it != mAvailable.end(); it++) {
-		VkDeviceSize offset = AlignUp(it->first, requirements.alignment);
-		VkDeviceSize blockEnd = AlignUp(offset + requirements.size, MEM_BLOCK_SIZE);
-
-		if (blockEnd > it->first + it->second) continue;
-
-		if (block == mAvailable.end() || it->second < block->second) {
-			memLocation = offset;
-			memSize = blockEnd - offset;
-			blockSize = blockEnd - it->first;
-			block = it;
-		}
-	}
-	if (block == mAvailable.end()) return false;
-
+bool Device::Allocation::SubAllocate(VkDeviceSize size, VkDeviceSize alignment, DeviceMemoryAllocation& allocation, const string& tag) {
+	VkDeviceSize offset;
+	uint32_t block;
+	if (!mAllocator.Allocate(size, alignment, offset, block)) return false;
 
 	allocation.mDeviceMemory = mMemory;
-	allocation.mOffset = memLocation;
-	allocation.mSize = memSize;
-	allocation.mMapped = ((uint8_t*)mMapped) + memLocation;
+	allocation.mOffset = offset;
+	allocation.mSize = size;
+	allocation.mMapped = mMapped ? ((uint8_t*)mMapped) + offset : nullptr;
 	allocation.mTag = tag;
-
-	if (block->second > blockSize) {
-		// still room left after this allocation, shift this block over
-		block->first += blockSize;
-		block->second -= blockSize;
-	} else
-		mAvailable.erase(block);
-
-	mAllocations.push_back(allocation);
-
+	allocation.mBlock = block;
 	return true;
 }
-void Device::Allocation::Deallocate(const DeviceMemoryAllocation& allocation) {
-	if (allocation.mDeviceMemory != mMemory) return;
-
-	for (auto it = mAllocations.begin(); it != mAllocations.end(); it++)
-		if (it->mOffset == allocation.mOffset) {
-			mAllocations.erase(it);
-			break;
-		}
-
-	VkDeviceSize end = allocation.mOffset + allocation.mSize;
-
-	auto firstAfter = mAvailable.end();
-	auto startBlock = mAvailable.end();
-	auto endBlock = mAvailable.end();
-
-	for (auto it = mAvailable.begin(); it != mAvailable.end(); it++) {
-		if (it->first > allocation.mOffset && (firstAfter == mAvailable.end() || it->first < firstAfter->first)) firstAfter = it;
-
-		if (it->first == end)
-			endBlock = it;
-		else if (it->first + it->second == allocation.mOffset)
-			startBlock = it;
-	}
-
-	// merge blocks
-
-	if (startBlock == mAvailable.end() && endBlock == mAvailable.end())
-		// block isn't adjacent to any other blocks
-		mAvailable.insert(firstAfter, make_pair(allocation.mOffset, allocation.mSize));
-	else if (startBlock == mAvailable.end()) {
-		//  --------     |---- allocation ----|---- endBlock ----|
-		endBlock->first = allocation.mOffset;
-		endBlock->second += allocation.mSize;
-	} else if (endBlock == mAvailable.end()) {
-		//  |---- startBlock ----|---- allocation ----|     --------
-		startBlock->second += allocation.mSize;
-	} else {
-		//  |---- startBlock ----|---- allocation ----|---- endBlock ----|
-		startBlock->second += allocation.mSize + endBlock->second;
-		mAvailable.erase(endBlock);
-	}
-}
 
 DeviceMemoryAllocation Device::AllocateMemory(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, const string& tag) {
-	lock_guard lock(mMemoryMutex);
-
-	VkPhysicalDeviceMemoryProperties memProperties;
-	vkGetPhysicalDeviceMemoryProperties(mPhysicalDevice, &memProperties);
-
 	int32_t memoryType = -1;
-	for (int32_t i = 0; i < memProperties.memoryTypeCount; ++i) {
-		if ((requirements.memoryTypeBits & (1 << i)) && ((memProperties.memoryTypes[i].propertyFlags & properties) == properties)) {
+	for (int32_t i = 0; i < mMemoryProperties.memoryTypeCount; ++i) {
+		if ((requirements.memoryTypeBits & (1 << i)) && ((mMemoryProperties.memoryTypes[i].propertyFlags & properties) == properties)) {
 			memoryType = i;
 			break;
 		}
@@ -345,25 +427,34 @@ DeviceMemoryAllocation Device::AllocateMemory(const VkMemoryRequirements& requir
 		throw;
 	}
 
+	// Linear and optimal resources can't share a bufferImageGranularity page, so nothing may share one
+	VkDeviceSize granularity = max<VkDeviceSize>(mLimits.bufferImageGranularity, 1);
+	VkDeviceSize alignment = max(requirements.alignment, granularity);
+	VkDeviceSize size = AlignUp(requirements.size, granularity);
+
 	DeviceMemoryAllocation alloc = {};
 	alloc.mMemoryType = memoryType;
 
-	vector<Allocation>& allocations = mMemoryAllocations[memoryType];
+	MemoryPool& pool = mMemoryPools[memoryType];
+	lock_guard lock(pool.mMutex);
 
-	for (uint32_t i = 0; i < allocations.size(); i++)
-		if (allocations[i].SubAllocate(requirements, alloc, tag))
+	for (Allocation& a : pool.mAllocations)
+		if (a.SubAllocate(size, alignment, alloc, tag))
 			return alloc;
 
 	// Failed to sub-allocate, make a new allocation
 
-	allocations.push_back({});
-	Allocation& allocation = allocations.back();
-	
 	VkMemoryAllocateInfo info = {};
 	info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
 	info.memoryTypeIndex = memoryType;
-	info.allocationSize = max(MEM_MIN_ALLOC, 2*AlignUp(requirements.size, MEM_BLOCK_SIZE));
-	ThrowIfFailed(vkAllocateMemory(mDevice, &info, nullptr, &allocation.mMemory), "vkAllocateMemory failed\n");
+	info.allocationSize = max<VkDeviceSize>(MEM_MIN_ALLOC, 2*(size + alignment));
+
+	// Only add the allocation once it exists, a failed vkAllocateMemory must not leave one without memory in the pool
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	ThrowIfFailed(vkAllocateMemory(mDevice, &info, nullptr, &memory), "vkAllocateMemory failed\n");
+	pool.mAllocations.emplace_back(info.allocationSize);
+	Allocation& allocation = pool.mAllocations.back();
+	allocation.mMemory = memory;
 	#ifdef PRINT_VK_ALLOCATIONS
 	if (info.allocationSize < 1024)
 		fprintf_color(COLOR_YELLOW, stdout, "Allocated %lu B of type %u\n", info.allocationSize, info.memoryTypeIndex);
@@ -372,13 +463,11 @@ DeviceMemoryAllocation Device::AllocateMemory(const VkMemoryRequirements& requir
 	else
 		fprintf_color(COLOR_YELLOW, stdout, "Allocated %lu MiB of type %u\n", info.allocationSize / (1024 * 1024), info.memoryTypeIndex);
 	#endif
-	allocation.mSize = info.allocationSize;
-	allocation.mAvailable = { make_pair((VkDeviceSize)0, allocation.mSize) };
 
 	if (properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
 		vkMapMemory(mDevice, allocation.mMemory, 0, allocation.mSize, 0, &allocation.mMapped);
 
-	if (!allocation.SubAllocate(requirements, alloc, tag)) {
+	if (!allocation.SubAllocate(size, alignment, alloc, tag)) {
 		fprintf_color(COLOR_RED_BOLD, stderr, "Failed to allocate memory\n");
 		throw;
 	}
@@ -386,31 +475,43 @@ DeviceMemoryAllocation Device::AllocateMemory(const VkMemoryRequirements& requir
 	return alloc;
 }
 void Device::FreeMemory(const DeviceMemoryAllocation& allocation) {
-	lock_guard lock(mMemoryMutex);
-	vector<Allocation>& allocations = mMemoryAllocations[allocation.mMemoryType];
-	for (auto it = allocations.begin(); it != allocations.end();)
+	MemoryPool& pool = mMemoryPools[allocation.mMemoryType];
+	lock_guard lock(pool.mMutex);
+	for (auto it = pool.mAllocations.begin(); it != pool.mAllocations.end(); it++)
 		if (it->mMemory == allocation.mDeviceMemory) {
-			it->Deallocate(allocation);
-			if (it->mAvailable.size() == 1 && it->mAvailable.begin()->second == it->mSize) {
+			it->mAllocator.Free(allocation.mBlock);
+			if (it->mAllocator.Empty()) {
 				vkFreeMemory(mDevice, it->mMemory, nullptr);
 				#ifdef PRINT_VK_ALLOCATIONS
-				if (allocation.mSize < 1024)
-					fprintf_color(COLOR_YELLOW, stdout, "Freed %lu B of type %u\n", allocation.mSize, allocation.mMemoryType);
-				else if (allocation.mSize < 1024 * 1024)
-					fprintf_color(COLOR_YELLOW, stdout, "Freed %lu KiB of type %u\n", allocation.mSize / 1024, allocation.mMemoryType);
+				if (it->mSize < 1024)
+					fprintf_color(COLOR_YELLOW, stdout, "Freed %lu B of type %u\n", it->mSize, allocation.mMemoryType);
+				else if (it->mSize < 1024 * 1024)
+					fprintf_color(COLOR_YELLOW, stdout, "Freed %lu KiB of type %u\n", it->mSize / 1024, allocation.mMemoryType);
 				else
-					fprintf_color(COLOR_YELLOW, stdout, "Freed %lu MiB of type %u\n", allocation.mSize / (1024 * 1024), allocation.mMemoryType);
+					fprintf_color(COLOR_YELLOW, stdout, "Freed %lu MiB of type %u\n", it->mSize / (1024 * 1024), allocation.mMemoryType);
 				#endif
-				it = allocations.erase(it);
-			} else
-				it++;
-		} else
-			it++;
+				pool.mAllocations.erase(it);
+			}
+			break;
+		}
 }
 
-shared_ptr<CommandBuffer> Device::GetCommandBuffer(const std::string& name) {
-	// get a commandpool for the current thread
-	lock_guard lock(mCommandPoolMutex);
+TlsfStats Device::MemoryStats(uint32_t memoryType) {
+	TlsfStats stats;
+	MemoryPool& pool = mMemoryPools[memoryType];
+	lock_guard lock(pool.mMutex);
+	for (const Allocation& a : pool.mAllocations)
+		stats += a.mAllocator.Stats();
+	return stats;
+}
+TlsfStats Device::MemoryStats() {
+	TlsfStats stats;
+	for (uint32_t i = 0; i < mMemoryProperties.memoryTypeCount; i++)
+		stats += MemoryStats(i);
+	return stats;
+}
+
+VkCommandPool Device::ThreadCommandPool(const std::string& name) {
 	VkCommandPool& commandPool = mCommandPools[this_thread::get_id()];
 	if (!commandPool) {
 		VkCommandPoolCreateInfo poolInfo = {};
@@ -420,6 +521,13 @@ shared_ptr<CommandBuffer> Device::GetCommandBuffer(const std::string& name) {
 		ThrowIfFailed(vkCreateCommandPool(mDevice, &poolInfo, nullptr, &commandPool), "vkCreateCommandPool failed");
 		SetObjectName(commandPool, name + " Graphics Command Pool", VK_OBJECT_TYPE_COMMAND_POOL);
 	}
+	return commandPool;
+}
+
+shared_ptr<CommandBuffer> Device::GetCommandBuffer(const std::string& name) {
+	// get a commandpool for the current thread
+	lock_guard lock(mCommandPoolMutex);
+	VkCommandPool commandPool = ThreadCommandPool(name);
 
 	auto& commandBufferQueue = mCommandBuffers[commandPool];
 
@@ -445,7 +553,43 @@ shared_ptr<CommandBuffer> Device::GetCommandBuffer(const std::string& name) {
 
 	return commandBuffer;
 }
+shared_ptr<CommandBuffer> Device::GetSecondaryCommandBuffer(const std::string& name, RenderPass* renderPass, VkFramebuffer framebuffer) {
+	lock_guard lock(mCommandPoolMutex);
+	VkCommandPool commandPool = ThreadCommandPool(name);
+
+	// Secondary command buffers are only reset here, by the thread that owns their pool, since command pools can't be used by two threads at once
+	auto& commandBufferQueue = mSecondaryCommandBuffers[commandPool];
+
+	shared_ptr<CommandBuffer> commandBuffer;
+	if (commandBufferQueue.size()) {
+		commandBuffer = commandBufferQueue.front();
+		if (commandBuffer->mSignalFence->Signaled()) {
+			commandBufferQueue.pop();
+			commandBuffer->Reset(name);
+		} else
+			commandBuffer.reset();
+	}
+
+	if (!commandBuffer) commandBuffer = shared_ptr<CommandBuffer>(new CommandBuffer(this, commandPool, name, VK_COMMAND_BUFFER_LEVEL_SECONDARY));
+
+	VkCommandBufferInheritanceInfo inheritanceInfo = {};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = *renderPass;
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = framebuffer;
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
+	ThrowIfFailed(vkBeginCommandBuffer(commandBuffer->mCommandBuffer, &beginInfo), "vkBeginCommandBuffer failed");
+	commandBuffer->mCurrentRenderPass = renderPass;
+
+	return commandBuffer;
+}
 shared_ptr<Fence> Device::Execute(shared_ptr<CommandBuffer> commandBuffer, bool frameContext) {
+	// Uploads recorded so far are submitted first, so commandBuffer can use what they wrote
+	FlushUploads();
 	lock_guard lock(mCommandPoolMutex);
 	ThrowIfFailed(vkEndCommandBuffer(commandBuffer->mCommandBuffer), "vkEndCommandBuffer failed");
 
@@ -476,45 +620,270 @@ shared_ptr<Fence> Device::Execute(shared_ptr<CommandBuffer> commandBuffer, bool
 
 	// store the command buffer in the queue
 	mCommandBuffers[commandBuffer->mCommandPool].push(commandBuffer);
+	for (const auto& secondary : commandBuffer->mSecondaryCommandBuffers)
+		mSecondaryCommandBuffers[secondary->mCommandPool].push(secondary);
+	commandBuffer->mSecondaryCommandBuffers.clear();
 	return commandBuffer->mSignalFence;
 }
 
 Buffer* Device::GetTempBuffer(const std::string& name, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties) {
-	lock_guard lock(mTmpBufferMutex);
-	FrameContext* frame = CurrentFrameContext();
+	ThreadContext* context = CurrentFrameContext()->CurrentThreadContext();
 
-	auto closest = frame->mTempBuffers.end();
-	for (auto it = frame->mTempBuffers.begin(); it != frame->mTempBuffers.end(); it++) {
+	auto closest = context->mTempBuffers.end();
+	for (auto it = context->mTempBuffers.begin(); it != context->mTempBuffers.end(); it++) {
 		if (((it->first->Usage() & usage) == usage) && ((it->first->MemoryProperties() & properties) == properties) && it->first->Size() >= size) {
-			if (closest == frame->mTempBuffers.end() || it->first->Size() < it->first->Size())
+			if (closest == context->mTempBuffers.end() || it->first->Size() < closest->first->Size())
 				closest = it;
 			if (it->first->Size() == size) break;
 		}
 	}
 
 	Buffer* b;
-	if (closest != frame->mTempBuffers.end()) {
+	if (closest != context->mTempBuffers.end()) {
 		b = closest->first;
-		frame->mTempBuffers.erase(closest);
+		context->mTempBuffers.erase(closest);
 	} else
 		b = new Buffer(name, this, size, usage, properties);
-	frame->mTempBuffersInUse.push_back(b);
+	context->mTempBuffersInUse.push_back(b);
 	return b;
 }
 DescriptorSet* Device::GetTempDescriptorSet(const std::string& name, VkDescriptorSetLayout layout) {
-	lock_guard lock(mTmpDescriptorSetMutex);
-	FrameContext* frame = CurrentFrameContext();
+	ThreadContext* context = CurrentFrameContext()->CurrentThreadContext();
 
-	auto& sets = frame->mTempDescriptorSets[layout];
+	ThreadContext::TempDescriptorSets& sets = context->mTempDescriptorSets[layout];
+	if (sets.mUsed == sets.mSets.size())
+		sets.mSets.push_back(new DescriptorSet(name, this, layout));
+	return sets.mSets[sets.mUsed++];
+}
+DescriptorSet* Device::GetCachedDescriptorSet(const std::string& name, const DescriptorKey& key) {
+	ThreadContext* context = CurrentFrameContext()->CurrentThreadContext();
+	if (DescriptorSet** cached = context->mDescriptorCache.Find(key)) return *cached;
 
+	VkDescriptorSetLayout layout = (VkDescriptorSetLayout)key.mLayout;
 	DescriptorSet* ds;
+	vector<DescriptorSet*>& sets = context->mFreeDescriptorSets[layout];
 	if (sets.size()) {
-		auto front = sets.begin();
-		ds = front->first;
-		sets.erase(front);
+		ds = sets.back();
+		sets.pop_back();
 	} else
 		ds = new DescriptorSet(name, this, layout);
-
-	frame->mTempDescriptorSetsInUse.push_back(ds);
+	ds->Write(key);
+	context->mDescriptorCache.Insert(key, ds);
 	return ds;
+}
+DescriptorCacheStats Device::DescriptorCacheStatistics() {
+	DescriptorCacheStats stats;
+	for (uint32_t i = 0; i < MaxFramesInFlight(); i++)
+		stats += mFrameContexts[i].mDescriptorCacheStats;
+	return stats;
+}
+FrameAllocation Device::AllocateFrameMemory(VkDeviceSize size, VkDeviceSize alignment) {
+	FrameContext* frame = CurrentFrameContext();
+
+	FrameAllocation allocation = {};
+	if (frame->mFrameBuffer && frame->mFrameAllocator.Allocate(size, alignment, allocation.mOffset)) {
+		allocation.mBuffer = frame->mFrameBuffer;
+		allocation.mMapped = (uint8_t*)frame->mFrameBuffer->MappedData() + allocation.mOffset;
+		return allocation;
+	}
+
+	// Out of frame memory, fall back to a temporary buffer and grow the frame buffer when the frame context is reset
+	frame->mFrameMemoryOverflow += AlignUp(size, alignment);
+	allocation.mBuffer = GetTempBuffer("Frame Memory Overflow", size, FRAME_MEM_USAGE, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	allocation.mOffset = 0;
+	allocation.mMapped = allocation.mBuffer->MappedData();
+	return allocation;
+}
+
+UploadContext Device::BeginUpload(VkDeviceSize size, VkDeviceSize alignment) {
+	mUploadMutex.lock();
+	RetireUploads();
+
+	// Alignments that aren't a power of two (3 component formats) are met by allocating extra space
+	bool pow2 = (alignment & (alignment - 1)) == 0;
+	VkDeviceSize allocSize = pow2 ? size : size + alignment;
+
+	UploadContext upload = {};
+	if (allocSize > UPLOAD_RING_MAX_ALLOC) {
+		upload.mBuffer = new Buffer("Upload Staging", this, allocSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		upload.mOffset = 0;
+	} else {
+		if (!mUploadRing) {
+			mUploadRing = new Buffer("Upload Ring", this, UPLOAD_RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+			mUploadAllocator.Reset(UPLOAD_RING_SIZE);
+		}
+		// The ring is full: submit the open batch so its space can be reclaimed, then wait for the oldest batch
+		while (!mUploadAllocator.Allocate(allocSize, pow2 ? alignment : 4, upload.mOffset)) {
+			PROFILER_BEGIN("Wait for uploads");
+			SubmitUploads();
+			RetireUploads(mSubmittedUploads.size() ? mSubmittedUploads.front()->mToken : 0);
+			PROFILER_END;
+		}
+		upload.mBuffer = mUploadRing;
+	}
+	if (!pow2) upload.mOffset = (upload.mOffset + alignment - 1) / alignment * alignment;
+	upload.mMapped = (uint8_t*)upload.mBuffer->MappedData() + upload.mOffset;
+
+	if (!mOpenUpload) {
+		if (mFreeUploads.size()) {
+			mOpenUpload = mFreeUploads.back();
+			mFreeUploads.pop_back();
+			mOpenUpload->mGraphics->Reset("Upload");
+			if (mOpenUpload->mTransfer != mOpenUpload->mGraphics) mOpenUpload->mTransfer->Reset("Upload Transfer");
+		} else {
+			mOpenUpload = new UploadBatch();
+			mOpenUpload->mGraphics = shared_ptr<CommandBuffer>(new CommandBuffer(this, mUploadCommandPools[0], "Upload"));
+			if (DedicatedTransferQueue()) {
+				mOpenUpload->mTransfer = shared_ptr<CommandBuffer>(new CommandBuffer(this, mUploadCommandPools[1], "Upload Transfer"));
+				mOpenUpload->mSemaphore = make_shared<Semaphore>(this);
+				SetObjectName(*mOpenUpload->mSemaphore, "Upload Semaphore", VK_OBJECT_TYPE_SEMAPHORE);
+			} else
+				mOpenUpload->mTransfer = mOpenUpload->mGraphics;
+		}
+		mOpenUpload->mToken = ++mNextUploadToken;
+
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		ThrowIfFailed(vkBeginCommandBuffer(*mOpenUpload->mGraphics, &beginInfo), "vkBeginCommandBuffer failed");
+		if (mOpenUpload->mTransfer != mOpenUpload->mGraphics)
+			ThrowIfFailed(vkBeginCommandBuffer(*mOpenUpload->mTransfer, &beginInfo), "vkBeginCommandBuffer failed");
+	}
+	if (upload.mBuffer != mUploadRing) mOpenUpload->mBuffers.push_back(upload.mBuffer);
+
+	upload.mTransfer = mOpenUpload->mTransfer.get();
+	upload.mGraphics = mOpenUpload->mGraphics.get();
+	upload.mToken = mOpenUpload->mToken;
+	return upload;
+}
+void Device::EndUpload(const UploadContext& upload) {
+	mUploadMutex.unlock();
+}
+UploadToken Device::UploadBuffer(Buffer* dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size) {
+	UploadContext upload = BeginUpload(size);
+	memcpy(upload.mMapped, data, size);
+
+	VkBufferCopy region = {};
+	region.srcOffset = upload.mOffset;
+	region.dstOffset = dstOffset;
+	region.size = size;
+	vkCmdCopyBuffer(*upload.mTransfer, *upload.mBuffer, *dst, 1, &region);
+
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = *dst;
+	barrier.offset = dstOffset;
+	barrier.size = size;
+	if (DedicatedTransferQueue()) {
+		// Release from the transfer queue, then acquire on the graphics queue
+		barrier.srcQueueFamilyIndex = mTransferQueueFamily;
+		barrier.dstQueueFamilyIndex = mGraphicsQueueFamily;
+		barrier.dstAccessMask = 0;
+		vkCmdPipelineBarrier(*upload.mTransfer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+		vkCmdPipelineBarrier(*upload.mGraphics, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+	} else
+		vkCmdPipelineBarrier(*upload.mGraphics, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+	EndUpload(upload);
+	return upload.mToken;
+}
+void Device::TransferImageOwnership(const UploadContext& upload, VkImage image, VkImageLayout layout, const VkImageSubresourceRange& range) {
+	if (!DedicatedTransferQueue()) return;
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = 0;
+	barrier.oldLayout = layout;
+	barrier.newLayout = layout;
+	barrier.srcQueueFamilyIndex = mTransferQueueFamily;
+	barrier.dstQueueFamilyIndex = mGraphicsQueueFamily;
+	barrier.image = image;
+	barrier.subresourceRange = range;
+	vkCmdPipelineBarrier(*upload.mTransfer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	// Whatever the graphics queue does with the image next starts with a transfer or a barrier from the transfer stage
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(*upload.mGraphics, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+void Device::FlushUploads() {
+	lock_guard lock(mUploadMutex);
+	SubmitUploads();
+	RetireUploads();
+}
+bool Device::UploadComplete(UploadToken token) {
+	if (token <= mCompletedUploads) return true;
+	lock_guard lock(mUploadMutex);
+	RetireUploads();
+	return token <= mCompletedUploads;
+}
+void Device::WaitForUpload(UploadToken token) {
+	if (token <= mCompletedUploads) return;
+	lock_guard lock(mUploadMutex);
+	if (mOpenUpload && mOpenUpload->mToken <= token) SubmitUploads();
+	RetireUploads(token);
+}
+void Device::SubmitUploads() {
+	if (!mOpenUpload) return;
+	PROFILER_BEGIN("Submit Uploads");
+	UploadBatch* batch = mOpenUpload;
+	mOpenUpload = nullptr;
+
+	VkCommandBuffer transfer = *batch->mTransfer;
+	VkCommandBuffer graphics = *batch->mGraphics;
+	VkSemaphore semaphore = VK_NULL_HANDLE;
+	VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	if (transfer != graphics) {
+		ThrowIfFailed(vkEndCommandBuffer(transfer), "vkEndCommandBuffer failed");
+		semaphore = *batch->mSemaphore;
+		submitInfo.pCommandBuffers = &transfer;
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &semaphore;
+		// Only uploads use the transfer queue, and mUploadMutex is locked
+		ThrowIfFailed(vkQueueSubmit(mTransferQueue, 1, &submitInfo, *batch->mTransfer->mSignalFence), "vkQueueSubmit failed");
+
+		submitInfo.signalSemaphoreCount = 0;
+		submitInfo.pSignalSemaphores = nullptr;
+		submitInfo.waitSemaphoreCount = 1;
+		submitInfo.pWaitSemaphores = &semaphore;
+		submitInfo.pWaitDstStageMask = &waitStage;
+	}
+	ThrowIfFailed(vkEndCommandBuffer(graphics), "vkEndCommandBuffer failed");
+	submitInfo.pCommandBuffers = &graphics;
+	{
+		lock_guard lock(mCommandPoolMutex);
+		ThrowIfFailed(vkQueueSubmit(mGraphicsQueue, 1, &submitInfo, *batch->mGraphics->mSignalFence), "vkQueueSubmit failed");
+	}
+
+	mUploadAllocator.Close(batch->mToken);
+	mSubmittedUploads.push_back(batch);
+	PROFILER_END;
+}
+void Device::RetireUploads(UploadToken wait) {
+	// Batches finish in the order they were submitted. The graphics submission waits for the transfer submission, so its fence signals last
+	while (mSubmittedUploads.size()) {
+		UploadBatch* batch = mSubmittedUploads.front();
+		if (batch->mToken <= wait)
+			batch->mGraphics->mSignalFence->Wait();
+		else if (!batch->mGraphics->mSignalFence->Signaled())
+			break;
+		if (batch->mTransfer != batch->mGraphics) batch->mTransfer->mSignalFence->Wait();
+		mSubmittedUploads.pop_front();
+
+		mUploadAllocator.Retire(batch->mToken);
+		mCompletedUploads = batch->mToken;
+		for (Buffer* b : batch->mBuffers)
+			delete b;
+		batch->mBuffers.clear();
+		mFreeUploads.push_back(batch);
+	}
 }
\ No newline at end of file
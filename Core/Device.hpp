@@ -1,15 +1,24 @@
 #pragma once
 
+#include <deque>
 #include <list>
+#include <shared_mutex>
+#include <unordered_set>
 #include <utility>
 
 #include <Core/DescriptorSet.hpp>
 #include <Core/CommandBuffer.hpp>
 #include <Core/Instance.hpp>
+#include <Core/JobSystem.hpp>
+#include <Core/PipelineCacheFile.hpp>
+#include <Util/LinearAllocator.hpp>
+#include <Util/RingAllocator.hpp>
+#include <Util/TlsfAllocator.hpp>
 #include <Util/Util.hpp>
 
 class CommandBuffer;
 class Fence;
+class RenderPass;
 class Window;
 
 struct DeviceMemoryAllocation {
@@ -19,25 +28,78 @@ struct DeviceMemoryAllocation {
 	uint32_t mMemoryType;
 	void* mMapped;
 	std::string mTag;
+	// Block in the owning allocation's TlsfAllocator
+	uint32_t mBlock;
+};
+
+/// Sub-range of a host visible, coherent buffer that is only valid for the current frame
+struct FrameAllocation {
+	Buffer* mBuffer;
+	VkDeviceSize mOffset;
+	void* mMapped;
+};
+
+/// Identifies a batch of uploads, see Device::BeginUpload. Tokens increase with every batch, 0 is never used
+typedef uint64_t UploadToken;
+
+/// Staging memory and command buffers for one upload, from Device::BeginUpload
+struct UploadContext {
+	// Host visible, coherent staging buffer. Write the data to mMapped, which is at mOffset in mBuffer
+	Buffer* mBuffer;
+	VkDeviceSize mOffset;
+	void* mMapped;
+	// Records the copies out of mBuffer. Submitted to the transfer queue
+	CommandBuffer* mTransfer;
+	// Submitted to the graphics queue after mTransfer finishes, for commands the transfer queue can't run such as blits.
+	// The same command buffer as mTransfer when the device has no dedicated transfer queue
+	CommandBuffer* mGraphics;
+	UploadToken mToken;
 };
 
 class Device {
 public:
+	/// Temporary buffers and descriptor sets handed out to one thread
+	struct ThreadContext {
+		/// Descriptor sets of one layout. The first mUsed sets are in use this frame
+		struct TempDescriptorSets {
+			std::vector<DescriptorSet*> mSets;
+			uint32_t mUsed;
+			inline TempDescriptorSets() : mUsed(0) {}
+		};
+
+		std::list<std::pair<Buffer*, uint32_t>> mTempBuffers;
+		std::vector<Buffer*> mTempBuffersInUse;
+		std::unordered_map<VkDescriptorSetLayout, TempDescriptorSets> mTempDescriptorSets;
+
+		// Descriptor sets that already hold their key's contents
+		DescriptorCache<DescriptorSet*> mDescriptorCache;
+		// Sets evicted from mDescriptorCache, rewritten for new keys with the same layout
+		std::unordered_map<VkDescriptorSetLayout, std::vector<DescriptorSet*>> mFreeDescriptorSets;
+	};
+
 	struct FrameContext {
 		std::vector<std::shared_ptr<Semaphore>> mSemaphores; // semaphores that signal when this frame is done
 		std::vector<std::shared_ptr<Fence>> mFences; // fences that signal when this frame is done
 		
-		std::list<std::pair<Buffer*, uint32_t>> mTempBuffers;
-		std::unordered_map<VkDescriptorSetLayout, std::list<std::pair<DescriptorSet*, uint32_t>>> mTempDescriptorSets;
+		// Each thread gets its own temporary resources, so threads recording commands in parallel don't contend on a lock
+		std::unordered_map<std::thread::id, ThreadContext> mThreadContexts;
+		std::shared_mutex mThreadContextMutex;
 
-		std::vector<Buffer*> mTempBuffersInUse;
-		std::vector<DescriptorSet*> mTempDescriptorSetsInUse;
+		// Persistently mapped memory that Device::AllocateFrameMemory sub-allocates from. Recycled as a whole once the frame's fences signal
+		Buffer* mFrameBuffer;
+		LinearAllocator mFrameAllocator;
+		// Bytes requested this frame that didn't fit in mFrameBuffer, mFrameBuffer grows to fit them in Reset()
+		std::atomic<VkDeviceSize> mFrameMemoryOverflow;
+		// Descriptor cache statistics of every frame that used this context
+		DescriptorCacheStats mDescriptorCacheStats;
 
 		Device* mDevice;
 
-		inline FrameContext() : mFences({}), mSemaphores({}), mTempBuffers({}), mTempDescriptorSets({}), mTempBuffersInUse({}), mTempDescriptorSetsInUse({}) {};
+		inline FrameContext() : mFences({}), mSemaphores({}), mThreadContexts({}), mFrameBuffer(nullptr), mFrameMemoryOverflow(0) {};
 		ENGINE_EXPORT ~FrameContext();
 		ENGINE_EXPORT void Reset();
+		/// The calling thread's temporary resources
+		ENGINE_EXPORT ThreadContext* CurrentThreadContext();
 	};
 
 	ENGINE_EXPORT static bool FindQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface, uint32_t& graphicsFamily, uint32_t& presentFamily);
@@ -46,14 +108,56 @@ public:
 
 	ENGINE_EXPORT DeviceMemoryAllocation AllocateMemory(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, const std::string& tag);
 	ENGINE_EXPORT void FreeMemory(const DeviceMemoryAllocation& allocation);
+	/// Sub-allocation statistics for one memory type
+	ENGINE_EXPORT TlsfStats MemoryStats(uint32_t memoryType);
+	/// Sub-allocation statistics summed over all memory types
+	ENGINE_EXPORT TlsfStats MemoryStats();
 	
+	/// Temporary resources are recycled once the frame context is reset. They come from per-thread lists and are safe to request from any thread
 	ENGINE_EXPORT Buffer* GetTempBuffer(const std::string& name, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties);
 	ENGINE_EXPORT DescriptorSet* GetTempDescriptorSet(const std::string& name, VkDescriptorSetLayout layout);
+	/// Returns a descriptor set holding the descriptors in key, which must be built with key.mLayout set to the set's VkDescriptorSetLayout.
+	/// Sets are cached per thread and frame context, so identical keys skip vkUpdateDescriptorSets; sets unused for a few frames are recycled.
+	/// The set must not be written to, since later requests with the same key will return it
+	ENGINE_EXPORT DescriptorSet* GetCachedDescriptorSet(const std::string& name, const DescriptorKey& key);
+	/// Descriptor cache statistics summed over every thread and frame context
+	ENGINE_EXPORT DescriptorCacheStats DescriptorCacheStatistics();
+	/// Allocates size bytes of host visible, coherent memory that stays valid until the frame context is reset. Lock-free, safe to call from any thread.
+	/// The buffer can be used as a storage, uniform, vertex, index or indirect buffer, or as a transfer source
+	ENGINE_EXPORT FrameAllocation AllocateFrameMemory(VkDeviceSize size, VkDeviceSize alignment = 16);
+
+	/// Allocates size bytes of staging memory and returns the command buffers of the current upload batch. Record the copies, then call EndUpload().
+	/// Uploads are batched into one submission that is flushed by Execute() or FlushUploads(), so this doesn't wait for the GPU unless the staging ring is full.
+	/// Locks the upload batch until EndUpload(), so don't call Execute() or FlushUploads() in between
+	ENGINE_EXPORT UploadContext BeginUpload(VkDeviceSize size, VkDeviceSize alignment = 16);
+	ENGINE_EXPORT void EndUpload(const UploadContext& upload);
+	/// Copies size bytes of data to dst at dstOffset. dst must not be in use by the GPU. Returns the token of the batch that does the copy
+	ENGINE_EXPORT UploadToken UploadBuffer(Buffer* dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+	/// Hands an image written by upload.mTransfer over to the graphics queue, keeping it in layout. Does nothing without a dedicated transfer queue
+	ENGINE_EXPORT void TransferImageOwnership(const UploadContext& upload, VkImage image, VkImageLayout layout, const VkImageSubresourceRange& range);
+	/// Submits the current upload batch
+	ENGINE_EXPORT void FlushUploads();
+	ENGINE_EXPORT bool UploadComplete(UploadToken token);
+	/// Submits the upload batch if it holds token, then waits for it to finish
+	ENGINE_EXPORT void WaitForUpload(UploadToken token);
 
 	ENGINE_EXPORT std::shared_ptr<CommandBuffer> GetCommandBuffer(const std::string& name = "Command Buffer");
+	/// Begins a secondary command buffer from the calling thread's command pool, continuing subpass 0 of renderPass.
+	/// Record it on the calling thread, End() it there, then pass it to CommandBuffer::ExecuteCommands
+	ENGINE_EXPORT std::shared_ptr<CommandBuffer> GetSecondaryCommandBuffer(const std::string& name, RenderPass* renderPass, VkFramebuffer framebuffer = VK_NULL_HANDLE);
 	ENGINE_EXPORT std::shared_ptr<Fence> Execute(std::shared_ptr<CommandBuffer> commandBuffer, bool frameContext = true);
 	ENGINE_EXPORT void Flush();
 
+	/// Runs job on the pipeline compilation threads, see AsyncPipelineCompilation(). Runs job on the calling thread if they don't exist yet,
+	/// so don't hold a lock job takes
+	ENGINE_EXPORT void CompilePipelineAsync(std::function<void()> job);
+	/// Waits for every pipeline being compiled in the background. Call before destroying anything a pipeline is being created from
+	ENGINE_EXPORT void WaitForPipelines();
+	/// Remembers that a pipeline was created, so later runs can create it ahead of time. Keys are saved when the device is destroyed
+	ENGINE_EXPORT void RecordPipeline(const PipelineKey& key);
+	/// Pipelines recorded in this run and in previous runs
+	ENGINE_EXPORT std::vector<PipelineKey> RecordedPipelines();
+
 	ENGINE_EXPORT void SetObjectName(void* object, const std::string& name, VkObjectType type) const;
 
 	ENGINE_EXPORT VkSampleCountFlagBits GetMaxUsableSampleCount();
@@ -64,15 +168,27 @@ public:
 	inline VkQueue PresentQueue() const { return mPresentQueue; };
 	inline uint32_t GraphicsQueueFamily() const { return mGraphicsQueueFamily; };
 	inline uint32_t PresentQueueFamily() const { return mPresentQueueFamily; };
+	/// The graphics queue if the device has no dedicated transfer queue
+	inline VkQueue TransferQueue() const { return mTransferQueue; };
+	inline uint32_t TransferQueueFamily() const { return mTransferQueueFamily; };
+	inline bool DedicatedTransferQueue() const { return mTransferQueueFamily != mGraphicsQueueFamily; };
 	inline uint32_t DescriptorSetCount() const { return mDescriptorSetCount; };
+	/// True if the device samples BC1-BC7 block compressed formats
+	inline bool TextureCompressionBC() const { return mTextureCompressionBC; };
 
 	inline uint32_t MaxFramesInFlight() const { return mInstance->MaxFramesInFlight(); }
 	inline uint32_t FrameContextIndex() const { return mFrameContextIndex; }
 	inline FrameContext* CurrentFrameContext() { return &mFrameContexts[mFrameContextIndex]; }
 
 	inline const VkPhysicalDeviceLimits& Limits() const { return mLimits; }
+	inline const VkPhysicalDeviceMemoryProperties& MemoryProperties() const { return mMemoryProperties; }
 	inline ::Instance* Instance() const { return mInstance; }
 	inline VkPipelineCache PipelineCache() const { return mPipelineCache; }
+	/// When enabled, GraphicsShader::GetPipeline returns VK_NULL_HANDLE and compiles missing pipelines in the background,
+	/// so draws using them are skipped for a few frames instead of stalling the frame. Disabled by default.
+	/// The compilation threads are created the first time it is enabled. Enable it while nothing is rendering
+	ENGINE_EXPORT void AsyncPipelineCompilation(bool v);
+	inline bool AsyncPipelineCompilation() const { return mAsyncPipelineCompilation; }
 
 	inline operator VkDevice() const { return mDevice; }
 
@@ -81,24 +197,44 @@ private:
 		void* mMapped;
 		VkDeviceMemory mMemory;
 		VkDeviceSize mSize;
-		// <offset, size>
-		std::list<std::pair<VkDeviceSize, VkDeviceSize>> mAvailable;
-		std::list<DeviceMemoryAllocation> mAllocations;
+		TlsfAllocator mAllocator;
 
-		ENGINE_EXPORT bool SubAllocate(const VkMemoryRequirements& requirements, DeviceMemoryAllocation& allocation, const std::string& tag);
-		ENGINE_EXPORT void Deallocate(const DeviceMemoryAllocation& allocation);
+		inline Allocation(VkDeviceSize size) : mMapped(nullptr), mMemory(VK_NULL_HANDLE), mSize(size), mAllocator(size) {}
+		ENGINE_EXPORT bool SubAllocate(VkDeviceSize size, VkDeviceSize alignment, DeviceMemoryAllocation& allocation, const std::string& tag);
+	};
+	// Allocations of one memory type, each memory type is locked separately
+	struct MemoryPool {
+		std::mutex mMutex;
+		std::vector<Allocation> mAllocations;
+	};
+	// Uploads submitted together. mGraphics's fence signals when the whole batch is done
+	struct UploadBatch {
+		UploadToken mToken;
+		std::shared_ptr<CommandBuffer> mTransfer;
+		std::shared_ptr<CommandBuffer> mGraphics;
+		// Signaled by mTransfer and waited on by mGraphics, only used with a dedicated transfer queue
+		std::shared_ptr<Semaphore> mSemaphore;
+		// Staging buffers for uploads too large for the ring, deleted once the batch is done
+		std::vector<Buffer*> mBuffers;
 	};
 
 	friend class DescriptorSet;
 	friend class CommandBuffer;
 	friend class ::Instance;
 	ENGINE_EXPORT Device(::Instance* instance, VkPhysicalDevice physicalDevice, uint32_t physicalDeviceIndex, uint32_t graphicsQueue, uint32_t presentQueue, const std::set<std::string>& deviceExtensions, std::vector<const char*> validationLayers);
+	/// Returns the calling thread's command pool, creating it if needed. mCommandPoolMutex must be locked
+	ENGINE_EXPORT VkCommandPool ThreadCommandPool(const std::string& name);
+	/// Submits mOpenUpload. mUploadMutex must be locked
+	ENGINE_EXPORT void SubmitUploads();
+	/// Recycles the submitted batches that are done, waiting for the ones up to wait. mUploadMutex must be locked
+	ENGINE_EXPORT void RetireUploads(UploadToken wait = 0);
 
 	::Instance* mInstance;
 	uint32_t mFrameContextIndex; // assigned by mInstance
 	FrameContext* mFrameContexts;
 
-	std::unordered_map<uint32_t, std::vector<Allocation>> mMemoryAllocations;
+	MemoryPool mMemoryPools[VK_MAX_MEMORY_TYPES];
+	VkPhysicalDeviceMemoryProperties mMemoryProperties;
 
 	VkPhysicalDeviceLimits mLimits;
 	uint32_t mMaxMSAASamples;
@@ -107,23 +243,50 @@ private:
 	VkPhysicalDevice mPhysicalDevice;
 	VkDevice mDevice;
 	VkPipelineCache mPipelineCache;
+	PipelineCacheHeader mPipelineCacheHeader;
+
+	// Read by every thread recording command buffers
+	std::atomic<bool> mAsyncPipelineCompilation;
+	std::atomic<JobSystem*> mPipelineJobs;
+	JobCounter mPipelineCompiles;
+
+	std::mutex mPipelineKeyMutex;
+	std::vector<PipelineKey> mPipelineKeys;
+	// Serialized mPipelineKeys, to skip duplicates
+	std::unordered_set<std::string> mPipelineKeyStrings;
 
 	uint32_t mGraphicsQueueFamily;
 	uint32_t mPresentQueueFamily;
+	uint32_t mTransferQueueFamily;
+	bool mTextureCompressionBC;
 
 	VkQueue mGraphicsQueue;
 	VkQueue mPresentQueue;
+	VkQueue mTransferQueue;
+
+	// Held from BeginUpload to EndUpload
+	std::mutex mUploadMutex;
+	// Staging memory shared by every upload, sub-allocated by mUploadAllocator and retired a batch at a time
+	Buffer* mUploadRing;
+	RingAllocator mUploadAllocator;
+	// Graphics and transfer queue family pools for upload command buffers, only used with mUploadMutex locked
+	VkCommandPool mUploadCommandPools[2];
+	// Batch that uploads are currently recorded into, nullptr until the next BeginUpload
+	UploadBatch* mOpenUpload;
+	std::deque<UploadBatch*> mSubmittedUploads;
+	std::vector<UploadBatch*> mFreeUploads;
+	UploadToken mNextUploadToken;
+	std::atomic<UploadToken> mCompletedUploads;
 
 	VkDescriptorPool mDescriptorPool;
 	uint32_t mDescriptorSetCount;
 
-	std::mutex mTmpDescriptorSetMutex;
-	std::mutex mTmpBufferMutex;
 	std::mutex mDescriptorPoolMutex;
 	std::mutex mCommandPoolMutex;
-	std::mutex mMemoryMutex;
 	std::unordered_map<std::thread::id, VkCommandPool> mCommandPools;
 	std::unordered_map<VkCommandPool, std::queue<std::shared_ptr<CommandBuffer>>> mCommandBuffers;
+	// Executed secondary command buffers, only reset by the thread that owns their pool
+	std::unordered_map<VkCommandPool, std::queue<std::shared_ptr<CommandBuffer>>> mSecondaryCommandBuffers;
 
 	#ifdef ENABLE_DEBUG_LAYERS
 	PFN_vkSetDebugUtilsObjectNameEXT SetDebugUtilsObjectNameEXT;
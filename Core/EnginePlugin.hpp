@@ -38,6 +38,9 @@ public:
 	
 	/// Higher priority plugins get called first
 	inline virtual int Priority() { return 50; }
+	/// Return true if PreUpdate, FixedUpdate, Update and PostUpdate may run on a job thread, alongside other plugins and objects.
+	/// Thread-safe hooks must not record into the CommandBuffer they are given
+	inline virtual bool ThreadSafeUpdate() { return false; }
 };
 
 #define ENGINE_PLUGIN(plugin) extern "C" { PLUGIN_EXPORT EnginePlugin* CreatePlugin() { return new plugin(); } }
\ No newline at end of file
@@ -129,7 +129,7 @@ bool Framebuffer::UpdateBuffers() {
 	return false;
 }
 
-void Framebuffer::BeginRenderPass(CommandBuffer* commandBuffer) {
+void Framebuffer::BeginRenderPass(CommandBuffer* commandBuffer, VkSubpassContents contents) {
 	uint32_t frameContextIndex = mDevice->FrameContextIndex();
 	if (UpdateBuffers()) {
 		if (mColorFormats.size()) {
@@ -146,7 +146,7 @@ void Framebuffer::BeginRenderPass(CommandBuffer* commandBuffer) {
 		}
 		mDepthBuffers[frameContextIndex]->TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, commandBuffer);
 	}
-	commandBuffer->BeginRenderPass(mRenderPass, { mWidth, mHeight }, mFramebuffers[frameContextIndex], mClearValues.data(), (uint32_t)mClearValues.size());
+	commandBuffer->BeginRenderPass(mRenderPass, { mWidth, mHeight }, mFramebuffers[frameContextIndex], mClearValues.data(), (uint32_t)mClearValues.size(), contents);
 }
 
 void Framebuffer::Clear(CommandBuffer* commandBuffer) {
@@ -34,9 +34,11 @@ public:
 	inline uint32_t ColorBufferCount() const { return mColorBuffers ? (uint32_t)mColorBuffers[mDevice->FrameContextIndex()].size() : 0; }
 
 	ENGINE_EXPORT void Clear(CommandBuffer* commandBuffer);
-	ENGINE_EXPORT void BeginRenderPass(CommandBuffer* commandBuffer);
+	/// Pass VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS to record the render pass into secondary command buffers, see CommandBuffer::ExecuteCommands
+	ENGINE_EXPORT void BeginRenderPass(CommandBuffer* commandBuffer, VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE);
 	inline ::RenderPass* RenderPass() const { return mRenderPass; }
 	inline ::Device* Device() const { return mDevice; }
+	inline operator VkFramebuffer() const { return mFramebuffers[mDevice->FrameContextIndex()]; }
 
 private:
 	::Device* mDevice;
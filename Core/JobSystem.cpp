@@ -0,0 +1,153 @@
+#include <Core/JobSystem.hpp>
+#include <Util/Profiler.hpp>
+
+using namespace std;
+
+// The JobSystem that owns the calling thread, and the thread's index in it
+static thread_local const JobSystem* gThreadJobSystem = nullptr;
+static thread_local uint32_t gThreadIndex = 0;
+
+JobSystem::JobSystem(uint32_t threadCount) : mShutdown(false), mQueuedJobs(0) {
+	if (threadCount == 0) {
+		uint32_t hw = thread::hardware_concurrency();
+		threadCount = hw > 1 ? hw - 1 : 0;
+	}
+
+	mQueues.resize(threadCount + 1);
+	for (uint32_t i = 0; i < mQueues.size(); i++)
+		mQueues[i] = new WorkQueue();
+
+	mThreads.reserve(threadCount);
+	for (uint32_t i = 0; i < threadCount; i++)
+		mThreads.push_back(thread(&JobSystem::WorkerThread, this, i + 1));
+}
+JobSystem::~JobSystem() {
+	mShutdown = true;
+	{
+		lock_guard<mutex> lock(mSleepMutex);
+	}
+	mWake.notify_all();
+	for (thread& t : mThreads)
+		t.join();
+	for (WorkQueue* q : mQueues)
+		safe_delete(q);
+}
+
+uint32_t JobSystem::ThreadIndex() const {
+	return gThreadJobSystem == this ? gThreadIndex : 0;
+}
+
+void JobSystem::Schedule(function<void()> job, JobCounter* counter, JobCounter* dependency) {
+	if (counter) counter->mValue.fetch_add(1, memory_order_acq_rel);
+
+	if (dependency) {
+		lock_guard<mutex> lock(dependency->mMutex);
+		if (!dependency->Done()) {
+			// Finish() will push this job when dependency reaches zero
+			dependency->mContinuations.push_back({ move(job), counter });
+			return;
+		}
+	}
+
+	Push({ move(job), counter });
+}
+
+void JobSystem::Wait(JobCounter* counter) {
+	uint32_t threadIndex = ThreadIndex();
+	while (!counter->Done())
+		if (!RunJob(threadIndex))
+			this_thread::yield();
+	// The last job may still hold the counter's mutex in Finish(), wait for it before the counter can be destroyed
+	lock_guard<mutex> lock(counter->mMutex);
+}
+
+void JobSystem::ParallelFor(uint32_t count, const function<void(uint32_t, uint32_t)>& func, uint32_t batchSize) {
+	if (count == 0) return;
+	batchSize = max(1u, batchSize);
+	if (mThreads.empty() || count <= batchSize) {
+		func(0, count);
+		return;
+	}
+
+	JobCounter counter;
+	for (uint32_t begin = 0; begin < count; begin += batchSize) {
+		uint32_t end = min(count, begin + batchSize);
+		Schedule([&func, begin, end]() { func(begin, end); }, &counter);
+	}
+	Wait(&counter);
+}
+
+void JobSystem::Push(Job&& job) {
+	WorkQueue* q = mQueues[ThreadIndex()];
+	{
+		lock_guard<mutex> lock(q->mMutex);
+		q->mJobs.push_back(move(job));
+	}
+	mQueuedJobs.fetch_add(1, memory_order_acq_rel);
+
+	// Lock the sleep mutex so a worker can't miss the wakeup between checking mQueuedJobs and going to sleep
+	{
+		lock_guard<mutex> lock(mSleepMutex);
+	}
+	mWake.notify_one();
+}
+
+bool JobSystem::RunJob(uint32_t threadIndex) {
+	Job job;
+	bool found = false;
+
+	// Newest job from this thread's queue first, it is the most likely to still be in cache
+	WorkQueue* q = mQueues[threadIndex];
+	{
+		lock_guard<mutex> lock(q->mMutex);
+		if (q->mJobs.size()) {
+			job = move(q->mJobs.back());
+			q->mJobs.pop_back();
+			found = true;
+		}
+	}
+
+	// Steal the oldest job from another thread
+	for (uint32_t i = 1; i < mQueues.size() && !found; i++) {
+		WorkQueue* victim = mQueues[(threadIndex + i) % mQueues.size()];
+		lock_guard<mutex> lock(victim->mMutex);
+		if (victim->mJobs.size()) {
+			job = move(victim->mJobs.front());
+			victim->mJobs.pop_front();
+			found = true;
+		}
+	}
+
+	if (!found) return false;
+
+	mQueuedJobs.fetch_sub(1, memory_order_acq_rel);
+	job.mFunction();
+	Finish(job.mCounter);
+	return true;
+}
+
+void JobSystem::Finish(JobCounter* counter) {
+	if (!counter) return;
+
+	vector<JobCounter::Continuation> continuations;
+	{
+		lock_guard<mutex> lock(counter->mMutex);
+		if (counter->mValue.fetch_sub(1, memory_order_acq_rel) != 1) return;
+		continuations.swap(counter->mContinuations);
+	}
+	for (JobCounter::Continuation& c : continuations)
+		Push({ move(c.mFunction), c.mCounter });
+}
+
+void JobSystem::WorkerThread(uint32_t threadIndex) {
+	gThreadJobSystem = this;
+	gThreadIndex = threadIndex;
+	Profiler::ThreadName("Job Worker " + to_string(threadIndex));
+
+	while (!mShutdown) {
+		if (RunJob(threadIndex)) continue;
+
+		unique_lock<mutex> lock(mSleepMutex);
+		mWake.wait(lock, [&]() { return mShutdown || mQueuedJobs.load(memory_order_acquire) > 0; });
+	}
+}
\ No newline at end of file
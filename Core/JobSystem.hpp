@@ -0,0 +1,89 @@
+#pragma once
+
+#include <Util/Util.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <type_traits>
+
+class JobSystem;
+
+/// Counts unfinished jobs. Schedule() increments it and it is decremented when each job finishes.
+/// Jobs can be scheduled to start once a counter reaches zero, see JobSystem::Schedule
+class JobCounter {
+public:
+	inline JobCounter() : mValue(0) {}
+
+	inline bool Done() const { return mValue.load(std::memory_order_acquire) == 0; }
+	inline uint32_t Value() const { return mValue.load(std::memory_order_acquire); }
+
+private:
+	friend class JobSystem;
+	struct Continuation {
+		std::function<void()> mFunction;
+		JobCounter* mCounter;
+	};
+
+	std::atomic<uint32_t> mValue;
+	std::mutex mMutex;
+	// Jobs waiting for this counter to reach zero
+	std::vector<Continuation> mContinuations;
+};
+
+/// Work-stealing job scheduler. Each thread owns a deque: it pushes and pops jobs at the back, and idle threads steal from the front of other threads' deques.
+/// Thread 0 is the thread that created the JobSystem, it only runs jobs while waiting in Wait() or ParallelFor().
+/// Jobs must not call into Vulkan or record commands unless they synchronize that themselves.
+class JobSystem {
+public:
+	/// threadCount is the number of worker threads, in addition to the calling thread. 0 uses one worker per hardware thread, minus one
+	ENGINE_EXPORT JobSystem(uint32_t threadCount = 0);
+	ENGINE_EXPORT ~JobSystem();
+
+	/// Schedules a job. If counter is not null, it is incremented now and decremented when the job finishes.
+	/// If dependency is not null, the job does not start until dependency reaches zero
+	ENGINE_EXPORT void Schedule(std::function<void()> job, JobCounter* counter = nullptr, JobCounter* dependency = nullptr);
+	/// Runs other jobs on the calling thread until counter reaches zero
+	ENGINE_EXPORT void Wait(JobCounter* counter);
+
+	/// Calls func(begin, end) over [0, count) in batches of batchSize, returns when every batch has finished
+	ENGINE_EXPORT void ParallelFor(uint32_t count, const std::function<void(uint32_t, uint32_t)>& func, uint32_t batchSize);
+	/// Calls func(i) for every i in [0, count) in batches of batchSize, returns when every call has finished
+	template<typename Func, typename = std::enable_if_t<std::is_invocable_v<Func, uint32_t>>>
+	inline void ParallelFor(uint32_t count, Func func, uint32_t batchSize = 1) {
+		ParallelFor(count, std::function<void(uint32_t, uint32_t)>([&](uint32_t begin, uint32_t end) {
+			for (uint32_t i = begin; i < end; i++) func(i);
+		}), batchSize);
+	}
+
+	/// Number of worker threads, not counting the thread that created the JobSystem
+	inline uint32_t WorkerCount() const { return (uint32_t)mThreads.size(); }
+	/// Index of the calling thread in [0, WorkerCount()]. Threads that don't belong to this JobSystem return 0
+	ENGINE_EXPORT uint32_t ThreadIndex() const;
+
+private:
+	struct Job {
+		std::function<void()> mFunction;
+		JobCounter* mCounter;
+	};
+	struct WorkQueue {
+		std::mutex mMutex;
+		std::deque<Job> mJobs;
+	};
+
+	std::vector<std::thread> mThreads;
+	std::vector<WorkQueue*> mQueues;
+
+	std::atomic<bool> mShutdown;
+	// Number of jobs sitting in queues, workers sleep while it is zero
+	std::atomic<uint32_t> mQueuedJobs;
+	std::mutex mSleepMutex;
+	std::condition_variable mWake;
+
+	ENGINE_EXPORT void Push(Job&& job);
+	/// Pops a job from this thread's queue, or steals one from another thread. Returns false if there was nothing to run
+	ENGINE_EXPORT bool RunJob(uint32_t threadIndex);
+	ENGINE_EXPORT void Finish(JobCounter* counter);
+	ENGINE_EXPORT void WorkerThread(uint32_t threadIndex);
+};
\ No newline at end of file
@@ -0,0 +1,143 @@
+#include <Core/PipelineCacheFile.hpp>
+#include <Util/MappedFile.hpp>
+
+#include <sstream>
+
+using namespace std;
+
+// Fields of a serialized PipelineKey: shader|pass|keywords|render pass|topology cull blend polygon|bindings|attributes
+// Bindings and attributes are separated by ';', with their members separated by spaces
+string PipelineKey::Serialize() const {
+	ostringstream s;
+	s << mShader << "|" << mPass << "|" << mKeywords << "|" << hex << mRenderPass << dec << "|";
+	s << mTopology << " " << mCullMode << " " << mBlendMode << " " << mPolygonMode << "|";
+	for (const VkVertexInputBindingDescription& b : mBindings)
+		s << b.binding << " " << b.stride << " " << (uint32_t)b.inputRate << ";";
+	s << "|";
+	for (const VkVertexInputAttributeDescription& a : mAttributes)
+		s << a.location << " " << a.binding << " " << (uint32_t)a.format << " " << a.offset << ";";
+	return s.str();
+}
+bool PipelineKey::Parse(const string& line, PipelineKey& key) {
+	vector<string> fields;
+	size_t start = 0;
+	for (size_t end; (end = line.find('|', start)) != string::npos; start = end + 1)
+		fields.push_back(line.substr(start, end - start));
+	fields.push_back(line.substr(start));
+	if (fields.size() != 7 || fields[0].empty()) return false;
+
+	key.mShader = fields[0];
+	key.mKeywords = fields[2];
+	if (!(istringstream(fields[1]) >> key.mPass)) return false;
+	if (!(istringstream(fields[3]) >> hex >> key.mRenderPass)) return false;
+	if (!(istringstream(fields[4]) >> key.mTopology >> key.mCullMode >> key.mBlendMode >> key.mPolygonMode)) return false;
+
+	key.mBindings.clear();
+	key.mAttributes.clear();
+	istringstream bindings(fields[5]);
+	for (string item; getline(bindings, item, ';');) {
+		VkVertexInputBindingDescription b = {};
+		uint32_t rate;
+		if (!(istringstream(item) >> b.binding >> b.stride >> rate)) return false;
+		b.inputRate = (VkVertexInputRate)rate;
+		key.mBindings.push_back(b);
+	}
+	istringstream attributes(fields[6]);
+	for (string item; getline(attributes, item, ';');) {
+		VkVertexInputAttributeDescription a = {};
+		uint32_t format;
+		if (!(istringstream(item) >> a.location >> a.binding >> format >> a.offset)) return false;
+		a.format = (VkFormat)format;
+		key.mAttributes.push_back(a);
+	}
+	return true;
+}
+
+PipelineCacheHeader PipelineCacheFile::Header(const VkPhysicalDeviceProperties& properties) {
+	PipelineCacheHeader header = {};
+	header.mMagic = Magic;
+	header.mVersion = Version;
+	header.mVendorID = properties.vendorID;
+	header.mDeviceID = properties.deviceID;
+	header.mDriverVersion = properties.driverVersion;
+	memcpy(header.mPipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+	return header;
+}
+
+vector<uint8_t> PipelineCacheFile::Encode(const PipelineCacheHeader& device, const void* data, size_t size) {
+	PipelineCacheHeader header = device;
+	header.mDataSize = size;
+	header.mChecksum = HashBytes(data, size);
+
+	vector<uint8_t> file(sizeof(PipelineCacheHeader) + size);
+	memcpy(file.data(), &header, sizeof(PipelineCacheHeader));
+	if (size) memcpy(file.data() + sizeof(PipelineCacheHeader), data, size);
+	return file;
+}
+bool PipelineCacheFile::Decode(const PipelineCacheHeader& device, const void* file, size_t size, const uint8_t*& data, size_t& dataSize) {
+	if (size < sizeof(PipelineCacheHeader)) return false;
+
+	PipelineCacheHeader header;
+	memcpy(&header, file, sizeof(PipelineCacheHeader));
+	if (header.mMagic != Magic || header.mVersion != Version) return false;
+	if (header.mVendorID != device.mVendorID || header.mDeviceID != device.mDeviceID || header.mDriverVersion != device.mDriverVersion) return false;
+	if (memcmp(header.mPipelineCacheUUID, device.mPipelineCacheUUID, VK_UUID_SIZE)) return false;
+	if (header.mDataSize != size - sizeof(PipelineCacheHeader)) return false;
+
+	data = (const uint8_t*)file + sizeof(PipelineCacheHeader);
+	dataSize = (size_t)header.mDataSize;
+	return HashBytes(data, dataSize) == header.mChecksum;
+}
+
+// Renames a completely written tmpFile over filename, or removes it if writing failed, so a crash mid-write leaves the old file intact
+inline bool ReplaceFile(const string& tmpFile, const string& filename, bool written) {
+	error_code error;
+	if (written) fs::rename(tmpFile, filename, error);
+	if (!written || error) {
+		remove(tmpFile.c_str());
+		return false;
+	}
+	return true;
+}
+bool PipelineCacheFile::Write(const string& filename, const PipelineCacheHeader& device, const void* data, size_t size) {
+	vector<uint8_t> file = Encode(device, data, size);
+	string tmpFile = filename + ".tmp";
+	FILE* f = fopen(tmpFile.c_str(), "wb");
+	if (!f) return false;
+	bool ok = fwrite(file.data(), 1, file.size(), f) == file.size();
+	if (fclose(f) != 0) ok = false;
+	return ReplaceFile(tmpFile, filename, ok);
+}
+bool PipelineCacheFile::Read(const string& filename, const PipelineCacheHeader& device, vector<uint8_t>& data) {
+	data.clear();
+	MappedFile file(filename);
+	if (!file.Valid()) return false;
+	const uint8_t* cache;
+	size_t size;
+	if (!Decode(device, file.Data(), file.Size(), cache, size)) return false;
+	data.assign(cache, cache + size);
+	return true;
+}
+
+bool PipelineCacheFile::WriteKeys(const string& filename, const vector<PipelineKey>& keys) {
+	string tmpFile = filename + ".tmp";
+	bool ok;
+	{
+		ofstream file(tmpFile);
+		if (!file.is_open()) return false;
+		for (const PipelineKey& k : keys)
+			file << k.Serialize() << "\n";
+		file.close();
+		ok = !file.fail();
+	}
+	return ReplaceFile(tmpFile, filename, ok);
+}
+bool PipelineCacheFile::ReadKeys(const string& filename, vector<PipelineKey>& keys) {
+	ifstream file(filename);
+	if (!file.is_open()) return false;
+	PipelineKey key;
+	for (string line; getline(file, line);)
+		if (PipelineKey::Parse(line, key))
+			keys.push_back(key);
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <Util/Util.hpp>
+
+/// Header of a pipeline cache file, followed by the data from vkGetPipelineCacheData.
+/// The cache is only loaded by the same device and driver that wrote it
+struct PipelineCacheHeader {
+	uint32_t mMagic;
+	uint32_t mVersion;
+	uint32_t mVendorID;
+	uint32_t mDeviceID;
+	uint32_t mDriverVersion;
+	uint8_t mPipelineCacheUUID[VK_UUID_SIZE];
+	uint64_t mDataSize;
+	// HashBytes of the data, so truncated or corrupted files are rejected before they reach the driver
+	uint64_t mChecksum;
+};
+
+/// Everything needed to create a graphics pipeline again in a later run, see GraphicsShader::GetPipeline.
+/// Render passes are identified by RenderPass::Hash(), which only depends on their attachments and subpasses
+struct PipelineKey {
+	std::string mShader;
+	uint32_t mPass;
+	std::string mKeywords;
+	uint64_t mRenderPass;
+	std::vector<VkVertexInputBindingDescription> mBindings;
+	std::vector<VkVertexInputAttributeDescription> mAttributes;
+	uint32_t mTopology;
+	uint32_t mCullMode;
+	uint32_t mBlendMode;
+	uint32_t mPolygonMode;
+
+	/// One line of text, without a newline
+	ENGINE_EXPORT std::string Serialize() const;
+	/// Parses a line written by Serialize(). Returns false if it is malformed
+	ENGINE_EXPORT static bool Parse(const std::string& line, PipelineKey& key);
+};
+
+/// Reads and writes pipeline cache files and lists of PipelineKeys. Independent of any VkDevice, so files can be validated headlessly
+class PipelineCacheFile {
+public:
+	static const uint32_t Magic = 0x43505453; // STPC
+	/// Increment when the layout of the file changes
+	static const uint32_t Version = 1;
+
+	/// Header for a cache written by the device with these properties, mDataSize and mChecksum are left at 0
+	ENGINE_EXPORT static PipelineCacheHeader Header(const VkPhysicalDeviceProperties& properties);
+
+	/// Prepends the header for device to data
+	ENGINE_EXPORT static std::vector<uint8_t> Encode(const PipelineCacheHeader& device, const void* data, size_t size);
+	/// Finds the cache data in file, which must start with the header for device. Returns false if the file is truncated, corrupted,
+	/// from another version, or was written by another device or driver. data points into file
+	ENGINE_EXPORT static bool Decode(const PipelineCacheHeader& device, const void* file, size_t size, const uint8_t*& data, size_t& dataSize);
+
+	/// Writes a temporary file and renames it over filename. Returns false if the file couldn't be written
+	ENGINE_EXPORT static bool Write(const std::string& filename, const PipelineCacheHeader& device, const void* data, size_t size);
+	/// Returns false and leaves data empty if the file is missing or Decode() rejects it
+	ENGINE_EXPORT static bool Read(const std::string& filename, const PipelineCacheHeader& device, std::vector<uint8_t>& data);
+
+	/// Writes one key per line, through a temporary file like Write(). Returns false if the file couldn't be written
+	ENGINE_EXPORT static bool WriteKeys(const std::string& filename, const std::vector<PipelineKey>& keys);
+	/// Appends the keys in filename to keys, skipping malformed lines. Returns false if the file couldn't be opened
+	ENGINE_EXPORT static bool ReadKeys(const std::string& filename, std::vector<PipelineKey>& keys);
+};
\ No newline at end of file
@@ -11,6 +11,26 @@ RenderPass::RenderPass(const string& name, ::Device* device,
 	mRasterizationSamples = attachments[subpasses[0].pDepthStencilAttachment->attachment].samples;
 	mColorAttachmentCount = subpasses[0].colorAttachmentCount;
 
+	size_t h = 0;
+	for (const VkAttachmentDescription& a : attachments) {
+		hash_combine(h, a.format);
+		hash_combine(h, a.samples);
+		hash_combine(h, a.loadOp);
+		hash_combine(h, a.storeOp);
+		hash_combine(h, a.initialLayout);
+		hash_combine(h, a.finalLayout);
+	}
+	for (const VkSubpassDescription& s : subpasses) {
+		hash_combine(h, s.colorAttachmentCount);
+		for (uint32_t i = 0; i < s.colorAttachmentCount; i++)
+			hash_combine(h, s.pColorAttachments[i].attachment);
+		if (s.pDepthStencilAttachment) hash_combine(h, s.pDepthStencilAttachment->attachment);
+		if (s.pResolveAttachments)
+			for (uint32_t i = 0; i < s.colorAttachmentCount; i++)
+				hash_combine(h, s.pResolveAttachments[i].attachment);
+	}
+	mHash = h;
+
 	VkRenderPassCreateInfo renderPassInfo = {};
 	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
 	renderPassInfo.attachmentCount = (uint32_t)attachments.size();
@@ -30,5 +50,7 @@ RenderPass::RenderPass(const string& name, ::Framebuffer* frameBuffer,
 	mFramebuffer = frameBuffer;
 }
 RenderPass::~RenderPass() {
+	// Background pipeline compiles may still be using this render pass
+	mDevice->WaitForPipelines();
 	vkDestroyRenderPass(*mDevice, mRenderPass, nullptr);
 }
\ No newline at end of file
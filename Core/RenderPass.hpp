@@ -24,6 +24,8 @@ public:
 	inline VkSampleCountFlagBits RasterizationSamples() const { return mRasterizationSamples; }
 	inline ::Device* Device() const { return mDevice; }
 	inline ::Framebuffer* Framebuffer() const { return mFramebuffer; }
+	/// Hash of the attachments and subpasses, equal for compatible render passes in every run. Identifies the render pass in PipelineKeys
+	inline uint64_t Hash() const { return mHash; }
 
 	inline operator VkRenderPass() const { return mRenderPass; }
 
@@ -33,4 +35,5 @@ private:
 	VkRenderPass mRenderPass;
 	VkSampleCountFlagBits mRasterizationSamples;
 	uint32_t mColorAttachmentCount;
+	uint64_t mHash;
 };
\ No newline at end of file
@@ -110,8 +110,10 @@ struct Ray {
 	}
 
 	inline bool Intersect(const AABB& aabb, float2& t) const {
-		float3 id = 1.f / mDirection;
-
+		return Intersect(aabb, 1.f / mDirection, t);
+	}
+	// Intersect with a precomputed inverse direction, to avoid recomputing it for every box during traversal
+	inline bool Intersect(const AABB& aabb, const float3& id, float2& t) const {
 		float3 pmin = (aabb.mMin - mOrigin) * id;
 		float3 pmax = (aabb.mMax - mOrigin) * id;
 
@@ -11,6 +11,14 @@
 #include <cassert>
 #include <math.h>
 
+#include <Math/Simd.hpp>
+
+// float4, quaternion and float4x4 arithmetic uses the SIMD backend from Simd.hpp when there is one.
+// Define MATH_SCALAR to use the scalar implementation. The types' layout is the same either way
+#if (defined(SIMD_SSE) || defined(SIMD_NEON)) && !defined(MATH_SCALAR)
+#define MATH_SIMD
+#endif
+
 #ifdef far
 #undef far
 #endif
@@ -1196,6 +1204,35 @@ struct float4 {
 		return *this;
 	}
 
+#ifdef MATH_SIMD
+	inline explicit float4(const simd4f& s) { s.StoreUnaligned(v); }
+	inline simd4f simd() const { return simd4f::LoadUnaligned(v); }
+
+	inline float4 operator -() const { return float4(simd4f(0.f) - simd()); }
+	inline float4 operator -(const float s) const { return float4(simd() - simd4f(s)); }
+	inline float4 operator -(const float4& s) const { return float4(simd() - s.simd()); }
+	inline float4 operator -=(const float s) { return *this = *this - s; }
+	inline float4 operator -=(const float4& s) { return *this = *this - s; }
+	inline friend float4 operator -(const float a, const float4& s) { return float4(simd4f(a) - s.simd()); }
+
+	inline float4 operator +(const float s) const { return float4(simd() + simd4f(s)); }
+	inline float4 operator +(const float4& s) const { return float4(simd() + s.simd()); }
+	inline float4 operator +=(const float s) { return *this = *this + s; }
+	inline float4 operator +=(const float4& s) { return *this = *this + s; }
+	inline friend float4 operator +(const float a, const float4& s) { return s + a; }
+
+	inline float4 operator *(const float s) const { return float4(simd() * simd4f(s)); }
+	inline float4 operator *(const float4& s) const { return float4(simd() * s.simd()); }
+	inline float4 operator *=(const float s) { return *this = *this * s; }
+	inline float4 operator *=(const float4& s) { return *this = *this * s; }
+	inline friend float4 operator *(const float a, const float4& s) { return s * a; }
+
+	inline friend float4 operator /(const float a, const float4& s) { return float4(simd4f(a) / s.simd()); }
+	inline float4 operator /(const float s) const { return operator*(1.f / s); }
+	inline float4 operator /(const float4& s) const { return float4(simd() / s.simd()); }
+	inline float4 operator /=(const float s) { return operator*=(1.f / s); }
+	inline float4 operator /=(const float4& v) { return *this = *this / v; }
+#else
 	inline float4 operator -() const {
 		float4 r;
 		rpt4(i) r.v[i] = -v[i];
@@ -1274,6 +1311,7 @@ struct float4 {
 	inline float4 operator /(const float4& s) const { return operator*(1.f / s); }
 	inline float4 operator /=(const float s) { return operator*=(1.f / s); }
 	inline float4 operator /=(const float4& v) { return operator*=(1.f / v); }
+#endif
 
 	inline float& operator[](int i) {
 		return v[i];
@@ -1684,6 +1722,8 @@ inline double4::double4(const double2& s) { rpt2(i) v[i] = s.v[i]; z = w = 0; }
 inline double4::double4(const double3& s) { rpt3(i) v[i] = s.v[i]; w = 0; }
 #pragma pack(pop)
 
+inline simd4f::simd4f(const float4& s) : simd4f(simd4f::LoadUnaligned(s.v)) {}
+
 #pragma region trigonometry
 inline float2 sin(const float2& s) {
 	float2 r;
@@ -2103,6 +2143,27 @@ struct quaternion {
 		return *this;
 	}
 
+#ifdef MATH_SIMD
+	inline quaternion operator +(const quaternion& s) const { quaternion r; r.xyzw = xyzw + s.xyzw; return r; }
+	inline quaternion operator -(const quaternion& s) const { quaternion r; r.xyzw = xyzw - s.xyzw; return r; }
+
+	inline quaternion operator *(const quaternion& s) const {
+		simd4f a = xyzw.simd();
+		simd4f b = s.xyzw.simd();
+		// The w lane negates the a.x * b.x and a.y * b.y terms
+		simd4f sign(1.f, 1.f, 1.f, -1.f);
+		simd4f r = shuffle<3, 3, 3, 3>(a, a) * b;
+		r = r + shuffle<0, 1, 2, 0>(a, a) * shuffle<3, 3, 3, 0>(b, b) * sign;
+		r = r + shuffle<1, 2, 0, 1>(a, a) * shuffle<2, 0, 1, 1>(b, b) * sign;
+		r = r - shuffle<2, 0, 1, 2>(a, a) * shuffle<1, 2, 0, 2>(b, b);
+		quaternion q;
+		q.xyzw = float4(r);
+		return q;
+	}
+
+	inline quaternion operator *(const float s) const { quaternion r; r.xyzw = xyzw * s; return r; }
+	inline quaternion operator *=(const float s) { xyzw *= s; return *this; }
+#else
 	inline quaternion operator +(const quaternion& s) const {
 		quaternion r;
 		rpt4(i) r.v[i] = v[i] + s.v[i];
@@ -2121,11 +2182,6 @@ struct quaternion {
 			w * s.z + s.w * z + x * s.y - s.x * y,
 			w * s.w - x * s.x - y * s.y - z * s.z);
 	}
-	inline quaternion operator *=(const quaternion& s) {
-		*this = *this * s;
-		return *this;
-	}
-
 	inline quaternion operator *(const float s) const {
 		quaternion r;
 		rpt4(i) r.v[i] = v[i] * s;
@@ -2135,6 +2191,11 @@ struct quaternion {
 		rpt4(i) v[i] *= s;
 		return *this;
 	}
+#endif
+	inline quaternion operator *=(const quaternion& s) {
+		*this = *this * s;
+		return *this;
+	}
 
 	inline quaternion operator /(const float s) const { return operator*(1.f / s); }
 	inline quaternion operator /=(const float s) { return operator*=(1.f / s); }
@@ -2337,6 +2398,14 @@ struct float4x4 {
 		rm.v[3].xyz = t;
 		return rm;
 	}
+	/// Inverse of TRS(t, r, s) for a unit quaternion r, computed as S^-1 * R^T * T^-1 instead of with a general inverse
+	inline static float4x4 InverseTRS(const float3& t, const quaternion& r, const float3& s) {
+		float4x4 rm(quaternion(-r.x, -r.y, -r.z, r.w));
+		float4 is(1.f / s.x, 1.f / s.y, 1.f / s.z, 1.f);
+		rpt3(i) rm.v[i] *= is;
+		rm.v[3] = float4(0, 0, 0, 1) - (rm.v[0] * t.x + rm.v[1] * t.y + rm.v[2] * t.z);
+		return rm;
+	}
 
 	inline float4& operator[](int i) {
 		return v[i];
@@ -2372,6 +2441,29 @@ struct float4x4 {
 	inline float4x4 operator/(const float& s) const { return operator *(1.f / s); }
 	inline float4x4 operator/=(const float& s) { return operator *=(1.f / s); }
 
+#ifdef MATH_SIMD
+	inline float4 operator*(const float4& s) const {
+		simd4f x = s.simd();
+		simd4f r = v[0].simd() * shuffle<0, 0, 0, 0>(x, x);
+		r = r + v[1].simd() * shuffle<1, 1, 1, 1>(x, x);
+		r = r + v[2].simd() * shuffle<2, 2, 2, 2>(x, x);
+		r = r + v[3].simd() * shuffle<3, 3, 3, 3>(x, x);
+		return float4(r);
+	}
+	inline float4x4 operator*(const float4x4& m) const {
+		simd4f c0 = v[0].simd(), c1 = v[1].simd(), c2 = v[2].simd(), c3 = v[3].simd();
+		float4x4 r;
+		rpt4(i) {
+			simd4f x = m.v[i].simd();
+			simd4f c = c0 * shuffle<0, 0, 0, 0>(x, x);
+			c = c + c1 * shuffle<1, 1, 1, 1>(x, x);
+			c = c + c2 * shuffle<2, 2, 2, 2>(x, x);
+			c = c + c3 * shuffle<3, 3, 3, 3>(x, x);
+			r.v[i] = float4(c);
+		}
+		return r;
+	}
+#else
 	inline float4 operator*(const float4& s) const {
 		float4 r = 0;
 		rpt4(i) r += v[i] * s.v[i];
@@ -2382,6 +2474,7 @@ struct float4x4 {
 		rpt4(i) r.v[i] = (*this) * m.v[i];
 		return r;
 	}
+#endif
 	inline float4x4 operator*=(const float4x4& m) {
 		*this = operator*(m);
 		return *this;
@@ -2401,6 +2494,49 @@ struct float4x4 {
 };
 #pragma pack(pop)
 
+#ifdef MATH_SIMD
+/// (m2[a] * m3[b] - m3[a] * m2[b], same, m1[a] * m3[b] - m3[a] * m1[b], m1[a] * m2[b] - m2[a] * m1[b])
+template<int a, int b>
+inline simd4f inverse_factor(const simd4f& m1, const simd4f& m2, const simd4f& m3) {
+	simd4f a21 = shuffle<a, a, a, a>(m2, m1);
+	simd4f b21 = shuffle<b, b, b, b>(m2, m1);
+	simd4f a32 = shuffle<a, a, a, a>(m3, m2);
+	simd4f b32 = shuffle<b, b, b, b>(m3, m2);
+	return a21 * shuffle<0, 0, 0, 2>(b32, b32) - shuffle<0, 0, 0, 2>(a32, a32) * b21;
+}
+inline float4x4 inverse(const float4x4& m) {
+	// Same cofactor expansion as the scalar version below, with each float4 built by shuffling columns
+	simd4f m0 = m.v[0].simd(), m1 = m.v[1].simd(), m2 = m.v[2].simd(), m3 = m.v[3].simd();
+
+	simd4f f0 = inverse_factor<2, 3>(m1, m2, m3);
+	simd4f f1 = inverse_factor<1, 3>(m1, m2, m3);
+	simd4f f2 = inverse_factor<1, 2>(m1, m2, m3);
+	simd4f f3 = inverse_factor<0, 3>(m1, m2, m3);
+	simd4f f4 = inverse_factor<0, 2>(m1, m2, m3);
+	simd4f f5 = inverse_factor<0, 1>(m1, m2, m3);
+
+	// (m1[i], m0[i], m0[i], m0[i])
+	simd4f t;
+	t = shuffle<0, 0, 0, 0>(m1, m0); simd4f v0 = shuffle<0, 2, 2, 2>(t, t);
+	t = shuffle<1, 1, 1, 1>(m1, m0); simd4f v1 = shuffle<0, 2, 2, 2>(t, t);
+	t = shuffle<2, 2, 2, 2>(m1, m0); simd4f v2 = shuffle<0, 2, 2, 2>(t, t);
+	t = shuffle<3, 3, 3, 3>(m1, m0); simd4f v3 = shuffle<0, 2, 2, 2>(t, t);
+
+	simd4f sa(+1, -1, +1, -1);
+	simd4f sb(-1, +1, -1, +1);
+	simd4f i0 = (v1 * f0 - v2 * f1 + v3 * f2) * sa;
+	simd4f i1 = (v0 * f0 - v2 * f3 + v3 * f4) * sb;
+	simd4f i2 = (v0 * f1 - v1 * f3 + v3 * f5) * sa;
+	simd4f i3 = (v0 * f2 - v1 * f4 + v2 * f5) * sb;
+
+	// (i0[0], i1[0], i2[0], i3[0])
+	simd4f r0 = shuffle<0, 2, 0, 2>(shuffle<0, 0, 0, 0>(i0, i1), shuffle<0, 0, 0, 0>(i2, i3));
+	simd4f d0 = m0 * r0;
+	simd4f d1 = d0 + shuffle<1, 0, 3, 2>(d0, d0);
+	simd4f rcp = simd4f(1.f) / (d1 + shuffle<2, 3, 0, 1>(d1, d1));
+	return float4x4(float4(i0 * rcp), float4(i1 * rcp), float4(i2 * rcp), float4(i3 * rcp));
+}
+#else
 inline float4x4 inverse(const float4x4& m) {
 	float c00 = m[2][2] * m[3][3] - m[3][2] * m[2][3];
 	float c02 = m[1][2] * m[3][3] - m[3][2] * m[1][3];
@@ -2452,6 +2588,7 @@ inline float4x4 inverse(const float4x4& m) {
 	float4 d0(m[0] * r0);
 	return inv / ((d0.x + d0.y) + (d0.z + d0.w));
 }
+#endif
 inline quaternion inverse(const quaternion& q) {
 	const float s = 1.f / dot(q.xyzw, q.xyzw);
 	return quaternion(-q.x, -q.y, -q.z, q.w) * s;
@@ -2463,11 +2600,22 @@ inline quaternion normalize(const quaternion& q){
 }
 
 inline float4x4 transpose(const float4x4& m) {
+#ifdef MATH_SIMD
+	simd4f m0 = m.v[0].simd(), m1 = m.v[1].simd(), m2 = m.v[2].simd(), m3 = m.v[3].simd();
+	simd4f t0 = shuffle<0, 1, 0, 1>(m0, m1);
+	simd4f t1 = shuffle<0, 1, 0, 1>(m2, m3);
+	simd4f t2 = shuffle<2, 3, 2, 3>(m0, m1);
+	simd4f t3 = shuffle<2, 3, 2, 3>(m2, m3);
+	return float4x4(
+		float4(shuffle<0, 2, 0, 2>(t0, t1)), float4(shuffle<1, 3, 1, 3>(t0, t1)),
+		float4(shuffle<0, 2, 0, 2>(t2, t3)), float4(shuffle<1, 3, 1, 3>(t2, t3)));
+#else
 	return float4x4(
 		m[0][0], m[0][1], m[0][2], m[0][3],
 		m[1][0], m[1][1], m[1][2], m[1][3],
 		m[2][0], m[2][1], m[2][2], m[2][3],
 		m[3][0], m[3][1], m[3][2], m[3][3] );
+#endif
 }
 
 namespace std {
@@ -2792,14 +2940,22 @@ inline float3 frac(const float3& a) {
 }
 
 inline float4 min(const float4& a, const float4& b) {
+#ifdef MATH_SIMD
+	return float4(min(a.simd(), b.simd()));
+#else
 	float4 r;
 	rpt4(i) r.v[i] = fminf(a.v[i], b.v[i]);
 	return r;
+#endif
 }
 inline float4 max(const float4& a, const float4& b) {
+#ifdef MATH_SIMD
+	return float4(max(a.simd(), b.simd()));
+#else
 	float4 r;
 	rpt4(i) r.v[i] = fmaxf(a.v[i], b.v[i]);
 	return r;
+#endif
 }
 inline float4 clamp(const float4& a, const float4& l, const float4& h) {
 	float4 r;
@@ -2807,9 +2963,13 @@ inline float4 clamp(const float4& a, const float4& l, const float4& h) {
 	return r;
 }
 inline float4 abs(const float4& a) {
+#ifdef MATH_SIMD
+	return float4(abs(a.simd()));
+#else
 	float4 r;
 	rpt4(i) r.v[i] = fabs(a.v[i]);
 	return r;
+#endif
 }
 inline float4 floor(const float4& a){
 	float4 r;
@@ -0,0 +1,199 @@
+#pragma once
+
+// Included by Math.hpp, so it can't use the Math types except through the conversions Math.hpp defines
+
+// Compile-time SIMD backend selection. Define SIMD_DISABLE to force the scalar path.
+#ifndef SIMD_DISABLE
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE
+#endif
+#if defined(SIMD_SSE) && defined(__AVX__)
+#define SIMD_AVX
+#endif
+#if !defined(SIMD_SSE) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define SIMD_NEON
+#endif
+#endif
+
+#if defined(SIMD_AVX)
+#include <immintrin.h>
+#elif defined(SIMD_SSE)
+#include <emmintrin.h>
+#elif defined(SIMD_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <cstdint>
+#include <math.h>
+
+struct float4;
+
+/// 4 float lanes. Comparisons return a lane mask (all bits set where true), use movemask() to get one bit per lane.
+struct simd4f {
+#if defined(SIMD_SSE)
+	__m128 v;
+	inline simd4f(__m128 v) : v(v) {}
+	inline simd4f(float s) : v(_mm_set1_ps(s)) {}
+	inline simd4f(float x, float y, float z, float w) : v(_mm_setr_ps(x, y, z, w)) {}
+	inline static simd4f Load(const float* p) { return _mm_load_ps(p); }
+	inline static simd4f LoadUnaligned(const float* p) { return _mm_loadu_ps(p); }
+	inline void Store(float* p) const { _mm_store_ps(p, v); }
+	inline void StoreUnaligned(float* p) const { _mm_storeu_ps(p, v); }
+
+	inline simd4f operator +(const simd4f& s) const { return _mm_add_ps(v, s.v); }
+	inline simd4f operator -(const simd4f& s) const { return _mm_sub_ps(v, s.v); }
+	inline simd4f operator *(const simd4f& s) const { return _mm_mul_ps(v, s.v); }
+	inline simd4f operator /(const simd4f& s) const { return _mm_div_ps(v, s.v); }
+	inline simd4f operator &(const simd4f& s) const { return _mm_and_ps(v, s.v); }
+	inline simd4f operator |(const simd4f& s) const { return _mm_or_ps(v, s.v); }
+	inline simd4f operator <(const simd4f& s) const { return _mm_cmplt_ps(v, s.v); }
+	inline simd4f operator <=(const simd4f& s) const { return _mm_cmple_ps(v, s.v); }
+	inline simd4f operator >(const simd4f& s) const { return _mm_cmpgt_ps(v, s.v); }
+	inline simd4f operator >=(const simd4f& s) const { return _mm_cmpge_ps(v, s.v); }
+
+	inline friend simd4f min(const simd4f& a, const simd4f& b) { return _mm_min_ps(a.v, b.v); }
+	inline friend simd4f max(const simd4f& a, const simd4f& b) { return _mm_max_ps(a.v, b.v); }
+	inline friend simd4f abs(const simd4f& a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a.v); }
+	inline friend simd4f select(const simd4f& mask, const simd4f& a, const simd4f& b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+	inline friend uint32_t movemask(const simd4f& a) { return (uint32_t)_mm_movemask_ps(a.v); }
+#elif defined(SIMD_NEON)
+	float32x4_t v;
+	inline simd4f(float32x4_t v) : v(v) {}
+	inline simd4f(uint32x4_t m) : v(vreinterpretq_f32_u32(m)) {}
+	inline simd4f(float s) : v(vdupq_n_f32(s)) {}
+	inline simd4f(float x, float y, float z, float w) { float t[4] { x, y, z, w }; v = vld1q_f32(t); }
+	inline static simd4f Load(const float* p) { return vld1q_f32(p); }
+	inline static simd4f LoadUnaligned(const float* p) { return vld1q_f32(p); }
+	inline void Store(float* p) const { vst1q_f32(p, v); }
+	inline void StoreUnaligned(float* p) const { vst1q_f32(p, v); }
+
+	inline simd4f operator +(const simd4f& s) const { return vaddq_f32(v, s.v); }
+	inline simd4f operator -(const simd4f& s) const { return vsubq_f32(v, s.v); }
+	inline simd4f operator *(const simd4f& s) const { return vmulq_f32(v, s.v); }
+	inline simd4f operator /(const simd4f& s) const { return vdivq_f32(v, s.v); }
+	inline simd4f operator &(const simd4f& s) const { return vandq_u32(vreinterpretq_u32_f32(v), vreinterpretq_u32_f32(s.v)); }
+	inline simd4f operator |(const simd4f& s) const { return vorrq_u32(vreinterpretq_u32_f32(v), vreinterpretq_u32_f32(s.v)); }
+	inline simd4f operator <(const simd4f& s) const { return vcltq_f32(v, s.v); }
+	inline simd4f operator <=(const simd4f& s) const { return vcleq_f32(v, s.v); }
+	inline simd4f operator >(const simd4f& s) const { return vcgtq_f32(v, s.v); }
+	inline simd4f operator >=(const simd4f& s) const { return vcgeq_f32(v, s.v); }
+
+	inline friend simd4f min(const simd4f& a, const simd4f& b) { return vminq_f32(a.v, b.v); }
+	inline friend simd4f max(const simd4f& a, const simd4f& b) { return vmaxq_f32(a.v, b.v); }
+	inline friend simd4f abs(const simd4f& a) { return vabsq_f32(a.v); }
+	inline friend simd4f select(const simd4f& mask, const simd4f& a, const simd4f& b) { return vbslq_f32(vreinterpretq_u32_f32(mask.v), a.v, b.v); }
+	inline friend uint32_t movemask(const simd4f& a) {
+		const int32_t shifts[4] { 0, 1, 2, 3 };
+		uint32x4_t bits = vshlq_u32(vshrq_n_u32(vreinterpretq_u32_f32(a.v), 31), vld1q_s32(shifts));
+		return vaddvq_u32(bits);
+	}
+#else
+	// Lane masks are stored as integer bits, aliased through the union
+	union {
+		float v[4];
+		uint32_t u[4];
+	};
+	inline simd4f(float s) { for (int i = 0; i < 4; i++) v[i] = s; }
+	inline simd4f(float x, float y, float z, float w) { v[0] = x; v[1] = y; v[2] = z; v[3] = w; }
+	inline static simd4f Load(const float* p) { simd4f r; for (int i = 0; i < 4; i++) r.v[i] = p[i]; return r; }
+	inline static simd4f LoadUnaligned(const float* p) { return Load(p); }
+	inline void Store(float* p) const { for (int i = 0; i < 4; i++) p[i] = v[i]; }
+	inline void StoreUnaligned(float* p) const { Store(p); }
+
+	inline simd4f operator +(const simd4f& s) const { simd4f r; for (int i = 0; i < 4; i++) r.v[i] = v[i] + s.v[i]; return r; }
+	inline simd4f operator -(const simd4f& s) const { simd4f r; for (int i = 0; i < 4; i++) r.v[i] = v[i] - s.v[i]; return r; }
+	inline simd4f operator *(const simd4f& s) const { simd4f r; for (int i = 0; i < 4; i++) r.v[i] = v[i] * s.v[i]; return r; }
+	inline simd4f operator /(const simd4f& s) const { simd4f r; for (int i = 0; i < 4; i++) r.v[i] = v[i] / s.v[i]; return r; }
+	inline simd4f operator &(const simd4f& s) const { simd4f r; for (int i = 0; i < 4; i++) r.u[i] = u[i] & s.u[i]; return r; }
+	inline simd4f operator |(const simd4f& s) const { simd4f r; for (int i = 0; i < 4; i++) r.u[i] = u[i] | s.u[i]; return r; }
+	inline simd4f operator <(const simd4f& s) const { simd4f r; for (int i = 0; i < 4; i++) r.u[i] = v[i] < s.v[i] ? ~0u : 0u; return r; }
+	inline simd4f operator <=(const simd4f& s) const { simd4f r; for (int i = 0; i < 4; i++) r.u[i] = v[i] <= s.v[i] ? ~0u : 0u; return r; }
+	inline simd4f operator >(const simd4f& s) const { simd4f r; for (int i = 0; i < 4; i++) r.u[i] = v[i] > s.v[i] ? ~0u : 0u; return r; }
+	inline simd4f operator >=(const simd4f& s) const { simd4f r; for (int i = 0; i < 4; i++) r.u[i] = v[i] >= s.v[i] ? ~0u : 0u; return r; }
+
+	inline friend simd4f min(const simd4f& a, const simd4f& b) { simd4f r; for (int i = 0; i < 4; i++) r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]; return r; }
+	inline friend simd4f max(const simd4f& a, const simd4f& b) { simd4f r; for (int i = 0; i < 4; i++) r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]; return r; }
+	inline friend simd4f abs(const simd4f& a) { simd4f r; for (int i = 0; i < 4; i++) r.v[i] = fabsf(a.v[i]); return r; }
+	inline friend simd4f select(const simd4f& mask, const simd4f& a, const simd4f& b) { simd4f r; for (int i = 0; i < 4; i++) r.v[i] = mask.u[i] ? a.v[i] : b.v[i]; return r; }
+	inline friend uint32_t movemask(const simd4f& a) { uint32_t m = 0; for (int i = 0; i < 4; i++) m |= (a.u[i] >> 31) << i; return m; }
+#endif
+	inline simd4f() {}
+	// Defined in Math.hpp
+	inline simd4f(const float4& s);
+};
+
+/// Returns (a[i0], a[i1], b[i2], b[i3]). Pass the same vector twice to permute one vector
+template<int i0, int i1, int i2, int i3>
+inline simd4f shuffle(const simd4f& a, const simd4f& b) {
+#if defined(SIMD_SSE)
+	return _mm_shuffle_ps(a.v, b.v, _MM_SHUFFLE(i3, i2, i1, i0));
+#elif defined(SIMD_NEON)
+	float32x4_t r = vdupq_n_f32(vgetq_lane_f32(a.v, i0));
+	r = vsetq_lane_f32(vgetq_lane_f32(a.v, i1), r, 1);
+	r = vsetq_lane_f32(vgetq_lane_f32(b.v, i2), r, 2);
+	return vsetq_lane_f32(vgetq_lane_f32(b.v, i3), r, 3);
+#else
+	return simd4f(a.v[i0], a.v[i1], b.v[i2], b.v[i3]);
+#endif
+}
+
+/// 8 float lanes. Uses AVX when available, otherwise a pair of simd4f.
+struct simd8f {
+#if defined(SIMD_AVX)
+	__m256 v;
+	inline simd8f(__m256 v) : v(v) {}
+	inline simd8f(float s) : v(_mm256_set1_ps(s)) {}
+	inline static simd8f Load(const float* p) { return _mm256_load_ps(p); }
+	inline static simd8f LoadUnaligned(const float* p) { return _mm256_loadu_ps(p); }
+	inline void Store(float* p) const { _mm256_store_ps(p, v); }
+	inline void StoreUnaligned(float* p) const { _mm256_storeu_ps(p, v); }
+
+	inline simd8f operator +(const simd8f& s) const { return _mm256_add_ps(v, s.v); }
+	inline simd8f operator -(const simd8f& s) const { return _mm256_sub_ps(v, s.v); }
+	inline simd8f operator *(const simd8f& s) const { return _mm256_mul_ps(v, s.v); }
+	inline simd8f operator /(const simd8f& s) const { return _mm256_div_ps(v, s.v); }
+	inline simd8f operator &(const simd8f& s) const { return _mm256_and_ps(v, s.v); }
+	inline simd8f operator |(const simd8f& s) const { return _mm256_or_ps(v, s.v); }
+	inline simd8f operator <(const simd8f& s) const { return _mm256_cmp_ps(v, s.v, _CMP_LT_OQ); }
+	inline simd8f operator <=(const simd8f& s) const { return _mm256_cmp_ps(v, s.v, _CMP_LE_OQ); }
+	inline simd8f operator >(const simd8f& s) const { return _mm256_cmp_ps(v, s.v, _CMP_GT_OQ); }
+	inline simd8f operator >=(const simd8f& s) const { return _mm256_cmp_ps(v, s.v, _CMP_GE_OQ); }
+
+	inline friend simd8f min(const simd8f& a, const simd8f& b) { return _mm256_min_ps(a.v, b.v); }
+	inline friend simd8f max(const simd8f& a, const simd8f& b) { return _mm256_max_ps(a.v, b.v); }
+	inline friend simd8f abs(const simd8f& a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a.v); }
+	inline friend simd8f select(const simd8f& mask, const simd8f& a, const simd8f& b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+	inline friend uint32_t movemask(const simd8f& a) { return (uint32_t)_mm256_movemask_ps(a.v); }
+#else
+	simd4f lo;
+	simd4f hi;
+	inline simd8f(const simd4f& lo, const simd4f& hi) : lo(lo), hi(hi) {}
+	inline simd8f(float s) : lo(s), hi(s) {}
+	inline static simd8f Load(const float* p) { return simd8f(simd4f::Load(p), simd4f::Load(p + 4)); }
+	inline static simd8f LoadUnaligned(const float* p) { return simd8f(simd4f::LoadUnaligned(p), simd4f::LoadUnaligned(p + 4)); }
+	inline void Store(float* p) const { lo.Store(p); hi.Store(p + 4); }
+	inline void StoreUnaligned(float* p) const { lo.StoreUnaligned(p); hi.StoreUnaligned(p + 4); }
+
+	inline simd8f operator +(const simd8f& s) const { return simd8f(lo + s.lo, hi + s.hi); }
+	inline simd8f operator -(const simd8f& s) const { return simd8f(lo - s.lo, hi - s.hi); }
+	inline simd8f operator *(const simd8f& s) const { return simd8f(lo * s.lo, hi * s.hi); }
+	inline simd8f operator /(const simd8f& s) const { return simd8f(lo / s.lo, hi / s.hi); }
+	inline simd8f operator &(const simd8f& s) const { return simd8f(lo & s.lo, hi & s.hi); }
+	inline simd8f operator |(const simd8f& s) const { return simd8f(lo | s.lo, hi | s.hi); }
+	inline simd8f operator <(const simd8f& s) const { return simd8f(lo < s.lo, hi < s.hi); }
+	inline simd8f operator <=(const simd8f& s) const { return simd8f(lo <= s.lo, hi <= s.hi); }
+	inline simd8f operator >(const simd8f& s) const { return simd8f(lo > s.lo, hi > s.hi); }
+	inline simd8f operator >=(const simd8f& s) const { return simd8f(lo >= s.lo, hi >= s.hi); }
+
+	inline friend simd8f min(const simd8f& a, const simd8f& b) { return simd8f(min(a.lo, b.lo), min(a.hi, b.hi)); }
+	inline friend simd8f max(const simd8f& a, const simd8f& b) { return simd8f(max(a.lo, b.lo), max(a.hi, b.hi)); }
+	inline friend simd8f abs(const simd8f& a) { return simd8f(abs(a.lo), abs(a.hi)); }
+	inline friend simd8f select(const simd8f& mask, const simd8f& a, const simd8f& b) { return simd8f(select(mask.lo, a.lo, b.lo), select(mask.hi, a.hi, b.hi)); }
+	inline friend uint32_t movemask(const simd8f& a) { return movemask(a.lo) | (movemask(a.hi) << 4); }
+#endif
+	inline simd8f() {}
+};
+
+template<uint32_t Width> struct simd_float;
+template<> struct simd_float<4> { typedef simd4f type; };
+template<> struct simd_float<8> { typedef simd8f type; };
\ No newline at end of file
@@ -202,5 +202,14 @@ void CameraControl::PreRenderScene(CommandBuffer* commandBuffer, Camera* camera,
 
 		snprintf(tmpText, 64, "%.2fms\n%d DescriptorSets", mScene->FPS(), commandBuffer->Device()->DescriptorSetCount());
 		GUI::DrawString(sem16, tmpText, 1.f, float2(5, camera->FramebufferHeight() - 30), 18.f);
+
+		#ifdef PROFILER_ENABLE
+		float counterY = camera->FramebufferHeight() - 70.f;
+		for (const ProfilerCounter& c : Profiler::LastFrameCounters()) {
+			snprintf(tmpText, 64, "%s: %lld", c.mLabel, (long long)c.mValue);
+			GUI::DrawString(reg14, tmpText, 1.f, float2(5, counterY), 14.f);
+			counterY -= 16.f;
+		}
+		#endif
 	}
 }
\ No newline at end of file
@@ -0,0 +1,187 @@
+#include <Scene/BvhBuilder.hpp>
+
+using namespace std;
+
+void BvhBuilder::Build(const AABB* primitiveBounds, uint32_t primitiveCount, const BvhBuildSettings& settings, vector<Bvh2Node>& nodes, vector<uint32_t>& primitiveOrder) {
+	nodes.clear();
+	primitiveOrder.resize(primitiveCount);
+	if (primitiveCount == 0) return;
+
+	vector<float3> centroids(primitiveCount);
+	for (uint32_t i = 0; i < primitiveCount; i++) {
+		primitiveOrder[i] = i;
+		centroids[i] = primitiveBounds[i].Center();
+	}
+
+	struct BuildTask {
+		// Index of the parent node if this is a right child, otherwise 0xFFFFFFFF
+		uint32_t mParent;
+		uint32_t mStart;
+		uint32_t mEnd;
+	};
+	struct Bin {
+		AABB mBounds;
+		uint32_t mCount;
+	};
+
+	uint32_t binCount = max(2u, settings.mBinCount);
+	vector<Bin> bins(binCount);
+	vector<float> rightCost(binCount);
+
+	vector<BuildTask> todo;
+	todo.reserve(64);
+	todo.push_back({ 0xFFFFFFFF, 0, primitiveCount });
+
+	nodes.reserve(2 * primitiveCount / max(1u, settings.mLeafSize));
+
+	while (todo.size()) {
+		// Pop the next item off of the stack
+		BuildTask task = todo.back();
+		todo.pop_back();
+		uint32_t start = task.mStart;
+		uint32_t end = task.mEnd;
+		uint32_t nPrims = end - start;
+
+		// The right child sets up the offset for the flat tree
+		uint32_t nodeIndex = (uint32_t)nodes.size();
+		if (task.mParent != 0xFFFFFFFF)
+			nodes[task.mParent].mRightOffset = nodeIndex - task.mParent;
+
+		// Calculate the bounding box for this node
+		AABB bb(primitiveBounds[primitiveOrder[start]]);
+		AABB bc(centroids[primitiveOrder[start]], centroids[primitiveOrder[start]]);
+		for (uint32_t p = start + 1; p < end; ++p) {
+			bb.Encapsulate(primitiveBounds[primitiveOrder[p]]);
+			bc.Encapsulate(centroids[primitiveOrder[p]]);
+		}
+
+		Bvh2Node node;
+		node.mBounds = bb;
+		node.mStartIndex = start;
+		node.mCount = nPrims;
+		node.mRightOffset = 0; // Leaves are signified by rightOffset == 0
+		nodes.push_back(node);
+
+		// If the number of primitives at this point is less than the leaf size, then this will become a leaf.
+		if (nPrims <= settings.mLeafSize) continue;
+
+		float3 ext = bc.mMax - bc.mMin;
+		uint32_t mid = start;
+
+		if (settings.mSplitMethod == BVH_SPLIT_SAH) {
+			float bestCost = 1e30f;
+			int32_t bestAxis = -1;
+			uint32_t bestBin = 0;
+
+			for (uint32_t axis = 0; axis < 3; axis++) {
+				if (ext[axis] <= 0.f) continue;
+				float scale = binCount / ext[axis];
+
+				for (Bin& b : bins) {
+					b.mBounds = AABB(float3(1e30f), float3(-1e30f));
+					b.mCount = 0;
+				}
+				for (uint32_t p = start; p < end; p++) {
+					uint32_t i = primitiveOrder[p];
+					uint32_t b = min(binCount - 1, (uint32_t)((centroids[i][axis] - bc.mMin[axis]) * scale));
+					bins[b].mBounds.Encapsulate(primitiveBounds[i]);
+					bins[b].mCount++;
+				}
+
+				// Sweep from the right to find the cost of everything right of each split plane
+				AABB rb(float3(1e30f), float3(-1e30f));
+				uint32_t rc = 0;
+				for (uint32_t b = binCount - 1; b > 0; b--) {
+					rb.Encapsulate(bins[b].mBounds);
+					rc += bins[b].mCount;
+					rightCost[b] = rc ? SurfaceArea(rb) * rc : 0.f;
+				}
+
+				// Sweep from the left, split plane b is between bin b and bin b+1
+				AABB lb(float3(1e30f), float3(-1e30f));
+				uint32_t lc = 0;
+				for (uint32_t b = 0; b < binCount - 1; b++) {
+					lb.Encapsulate(bins[b].mBounds);
+					lc += bins[b].mCount;
+					if (lc == 0 || lc == nPrims) continue;
+					float cost = SurfaceArea(lb) * lc + rightCost[b + 1];
+					if (cost < bestCost) {
+						bestCost = cost;
+						bestAxis = axis;
+						bestBin = b;
+					}
+				}
+			}
+
+			if (bestAxis != -1) {
+				float scale = binCount / ext[bestAxis];
+				float mn = bc.mMin[bestAxis];
+				mid = (uint32_t)(partition(primitiveOrder.begin() + start, primitiveOrder.begin() + end, [&](uint32_t i) {
+					return min(binCount - 1, (uint32_t)((centroids[i][bestAxis] - mn) * scale)) <= bestBin;
+				}) - primitiveOrder.begin());
+			}
+		} else {
+			// Set the split dimensions
+			uint32_t split_dim = 0;
+			if (ext.y > ext.x) {
+				split_dim = 1;
+				if (ext.z > ext.y) split_dim = 2;
+			} else
+				if (ext.z > ext.x) split_dim = 2;
+
+			// Split on the center of the longest axis
+			float split_coord = .5f * (bc.mMin[split_dim] + bc.mMax[split_dim]);
+
+			// Partition the list of objects on this split
+			mid = (uint32_t)(partition(primitiveOrder.begin() + start, primitiveOrder.begin() + end, [&](uint32_t i) {
+				return centroids[i][split_dim] < split_coord;
+			}) - primitiveOrder.begin());
+		}
+
+		// If we get a bad split, just choose the center...
+		if (mid == start || mid == end)
+			mid = start + (end - start) / 2;
+
+		// Push the right child first so the left child is emitted directly after this node
+		todo.push_back({ nodeIndex, mid, end });
+		todo.push_back({ 0xFFFFFFFF, start, mid });
+	}
+}
+
+BvhStats BvhBuilder::ComputeStats(const vector<Bvh2Node>& nodes, const BvhBuildSettings& settings) {
+	BvhStats stats = {};
+	if (nodes.empty()) return stats;
+
+	float rootArea = SurfaceArea(nodes[0].mBounds);
+	if (rootArea <= 0.f) rootArea = 1.f;
+
+	uint64_t leafDepthSum = 0;
+
+	vector<pair<uint32_t, uint32_t>> todo;
+	todo.push_back(make_pair(0u, 0u));
+	while (todo.size()) {
+		uint32_t ni = todo.back().first;
+		uint32_t depth = todo.back().second;
+		todo.pop_back();
+		const Bvh2Node& node = nodes[ni];
+
+		stats.mNodeCount++;
+		stats.mMaxDepth = max(stats.mMaxDepth, depth);
+
+		float relativeArea = SurfaceArea(node.mBounds) / rootArea;
+		if (node.mRightOffset == 0) {
+			stats.mLeafCount++;
+			stats.mSahCost += settings.mIntersectionCost * node.mCount * relativeArea;
+			leafDepthSum += depth;
+			if (stats.mLeafHistogram.size() <= node.mCount) stats.mLeafHistogram.resize(node.mCount + 1);
+			stats.mLeafHistogram[node.mCount]++;
+		} else {
+			stats.mSahCost += settings.mTraversalCost * relativeArea;
+			todo.push_back(make_pair(ni + node.mRightOffset, depth + 1));
+			todo.push_back(make_pair(ni + 1, depth + 1));
+		}
+	}
+
+	stats.mAverageLeafDepth = stats.mLeafCount ? (float)leafDepthSum / (float)stats.mLeafCount : 0.f;
+	return stats;
+}
\ No newline at end of file
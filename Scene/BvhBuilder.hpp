@@ -0,0 +1,63 @@
+#pragma once
+
+#include <Util/Util.hpp>
+
+/// Node layout shared by ObjectBvh2 and TriangleBvh2
+struct Bvh2Node {
+	AABB mBounds;
+	// index of the first primitive inside this node
+	uint32_t mStartIndex;
+	// number of primitives inside this node
+	uint32_t mCount;
+	uint32_t mRightOffset; // 1st child is at node[index + 1], 2nd child is at node[index + mRightOffset]
+};
+
+enum BvhSplitMethod {
+	// Split at the center of the longest centroid axis
+	BVH_SPLIT_MEDIAN = 0,
+	// Binned surface area heuristic
+	BVH_SPLIT_SAH = 1,
+};
+
+struct BvhBuildSettings {
+	BvhSplitMethod mSplitMethod;
+	// Nodes with this many primitives or fewer become leaves
+	uint32_t mLeafSize;
+	// Number of bins per axis used by BVH_SPLIT_SAH
+	uint32_t mBinCount;
+	// Relative cost of traversing a node vs intersecting a primitive, used by BVH_SPLIT_SAH and BvhStats
+	float mTraversalCost;
+	float mIntersectionCost;
+	// Branching factor of the tree used for queries: 4 or 8 collapses the binary tree into a WideBvh, 2 traverses the binary tree directly
+	uint32_t mWidth;
+
+	inline BvhBuildSettings(uint32_t leafSize = 1, BvhSplitMethod splitMethod = BVH_SPLIT_SAH, uint32_t binCount = 16, uint32_t width = 4)
+		: mSplitMethod(splitMethod), mLeafSize(leafSize), mBinCount(binCount), mTraversalCost(1.f), mIntersectionCost(1.f), mWidth(width) {}
+};
+
+/// Tree quality metrics, used to compare builders on the same input
+struct BvhStats {
+	// SAH cost of the whole tree, relative to the surface area of the root
+	float mSahCost;
+	uint32_t mNodeCount;
+	uint32_t mLeafCount;
+	uint32_t mMaxDepth;
+	float mAverageLeafDepth;
+	// mLeafHistogram[i] is the number of leaves containing i primitives
+	std::vector<uint32_t> mLeafHistogram;
+};
+
+class BvhBuilder {
+public:
+	/// Builds a flattened binary tree over primitiveBounds. Nodes are emitted depth-first, with the left child directly after its parent.
+	/// primitiveOrder receives the index of the primitive that belongs at each leaf slot (Node::mStartIndex indexes into primitiveOrder)
+	ENGINE_EXPORT static void Build(const AABB* primitiveBounds, uint32_t primitiveCount, const BvhBuildSettings& settings,
+		std::vector<Bvh2Node>& nodes, std::vector<uint32_t>& primitiveOrder);
+
+	ENGINE_EXPORT static BvhStats ComputeStats(const std::vector<Bvh2Node>& nodes, const BvhBuildSettings& settings);
+
+	inline static float SurfaceArea(const AABB& aabb) {
+		float3 e = aabb.mMax - aabb.mMin;
+		return 2.f * (e.x * e.y + e.y * e.z + e.z * e.x);
+	}
+};
\ No newline at end of file
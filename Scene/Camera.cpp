@@ -7,6 +7,9 @@
  
 using namespace std;
 
+static const PropertyID gStereoEyeID = PropertyToID("StereoEye");
+static const PropertyID gStereoClipTransformID = PropertyToID("StereoClipTransform");
+
 void Camera::CreateDescriptorSet() {
 	VkDescriptorSetLayoutBinding binding = {};
 	binding.binding = CAMERA_BUFFER_BINDING;
@@ -219,6 +222,9 @@ void Camera::Set(CommandBuffer* commandBuffer) {
 	buf.Right = WorldRotation() * float3(1, 0, 0);
 	buf.Up = WorldRotation() * float3(0, 1, 0);
 	
+	SetViewport(commandBuffer);
+}
+void Camera::SetViewport(CommandBuffer* commandBuffer) {
 	VkRect2D scissor{ { 0, 0 }, { mFramebuffer->Width(), mFramebuffer->Height() } };
 	vkCmdSetScissor(*commandBuffer, 0, 1, &scissor);
 	vkCmdSetViewport(*commandBuffer, 0, 1, &mViewport);
@@ -227,7 +233,7 @@ void Camera::Set(CommandBuffer* commandBuffer) {
 void Camera::SetStereo(CommandBuffer* commandBuffer, ShaderVariant* shader, StereoEye eye) {
 	if (!shader) return;
 	uint32_t eyec = eye;
-	commandBuffer->PushConstant(shader, "StereoEye", &eyec);
+	commandBuffer->PushConstant(shader, gStereoEyeID, &eyec);
 
 	float4 clipst(1, 1, 0, 0);
 	VkRect2D scissor{ { 0, 0 }, { mFramebuffer->Width(), mFramebuffer->Height() } };
@@ -241,7 +247,7 @@ void Camera::SetStereo(CommandBuffer* commandBuffer, ShaderVariant* shader, Ster
 		scissor.offset.y = eye == EYE_LEFT ? 0 : scissor.extent.height;
 	}
 
-	commandBuffer->PushConstant(shader, "StereoClipTransform", &clipst);
+	commandBuffer->PushConstant(shader, gStereoClipTransformID, &clipst);
 
 	vkCmdSetScissor(*commandBuffer, 0, 1, &scissor);
 }
@@ -35,6 +35,8 @@ public:
 
 	// Updates the uniform buffer and sets the non-stereo viewport
 	ENGINE_EXPORT virtual void Set(CommandBuffer* commandBuffer);
+	// Sets the non-stereo viewport without touching the uniform buffer, for command buffers recorded after Set()
+	ENGINE_EXPORT virtual void SetViewport(CommandBuffer* commandBuffer);
 	// Sets the viewport and StereoEye push constant
 	ENGINE_EXPORT virtual void SetStereo(CommandBuffer* commandBuffer, ShaderVariant* shader, StereoEye eye);
 
@@ -10,6 +10,10 @@
 
 using namespace std;
 
+static const PropertyID gTimeID = PropertyToID("Time");
+static const PropertyID gLightCountID = PropertyToID("LightCount");
+static const PropertyID gShadowTexelSizeID = PropertyToID("ShadowTexelSize");
+
 ClothRenderer::ClothRenderer(const string& name)
 	:  MeshRenderer(name), Object(name), mMove(0),
 	mVertexBuffer(nullptr), mVelocityBuffer(nullptr), mForceBuffer(nullptr), mEdgeBuffer(nullptr), mCopyVertices(false), mPin(true),
@@ -247,9 +251,9 @@ void ClothRenderer::DrawInstanced(CommandBuffer* commandBuffer, Camera* camera,
 	uint32_t lc = (uint32_t)Scene()->ActiveLights().size();
 	float2 s = Scene()->ShadowTexelSize();
 	float t = Scene()->TotalTime();
-	commandBuffer->PushConstant(shader, "Time", &t);
-	commandBuffer->PushConstant(shader, "LightCount", &lc);
-	commandBuffer->PushConstant(shader, "ShadowTexelSize", &s);
+	commandBuffer->PushConstant(shader, gTimeID, &t);
+	commandBuffer->PushConstant(shader, gLightCountID, &lc);
+	commandBuffer->PushConstant(shader, gShadowTexelSizeID, &s);
 	for (const auto& kp : mPushConstants)
 		commandBuffer->PushConstant(shader, kp.first, &kp.second);
 
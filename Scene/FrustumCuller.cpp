@@ -0,0 +1,88 @@
+#include <Scene/FrustumCuller.hpp>
+#include <Util/Profiler.hpp>
+
+using namespace std;
+
+void FrustumCuller::Gather(const ObjectBvh2& bvh) {
+	uint32_t count = bvh.PrimitiveCount();
+	uint32_t padded = (count + 7) & ~7u;
+
+	mObjects.resize(count);
+	mCenterX.resize(padded);
+	mCenterY.resize(padded);
+	mCenterZ.resize(padded);
+	mExtentX.resize(padded);
+	mExtentY.resize(padded);
+	mExtentZ.resize(padded);
+	mVisibility.resize(padded);
+
+	for (uint32_t i = 0; i < count; i++) {
+		mObjects[i] = bvh.GetObject(i);
+		const AABB& b = bvh.PrimitiveBounds(i);
+		float3 c = b.Center();
+		float3 e = b.Extents();
+		mCenterX[i] = c.x;
+		mCenterY[i] = c.y;
+		mCenterZ[i] = c.z;
+		mExtentX[i] = e.x;
+		mExtentY[i] = e.y;
+		mExtentZ[i] = e.z;
+	}
+	for (uint32_t i = count; i < padded; i++)
+		mCenterX[i] = mCenterY[i] = mCenterZ[i] = mExtentX[i] = mExtentY[i] = mExtentZ[i] = 0;
+}
+
+uint32_t FrustumCuller::AddFrustum(const float4 frustum[6]) {
+	if (mFrustumCount >= MaxFrusta) return ~0u;
+	memcpy(mFrusta[mFrustumCount], frustum, sizeof(float4) * 6);
+	return mFrustumCount++;
+}
+uint32_t FrustumCuller::FindFrustum(const float4 frustum[6]) const {
+	for (uint32_t i = 0; i < mFrustumCount; i++)
+		if (memcmp(mFrusta[i], frustum, sizeof(float4) * 6) == 0)
+			return i;
+	return ~0u;
+}
+
+void FrustumCuller::Cull(uint32_t begin, uint32_t end) {
+	for (uint32_t i = begin; i < end; i += 8) {
+		simd8f cx = simd8f::LoadUnaligned(mCenterX.data() + i);
+		simd8f cy = simd8f::LoadUnaligned(mCenterY.data() + i);
+		simd8f cz = simd8f::LoadUnaligned(mCenterZ.data() + i);
+		simd8f ex = simd8f::LoadUnaligned(mExtentX.data() + i);
+		simd8f ey = simd8f::LoadUnaligned(mExtentY.data() + i);
+		simd8f ez = simd8f::LoadUnaligned(mExtentZ.data() + i);
+
+		uint32_t visibility[8] {};
+		for (uint32_t f = 0; f < mFrustumCount; f++) {
+			// Same test as AABB::Intersects: outside a plane when dot(center, n) - w <= -dot(extent, abs(n))
+			uint32_t inside = 0xFF;
+			for (uint32_t p = 0; p < 6 && inside; p++) {
+				const float4& plane = mFrusta[f][p];
+				simd8f d = cx * simd8f(plane.x) + cy * simd8f(plane.y) + cz * simd8f(plane.z) - simd8f(plane.w);
+				simd8f r = ex * simd8f(fabsf(plane.x)) + ey * simd8f(fabsf(plane.y)) + ez * simd8f(fabsf(plane.z));
+				inside &= movemask(d > simd8f(0.f) - r);
+			}
+			for (uint32_t j = 0; j < 8; j++)
+				visibility[j] |= ((inside >> j) & 1) << f;
+		}
+		memcpy(mVisibility.data() + i, visibility, sizeof(visibility));
+	}
+}
+void FrustumCuller::Cull(JobSystem* jobSystem) {
+	PROFILER_BEGIN("Frustum Cull");
+	uint32_t blocks = (uint32_t)mVisibility.size() / 8;
+	// Small scenes aren't worth the scheduling overhead
+	if (jobSystem && blocks >= 256)
+		jobSystem->ParallelFor(blocks, [&](uint32_t begin, uint32_t end) { Cull(begin * 8, end * 8); }, 64);
+	else
+		Cull(0, blocks * 8);
+	PROFILER_END;
+}
+
+void FrustumCuller::Collect(uint32_t frustum, uint32_t mask, vector<Object*>& objects) const {
+	uint32_t bit = 1u << frustum;
+	for (uint32_t i = 0; i < mObjects.size(); i++)
+		if ((mVisibility[i] & bit) && (mObjects[i]->LayerMask() & mask))
+			objects.push_back(mObjects[i]);
+}
\ No newline at end of file
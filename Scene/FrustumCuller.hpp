@@ -0,0 +1,48 @@
+#pragma once
+
+#include <Core/JobSystem.hpp>
+#include <Scene/ObjectBvh2.hpp>
+
+/// Tests the primitives of an ObjectBvh2 against up to 32 frusta at once. Bounds are copied into SoA arrays of centers and extents,
+/// and each pass over them tests 8 boxes per instruction against every frustum, so adding a camera or shadow cascade doesn't add
+/// another walk over the scene. The result is one bitmask per object, bit i set when the object intersects frustum i
+class FrustumCuller {
+public:
+	static const uint32_t MaxFrusta = 32;
+
+	/// Copies the bounds of every primitive in bvh
+	ENGINE_EXPORT void Gather(const ObjectBvh2& bvh);
+
+	inline void ClearFrusta() { mFrustumCount = 0; }
+	/// Returns the index of the frustum's bit in Visibility(), or ~0u if MaxFrusta frusta were already added
+	ENGINE_EXPORT uint32_t AddFrustum(const float4 frustum[6]);
+	inline uint32_t FrustumCount() const { return mFrustumCount; }
+	/// Returns the index of a frustum equal to frustum, or ~0u
+	ENGINE_EXPORT uint32_t FindFrustum(const float4 frustum[6]) const;
+
+	/// Tests every gathered object against every frustum. Splits the work across jobSystem when there are enough objects, jobSystem may be null
+	ENGINE_EXPORT void Cull(JobSystem* jobSystem);
+
+	inline uint32_t ObjectCount() const { return (uint32_t)mObjects.size(); }
+	inline Object* GetObject(uint32_t index) const { return mObjects[index]; }
+	inline const uint32_t* Visibility() const { return mVisibility.data(); }
+	/// Appends the objects visible in a frustum whose LayerMask() intersects mask, in the same way as ObjectBvh2::FrustumCheck
+	ENGINE_EXPORT void Collect(uint32_t frustum, uint32_t mask, std::vector<Object*>& objects) const;
+
+private:
+	/// Tests objects [begin, end), begin and end are multiples of 8
+	ENGINE_EXPORT void Cull(uint32_t begin, uint32_t end);
+
+	std::vector<Object*> mObjects;
+	// Padded to a multiple of 8, the results of the padding are discarded
+	std::vector<float> mCenterX;
+	std::vector<float> mCenterY;
+	std::vector<float> mCenterZ;
+	std::vector<float> mExtentX;
+	std::vector<float> mExtentY;
+	std::vector<float> mExtentZ;
+	std::vector<uint32_t> mVisibility;
+
+	uint32_t mFrustumCount = 0;
+	float4 mFrusta[MaxFrusta][6];
+};
\ No newline at end of file
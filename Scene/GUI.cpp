@@ -3,6 +3,13 @@
 
 using namespace std;
 
+static const PropertyID gScreenSizeID = PropertyToID("ScreenSize");
+static const PropertyID gColorID = PropertyToID("Color");
+static const PropertyID gOffsetID = PropertyToID("Offset");
+static const PropertyID gBoundsID = PropertyToID("Bounds");
+static const PropertyID gDepthID = PropertyToID("Depth");
+static const PropertyID gScaleTranslateID = PropertyToID("ScaleTranslate");
+
 #define START_DEPTH  0.01f
 #define DEPTH_DELTA -0.0001f;
 
@@ -92,12 +99,12 @@ void GUI::Draw(CommandBuffer* commandBuffer, PassType pass, Camera* camera) {
 		VkPipelineLayout layout = commandBuffer->BindShader(shader, pass, nullptr);
 		if (!layout) return;
 
-		Buffer* screenRects = commandBuffer->Device()->GetTempBuffer("WorldRects", mWorldRects.size() * sizeof(GuiRect), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
-		memcpy(screenRects->MappedData(), mWorldRects.data(), mWorldRects.size() * sizeof(GuiRect));
+		FrameAllocation screenRects = commandBuffer->Device()->AllocateFrameMemory(mWorldRects.size() * sizeof(GuiRect), commandBuffer->Device()->Limits().minStorageBufferOffsetAlignment);
+		memcpy(screenRects.mMapped, mWorldRects.data(), mWorldRects.size() * sizeof(GuiRect));
 
-		DescriptorSet* ds = commandBuffer->Device()->GetTempDescriptorSet("WorldRects", shader->mDescriptorSetLayouts[PER_OBJECT]);
-		ds->CreateStorageBufferDescriptor(screenRects, 0, mWorldRects.size() * sizeof(GuiRect), shader->mDescriptorBindings.at("Rects").second.binding);
-		ds->FlushWrites();
+		DescriptorKey key((uint64_t)shader->mDescriptorSetLayouts[PER_OBJECT]);
+		DescriptorSet::AddStorageBufferDescriptor(key, screenRects.mBuffer, screenRects.mOffset, mWorldRects.size() * sizeof(GuiRect), shader->mDescriptorBindings.at("Rects").second.binding);
+		DescriptorSet* ds = commandBuffer->Device()->GetCachedDescriptorSet("WorldRects", key);
 		vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, PER_OBJECT, 1, *ds, 0, nullptr);
 
 		vkCmdDraw(*commandBuffer, 6, (uint32_t)mWorldRects.size(), 0, 0);
@@ -108,14 +115,14 @@ void GUI::Draw(CommandBuffer* commandBuffer, PassType pass, Camera* camera) {
 		VkPipelineLayout layout = commandBuffer->BindShader(shader, pass, nullptr);
 		if (!layout) return;
 
-		Buffer* screenRects = commandBuffer->Device()->GetTempBuffer("WorldRects", mWorldTextureRects.size() * sizeof(GuiRect), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
-		memcpy(screenRects->MappedData(), mWorldTextureRects.data(), mWorldTextureRects.size() * sizeof(GuiRect));
+		FrameAllocation screenRects = commandBuffer->Device()->AllocateFrameMemory(mWorldTextureRects.size() * sizeof(GuiRect), commandBuffer->Device()->Limits().minStorageBufferOffsetAlignment);
+		memcpy(screenRects.mMapped, mWorldTextureRects.data(), mWorldTextureRects.size() * sizeof(GuiRect));
 
-		DescriptorSet* ds = commandBuffer->Device()->GetTempDescriptorSet("WorldRects", shader->mDescriptorSetLayouts[PER_OBJECT]);
-		ds->CreateStorageBufferDescriptor(screenRects, 0, mWorldTextureRects.size() * sizeof(GuiRect), shader->mDescriptorBindings.at("Rects").second.binding);
+		DescriptorKey key((uint64_t)shader->mDescriptorSetLayouts[PER_OBJECT]);
+		DescriptorSet::AddStorageBufferDescriptor(key, screenRects.mBuffer, screenRects.mOffset, mWorldTextureRects.size() * sizeof(GuiRect), shader->mDescriptorBindings.at("Rects").second.binding);
 		for (uint32_t i = 0; i < mTextureArray.size(); i++)
-			ds->CreateSampledTextureDescriptor(mTextureArray[i], i, shader->mDescriptorBindings.at("Textures").second.binding);
-		ds->FlushWrites();
+			DescriptorSet::AddSampledTextureDescriptor(key, mTextureArray[i], shader->mDescriptorBindings.at("Textures").second.binding, i);
+		DescriptorSet* ds = commandBuffer->Device()->GetCachedDescriptorSet("WorldRects", key);
 		vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, PER_OBJECT, 1, *ds, 0, nullptr);
 
 		vkCmdDraw(*commandBuffer, 6, (uint32_t)mWorldTextureRects.size(), 0, 0);
@@ -126,10 +133,10 @@ void GUI::Draw(CommandBuffer* commandBuffer, PassType pass, Camera* camera) {
 		VkPipelineLayout layout = commandBuffer->BindShader(shader, PASS_MAIN, nullptr);
 		if (!layout) return;
 		float2 s(camera->FramebufferWidth(), camera->FramebufferHeight());
-		commandBuffer->PushConstant(shader, "ScreenSize", &s);
+		commandBuffer->PushConstant(shader, gScreenSizeID, &s);
 
-		Buffer* transforms = commandBuffer->Device()->GetTempBuffer("Transforms", sizeof(float4x4) * mWorldStrings.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-		float4x4* m = (float4x4*)transforms->MappedData();
+		FrameAllocation transforms = commandBuffer->Device()->AllocateFrameMemory(sizeof(float4x4) * mWorldStrings.size(), commandBuffer->Device()->Limits().minStorageBufferOffsetAlignment);
+		float4x4* m = (float4x4*)transforms.mMapped;
 		for (const GuiString& s : mWorldStrings) {
 			*m = s.mTransform;
 			m++;
@@ -168,16 +175,16 @@ void GUI::Draw(CommandBuffer* commandBuffer, PassType pass, Camera* camera) {
 				bc.mGlyphCache.emplace(key, make_pair(glyphBuffer, 8u));
 			}
 
-			DescriptorSet* descriptorSet = commandBuffer->Device()->GetTempDescriptorSet(s.mFont->mName + " DescriptorSet", shader->mDescriptorSetLayouts[PER_OBJECT]);
-			descriptorSet->CreateSampledTextureDescriptor(s.mFont->Texture(), BINDING_START + 0);
-			descriptorSet->CreateStorageBufferDescriptor(transforms, 0, transforms->Size(), BINDING_START + 1);
-			descriptorSet->CreateStorageBufferDescriptor(glyphBuffer, 0, glyphBuffer->Size(), BINDING_START + 2);
-			descriptorSet->FlushWrites();
+			DescriptorKey descriptorKey((uint64_t)shader->mDescriptorSetLayouts[PER_OBJECT]);
+			DescriptorSet::AddSampledTextureDescriptor(descriptorKey, s.mFont->Texture(), BINDING_START + 0);
+			DescriptorSet::AddStorageBufferDescriptor(descriptorKey, transforms.mBuffer, transforms.mOffset, sizeof(float4x4) * mWorldStrings.size(), BINDING_START + 1);
+			DescriptorSet::AddStorageBufferDescriptor(descriptorKey, glyphBuffer, 0, glyphBuffer->Size(), BINDING_START + 2);
+			DescriptorSet* descriptorSet = commandBuffer->Device()->GetCachedDescriptorSet(s.mFont->mName + " DescriptorSet", descriptorKey);
 			vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, PER_OBJECT, 1, *descriptorSet, 0, nullptr);
-			commandBuffer->PushConstant(shader, "Color", &s.mColor);
-			commandBuffer->PushConstant(shader, "Offset", &s.mOffset);
-			commandBuffer->PushConstant(shader, "Bounds", &s.mBounds);
-			commandBuffer->PushConstant(shader, "Depth", &s.mDepth);
+			commandBuffer->PushConstant(shader, gColorID, &s.mColor);
+			commandBuffer->PushConstant(shader, gOffsetID, &s.mOffset);
+			commandBuffer->PushConstant(shader, gBoundsID, &s.mBounds);
+			commandBuffer->PushConstant(shader, gDepthID, &s.mDepth);
 			vkCmdDraw(*commandBuffer, (glyphBuffer->Size() / sizeof(TextGlyph)) * 6, 1, 0, idx);
 
 			idx++;
@@ -192,16 +199,16 @@ void GUI::Draw(CommandBuffer* commandBuffer, PassType pass, Camera* camera) {
 		VkPipelineLayout layout = commandBuffer->BindShader(shader, pass, nullptr);
 		if (!layout) return;
 
-		Buffer* screenRects = commandBuffer->Device()->GetTempBuffer("ScreenRects", mScreenRects.size() * sizeof(GuiRect), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
-		memcpy(screenRects->MappedData(), mScreenRects.data(), mScreenRects.size() * sizeof(GuiRect));
+		FrameAllocation screenRects = commandBuffer->Device()->AllocateFrameMemory(mScreenRects.size() * sizeof(GuiRect), commandBuffer->Device()->Limits().minStorageBufferOffsetAlignment);
+		memcpy(screenRects.mMapped, mScreenRects.data(), mScreenRects.size() * sizeof(GuiRect));
 
-		DescriptorSet* ds = commandBuffer->Device()->GetTempDescriptorSet("ScreenRects", shader->mDescriptorSetLayouts[PER_OBJECT]);
-		ds->CreateStorageBufferDescriptor(screenRects, 0, mScreenRects.size() * sizeof(GuiRect), shader->mDescriptorBindings.at("Rects").second.binding);
-		ds->FlushWrites();
+		DescriptorKey key((uint64_t)shader->mDescriptorSetLayouts[PER_OBJECT]);
+		DescriptorSet::AddStorageBufferDescriptor(key, screenRects.mBuffer, screenRects.mOffset, mScreenRects.size() * sizeof(GuiRect), shader->mDescriptorBindings.at("Rects").second.binding);
+		DescriptorSet* ds = commandBuffer->Device()->GetCachedDescriptorSet("ScreenRects", key);
 		vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, PER_OBJECT, 1, *ds, 0, nullptr);
 
 		float2 s(camera->FramebufferWidth(), camera->FramebufferHeight());
-		commandBuffer->PushConstant(shader, "ScreenSize", &s);
+		commandBuffer->PushConstant(shader, gScreenSizeID, &s);
 
 		vkCmdDraw(*commandBuffer, 6, (uint32_t)mScreenRects.size(), 0, 0);
 	}
@@ -211,14 +218,14 @@ void GUI::Draw(CommandBuffer* commandBuffer, PassType pass, Camera* camera) {
 		VkPipelineLayout layout = commandBuffer->BindShader(shader, pass, nullptr);
 		if (!layout) return;
 
-		Buffer* screenRects = commandBuffer->Device()->GetTempBuffer("WorldRects", mScreenTextureRects.size() * sizeof(GuiRect), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
-		memcpy(screenRects->MappedData(), mScreenTextureRects.data(), mScreenTextureRects.size() * sizeof(GuiRect));
+		FrameAllocation screenRects = commandBuffer->Device()->AllocateFrameMemory(mScreenTextureRects.size() * sizeof(GuiRect), commandBuffer->Device()->Limits().minStorageBufferOffsetAlignment);
+		memcpy(screenRects.mMapped, mScreenTextureRects.data(), mScreenTextureRects.size() * sizeof(GuiRect));
 
-		DescriptorSet* ds = commandBuffer->Device()->GetTempDescriptorSet("WorldRects", shader->mDescriptorSetLayouts[PER_OBJECT]);
-		ds->CreateStorageBufferDescriptor(screenRects, 0, mScreenTextureRects.size() * sizeof(GuiRect), shader->mDescriptorBindings.at("Rects").second.binding);
+		DescriptorKey key((uint64_t)shader->mDescriptorSetLayouts[PER_OBJECT]);
+		DescriptorSet::AddStorageBufferDescriptor(key, screenRects.mBuffer, screenRects.mOffset, mScreenTextureRects.size() * sizeof(GuiRect), shader->mDescriptorBindings.at("Rects").second.binding);
 		for (uint32_t i = 0; i < mTextureArray.size(); i++)
-			ds->CreateSampledTextureDescriptor(mTextureArray[i], i, shader->mDescriptorBindings.at("Textures").second.binding);
-		ds->FlushWrites();
+			DescriptorSet::AddSampledTextureDescriptor(key, mTextureArray[i], shader->mDescriptorBindings.at("Textures").second.binding, i);
+		DescriptorSet* ds = commandBuffer->Device()->GetCachedDescriptorSet("WorldRects", key);
 		vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, PER_OBJECT, 1, *ds, 0, nullptr);
 
 		vkCmdDraw(*commandBuffer, 6, (uint32_t)mScreenTextureRects.size(), 0, 0);
@@ -229,7 +236,7 @@ void GUI::Draw(CommandBuffer* commandBuffer, PassType pass, Camera* camera) {
 		VkPipelineLayout layout = commandBuffer->BindShader(shader, PASS_MAIN, nullptr);
 		if (!layout) return;
 		float2 s(camera->FramebufferWidth(), camera->FramebufferHeight());
-		commandBuffer->PushConstant(shader, "ScreenSize", &s);
+		commandBuffer->PushConstant(shader, gScreenSizeID, &s);
 
 		for (const GuiString& s : mScreenStrings) {
 			Buffer* glyphBuffer = nullptr;
@@ -262,16 +269,16 @@ void GUI::Draw(CommandBuffer* commandBuffer, PassType pass, Camera* camera) {
 				bc.mGlyphCache.emplace(key, make_pair(glyphBuffer, 8u));
 			}
 
-			DescriptorSet* descriptorSet = commandBuffer->Device()->GetTempDescriptorSet(s.mFont->mName + " DescriptorSet", shader->mDescriptorSetLayouts[PER_OBJECT]);
-			descriptorSet->CreateSampledTextureDescriptor(s.mFont->Texture(), BINDING_START + 0);
-			descriptorSet->CreateStorageBufferDescriptor(glyphBuffer, 0, glyphBuffer->Size(), BINDING_START + 2);
-			descriptorSet->FlushWrites();
+			DescriptorKey descriptorKey((uint64_t)shader->mDescriptorSetLayouts[PER_OBJECT]);
+			DescriptorSet::AddSampledTextureDescriptor(descriptorKey, s.mFont->Texture(), BINDING_START + 0);
+			DescriptorSet::AddStorageBufferDescriptor(descriptorKey, glyphBuffer, 0, glyphBuffer->Size(), BINDING_START + 2);
+			DescriptorSet* descriptorSet = commandBuffer->Device()->GetCachedDescriptorSet(s.mFont->mName + " DescriptorSet", descriptorKey);
 			vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, PER_OBJECT, 1, *descriptorSet, 0, nullptr);
 
-			commandBuffer->PushConstant(shader, "Color", &s.mColor);
-			commandBuffer->PushConstant(shader, "Offset", &s.mOffset);
-			commandBuffer->PushConstant(shader, "Bounds", &s.mBounds);
-			commandBuffer->PushConstant(shader, "Depth", &s.mDepth);
+			commandBuffer->PushConstant(shader, gColorID, &s.mColor);
+			commandBuffer->PushConstant(shader, gOffsetID, &s.mOffset);
+			commandBuffer->PushConstant(shader, gBoundsID, &s.mBounds);
+			commandBuffer->PushConstant(shader, gDepthID, &s.mDepth);
 			vkCmdDraw(*commandBuffer, (glyphBuffer->Size() / sizeof(TextGlyph)) * 6, 1, 0, 0);
 		}
 	}
@@ -282,24 +289,24 @@ void GUI::Draw(CommandBuffer* commandBuffer, PassType pass, Camera* camera) {
 		VkPipelineLayout layout = commandBuffer->BindShader(shader, pass, nullptr, nullptr, VK_PRIMITIVE_TOPOLOGY_LINE_STRIP);
 		if (!layout) return;
 
-		Buffer* b = commandBuffer->Device()->GetTempBuffer("Perf Graph Pts", sizeof(float2) * mLinePoints.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
-		memcpy(b->MappedData(), mLinePoints.data(), sizeof(float2) * mLinePoints.size());
+		FrameAllocation b = commandBuffer->Device()->AllocateFrameMemory(sizeof(float2) * mLinePoints.size(), commandBuffer->Device()->Limits().minStorageBufferOffsetAlignment);
+		memcpy(b.mMapped, mLinePoints.data(), sizeof(float2) * mLinePoints.size());
 		
-		DescriptorSet* ds = commandBuffer->Device()->GetTempDescriptorSet("Perf Graph DS", shader->mDescriptorSetLayouts[PER_OBJECT]);
-		ds->CreateStorageBufferDescriptor(b, 0, sizeof(float2) * mLinePoints.size(), INSTANCE_BUFFER_BINDING);
-		ds->FlushWrites();
+		DescriptorKey key((uint64_t)shader->mDescriptorSetLayouts[PER_OBJECT]);
+		DescriptorSet::AddStorageBufferDescriptor(key, b.mBuffer, b.mOffset, sizeof(float2) * mLinePoints.size(), INSTANCE_BUFFER_BINDING);
+		DescriptorSet* ds = commandBuffer->Device()->GetCachedDescriptorSet("Perf Graph DS", key);
 
 		vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, PER_OBJECT, 1, *ds, 0, nullptr);
 
 		float4 sz(0, 0, camera->FramebufferWidth(), camera->FramebufferHeight());
-		commandBuffer->PushConstant(shader, "ScreenSize", &sz.z);
+		commandBuffer->PushConstant(shader, gScreenSizeID, &sz.z);
 
 		for (const GuiLine& l : mScreenLines) {
 			vkCmdSetLineWidth(*commandBuffer, l.mThickness);
-			commandBuffer->PushConstant(shader, "Color", &l.mColor);
-			commandBuffer->PushConstant(shader, "ScaleTranslate", &l.mScaleTranslate);
-			commandBuffer->PushConstant(shader, "Bounds", &l.mBounds);
-			commandBuffer->PushConstant(shader, "Depth", &l.mDepth);
+			commandBuffer->PushConstant(shader, gColorID, &l.mColor);
+			commandBuffer->PushConstant(shader, gScaleTranslateID, &l.mScaleTranslate);
+			commandBuffer->PushConstant(shader, gBoundsID, &l.mBounds);
+			commandBuffer->PushConstant(shader, gDepthID, &l.mDepth);
 			vkCmdDraw(*commandBuffer, l.mCount, 1, l.mIndex, 0);
 		}
 	}
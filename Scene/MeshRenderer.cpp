@@ -9,6 +9,10 @@
 
 using namespace std;
 
+static const PropertyID gTimeID = PropertyToID("Time");
+static const PropertyID gLightCountID = PropertyToID("LightCount");
+static const PropertyID gShadowTexelSizeID = PropertyToID("ShadowTexelSize");
+
 MeshRenderer::MeshRenderer(const string& name)
 	: Object(name), mVisible(true), mMesh(nullptr), mRayMask(0) {}
 MeshRenderer::~MeshRenderer() {}
@@ -34,9 +38,9 @@ void MeshRenderer::DrawInstanced(CommandBuffer* commandBuffer, Camera* camera, u
 	uint32_t lc = (uint32_t)Scene()->ActiveLights().size();
 	float2 s = Scene()->ShadowTexelSize();
 	float t = Scene()->TotalTime();
-	commandBuffer->PushConstant(shader, "Time", &t);
-	commandBuffer->PushConstant(shader, "LightCount", &lc);
-	commandBuffer->PushConstant(shader, "ShadowTexelSize", &s);
+	commandBuffer->PushConstant(shader, gTimeID, &t);
+	commandBuffer->PushConstant(shader, gLightCountID, &lc);
+	commandBuffer->PushConstant(shader, gShadowTexelSizeID, &s);
 	for (const auto& kp : mPushConstants)
 		commandBuffer->PushConstant(shader, kp.first, &kp.second);
 	
@@ -50,12 +50,17 @@ public:
 	ENGINE_EXPORT virtual void Material(std::shared_ptr<::Material> m) { mMaterial = m; }
 
 	template<typename T>
-	inline void PushConstant(const std::string& name, const T& value) { mPushConstants.emplace(name, PushConstantValue(value)); }
-	inline PushConstantValue PushConstant(const std::string& name) { return mPushConstants.at(name); }
+	inline void PushConstant(PropertyID id, const T& value) { mPushConstants.emplace(id, PushConstantValue(value)); }
+	template<typename T>
+	inline void PushConstant(const std::string& name, const T& value) { PushConstant(PropertyToID(name), value); }
+	inline PushConstantValue PushConstant(PropertyID id) { return mPushConstants.at(id); }
+	inline PushConstantValue PushConstant(const std::string& name) { return PushConstant(PropertyToID(name)); }
 
 	inline virtual bool Visible() override { return mVisible && Mesh() && mMaterial && EnabledHierarchy(); }
 	inline virtual uint32_t RenderQueue() override { return mMaterial ? mMaterial->RenderQueue() : Renderer::RenderQueue(); }
+	inline virtual uint32_t BatchKey() override { return mMaterial && Mesh() ? ((mMaterial->SortId() & 0xFFFF) << 16) | (Mesh()->SortId() & 0xFFFF) : 0; }
 	ENGINE_EXPORT virtual void Draw(CommandBuffer* commandBuffer, Camera* camera, PassType pass) override;
+	inline virtual bool ThreadSafeDraw() override { return true; }
 
 	ENGINE_EXPORT virtual void PreRender(CommandBuffer* commandBuffer, Camera* camera, PassType pass) override;
 	ENGINE_EXPORT virtual void DrawInstanced(CommandBuffer* commandBuffer, Camera* camera, uint32_t instanceCount, VkDescriptorSet instanceDS, PassType pass);
@@ -68,7 +73,7 @@ private:
 
 protected:
 	std::shared_ptr<::Material> mMaterial;
-	std::unordered_map<std::string, PushConstantValue> mPushConstants;
+	std::unordered_map<PropertyID, PushConstantValue> mPushConstants;
 
 	AABB mAABB;
 	std::variant<::Mesh*, std::shared_ptr<::Mesh>> mMesh;
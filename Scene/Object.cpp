@@ -1,38 +1,52 @@
 #include <Scene/Object.hpp>
 #include <Scene/Camera.hpp>
 #include <Scene/Scene.hpp>
+#include <Scene/TransformHierarchy.hpp>
 
 using namespace std;
 
 Object::Object(const string& name)
-	: mName(name), mParent(nullptr), mScene(nullptr), mLayerMask(0),
+	: mName(name), mParent(nullptr), mScene(nullptr), mHierarchy(nullptr), mHierarchyNode(0), mHierarchyUpdated(false), mLayerMask(0),
 	mLocalPosition(float3()), mLocalRotation(quaternion(0, 0, 0, 1)), mLocalScale(float3(1)),
 	mWorldPosition(float3()), mWorldRotation(quaternion(0, 0, 0, 1)),
-	mObjectToWorld(float4x4(1)), mWorldToObject(float4x4(1)), mTransformDirty(true), mEnabled(true) {
+	mObjectToWorld(float4x4(1)), mWorldToObject(float4x4(1)), mTransformDirty(true), mLocalTransformValid(false), mEnabled(true) {
 	Dirty();
 }
 Object::~Object() {
 	while (mChildren.size())
 		RemoveChild(mChildren[0]);
 	if (mParent) mParent->RemoveChild(this);
+	if (mHierarchy) mHierarchy->Remove(this);
 }
 
 bool Object::UpdateTransform() {
 	if (!mTransformDirty) return false;
 
-	mObjectToParent = float4x4::TRS(mLocalPosition, mLocalRotation, mLocalScale);
+	if (mHierarchyUpdated) {
+		mHierarchyUpdated = false;
+		mTransformDirty = false;
+		return true;
+	}
+
+	if (!mLocalTransformValid) {
+		mObjectToParent = float4x4::TRS(mLocalPosition, mLocalRotation, mLocalScale);
+		mParentToObject = float4x4::InverseTRS(mLocalPosition, mLocalRotation, mLocalScale);
+	}
+	mLocalTransformValid = false;
 
+	// The world transform is a product of TRS matrices, so its inverse is the product of their inverses in reverse order
 	if (mParent) {
 		mObjectToWorld = mParent->ObjectToWorld() * mObjectToParent;
+		mWorldToObject = mParentToObject * mParent->mWorldToObject;
 		mWorldPosition = (mParent->mObjectToWorld * float4(mLocalPosition, 1.f)).xyz;
 		mWorldRotation = mParent->mWorldRotation * mLocalRotation;
 	} else {
 		mObjectToWorld = mObjectToParent;
+		mWorldToObject = mParentToObject;
 		mWorldPosition = mLocalPosition;
 		mWorldRotation = mLocalRotation;
 	}
 
-	mWorldToObject = inverse(mObjectToWorld);
 	mWorldScale.x = length(mObjectToWorld[0].xyz);
 	mWorldScale.y = length(mObjectToWorld[1].xyz);
 	mWorldScale.z = length(mObjectToWorld[2].xyz);
@@ -42,6 +56,30 @@ bool Object::UpdateTransform() {
 	return true;
 }
 
+void Object::UpdateTransforms(Object* const* objects, uint32_t count) {
+	static thread_local vector<pair<uint32_t, Object*>> dirty; // depth, object
+	dirty.clear();
+	for (uint32_t i = 0; i < count; i++) {
+		Object* o = objects[i];
+		if (!o->mTransformDirty) continue;
+		uint32_t depth = 0;
+		for (Object* p = o->mParent; p; p = p->mParent) depth++;
+		dirty.push_back(make_pair(depth, o));
+	}
+
+	for (const auto& d : dirty) {
+		Object* o = d.second;
+		o->mObjectToParent = float4x4::TRS(o->mLocalPosition, o->mLocalRotation, o->mLocalScale);
+		o->mParentToObject = float4x4::InverseTRS(o->mLocalPosition, o->mLocalRotation, o->mLocalScale);
+		o->mLocalTransformValid = true;
+	}
+
+	// Parents first, so each object finds its parent's world transform already up to date
+	stable_sort(dirty.begin(), dirty.end(), [](const pair<uint32_t, Object*>& a, const pair<uint32_t, Object*>& b) { return a.first < b.first; });
+	for (const auto& d : dirty)
+		d.second->UpdateTransform();
+}
+
 void Object::AddChild(Object* c) {
 	if (c->mParent == this) return;
 
@@ -54,6 +92,7 @@ void Object::AddChild(Object* c) {
 
 	mChildren.push_back(c);
 	c->mParent = this;
+	if (c->mHierarchy) c->mHierarchy->Reparent();
 	c->Dirty();
 }
 void Object::RemoveChild(Object* c) {
@@ -66,6 +105,7 @@ void Object::RemoveChild(Object* c) {
 			it++;
 
 	c->mParent = nullptr;
+	if (c->mHierarchy) c->mHierarchy->Reparent();
 	c->Dirty();
 }
 
@@ -73,6 +113,13 @@ void Object::Dirty() {
 	if (mScene && LayerMask()) mScene->BvhDirty(this);
 
 	mTransformDirty = true;
+	mHierarchyUpdated = false;
+	// The hierarchy flags descendants in its next Update()
+	if (mHierarchy) {
+		mHierarchy->Dirty(mHierarchyNode, mLocalPosition, mLocalRotation, mLocalScale);
+		return;
+	}
+
 	queue<Object*> objs;
 	for (Object* c : mChildren) {
 		if (c == this) fprintf_color(COLOR_RED, stderr, "Loop in heirarchy! %s -> %s\n", c->mName.c_str(), mName.c_str());
@@ -82,7 +129,7 @@ void Object::Dirty() {
 		Object* c = objs.front();
 		objs.pop();
 		c->mTransformDirty = true;
-		if (mScene && c->LayerMask()) mScene->BvhDirty(this);
+		if (mScene && c->LayerMask()) mScene->BvhDirty(c);
 		for (Object* o : c->mChildren)
 			if (o == this) fprintf_color(COLOR_RED, stderr, "Loop in heirarchy! %s -> %s\n", c->mName.c_str(), mName.c_str());
 			else objs.push(o);
@@ -95,6 +142,8 @@ AABB Object::Bounds() {
 }
 
 bool Object::EnabledHierarchy() {
+	if (mHierarchy && mHierarchy->Sorted()) return mEnabled && mHierarchy->ParentsEnabled(mHierarchyNode);
+
 	Object* o = this;
 	while (o) {
 		if (!o->mEnabled) return false;
@@ -5,6 +5,7 @@
 
 class Camera;
 class Scene;
+class TransformHierarchy;
 
 class Object {
 public:
@@ -14,6 +15,10 @@ public:
 	ENGINE_EXPORT Object(const std::string& name);
 	ENGINE_EXPORT ~Object();
 
+	/// Updates the transforms of the dirty objects in objects, parents before children. Computes every local matrix in one pass first,
+	/// so a scene with many moving objects doesn't update them one by one as their transforms are first used
+	ENGINE_EXPORT static void UpdateTransforms(Object* const* objects, uint32_t count);
+
 	inline ::Scene* Scene() const { return mScene; }
 
 	inline Object* Parent() const { return mParent; }
@@ -46,6 +51,9 @@ public:
 	ENGINE_EXPORT virtual AABB Bounds();
 
 	inline virtual void FixedUpdate(CommandBuffer* commandBuffer) {};
+	/// Return true if FixedUpdate may run on a job thread, alongside other objects and plugins.
+	/// A thread-safe FixedUpdate must not record into the CommandBuffer it is given or touch other objects
+	inline virtual bool ThreadSafeUpdate() { return false; }
 	inline virtual void DrawGizmos(CommandBuffer* commandBuffer, Camera* camera) {};
 	
 	ENGINE_EXPORT bool EnabledHierarchy();
@@ -58,9 +66,17 @@ public:
 	inline virtual void LayerMask(uint32_t m) { mLayerMask = m; };
 	inline virtual uint32_t LayerMask() { return mLayerMask; };
 
+	/// The hierarchy this object is a node of, if its scene uses one
+	inline ::TransformHierarchy* TransformHierarchy() const { return mHierarchy; }
+
 private:
 	friend class ::Scene;
+	friend class ::TransformHierarchy;
 	::Scene* mScene;
+	::TransformHierarchy* mHierarchy;
+	uint32_t mHierarchyNode;
+	// The hierarchy wrote the world transform, UpdateTransform() only has to accept it
+	bool mHierarchyUpdated;
 
 	bool mTransformDirty;
 	float3 mLocalPosition;
@@ -69,6 +85,9 @@ private:
 	float3 mWorldScale;
 	AABB mBounds;
 	float4x4 mObjectToParent;
+	float4x4 mParentToObject;
+	// mObjectToParent and mParentToObject were computed by UpdateTransforms() for the next UpdateTransform()
+	bool mLocalTransformValid;
 	float4x4 mObjectToWorld;
 	float4x4 mWorldToObject;
 
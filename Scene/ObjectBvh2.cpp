@@ -12,120 +12,162 @@ void ObjectBvh2::Build(Object** objects, uint32_t objectCount) {
 	mRendererBounds.mMin = 1e10f;
 	mRendererBounds.mMax = -1e10f;
 
+	vector<Primitive> primitives(objectCount);
+	vector<AABB> bounds(objectCount);
 	for (uint32_t i = 0; i < objectCount; i++) {
 		AABB aabb(objects[i]->Bounds());
 		aabb.mMin -= 1e-2f;
 		aabb.mMax += 1e-2f;
-		mPrimitives.push_back({ aabb, objects[i] });
+		primitives[i] = { aabb, objects[i] };
+		bounds[i] = aabb;
 
 		if (dynamic_cast<Renderer*>(objects[i]))
 			mRendererBounds.Encapsulate(aabb);
 	}
 
-	struct BuildTask {
-		uint32_t mParentOffset;
-		uint32_t mStart;
-		uint32_t mEnd;
-	};
+	vector<uint32_t> order;
+	BvhBuilder::Build(bounds.data(), objectCount, mSettings, mNodes, order);
 
-	BuildTask todo[1024];
-	uint32_t stackptr = 0;
-	const uint32_t untouched = 0xffffffff;
-	const uint32_t touchedTwice = 0xfffffffd;
-
-	uint32_t nNodes = 0;
-	uint32_t nLeafs = 0;
-
-	Node node;
-
-	todo[stackptr].mStart = 0;
-	todo[stackptr].mEnd = mPrimitives.size();
-	todo[stackptr].mParentOffset = 0xfffffffc;
-	stackptr++;
-
-	while (stackptr > 0) {
-		// Pop the next item off of the stack
-		BuildTask& bnode(todo[--stackptr]);
-		uint32_t start = bnode.mStart;
-		uint32_t end = bnode.mEnd;
-		uint32_t nPrims = end - start;
-
-		nNodes++;
-		node.mStartIndex = start;
-		node.mCount = nPrims;
-		node.mRightOffset = untouched;
-
-		// Calculate the bounding box for this node
-		AABB bb(mPrimitives[start].mBounds);
-		AABB bc(mPrimitives[start].mBounds.Center(), mPrimitives[start].mBounds.Center());
-		for (uint32_t p = start + 1; p < end; ++p) {
-			bb.Encapsulate(mPrimitives[p].mBounds);
-			bc.Encapsulate(mPrimitives[p].mBounds.Center());
-		}
-		node.mBounds = bb;
+	mPrimitives.resize(objectCount);
+	for (uint32_t i = 0; i < objectCount; i++)
+		mPrimitives[i] = primitives[order[i]];
 
-		// If the number of primitives at this point is less than the leaf
-		// size, then this will become a leaf. (Signified by rightOffset == 0)
-		if (nPrims <= 1) {
-			node.mRightOffset = 0;
-			nLeafs++;
+	// Build mappings used by Refit()
+	mPrimitiveIndices.clear();
+	mRendererPrimitives.clear();
+	mPrimitiveLeaf.resize(objectCount);
+	mParents.resize(mNodes.size());
+	mDirtyPrimitives.clear();
+	mPrimitiveDirty.assign(objectCount, false);
+	mNodeDirty.assign(mNodes.size(), false);
+	mCostSum = 0;
+
+	for (uint32_t i = 0; i < objectCount; i++) {
+		mPrimitiveIndices[mPrimitives[i].mObject] = i;
+		if (dynamic_cast<Renderer*>(mPrimitives[i].mObject)) mRendererPrimitives.push_back(i);
+	}
+
+	if (mNodes.size()) mParents[0] = 0xFFFFFFFF;
+	for (uint32_t ni = 0; ni < mNodes.size(); ni++) {
+		const Node& node = mNodes[ni];
+		mCostSum += NodeCost(node);
+		if (node.mRightOffset == 0) {
+			for (uint32_t o = 0; o < node.mCount; o++)
+				mPrimitiveLeaf[node.mStartIndex + o] = ni;
+		} else {
+			mParents[ni + 1] = ni;
+			mParents[ni + node.mRightOffset] = ni;
 		}
+	}
+
+	float rootArea = mNodes.size() ? BvhBuilder::SurfaceArea(mNodes[0].mBounds) : 0.f;
+	mBuildCost = rootArea > 0 ? mCostSum / rootArea : 0.f;
+
+	mWidth = mSettings.mWidth;
+	switch (mWidth) {
+	case 4:
+		mBvh4.Collapse(mNodes);
+		break;
+	case 8:
+		mBvh8.Collapse(mNodes);
+		break;
+	default:
+		mWidth = 2;
+		break;
+	}
+}
 
-		mNodes.push_back(node);
+bool ObjectBvh2::MarkDirty(Object* object) {
+	auto it = mPrimitiveIndices.find(object);
+	if (it == mPrimitiveIndices.end()) return false;
+	lock_guard<mutex> lock(mDirtyMutex);
+	if (!mPrimitiveDirty[it->second]) {
+		mPrimitiveDirty[it->second] = true;
+		mDirtyPrimitives.push_back(it->second);
+	}
+	return true;
+}
 
-		// Child touches parent...
-		// Special case: Don't do this for the root.
-		if (bnode.mParentOffset != 0xfffffffc) {
-			mNodes[bnode.mParentOffset].mRightOffset--;
+bool ObjectBvh2::Refit() {
+	if (mDirtyPrimitives.empty()) return true;
 
-			// When this is the second touch, this is the right child.
-			// The right child sets up the offset for the flat tree.
-			if (mNodes[bnode.mParentOffset].mRightOffset == touchedTwice) {
-				mNodes[bnode.mParentOffset].mRightOffset = nNodes - 1 - bnode.mParentOffset;
-			}
+	// Update primitive bounds, and gather their leaves and all ancestors
+	vector<uint32_t> dirtyNodes;
+	bool renderersMoved = false;
+	for (uint32_t p : mDirtyPrimitives) {
+		Primitive& prim = mPrimitives[p];
+		AABB aabb(prim.mObject->Bounds());
+		aabb.mMin -= 1e-2f;
+		aabb.mMax += 1e-2f;
+		prim.mBounds = aabb;
+		mPrimitiveDirty[p] = false;
+
+		if (dynamic_cast<Renderer*>(prim.mObject)) renderersMoved = true;
+
+		uint32_t ni = mPrimitiveLeaf[p];
+		while (ni != 0xFFFFFFFF && !mNodeDirty[ni]) {
+			mNodeDirty[ni] = true;
+			dirtyNodes.push_back(ni);
+			ni = mParents[ni];
 		}
+	}
+	mDirtyPrimitives.clear();
 
-		// If this is a leaf, no need to subdivide.
-		if (node.mRightOffset == 0) continue;
-
-		// Set the split dimensions
-		uint32_t split_dim = 0;
-		float3 ext = bc.Extents();
-		if (ext.y > ext.x) {
-			split_dim = 1;
-			if (ext.z > ext.y) split_dim = 2;
-		} else
-			if (ext.z > ext.x) split_dim = 2;
-
-		// Split on the center of the longest axis
-		float split_coord = .5f * (bc.mMin[split_dim] + bc.mMax[split_dim]);
-
-		// Partition the list of objects on this split
-		uint32_t mid = start;
-		for (uint32_t i = start; i < end; ++i)
-			if (mPrimitives[i].mBounds.Center()[split_dim] < split_coord) {
-				swap(mPrimitives[i], mPrimitives[mid]);
-				mid++;
-			}
+	// Nodes are stored depth-first, so children always come after their parents
+	sort(dirtyNodes.begin(), dirtyNodes.end(), greater<uint32_t>());
+	for (uint32_t ni : dirtyNodes) {
+		Node& node = mNodes[ni];
+		mCostSum -= NodeCost(node);
+		if (node.mRightOffset == 0) {
+			node.mBounds = mPrimitives[node.mStartIndex].mBounds;
+			for (uint32_t o = 1; o < node.mCount; o++)
+				node.mBounds.Encapsulate(mPrimitives[node.mStartIndex + o].mBounds);
+		} else {
+			node.mBounds = mNodes[ni + 1].mBounds;
+			node.mBounds.Encapsulate(mNodes[ni + node.mRightOffset].mBounds);
+		}
+		mCostSum += NodeCost(node);
+		mNodeDirty[ni] = false;
 
-		// If we get a bad split, just choose the center...
-		if (mid == start || mid == end)
-			mid = start + (end - start) / 2;
-
-		todo[stackptr].mStart = mid;
-		todo[stackptr].mEnd = end;
-		todo[stackptr].mParentOffset = nNodes - 1;
-		stackptr++;
-		todo[stackptr].mStart = start;
-		todo[stackptr].mEnd = mid;
-		todo[stackptr].mParentOffset = nNodes - 1;
-		stackptr++;
+		if (mWidth == 4) mBvh4.UpdateBounds(ni, node.mBounds);
+		else if (mWidth == 8) mBvh8.UpdateBounds(ni, node.mBounds);
 	}
+
+	// Renderers that moved can shrink the bounds as well as grow them, so recompute them. The root holds them when every primitive is a Renderer
+	if (renderersMoved) {
+		if (mRendererPrimitives.size() == mPrimitives.size())
+			mRendererBounds = mNodes[0].mBounds;
+		else {
+			mRendererBounds.mMin = 1e10f;
+			mRendererBounds.mMax = -1e10f;
+			for (uint32_t p : mRendererPrimitives)
+				mRendererBounds.Encapsulate(mPrimitives[p].mBounds);
+		}
+	}
+
+	float rootArea = BvhBuilder::SurfaceArea(mNodes[0].mBounds);
+	float cost = rootArea > 0 ? mCostSum / rootArea : 0.f;
+	return cost <= mBuildCost * mRefitThreshold;
 }
 
 void ObjectBvh2::FrustumCheck(const float4 frustum[6], vector<Object*>& objects, uint32_t mask) {
 	if (mNodes.size() == 0) return;
 
+	auto leaf = [&](uint32_t start, uint32_t count) {
+		for (uint32_t o = 0; o < count; ++o)
+			if ((mPrimitives[start + o].mObject->LayerMask() & mask) && mPrimitives[start + o].mBounds.Intersects(frustum))
+				objects.push_back(mPrimitives[start + o].mObject);
+	};
+
+	if (mWidth == 4) {
+		mBvh4.FrustumCheck(frustum, leaf);
+		return;
+	}
+	if (mWidth == 8) {
+		mBvh8.FrustumCheck(frustum, leaf);
+		return;
+	}
+
 	uint32_t todo[1024];
 	int32_t stackptr = 0;
 
@@ -137,9 +179,7 @@ void ObjectBvh2::FrustumCheck(const float4 frustum[6], vector<Object*>& objects,
 		const Node& node(mNodes[ni]);
 
 		if (node.mRightOffset == 0) { // leaf node
-			for (uint32_t o = 0; o < node.mCount; ++o)
-				if ((mPrimitives[node.mStartIndex + o].mObject->LayerMask() & mask) && mPrimitives[node.mStartIndex + o].mBounds.Intersects(frustum))
-					objects.push_back(mPrimitives[node.mStartIndex + o].mObject);
+			leaf(node.mStartIndex, node.mCount);
 		} else {
 			uint32_t n0 = ni + 1;
 			uint32_t n1 = ni + node.mRightOffset;
@@ -154,43 +194,55 @@ Object* ObjectBvh2::Intersect(const Ray& ray, float* t, bool any, uint32_t mask)
 	float ht = 1e20f;
 	Object* hitObject = nullptr;
 
-	uint32_t todo[128];
-	int stackptr = 0;
-
-	todo[stackptr] = 0;
+	// Returns true to stop traversal
+	auto leaf = [&](uint32_t start, uint32_t count, float& tmax) {
+		for (uint32_t o = 0; o < count; ++o) {
+			if ((mPrimitives[start + o].mObject->LayerMask() & mask) == 0) continue;
 
-	while (stackptr >= 0) {
-		uint32_t ni = todo[stackptr];
-		stackptr--;
-		const Node& node = mNodes[ni];
+			float ct;
+			if (!mPrimitives[start + o].mObject->Intersect(ray, &ct, any)) continue;
 
-		if (node.mRightOffset == 0) {
-			for (uint32_t o = 0; o < node.mCount; ++o) {
-				if ((mPrimitives[node.mStartIndex + o].mObject->LayerMask() & mask) == 0) continue;
-
-				float ct;
-				if (!mPrimitives[node.mStartIndex + o].mObject->Intersect(ray, &ct, any)) continue;
-
-				if (ct < ht) {
-					ht = ct;
-					hitObject = mPrimitives[node.mStartIndex + o].mObject;
-					if (any) {
-						if (t) *t = ct;
-						return mPrimitives[node.mStartIndex + o].mObject;
-					}
-				}
+			if (ct < ht) {
+				ht = ct;
+				tmax = ct;
+				hitObject = mPrimitives[start + o].mObject;
+				if (any) return true;
 			}
-		} else {
-			uint32_t n0 = ni + 1;
-			uint32_t n1 = ni + node.mRightOffset;
+		}
+		return false;
+	};
 
-			float2 t0;
-			float2 t1;
-			bool h0 = ray.Intersect(mNodes[n0].mBounds, t0);
-			bool h1 = ray.Intersect(mNodes[n1].mBounds, t1);
+	if (mWidth == 4)
+		mBvh4.Intersect(ray, ht, leaf);
+	else if (mWidth == 8)
+		mBvh8.Intersect(ray, ht, leaf);
+	else {
+		float3 invDirection = 1.f / ray.mDirection;
 
-			if (h0 && t0.y < ht) todo[++stackptr] = n0;
-			if (h1 && t1.y < ht) todo[++stackptr] = n1;
+		uint32_t todo[128];
+		int stackptr = 0;
+
+		todo[stackptr] = 0;
+
+		while (stackptr >= 0) {
+			uint32_t ni = todo[stackptr];
+			stackptr--;
+			const Node& node = mNodes[ni];
+
+			if (node.mRightOffset == 0) {
+				if (leaf(node.mStartIndex, node.mCount, ht)) break;
+			} else {
+				uint32_t n0 = ni + 1;
+				uint32_t n1 = ni + node.mRightOffset;
+
+				float2 t0;
+				float2 t1;
+				bool h0 = ray.Intersect(mNodes[n0].mBounds, invDirection, t0);
+				bool h1 = ray.Intersect(mNodes[n1].mBounds, invDirection, t1);
+
+				if (h0 && t0.x < ht) todo[++stackptr] = n0;
+				if (h1 && t1.x < ht) todo[++stackptr] = n1;
+			}
 		}
 	}
 
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <Scene/BvhBuilder.hpp>
 #include <Scene/Object.hpp>
+#include <Scene/WideBvh.hpp>
 
 #ifdef GetObject
 #undef GetObject
@@ -12,31 +14,73 @@ public:
 		AABB mBounds;
 		Object* mObject;
 	};
-	struct Node {
-		AABB mBounds;
-		// index of the first primitive inside this node
-		uint32_t mStartIndex;
-		// number of primitives inside this node
-		uint32_t mCount;
-		uint32_t mRightOffset; // 1st child is at node[index + 1], 2nd child is at node[index + mRightOffset]
-	};
+	typedef Bvh2Node Node;
 
-	inline ObjectBvh2() {};
+	inline ObjectBvh2(const BvhBuildSettings& settings = BvhBuildSettings(1)) : mSettings(settings), mWidth(2), mRefitThreshold(1.5f), mBuildCost(0), mCostSum(0) {};
 	inline ~ObjectBvh2() {}
 
 	const std::vector<Node>& Nodes() const { return mNodes; }
+	inline uint32_t PrimitiveCount() const { return (uint32_t)mPrimitives.size(); }
 	Object* GetObject(uint32_t index) const { return mPrimitives[index].mObject; }
+	inline const AABB& PrimitiveBounds(uint32_t index) const { return mPrimitives[index].mBounds; }
+	/// Index of the leaf node containing the primitive at index
+	inline uint32_t LeafIndex(uint32_t index) const { return mPrimitiveLeaf[index]; }
 
 	inline AABB RendererBounds() { return mRendererBounds; }
 
+	/// Settings used by the next Build()
+	inline BvhBuildSettings& Settings() { return mSettings; }
+	/// Computes quality metrics for the current tree
+	inline BvhStats Stats() const { return BvhBuilder::ComputeStats(mNodes, mSettings); }
+
 	ENGINE_EXPORT void Build(Object** objects, uint32_t objectCount);
+
+	/// Marks the leaf containing object for refitting. Returns false if object is not in the tree, in which case a full Build() is required.
+	/// Thread-safe, objects updated as jobs mark themselves dirty concurrently. Must not overlap Build() or Refit()
+	ENGINE_EXPORT bool MarkDirty(Object* object);
+	inline bool RefitPending() const { return !mDirtyPrimitives.empty(); }
+	/// Number of primitives waiting for Refit()
+	inline uint32_t DirtyCount() const { return (uint32_t)mDirtyPrimitives.size(); }
+	/// Recomputes the bounds of dirty primitives and refits their ancestors bottom-up.
+	/// Returns false if the SAH cost of the tree has grown past RefitThreshold() times the cost after the last Build(), in which case the tree should be rebuilt
+	ENGINE_EXPORT bool Refit();
+	inline float RefitThreshold() const { return mRefitThreshold; }
+	inline void RefitThreshold(float t) { mRefitThreshold = t; }
+	/// Queries use the tree width in Settings().mWidth at the time of the last Build()
 	ENGINE_EXPORT void FrustumCheck(const float4 frustum[6], std::vector<Object*>& objects, uint32_t mask);
 	ENGINE_EXPORT Object* Intersect(const Ray& ray, float* t, bool any, uint32_t mask);
 
 	ENGINE_EXPORT void DrawGizmos(CommandBuffer* commandBuffer, Camera* camera, Scene* scene);
 
 private:
+	BvhBuildSettings mSettings;
 	AABB mRendererBounds;
 	std::vector<Node> mNodes;
 	std::vector<Primitive> mPrimitives;
+
+	// Width the wide trees were collapsed with, 2 if only the binary tree is valid
+	uint32_t mWidth;
+	Bvh4 mBvh4;
+	Bvh8 mBvh8;
+
+	std::unordered_map<Object*, uint32_t> mPrimitiveIndices;
+	std::vector<uint32_t> mPrimitiveLeaf;
+	std::vector<uint32_t> mParents;
+	// Primitives that are Renderers, to recompute mRendererBounds in Refit()
+	std::vector<uint32_t> mRendererPrimitives;
+	// Guards mDirtyPrimitives and mPrimitiveDirty in MarkDirty()
+	std::mutex mDirtyMutex;
+	std::vector<uint32_t> mDirtyPrimitives;
+	std::vector<bool> mPrimitiveDirty;
+	std::vector<bool> mNodeDirty;
+
+	float mRefitThreshold;
+	// SAH cost after the last Build()
+	float mBuildCost;
+	// SAH cost of the tree, not normalized by the root's surface area
+	float mCostSum;
+
+	inline float NodeCost(const Node& node) const {
+		return (node.mRightOffset ? mSettings.mTraversalCost : mSettings.mIntersectionCost * node.mCount) * BvhBuilder::SurfaceArea(node.mBounds);
+	}
 };
\ No newline at end of file
@@ -0,0 +1,272 @@
+#include <Scene/OcclusionCuller.hpp>
+
+using namespace std;
+
+// Pixel centers of a row of 8 pixels
+static const float gPixelCenters[8] = { .5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f };
+
+OcclusionCuller::OcclusionCuller(uint32_t width, uint32_t height) : mViewProjection(float4x4(1)), mTriangleCount(0), mOccludedCount(0) {
+	mWidth = max(TileSize, (width + TileSize - 1) & ~(TileSize - 1));
+	mHeight = max(TileSize, (height + TileSize - 1) & ~(TileSize - 1));
+	mTilesX = mWidth / TileSize;
+	mTilesY = mHeight / TileSize;
+	mDepth.assign(mWidth * mHeight, 1.f);
+	mTileDepth.assign(mTilesX * mTilesY, 1.f);
+}
+
+void OcclusionCuller::Begin(const float4x4& viewProjection) {
+	mViewProjection = viewProjection;
+	fill(mDepth.begin(), mDepth.end(), 1.f);
+	fill(mTileDepth.begin(), mTileDepth.end(), 1.f);
+	mTriangleCount = 0;
+	mOccludedCount = 0;
+}
+
+void OcclusionCuller::RenderTriangles(const float3* vertices, uint32_t vertexCount, const uint3* triangles, uint32_t triangleCount, const float4x4& objectToWorld) {
+	float4x4 objectToClip = mViewProjection * objectToWorld;
+	mClipVertices.resize(vertexCount);
+	for (uint32_t i = 0; i < vertexCount; i++)
+		mClipVertices[i] = objectToClip * float4(vertices[i], 1.f);
+
+	float4 batch[4][3];
+	uint32_t batchSize = 0;
+	auto append = [&](const float4& v0, const float4& v1, const float4& v2) {
+		batch[batchSize][0] = v0;
+		batch[batchSize][1] = v1;
+		batch[batchSize][2] = v2;
+		if (++batchSize == 4) {
+			RasterizeTriangles(batch, 4);
+			batchSize = 0;
+		}
+	};
+
+	for (uint32_t t = 0; t < triangleCount; t++) {
+		const float4& v0 = mClipVertices[triangles[t].x];
+		const float4& v1 = mClipVertices[triangles[t].y];
+		const float4& v2 = mClipVertices[triangles[t].z];
+
+		// Skip triangles completely outside one of the side or far planes
+		if ((v0.x > v0.w && v1.x > v1.w && v2.x > v2.w) || (v0.x < -v0.w && v1.x < -v1.w && v2.x < -v2.w) ||
+			(v0.y > v0.w && v1.y > v1.w && v2.y > v2.w) || (v0.y < -v0.w && v1.y < -v1.w && v2.y < -v2.w) ||
+			(v0.z > v0.w && v1.z > v1.w && v2.z > v2.w)) continue;
+
+		uint32_t behind = (v0.z < 0 ? 1 : 0) | (v1.z < 0 ? 2 : 0) | (v2.z < 0 ? 4 : 0);
+		if (behind == 7) continue;
+		if (!behind) {
+			append(v0, v1, v2);
+			continue;
+		}
+
+		// Clip against the near plane, leaving a triangle or a quad
+		const float4* in[3] { &v0, &v1, &v2 };
+		float4 clipped[4];
+		uint32_t n = 0;
+		for (uint32_t i = 0; i < 3; i++) {
+			const float4& a = *in[i];
+			const float4& b = *in[(i + 1) % 3];
+			if (a.z >= 0) clipped[n++] = a;
+			if ((a.z >= 0) != (b.z >= 0)) clipped[n++] = lerp(a, b, a.z / (a.z - b.z));
+		}
+		append(clipped[0], clipped[1], clipped[2]);
+		if (n == 4) append(clipped[0], clipped[2], clipped[3]);
+	}
+	if (batchSize) RasterizeTriangles(batch, batchSize);
+}
+
+void OcclusionCuller::RasterizeTriangles(const float4 triangles[4][3], uint32_t count) {
+	// Unused lanes repeat the first triangle and are skipped after setup
+	uint32_t l1 = min(1u, count - 1);
+	uint32_t l2 = min(2u, count - 1);
+	uint32_t l3 = min(3u, count - 1);
+
+	simd4f x[3], y[3], z[3];
+	for (uint32_t k = 0; k < 3; k++) {
+		const float4& a = triangles[0][k];
+		const float4& b = triangles[l1][k];
+		const float4& c = triangles[l2][k];
+		const float4& d = triangles[l3][k];
+		simd4f invW = simd4f(1.f) / simd4f(a.w, b.w, c.w, d.w);
+		x[k] = (simd4f(a.x, b.x, c.x, d.x) * invW * simd4f(.5f) + simd4f(.5f)) * simd4f((float)mWidth);
+		y[k] = (simd4f(a.y, b.y, c.y, d.y) * invW * simd4f(.5f) + simd4f(.5f)) * simd4f((float)mHeight);
+		z[k] = simd4f(a.z, b.z, c.z, d.z) * invW;
+	}
+
+	simd4f area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	// Occluders are double sided, flip the edge functions of clockwise triangles so they are positive inside
+	simd4f sign = select(area < simd4f(0.f), simd4f(-1.f), simd4f(1.f));
+	alignas(16) float edgeA[3][4], edgeB[3][4], edgeC[3][4];
+	for (uint32_t k = 0; k < 3; k++) {
+		uint32_t n = (k + 1) % 3;
+		((y[k] - y[n]) * sign).Store(edgeA[k]);
+		((x[n] - x[k]) * sign).Store(edgeB[k]);
+		((x[k] * y[n] - y[k] * x[n]) * sign).Store(edgeC[k]);
+	}
+
+	// Depth plane, offset to the farthest depth it reaches within a pixel so the depth buffer stays conservative
+	simd4f invArea = simd4f(1.f) / area;
+	simd4f dzdx = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) * invArea;
+	simd4f dzdy = ((z[2] - z[0]) * (x[1] - x[0]) - (z[1] - z[0]) * (x[2] - x[0])) * invArea;
+	simd4f z0 = z[0] - dzdx * x[0] - dzdy * y[0] + simd4f(.5f) * (abs(dzdx) + abs(dzdy));
+	alignas(16) float depthX[4], depthY[4], depth0[4], depthMax[4];
+	dzdx.Store(depthX);
+	dzdy.Store(depthY);
+	z0.Store(depth0);
+	max(max(z[0], z[1]), z[2]).Store(depthMax);
+
+	alignas(16) float areas[4], minX[4], maxX[4], minY[4], maxY[4];
+	abs(area).Store(areas);
+	// Clamped before converting to pixels, vertices just past the near plane project very far away
+	max(min(min(x[0], x[1]), x[2]), simd4f(-1.f)).Store(minX);
+	min(max(max(x[0], x[1]), x[2]), simd4f((float)mWidth + 1)).Store(maxX);
+	max(min(min(y[0], y[1]), y[2]), simd4f(-1.f)).Store(minY);
+	min(max(max(y[0], y[1]), y[2]), simd4f((float)mHeight + 1)).Store(maxY);
+
+	simd8f centers = simd8f::LoadUnaligned(gPixelCenters);
+	simd8f zero(0.f);
+	for (uint32_t l = 0; l < count; l++) {
+		// Also skips NaN areas
+		if (!(areas[l] > 1e-6f)) continue;
+
+		// Pixels whose centers are inside the triangle's bounds
+		int32_t px0 = max(0, (int32_t)ceilf(minX[l] - .5f));
+		int32_t px1 = min((int32_t)mWidth - 1, (int32_t)floorf(maxX[l] - .5f));
+		int32_t py0 = max(0, (int32_t)ceilf(minY[l] - .5f));
+		int32_t py1 = min((int32_t)mHeight - 1, (int32_t)floorf(maxY[l] - .5f));
+		if (px0 > px1 || py0 > py1) continue;
+		mTriangleCount++;
+
+		simd8f a0(edgeA[0][l]), a1(edgeA[1][l]), a2(edgeA[2][l]);
+		simd8f dx(depthX[l]), zMax(depthMax[l]);
+		// Rows start on a multiple of 8 pixels, the rows are padded so the last span never passes the end of the row
+		int32_t xStart = px0 & ~7;
+		for (int32_t py = py0; py <= py1; py++) {
+			float cy = py + .5f;
+			simd8f e0(edgeB[0][l] * cy + edgeC[0][l]);
+			simd8f e1(edgeB[1][l] * cy + edgeC[1][l]);
+			simd8f e2(edgeB[2][l] * cy + edgeC[2][l]);
+			simd8f zRow(depthY[l] * cy + depth0[l]);
+			float* row = mDepth.data() + py * mWidth;
+			for (int32_t px = xStart; px <= px1; px += 8) {
+				simd8f cx = centers + simd8f((float)px);
+				simd8f inside = (a0 * cx + e0 >= zero) & (a1 * cx + e1 >= zero) & (a2 * cx + e2 >= zero);
+				if (!movemask(inside)) continue;
+				simd8f d = simd8f::LoadUnaligned(row + px);
+				select(inside, min(d, min(dx * cx + zRow, zMax)), d).StoreUnaligned(row + px);
+			}
+		}
+	}
+}
+
+void OcclusionCuller::End() {
+	for (uint32_t ty = 0; ty < mTilesY; ty++)
+		for (uint32_t tx = 0; tx < mTilesX; tx++) {
+			const float* tile = mDepth.data() + ty * TileSize * mWidth + tx * TileSize;
+			simd8f m = simd8f::LoadUnaligned(tile);
+			for (uint32_t r = 1; r < TileSize; r++)
+				m = max(m, simd8f::LoadUnaligned(tile + r * mWidth));
+			float v[8];
+			m.StoreUnaligned(v);
+			mTileDepth[ty * mTilesX + tx] = max(max(max(v[0], v[1]), max(v[2], v[3])), max(max(v[4], v[5]), max(v[6], v[7])));
+		}
+}
+
+bool OcclusionCuller::Visible(const AABB& bounds) const {
+	const float3& mn = bounds.mMin;
+	const float3& mx = bounds.mMax;
+	const float cornersX[8] { mn.x, mx.x, mn.x, mx.x, mn.x, mx.x, mn.x, mx.x };
+	const float cornersY[8] { mn.y, mn.y, mx.y, mx.y, mn.y, mn.y, mx.y, mx.y };
+	const float cornersZ[8] { mn.z, mn.z, mn.z, mn.z, mx.z, mx.z, mx.z, mx.z };
+	simd8f cx = simd8f::LoadUnaligned(cornersX);
+	simd8f cy = simd8f::LoadUnaligned(cornersY);
+	simd8f cz = simd8f::LoadUnaligned(cornersZ);
+
+	// Project all 8 corners at once
+	const float4x4& m = mViewProjection;
+	simd8f z = cx * simd8f(m[0].z) + cy * simd8f(m[1].z) + cz * simd8f(m[2].z) + simd8f(m[3].z);
+	// Boxes crossing the near plane contain the camera or are right in front of it
+	if (movemask(z < simd8f(0.f))) return true;
+	simd8f invW = simd8f(1.f) / (cx * simd8f(m[0].w) + cy * simd8f(m[1].w) + cz * simd8f(m[2].w) + simd8f(m[3].w));
+	simd8f x = ((cx * simd8f(m[0].x) + cy * simd8f(m[1].x) + cz * simd8f(m[2].x) + simd8f(m[3].x)) * invW * simd8f(.5f) + simd8f(.5f)) * simd8f((float)mWidth);
+	simd8f y = ((cx * simd8f(m[0].y) + cy * simd8f(m[1].y) + cz * simd8f(m[2].y) + simd8f(m[3].y)) * invW * simd8f(.5f) + simd8f(.5f)) * simd8f((float)mHeight);
+	z = z * invW;
+
+	float px[8], py[8], pz[8];
+	x.StoreUnaligned(px);
+	y.StoreUnaligned(py);
+	z.StoreUnaligned(pz);
+	float minX = px[0], maxX = px[0], minY = py[0], maxY = py[0], minZ = pz[0];
+	for (uint32_t i = 1; i < 8; i++) {
+		minX = min(minX, px[i]);
+		maxX = max(maxX, px[i]);
+		minY = min(minY, py[i]);
+		maxY = max(maxY, py[i]);
+		minZ = min(minZ, pz[i]);
+	}
+
+	// Every pixel the box's projection touches
+	int32_t x0 = max(0, (int32_t)floorf(max(minX, -1.f)));
+	int32_t x1 = min((int32_t)mWidth - 1, (int32_t)floorf(min(maxX, (float)mWidth)));
+	int32_t y0 = max(0, (int32_t)floorf(max(minY, -1.f)));
+	int32_t y1 = min((int32_t)mHeight - 1, (int32_t)floorf(min(maxY, (float)mHeight)));
+	if (x0 > x1 || y0 > y1) return true;
+
+	simd8f boxDepth(minZ);
+	for (int32_t ty = y0 / (int32_t)TileSize; ty <= y1 / (int32_t)TileSize; ty++)
+		for (int32_t tx = x0 / (int32_t)TileSize; tx <= x1 / (int32_t)TileSize; tx++) {
+			// Every pixel of the tile is in front of the box
+			if (mTileDepth[ty * mTilesX + tx] < minZ) continue;
+
+			// Test the pixels of the tile the box covers
+			int32_t bx = tx * TileSize;
+			uint32_t columns = 0xFF;
+			if (x0 > bx) columns &= 0xFF << (x0 - bx);
+			if (x1 < bx + (int32_t)TileSize - 1) columns &= 0xFF >> (bx + TileSize - 1 - x1);
+			int32_t ry1 = min(y1, ty * (int32_t)TileSize + (int32_t)TileSize - 1);
+			for (int32_t ry = max(y0, ty * (int32_t)TileSize); ry <= ry1; ry++)
+				if (movemask(simd8f::LoadUnaligned(mDepth.data() + ry * mWidth + bx) >= boxDepth) & columns)
+					return true;
+		}
+	return false;
+}
+
+void OcclusionCuller::Cull(const ObjectBvh2& bvh, const float4 frustum[6], vector<Object*>& objects, uint32_t mask) {
+	const vector<ObjectBvh2::Node>& nodes = bvh.Nodes();
+	if (nodes.empty()) return;
+
+	uint32_t todo[1024];
+	int32_t stackptr = 0;
+	todo[stackptr] = 0;
+
+	while (stackptr >= 0) {
+		uint32_t ni = todo[stackptr];
+		stackptr--;
+		const ObjectBvh2::Node& node = nodes[ni];
+
+		if (!node.mBounds.Intersects(frustum)) continue;
+		if (!Visible(node.mBounds)) {
+			mOccludedCount += node.mCount;
+			continue;
+		}
+
+		if (node.mRightOffset) {
+			todo[++stackptr] = ni + 1;
+			todo[++stackptr] = ni + node.mRightOffset;
+			continue;
+		}
+
+		for (uint32_t i = node.mStartIndex; i < node.mStartIndex + node.mCount; i++) {
+			Object* object = bvh.GetObject(i);
+			if (!(object->LayerMask() & mask)) continue;
+			// The bounds of a leaf with one object are that object's bounds, which were just tested
+			if (node.mCount > 1) {
+				const AABB& bounds = bvh.PrimitiveBounds(i);
+				if (!bounds.Intersects(frustum)) continue;
+				if (!Visible(bounds)) {
+					mOccludedCount++;
+					continue;
+				}
+			}
+			objects.push_back(object);
+		}
+	}
+}
\ No newline at end of file
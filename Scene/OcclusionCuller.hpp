@@ -0,0 +1,62 @@
+#pragma once
+
+#include <Scene/ObjectBvh2.hpp>
+#include <Scene/TriangleBvh2.hpp>
+
+/// Software occlusion culling: rasterizes occluder triangles into a small depth buffer on the CPU, then tests bounding boxes against it.
+/// Depth is clip space z / w, from 0 at the near plane to 1 at the far plane. Each pixel stores the farthest depth the occluders covering it
+/// can have, and each 8x8 tile stores the farthest depth of its pixels, so most boxes are accepted or rejected from the tiles alone.
+/// Coverage is sampled at pixel centers, so objects less than a pixel behind an occluder's silhouette may be culled
+class OcclusionCuller {
+public:
+	static const uint32_t TileSize = 8;
+
+	/// width and height are rounded up to a multiple of TileSize
+	ENGINE_EXPORT OcclusionCuller(uint32_t width = 256, uint32_t height = 128);
+
+	inline uint32_t Width() const { return mWidth; }
+	inline uint32_t Height() const { return mHeight; }
+	/// Width() * Height() depths, row by row
+	inline const float* Depth() const { return mDepth.data(); }
+
+	/// Clears the depth buffer and the counters. viewProjection transforms world space to clip space with z in [0, 1], such as
+	/// Camera::ViewProjection() * float4x4::Translate(-Camera::WorldPosition())
+	ENGINE_EXPORT void Begin(const float4x4& viewProjection);
+	/// Rasterizes triangles, which index vertices, transformed by objectToWorld. Triangles crossing the near plane are clipped
+	ENGINE_EXPORT void RenderTriangles(const float3* vertices, uint32_t vertexCount, const uint3* triangles, uint32_t triangleCount, const float4x4& objectToWorld);
+	/// Rasterizes the triangles of a mesh's CPU-side geometry, see Mesh::BVH()
+	inline void RenderOccluder(const TriangleBvh2& mesh, const float4x4& objectToWorld) {
+		RenderTriangles(mesh.Vertices().data(), (uint32_t)mesh.Vertices().size(), mesh.Triangles().data(), mesh.TriangleCount(), objectToWorld);
+	}
+	/// Computes the depth of every tile. Call after rendering the occluders and before testing boxes
+	ENGINE_EXPORT void End();
+
+	/// Returns false if bounds is completely hidden behind the occluders
+	ENGINE_EXPORT bool Visible(const AABB& bounds) const;
+	/// Appends the objects in bvh whose LayerMask() intersects mask, that intersect frustum and aren't hidden behind the occluders,
+	/// like ObjectBvh2::FrustumCheck. Nodes are tested against the depth buffer too, so hidden subtrees are skipped
+	ENGINE_EXPORT void Cull(const ObjectBvh2& bvh, const float4 frustum[6], std::vector<Object*>& objects, uint32_t mask);
+
+	/// Triangles rasterized since Begin(), after clipping
+	inline uint32_t TriangleCount() const { return mTriangleCount; }
+	/// Objects Cull() found hidden since Begin(), counting every object in a hidden node
+	inline uint32_t OccludedCount() const { return mOccludedCount; }
+
+private:
+	/// Sets up and rasterizes count <= 4 clip space triangles in front of the near plane, 4 at a time
+	ENGINE_EXPORT void RasterizeTriangles(const float4 triangles[4][3], uint32_t count);
+
+	uint32_t mWidth;
+	uint32_t mHeight;
+	uint32_t mTilesX;
+	uint32_t mTilesY;
+	float4x4 mViewProjection;
+	std::vector<float> mDepth;
+	// Farthest depth in each tile
+	std::vector<float> mTileDepth;
+	// Vertices of the mesh being rendered, in clip space
+	std::vector<float4> mClipVertices;
+
+	uint32_t mTriangleCount;
+	uint32_t mOccludedCount;
+};
\ No newline at end of file
@@ -4,6 +4,9 @@
 #include <Scene/Scene.hpp>
 #include <Util/Util.hpp>
 
+/// Render queues from this one up are blended, and sort back to front instead of by BatchKey()
+#define RENDER_QUEUE_TRANSPARENT 3000
+
 class Renderer : public virtual Object {
 public:
 	inline virtual uint32_t RenderQueue() { return 1000; }
@@ -13,6 +16,26 @@ public:
 	inline virtual void PreFrame(CommandBuffer* commandBuffer) {};
 	inline virtual void PreRender(CommandBuffer* commandBuffer, Camera* camera, PassType pass) {};
 	virtual void Draw(CommandBuffer* commandBuffer, Camera* camera, PassType pass) = 0;
+	/// Return true if Draw() only records commands and doesn't modify shared state, so it can run on a worker thread
+	/// while other renderers draw (see Scene::ParallelRecording())
+	inline virtual bool ThreadSafeDraw() { return false; }
 
 	inline virtual uint32_t LayerMask() override { return Visible() ? Object::LayerMask() | PassMask() : Object::LayerMask(); };
+
+	/// Identifies what the renderer draws with, such as its material and mesh. Renderers with equal keys are sorted next to each other so they can be batched
+	inline virtual uint32_t BatchKey() { return 0; }
+	/// Render list sort key: render queue, then BatchKey(), then distance to cameraPosition, front to back.
+	/// Queues from RENDER_QUEUE_TRANSPARENT up sort by distance alone, back to front, so blending composites far to near. Invisible renderers sort last
+	inline uint64_t SortKey(const float3& cameraPosition) {
+		if (!Visible()) return ~0ull;
+		float3 d = Bounds().Center() - cameraPosition;
+		float distance = dot(d, d);
+		// The bits of a positive float sort the same as its value
+		uint32_t bits;
+		memcpy(&bits, &distance, sizeof(bits));
+		uint32_t queue = std::min(RenderQueue(), 0xFFFEu);
+		if (queue >= RENDER_QUEUE_TRANSPARENT) return ((uint64_t)queue << 48) | ((uint64_t)~bits << 16);
+		// Keep the exponent and 7 bits of mantissa
+		return ((uint64_t)queue << 48) | ((uint64_t)BatchKey() << 16) | (bits >> 16);
+	}
 };
\ No newline at end of file
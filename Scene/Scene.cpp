@@ -5,6 +5,7 @@
 #include <Scene/GUI.hpp>
 #include <Core/Instance.hpp>
 #include <Util/Profiler.hpp>
+#include <Util/RadixSort.hpp>
 
 #include <assimp/scene.h>
 #include <assimp/cimport.h>
@@ -14,6 +15,8 @@
 using namespace std;
 
 #define INSTANCE_BATCH_SIZE 1024
+// Most renderers recorded into one secondary command buffer when recording in parallel
+#define RECORD_BATCH_SIZE 256
 #define MAX_GPU_LIGHTS 64
 
 #define SHADOW_ATLAS_RESOLUTION 8192
@@ -119,25 +122,20 @@ inline Bone* AddBone(AnimationRig& rig, aiNode* node, const aiScene* scene, aiNo
 	return bone;
 }
 
-bool RendererCompare(Object* oa, Object* ob) {
-	Renderer* a = dynamic_cast<Renderer*>(oa);
-	Renderer* b = dynamic_cast<Renderer*>(ob);
-	uint32_t qa = a->Visible() ? a->RenderQueue() : 0xFFFFFFFF;
-	uint32_t qb = b->Visible() ? b->RenderQueue() : 0xFFFFFFFF;
-	if (qa == qb && qa != 0xFFFFFFFF) {
-		MeshRenderer* ma = dynamic_cast<MeshRenderer*>(a);
-		MeshRenderer* mb = dynamic_cast<MeshRenderer*>(b);
-		if (ma && mb)
-			if (ma->Material() == mb->Material())
-				return ma->Mesh() < mb->Mesh();
-			else
-				return ma->Material() < mb->Material();
-	}
-	return qa < qb;
-};
+/// Sorts renderers by Renderer::SortKey() with a radix sort, so keys are computed once per renderer instead of once per comparison
+template<typename T>
+inline void SortRenderers(vector<T*>& renderers, vector<pair<uint64_t, T*>>& entries, vector<pair<uint64_t, T*>>& scratch, const float3& cameraPosition) {
+	entries.resize(renderers.size());
+	scratch.resize(renderers.size());
+	for (uint32_t i = 0; i < renderers.size(); i++)
+		entries[i] = make_pair(dynamic_cast<Renderer*>(renderers[i])->SortKey(cameraPosition), renderers[i]);
+	RadixSort(entries.data(), scratch.data(), entries.size(), [](const pair<uint64_t, T*>& e) { return e.first; });
+	for (uint32_t i = 0; i < renderers.size(); i++)
+		renderers[i] = entries[i].second;
+}
 
-Scene::Scene(::Instance* instance, ::AssetManager* assetManager, ::InputManager* inputManager, ::PluginManager* pluginManager)
-	: mInstance(instance), mAssetManager(assetManager), mInputManager(inputManager), mPluginManager(pluginManager), mLastBvhBuild(0), mDrawGizmos(false), mBvhDirty(true),
+Scene::Scene(::Instance* instance, ::AssetManager* assetManager, ::InputManager* inputManager, ::PluginManager* pluginManager, ::JobSystem* jobSystem)
+	: mInstance(instance), mAssetManager(assetManager), mInputManager(inputManager), mPluginManager(pluginManager), mJobSystem(jobSystem), mTransformHierarchy(nullptr), mOcclusionCuller(nullptr), mCullFrame(0), mLastBvhBuild(0), mDrawGizmos(false), mParallelRecording(true), mBvhDirty(true),
 	mFixedTimeStep(.0025f), mPhysicsTimeLimitPerFrame(.2f) , mFixedAccumulator(0), mDeltaTime(0), mTotalTime(0), mFps(0), mFrameTimeAccum(0), mFrameCount(0){
 
 	mBvh = new ObjectBvh2();
@@ -191,6 +189,8 @@ Scene::~Scene(){
 
 	while (mObjects.size())
 		RemoveObject(mObjects[0].get());
+	safe_delete(mTransformHierarchy);
+	safe_delete(mOcclusionCuller);
 
 	safe_delete(mEnvironment);
 
@@ -573,17 +573,35 @@ void Scene::Update(CommandBuffer* commandBuffer) {
 		mFrameCount = 0;
 	}
 
+	if (mTransformHierarchy) {
+		PROFILER_BEGIN("Update Transforms");
+		mTransformHierarchy->Update(mJobSystem);
+		PROFILER_END;
+	}
+
 	PROFILER_BEGIN("FixedUpdate");
 	float physicsTime = 0;
 	mFixedAccumulator += mDeltaTime;
 	t1 = mClock.now();
 	while (mFixedAccumulator > mFixedTimeStep && physicsTime < mPhysicsTimeLimitPerFrame) {
+		// Thread-safe objects are updated as jobs while the rest are updated in order on this thread
+		mParallelObjects.clear();
+		for (auto o : mObjects)
+			if (o->EnabledHierarchy() && o->ThreadSafeUpdate())
+				mParallelObjects.push_back(o.get());
+
+		JobCounter objectJobs;
+		mJobSystem->Schedule([&]() {
+			mJobSystem->ParallelFor((uint32_t)mParallelObjects.size(), [&](uint32_t i) {
+				mParallelObjects[i]->FixedUpdate(commandBuffer);
+			}, 16);
+		}, &objectJobs);
 		for (auto o : mObjects)
-			if (o->EnabledHierarchy())
+			if (o->EnabledHierarchy() && !o->ThreadSafeUpdate())
 				o->FixedUpdate(commandBuffer);
-		for (const auto& p : mPluginManager->Plugins())
-			if (p->mEnabled)
-				p->FixedUpdate(commandBuffer);
+		mJobSystem->Wait(&objectJobs);
+
+		UpdatePlugins(&EnginePlugin::FixedUpdate, commandBuffer);
 
 		mFixedAccumulator -= mFixedTimeStep;
 		physicsTime = (mClock.now() - t1).count() * 1e-9f;
@@ -591,19 +609,24 @@ void Scene::Update(CommandBuffer* commandBuffer) {
 	PROFILER_END;
 
 	PROFILER_BEGIN("Update");
-	for (const auto& p : mPluginManager->Plugins())
-		if (p->mEnabled)
-			p->PreUpdate(commandBuffer);
+	UpdatePlugins(&EnginePlugin::PreUpdate, commandBuffer);
+	UpdatePlugins(&EnginePlugin::Update, commandBuffer);
+	UpdatePlugins(&EnginePlugin::PostUpdate, commandBuffer);
+	PROFILER_END;
 
+}
+
+void Scene::UpdatePlugins(void (EnginePlugin::*hook)(CommandBuffer*), CommandBuffer* commandBuffer) {
+	JobCounter pluginJobs;
 	for (const auto& p : mPluginManager->Plugins())
-		if (p->mEnabled)
-			p->Update(commandBuffer);
+		if (p->mEnabled && p->ThreadSafeUpdate())
+			mJobSystem->Schedule([=]() { (p->*hook)(commandBuffer); }, &pluginJobs);
 
 	for (const auto& p : mPluginManager->Plugins())
-		if (p->mEnabled)
-			p->PostUpdate(commandBuffer);
-	PROFILER_END;
+		if (p->mEnabled && !p->ThreadSafeUpdate())
+			(p->*hook)(commandBuffer);
 
+	mJobSystem->Wait(&pluginJobs);
 }
 
 void Scene::PrePresent() {
@@ -618,6 +641,7 @@ void Scene::PrePresent() {
 void Scene::AddObject(shared_ptr<Object> object) {
 	mObjects.push_back(object);
 	object->mScene = this;
+	if (mTransformHierarchy) mTransformHierarchy->Add(object.get());
 
 	if (auto l = dynamic_cast<Light*>(object.get()))
 		mLights.push_back(l);
@@ -658,12 +682,17 @@ void Scene::RemoveObject(Object* object) {
 				it++;
 		}
 
+	if (auto m = dynamic_cast<MeshRenderer*>(object))
+		RemoveOccluder(m);
+
 	for (auto it = mObjects.begin(); it != mObjects.end();)
 		if (it->get() == object) {
 			mBvhDirty = true;
+			mCullFrame = 0;
 			while (object->mChildren.size())
 				object->RemoveChild(object->mChildren[0]);
 			if (object->mParent) object->mParent->RemoveChild(object);
+			if (mTransformHierarchy) mTransformHierarchy->Remove(object);
 			object->mParent = nullptr;
 			object->mScene = nullptr;
 			it = mObjects.erase(it);
@@ -672,6 +701,37 @@ void Scene::RemoveObject(Object* object) {
 			it++;
 }
 
+void Scene::UseTransformHierarchy(bool use) {
+	if (use == (mTransformHierarchy != nullptr)) return;
+	if (use) {
+		mTransformHierarchy = new ::TransformHierarchy();
+		for (const auto& o : mObjects)
+			mTransformHierarchy->Add(o.get());
+	} else {
+		// Detached objects flag their descendants again when they move
+		for (const auto& o : mObjects)
+			mTransformHierarchy->Remove(o.get());
+		safe_delete(mTransformHierarchy);
+		for (const auto& o : mObjects)
+			o->Dirty();
+	}
+}
+
+void Scene::UseOcclusionCulling(bool use) {
+	if (use == (mOcclusionCuller != nullptr)) return;
+	if (use)
+		mOcclusionCuller = new ::OcclusionCuller();
+	else
+		safe_delete(mOcclusionCuller);
+}
+void Scene::AddOccluder(MeshRenderer* renderer) {
+	if (find(mOccluders.begin(), mOccluders.end(), renderer) == mOccluders.end())
+		mOccluders.push_back(renderer);
+}
+void Scene::RemoveOccluder(MeshRenderer* renderer) {
+	mOccluders.erase(remove(mOccluders.begin(), mOccluders.end(), renderer), mOccluders.end());
+}
+
 void Scene::AddShadowCamera(uint32_t si, ShadowData* sd, bool ortho, float size, const float3& pos, const quaternion& rot, float near, float far) {
 	if (mShadowCameras.size() <= si)
 		mShadowCameras.push_back(new Camera("ShadowCamera", mShadowAtlasFramebuffer));
@@ -698,6 +758,17 @@ void Scene::AddShadowCamera(uint32_t si, ShadowData* sd, bool ortho, float size,
 
 void Scene::PreFrame(CommandBuffer* commandBuffer) {
 	vkCmdSetLineWidth(*commandBuffer, 1.0f);
+
+	PROFILER_BEGIN("Update Transforms");
+	if (mTransformHierarchy)
+		mTransformHierarchy->Update(mJobSystem);
+	else {
+		mTransformObjects.clear();
+		for (const auto& o : mObjects)
+			mTransformObjects.push_back(o.get());
+		Object::UpdateTransforms(mTransformObjects.data(), (uint32_t)mTransformObjects.size());
+	}
+	PROFILER_END;
 	
 	PROFILER_BEGIN("Renderer PreFrame");
 	for (Renderer* r : mRenderers)
@@ -718,7 +789,8 @@ void Scene::PreFrame(CommandBuffer* commandBuffer) {
 
 	if (!mBvh) {
 		PROFILER_BEGIN("Sort Renderers");
-		sort(mRenderers.begin(), mRenderers.end(), RendererCompare);
+		vector<pair<uint64_t, Renderer*>> entries, scratch;
+		SortRenderers(mRenderers, entries, scratch, mainCamera ? mainCamera->WorldPosition() : float3());
 		PROFILER_END;
 	}
 
@@ -877,17 +949,52 @@ void Scene::PreFrame(CommandBuffer* commandBuffer) {
 		}
 		PROFILER_END;
 	}
+	if (mBvh) {
+		PROFILER_BEGIN("Cull");
+		mFrustumCuller.Gather(*BVH());
+		mFrustumCuller.ClearFrusta();
+		for (Camera* c : mCameras)
+			if (c->EnabledHierarchy())
+				mFrustumCuller.AddFrustum(c->Frustum());
+		for (uint32_t i = 0; i < si; i++)
+			mFrustumCuller.AddFrustum(mShadowCameras[i]->Frustum());
+		mFrustumCuller.Cull(mJobSystem);
+		mCullFrame = mInstance->FrameCount();
+		PROFILER_END;
+	}
+
 	if (si) {
 		PROFILER_BEGIN("Render Shadows");
 		BEGIN_CMD_REGION(commandBuffer, "Render Shadows");
 
 		bool g = mDrawGizmos;
 		mDrawGizmos = false;
-		for (uint32_t i = 0; i < si; i++) {
-			mShadowCameras[i]->mEnabled = true;
-			Render(commandBuffer, mShadowCameras[i], mShadowAtlasFramebuffer, PASS_DEPTH, i == 0);
-			mShadowCount++;
-		}
+		if (mParallelRecording && mJobSystem && mJobSystem->WorkerCount()) {
+			// Record every shadow view on the job system at once, then execute them in order
+			if (mShadowRenderLists.size() < si) mShadowRenderLists.resize(si);
+			vector<vector<shared_ptr<CommandBuffer>>> commandBuffers(si);
+			JobCounter counter;
+			for (uint32_t i = 0; i < si; i++) {
+				mShadowCameras[i]->mEnabled = true;
+				GatherRenderers(mShadowCameras[i], PASS_DEPTH, mShadowRenderLists[i]);
+				if (PreRender(commandBuffer, mShadowCameras[i], PASS_DEPTH, mShadowRenderLists[i]))
+					RecordScene(mShadowCameras[i], mShadowAtlasFramebuffer, PASS_DEPTH, i == 0, mShadowRenderLists[i], commandBuffers[i], &counter);
+			}
+			mJobSystem->Wait(&counter);
+			for (uint32_t i = 0; i < si; i++) {
+				if (commandBuffers[i].size()) {
+					mShadowAtlasFramebuffer->BeginRenderPass(commandBuffer, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+					commandBuffer->ExecuteCommands(commandBuffers[i]);
+					vkCmdEndRenderPass(*commandBuffer);
+				}
+				mShadowCount++;
+			}
+		} else
+			for (uint32_t i = 0; i < si; i++) {
+				mShadowCameras[i]->mEnabled = true;
+				Render(commandBuffer, mShadowCameras[i], mShadowAtlasFramebuffer, PASS_DEPTH, i == 0);
+				mShadowCount++;
+			}
 		for (uint32_t i = si; i < mShadowCameras.size(); i++)
 			mShadowCameras[i]->mEnabled = false;
 		mDrawGizmos = g;
@@ -908,21 +1015,81 @@ void Scene::PreFrame(CommandBuffer* commandBuffer) {
 }
 
 void Scene::Render(CommandBuffer* commandBuffer, Camera* camera, Framebuffer* framebuffer, PassType pass, bool clear) {
+	GatherRenderers(camera, pass, mRenderList);
+	Render(commandBuffer, camera, framebuffer, pass, clear, mRenderList);
+}
+
+void Scene::GatherRenderers(Camera* camera, PassType pass, vector<Object*>& renderList) {
 	PROFILER_BEGIN("Gather Renderers");
-	mRenderList.clear();
-	BVH()->FrustumCheck(camera->Frustum(), mRenderList, pass);
+	renderList.clear();
+	if (mOcclusionCuller && pass == PASS_MAIN && camera->StereoMode() == STEREO_NONE) {
+		// Rasterize the occluders in view, then walk the BVH skipping whatever they hide
+		PROFILER_BEGIN("Occlusion Cull");
+		mOcclusionCuller->Begin(camera->ViewProjection() * float4x4::Translate(-camera->WorldPosition()));
+		for (MeshRenderer* o : mOccluders)
+			if (o->Visible() && o->Mesh()->BVH() && o->Bounds().Intersects(camera->Frustum()))
+				mOcclusionCuller->RenderOccluder(*o->Mesh()->BVH(), o->ObjectToWorld());
+		mOcclusionCuller->End();
+		mOcclusionCuller->Cull(*BVH(), camera->Frustum(), renderList, pass);
+		PROFILER_COUNT("Occluder Triangles", mOcclusionCuller->TriangleCount());
+		PROFILER_COUNT("Occluded Objects", mOcclusionCuller->OccludedCount());
+		PROFILER_END;
+	} else {
+		// Use the results from PreFrame() if nothing moved or was removed since
+		uint32_t frustum = ~0u;
+		if (mCullFrame == mInstance->FrameCount() && mBvh && !mBvhDirty && !mBvh->RefitPending())
+			frustum = mFrustumCuller.FindFrustum(camera->Frustum());
+		if (frustum != ~0u)
+			mFrustumCuller.Collect(frustum, pass, renderList);
+		else
+			BVH()->FrustumCheck(camera->Frustum(), renderList, pass);
+	}
 	PROFILER_END;
 	PROFILER_BEGIN("Sort Renderers");
-	sort(mRenderList.begin(), mRenderList.end(), RendererCompare);
+	SortRenderers(renderList, mSortEntries, mSortScratch, camera->WorldPosition());
 	PROFILER_END;
-
-	Render(commandBuffer, camera, framebuffer, pass, clear, mRenderList);
 }
 
 void Scene::Render(CommandBuffer* commandBuffer, Camera* camera, Framebuffer* framebuffer, PassType pass, bool clear, vector<Object*>& renderList) {
+	if (!PreRender(commandBuffer, camera, pass, renderList))
+		return;
+
+	PROFILER_BEGIN("Render");
+	BEGIN_CMD_REGION(commandBuffer, "Render");
+
+	PROFILER_BEGIN("Begin RenderPass");
+	// begin renderpass
+	if (!framebuffer) framebuffer = camera->Framebuffer();
+	bool parallel = mParallelRecording && mJobSystem && mJobSystem->WorkerCount() && renderList.size() > RECORD_BATCH_SIZE;
+	framebuffer->BeginRenderPass(commandBuffer, parallel ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+	PROFILER_END;
+
+	if (parallel) {
+		PROFILER_BEGIN("Record Secondary Command Buffers");
+		JobCounter counter;
+		vector<shared_ptr<CommandBuffer>> commandBuffers;
+		RecordScene(camera, framebuffer, pass, clear, renderList, commandBuffers, &counter);
+		mJobSystem->Wait(&counter);
+		commandBuffer->ExecuteCommands(commandBuffers);
+		PROFILER_END;
+	} else {
+		BeginScene(commandBuffer, camera, framebuffer, pass, clear);
+		DrawRenderers(commandBuffer, camera, pass, renderList.data(), (uint32_t)renderList.size());
+		EndScene(commandBuffer, camera, pass);
+	}
+
+	PROFILER_BEGIN("End RenderPass");
+	vkCmdEndRenderPass(*commandBuffer);
+	PROFILER_END;
+
+	END_CMD_REGION(commandBuffer);
+	PROFILER_END;
+}
+
+bool Scene::PreRender(CommandBuffer* commandBuffer, Camera* camera, PassType pass, vector<Object*>& renderList) {
 	camera->PreRender();
 	if (camera->FramebufferWidth() == 0 || camera->FramebufferHeight() == 0)
-		return;
+		return false;
 
 	PROFILER_BEGIN("Environment PreRender");
 	BEGIN_CMD_REGION(commandBuffer, "Environment PreRender");
@@ -945,17 +1112,12 @@ void Scene::Render(CommandBuffer* commandBuffer, Camera* camera, Framebuffer* fr
 		dynamic_cast<Renderer*>(o)->PreRender(commandBuffer, camera, pass);
 	END_CMD_REGION(commandBuffer);
 	PROFILER_END;
+	return true;
+}
 
-	PROFILER_BEGIN("Render");
-	BEGIN_CMD_REGION(commandBuffer, "Render");
-
-	PROFILER_BEGIN("Begin RenderPass");
-	// begin renderpass
-	if (!framebuffer) framebuffer = camera->Framebuffer();
-	framebuffer->BeginRenderPass(commandBuffer);
+void Scene::BeginScene(CommandBuffer* commandBuffer, Camera* camera, Framebuffer* framebuffer, PassType pass, bool clear) {
 	if (clear) framebuffer->Clear(commandBuffer);
 	camera->Set(commandBuffer);
-	PROFILER_END;
 
 	PROFILER_BEGIN("Plugin PreRenderScene");
 	for (const auto& p : mPluginManager->Plugins())
@@ -967,23 +1129,27 @@ void Scene::Render(CommandBuffer* commandBuffer, Camera* camera, Framebuffer* fr
 		PROFILER_BEGIN("Draw skybox");
 		ShaderVariant* shader = mEnvironment->mSkyboxMaterial->GetShader(PASS_MAIN);
 		VkPipelineLayout layout = commandBuffer->BindMaterial(mEnvironment->mSkyboxMaterial.get(), pass, mSkyboxCube->VertexInput(), camera, mSkyboxCube->Topology());
-		commandBuffer->BindVertexBuffer(mSkyboxCube->VertexBuffer().get(), 0, 0);
-		commandBuffer->BindIndexBuffer(mSkyboxCube->IndexBuffer().get(), 0, mSkyboxCube->IndexType());
-		camera->SetStereo(commandBuffer, shader, EYE_LEFT);
-		vkCmdDrawIndexed(*commandBuffer, mSkyboxCube->IndexCount(), 1, mSkyboxCube->BaseIndex(), mSkyboxCube->BaseVertex(), 0);
-		commandBuffer->mTriangleCount += mSkyboxCube->IndexCount() / 3;
-		if (camera->StereoMode() != STEREO_NONE) {
-			camera->SetStereo(commandBuffer, shader, EYE_RIGHT);
+		if (layout) {
+			commandBuffer->BindVertexBuffer(mSkyboxCube->VertexBuffer().get(), 0, 0);
+			commandBuffer->BindIndexBuffer(mSkyboxCube->IndexBuffer().get(), 0, mSkyboxCube->IndexType());
+			camera->SetStereo(commandBuffer, shader, EYE_LEFT);
 			vkCmdDrawIndexed(*commandBuffer, mSkyboxCube->IndexCount(), 1, mSkyboxCube->BaseIndex(), mSkyboxCube->BaseVertex(), 0);
 			commandBuffer->mTriangleCount += mSkyboxCube->IndexCount() / 3;
+			if (camera->StereoMode() != STEREO_NONE) {
+				camera->SetStereo(commandBuffer, shader, EYE_RIGHT);
+				vkCmdDrawIndexed(*commandBuffer, mSkyboxCube->IndexCount(), 1, mSkyboxCube->BaseIndex(), mSkyboxCube->BaseVertex(), 0);
+				commandBuffer->mTriangleCount += mSkyboxCube->IndexCount() / 3;
+			}
 		}
 		PROFILER_END;
 	}
+}
 
+void Scene::DrawRenderers(CommandBuffer* commandBuffer, Camera* camera, PassType pass, Object* const* renderers, uint32_t count) {
 	#pragma region Render renderers
 	uint32_t frameContextIndex = commandBuffer->Device()->FrameContextIndex();
+	VkDeviceSize instanceAlignment = commandBuffer->Device()->Limits().minStorageBufferOffsetAlignment;
 	DescriptorSet* batchDS = nullptr;
-	Buffer* batchBuffer = nullptr;
 	InstanceBuffer* curBatch = nullptr;
 	MeshRenderer* batchStart = nullptr;
 	uint32_t batchSize = 0;
@@ -996,8 +1162,8 @@ void Scene::Render(CommandBuffer* commandBuffer, Camera* camera, Framebuffer* fr
 			PROFILER_END;
 		}
 	};
-	for (Object* o : renderList) {
-		Renderer* r = dynamic_cast<Renderer*>(o);
+	for (uint32_t i = 0; i < count; i++) {
+		Renderer* r = dynamic_cast<Renderer*>(renderers[i]);
 		bool batched = false;
 		if (MeshRenderer* cur = dynamic_cast<MeshRenderer*>(r)) {
 			GraphicsShader* curShader = cur->Material()->GetShader(pass);
@@ -1011,20 +1177,28 @@ void Scene::Render(CommandBuffer* commandBuffer, Camera* camera, Framebuffer* fr
 					batchSize = 0;
 					batchStart = cur;
 
-					batchBuffer = commandBuffer->Device()->GetTempBuffer("Instance Batch", sizeof(InstanceBuffer) * INSTANCE_BATCH_SIZE, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-					curBatch = (InstanceBuffer*)batchBuffer->MappedData();
+					// count the renderers that will join this batch, so exactly that many instances are allocated from the frame's memory
+					uint32_t instanceCount = 1;
+					for (uint32_t j = i + 1; j < count && instanceCount + 1 < INSTANCE_BATCH_SIZE; j++) {
+						MeshRenderer* next = dynamic_cast<MeshRenderer*>(renderers[j]);
+						if (!next || next->Material() != cur->Material() || next->Mesh() != cur->Mesh()) break;
+						instanceCount++;
+					}
+
+					FrameAllocation batchMemory = commandBuffer->Device()->AllocateFrameMemory(sizeof(InstanceBuffer) * instanceCount, instanceAlignment);
+					curBatch = (InstanceBuffer*)batchMemory.mMapped;
 
-					batchDS = commandBuffer->Device()->GetTempDescriptorSet("Instance Batch", curShader->mDescriptorSetLayouts[PER_OBJECT]);
-					batchDS->CreateStorageBufferDescriptor(batchBuffer, 0, batchBuffer->Size(), INSTANCE_BUFFER_BINDING);
+					DescriptorKey key((uint64_t)curShader->mDescriptorSetLayouts[PER_OBJECT]);
+					DescriptorSet::AddStorageBufferDescriptor(key, batchMemory.mBuffer, batchMemory.mOffset, sizeof(InstanceBuffer) * instanceCount, INSTANCE_BUFFER_BINDING);
 					if (pass == PASS_MAIN) {
 						if (curShader->mDescriptorBindings.count("Lights"))
-							batchDS->CreateStorageBufferDescriptor(mLightBuffers[frameContextIndex], 0, mLightBuffers[frameContextIndex]->Size(), LIGHT_BUFFER_BINDING);
+							DescriptorSet::AddStorageBufferDescriptor(key, mLightBuffers[frameContextIndex], 0, mLightBuffers[frameContextIndex]->Size(), LIGHT_BUFFER_BINDING);
 						if (curShader->mDescriptorBindings.count("Shadows"))
-							batchDS->CreateStorageBufferDescriptor(mShadowBuffers[frameContextIndex], 0, mShadowBuffers[frameContextIndex]->Size(), SHADOW_BUFFER_BINDING);
+							DescriptorSet::AddStorageBufferDescriptor(key, mShadowBuffers[frameContextIndex], 0, mShadowBuffers[frameContextIndex]->Size(), SHADOW_BUFFER_BINDING);
 						if (curShader->mDescriptorBindings.count("ShadowAtlas"))
-							batchDS->CreateSampledTextureDescriptor(mShadowAtlases[frameContextIndex], SHADOW_ATLAS_BINDING);
+							DescriptorSet::AddSampledTextureDescriptor(key, mShadowAtlases[frameContextIndex], SHADOW_ATLAS_BINDING);
 					}
-					batchDS->FlushWrites();
+					batchDS = commandBuffer->Device()->GetCachedDescriptorSet("Instance Batch", key);
 
 					PROFILER_END;
 				}
@@ -1050,7 +1224,9 @@ void Scene::Render(CommandBuffer* commandBuffer, Camera* camera, Framebuffer* fr
 	// render last batch
 	DrawLastBatch();
 	#pragma endregion
+}
 
+void Scene::EndScene(CommandBuffer* commandBuffer, Camera* camera, PassType pass) {
 	if (mDrawGizmos && pass == PASS_MAIN) {
 		PROFILER_BEGIN("Draw Gizmos");
 		BEGIN_CMD_REGION(commandBuffer, "Draw Gizmos");
@@ -1105,14 +1281,54 @@ void Scene::Render(CommandBuffer* commandBuffer, Camera* camera, Framebuffer* fr
 	for (const auto& p : mPluginManager->Plugins())
 		if (p->mEnabled) p->PostRenderScene(commandBuffer, camera, pass);
 	PROFILER_END;
+}
 
+void Scene::RecordScene(Camera* camera, Framebuffer* framebuffer, PassType pass, bool clear, vector<Object*>& renderList, vector<shared_ptr<CommandBuffer>>& commandBuffers, JobCounter* counter) {
+	Device* device = mInstance->Device();
+	RenderPass* renderPass = framebuffer->RenderPass();
+	VkFramebuffer vkFramebuffer = *framebuffer;
+
+	// Split the render list into batches of up to RECORD_BATCH_SIZE renderers that can be drawn from any thread,
+	// and runs of renderers that have to be drawn on this one
+	vector<pair<uint32_t, uint32_t>> batches;
+	vector<bool> threadSafe;
+	for (uint32_t i = 0; i < renderList.size();) {
+		bool safe = dynamic_cast<Renderer*>(renderList[i])->ThreadSafeDraw();
+		uint32_t end = i + 1;
+		while (end < renderList.size() && (!safe || end - i < RECORD_BATCH_SIZE) && dynamic_cast<Renderer*>(renderList[end])->ThreadSafeDraw() == safe)
+			end++;
+		batches.push_back(make_pair(i, end));
+		threadSafe.push_back(safe);
+		i = end;
+	}
 
-	PROFILER_BEGIN("End RenderPass");
-	vkCmdEndRenderPass(*commandBuffer);
-	PROFILER_END;
+	// The scene setup goes first and the plugins, gizmos and GUI go last; each batch writes its own element in between
+	commandBuffers.resize(batches.size() + 2);
 
-	END_CMD_REGION(commandBuffer);
-	PROFILER_END;
+	auto Record = [=, &renderList](uint32_t begin, uint32_t end) {
+		shared_ptr<CommandBuffer> commandBuffer = device->GetSecondaryCommandBuffer("Scene Render", renderPass, vkFramebuffer);
+		camera->SetViewport(commandBuffer.get());
+		DrawRenderers(commandBuffer.get(), camera, pass, renderList.data() + begin, end - begin);
+		commandBuffer->End();
+		return commandBuffer;
+	};
+
+	commandBuffers[0] = device->GetSecondaryCommandBuffer("Scene Begin", renderPass, vkFramebuffer);
+	BeginScene(commandBuffers[0].get(), camera, framebuffer, pass, clear);
+	commandBuffers[0]->End();
+
+	for (uint32_t i = 0; i < batches.size(); i++)
+		if (threadSafe[i]) {
+			pair<uint32_t, uint32_t> batch = batches[i];
+			mJobSystem->Schedule([=, &commandBuffers]() { commandBuffers[i + 1] = Record(batch.first, batch.second); }, counter);
+		}
+	for (uint32_t i = 0; i < batches.size(); i++)
+		if (!threadSafe[i])
+			commandBuffers[i + 1] = Record(batches[i].first, batches[i].second);
+
+	commandBuffers.back() = device->GetSecondaryCommandBuffer("Scene End", renderPass, vkFramebuffer);
+	EndScene(commandBuffers.back().get(), camera, pass);
+	commandBuffers.back()->End();
 }
 
 vector<Object*> Scene::Objects() const {
@@ -1130,6 +1346,33 @@ ObjectBvh2* Scene::BVH() {
 		mBvhDirty = false;
 		mLastBvhBuild = mInstance->FrameCount();
 		PROFILER_END;
+	} else if (mBvh && mBvh->RefitPending()) {
+		PROFILER_BEGIN("Refit BVH");
+		if (!mBvh->Refit()) {
+			// Tree quality degraded too far, rebuild from scratch
+			vector<Object*> objs = Objects();
+			mBvh->Build(objs.data(), objs.size());
+		}
+		mLastBvhBuild = mInstance->FrameCount();
+		PROFILER_END;
 	}
 	return mBvh;
+}
+
+uint32_t Scene::PrewarmPipelines() {
+	vector<PipelineKey> keys = mInstance->Device()->RecordedPipelines();
+	if (keys.empty()) return 0;
+
+	PROFILER_BEGIN("Prewarm pipelines");
+	unordered_set<RenderPass*> renderPasses;
+	if (mShadowAtlasFramebuffer->RenderPass()) renderPasses.insert(mShadowAtlasFramebuffer->RenderPass());
+	for (Camera* c : mCameras)
+		if (c->Framebuffer() && c->Framebuffer()->RenderPass())
+			renderPasses.insert(c->Framebuffer()->RenderPass());
+
+	uint32_t count = 0;
+	for (RenderPass* rp : renderPasses)
+		count += mAssetManager->PrewarmPipelines(keys, rp);
+	PROFILER_END;
+	return count;
 }
\ No newline at end of file
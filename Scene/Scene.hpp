@@ -4,19 +4,25 @@
 #include <Content/Material.hpp>
 #include <Core/Instance.hpp>
 #include <Core/DescriptorSet.hpp>
+#include <Core/JobSystem.hpp>
 #include <Core/PluginManager.hpp>
 #include <Input/InputManager.hpp>
 #include <Scene/ObjectBvh2.hpp>
 #include <Scene/Camera.hpp>
 #include <Scene/Gizmos.hpp>
 #include <Scene/Environment.hpp>
+#include <Scene/FrustumCuller.hpp>
 #include <Scene/Light.hpp>
 #include <Scene/Object.hpp>
+#include <Scene/OcclusionCuller.hpp>
+#include <Scene/TransformHierarchy.hpp>
 #include <Util/Util.hpp>
 
+#include <atomic>
 #include <functional>
 
 class Renderer;
+class MeshRenderer;
 
 /// Holds scene Objects. In general, plugins will add objects during their lifetime,
 /// and remove objects during or at the end of their lifetime.
@@ -68,18 +74,49 @@ public:
 	inline ::AssetManager* AssetManager() const { return mAssetManager; }
 	inline ::InputManager* InputManager() const { return mInputManager; }
 	inline ::PluginManager* PluginManager() const { return mPluginManager; }
+	inline ::JobSystem* JobSystem() const { return mJobSystem; }
 	inline ::Environment* Environment() const { return mEnvironment; }
 	inline ::Instance* Instance() const { return mInstance; }
 
 	inline void DrawGizmos(bool g) { mDrawGizmos = g; }
 	inline bool DrawGizmos() const { return mDrawGizmos; }
 
+	/// Records large render lists into secondary command buffers on the job system, in batches of renderers whose
+	/// Renderer::ThreadSafeDraw() is true, and records every shadow view at once. Has no effect without worker threads. On by default
+	inline void ParallelRecording(bool p) { mParallelRecording = p; }
+	inline bool ParallelRecording() const { return mParallelRecording; }
+
 	// All objects, in order off insertion
 	ENGINE_EXPORT std::vector<Object*> Objects() const;
 
+	/// Attaches every object to a TransformHierarchy, which updates transforms in bulk once per fixed update and once per frame
+	/// instead of flagging descendants every time an object moves. Off by default, see TransformHierarchy for the differences
+	ENGINE_EXPORT void UseTransformHierarchy(bool use);
+	/// The hierarchy used by UseTransformHierarchy(), or null
+	inline ::TransformHierarchy* TransformHierarchy() const { return mTransformHierarchy; }
+
+	/// Rasterizes the occluders on the CPU before each PASS_MAIN render of a mono camera, and skips the renderers they hide.
+	/// Off by default
+	ENGINE_EXPORT void UseOcclusionCulling(bool use);
+	/// The culler used by UseOcclusionCulling(), or null
+	inline ::OcclusionCuller* OcclusionCuller() const { return mOcclusionCuller; }
+	/// Adds a renderer whose mesh hides what is behind it when UseOcclusionCulling() is on. Its Mesh()->BVH() supplies the triangles,
+	/// so large meshes with few triangles, such as walls and floors, make the best occluders
+	ENGINE_EXPORT void AddOccluder(MeshRenderer* renderer);
+	ENGINE_EXPORT void RemoveOccluder(MeshRenderer* renderer);
+
 	ENGINE_EXPORT ObjectBvh2* BVH();
-	inline void BvhDirty(Object* reason) { mBvhDirty = true; }
-	// Frame id of the last bvh build
+
+	/// Creates the pipelines recorded in previous runs (see Device::RecordedPipelines()) for the render passes of the cameras and the shadow atlas,
+	/// so they aren't created in the middle of a frame. Call after the cameras are created. Returns the number of pipelines created or scheduled
+	ENGINE_EXPORT uint32_t PrewarmPipelines();
+	/// Called when reason moves. Objects already in the BVH only have their leaf refit, anything else triggers a full build.
+	/// Thread-safe, thread-safe FixedUpdates call it from jobs
+	inline void BvhDirty(Object* reason) {
+		if (mBvhDirty) return;
+		if (!reason || !mBvh || !mBvh->MarkDirty(reason)) mBvhDirty = true;
+	}
+	// Frame id of the last bvh build or refit
 	inline uint64_t LastBvhBuild() { return mLastBvhBuild; }
 
 private:
@@ -87,12 +124,27 @@ private:
 	ENGINE_EXPORT void Update(CommandBuffer* commandBuffer);
 	ENGINE_EXPORT void PreFrame(CommandBuffer* commandBuffer);
 	ENGINE_EXPORT void PrePresent();
-	ENGINE_EXPORT Scene(::Instance* instance, ::AssetManager* assetManager, ::InputManager* inputManager, ::PluginManager* pluginManager);
+	ENGINE_EXPORT Scene(::Instance* instance, ::AssetManager* assetManager, ::InputManager* inputManager, ::PluginManager* pluginManager, ::JobSystem* jobSystem);
 	
 	/// Used in PreFrame() to add a shadow camera to mShadowCameras
 	ENGINE_EXPORT void AddShadowCamera(uint32_t si, ShadowData* sd, bool ortho, float size, const float3& pos, const quaternion& rot, float near, float far);
 
+	/// Culls and sorts the renderers camera sees into renderList
+	ENGINE_EXPORT void GatherRenderers(Camera* camera, PassType pass, std::vector<Object*>& renderList);
 	ENGINE_EXPORT void Render(CommandBuffer* commandBuffer, Camera* camera, Framebuffer* framebuffer, PassType pass, bool clear, std::vector<Object*>& renderList);
+	/// Runs the PreRender hooks, before the render pass begins. Returns false if the camera has nothing to render to
+	ENGINE_EXPORT bool PreRender(CommandBuffer* commandBuffer, Camera* camera, PassType pass, std::vector<Object*>& renderList);
+	/// Clears, sets the camera, and draws the plugins' PreRenderScene and the skybox
+	ENGINE_EXPORT void BeginScene(CommandBuffer* commandBuffer, Camera* camera, Framebuffer* framebuffer, PassType pass, bool clear);
+	/// Draws renderers in order, batching consecutive MeshRenderers into instanced draws
+	ENGINE_EXPORT void DrawRenderers(CommandBuffer* commandBuffer, Camera* camera, PassType pass, Object* const* renderers, uint32_t count);
+	/// Draws the gizmos, the GUI and the plugins' PostRenderScene
+	ENGINE_EXPORT void EndScene(CommandBuffer* commandBuffer, Camera* camera, PassType pass);
+	/// Records the contents of a render pass of framebuffer into commandBuffers, in the order to execute them. Batches of thread-safe renderers
+	/// are recorded by jobs that increment counter; wait for it before executing. renderList and commandBuffers must stay alive until then
+	ENGINE_EXPORT void RecordScene(Camera* camera, Framebuffer* framebuffer, PassType pass, bool clear, std::vector<Object*>& renderList, std::vector<std::shared_ptr<CommandBuffer>>& commandBuffers, JobCounter* counter);
+	/// Runs a plugin hook on every enabled plugin. Thread-safe plugins run as jobs while the rest run in order on the calling thread
+	ENGINE_EXPORT void UpdatePlugins(void (EnginePlugin::*hook)(CommandBuffer*), CommandBuffer* commandBuffer);
 
 	float mFixedAccumulator;
 	float mFixedTimeStep;
@@ -109,9 +161,17 @@ private:
 
 	Mesh* mSkyboxCube;
 
+	::TransformHierarchy* mTransformHierarchy;
+	::OcclusionCuller* mOcclusionCuller;
+	std::vector<MeshRenderer*> mOccluders;
+
 	ObjectBvh2* mBvh;
+	// Culls the BVH's primitives against every camera and shadow camera once per frame, Render() reuses the results
+	FrustumCuller mFrustumCuller;
+	// Frame the culling results were computed in, 0 after objects are removed
+	uint64_t mCullFrame;
 	uint64_t mLastBvhBuild;
-	bool mBvhDirty;
+	std::atomic<bool> mBvhDirty;
 
 	float2 mShadowTexelSize;
 
@@ -120,6 +180,8 @@ private:
 	Buffer** mLightBuffers;
 	Buffer** mShadowBuffers;
 	std::vector<Camera*> mShadowCameras;
+	// Render list of each shadow camera, when shadows are recorded in parallel
+	std::vector<std::vector<Object*>> mShadowRenderLists;
 	Framebuffer* mShadowAtlasFramebuffer;
 
 	Texture** mShadowAtlases;
@@ -130,11 +192,20 @@ private:
 	::Instance* mInstance;
 	::InputManager* mInputManager;
 	::PluginManager* mPluginManager;
+	::JobSystem* mJobSystem;
 	::Environment* mEnvironment;
 	std::vector<std::shared_ptr<Object>> mObjects;
 	std::vector<Light*> mLights;
 	std::vector<Camera*> mCameras;
 	std::vector<Renderer*> mRenderers;
 	std::vector<Object*> mRenderList;
+	// Sort keys of mRenderList, kept to avoid reallocating every Render()
+	std::vector<std::pair<uint64_t, Object*>> mSortEntries;
+	std::vector<std::pair<uint64_t, Object*>> mSortScratch;
+	// Enabled objects with thread-safe FixedUpdates, rebuilt every fixed step
+	std::vector<Object*> mParallelObjects;
+	// Every object, rebuilt every frame for Object::UpdateTransforms
+	std::vector<Object*> mTransformObjects;
 	bool mDrawGizmos;
+	bool mParallelRecording;
 };
\ No newline at end of file
@@ -4,6 +4,10 @@
 
 using namespace std;
 
+static const PropertyID gTimeID = PropertyToID("Time");
+static const PropertyID gLightCountID = PropertyToID("LightCount");
+static const PropertyID gShadowTexelSizeID = PropertyToID("ShadowTexelSize");
+
 SkinnedMeshRenderer::SkinnedMeshRenderer(const string& name) : MeshRenderer(name), Object(name) {}
 SkinnedMeshRenderer::~SkinnedMeshRenderer() {}
 
@@ -140,9 +144,9 @@ void SkinnedMeshRenderer::DrawInstanced(CommandBuffer* commandBuffer, Camera* ca
 	uint32_t lc = (uint32_t)Scene()->ActiveLights().size();
 	float2 s = Scene()->ShadowTexelSize();
 	float t = Scene()->TotalTime();
-	commandBuffer->PushConstant(shader, "Time", &t);
-	commandBuffer->PushConstant(shader, "LightCount", &lc);
-	commandBuffer->PushConstant(shader, "ShadowTexelSize", &s);
+	commandBuffer->PushConstant(shader, gTimeID, &t);
+	commandBuffer->PushConstant(shader, gLightCountID, &lc);
+	commandBuffer->PushConstant(shader, gShadowTexelSizeID, &s);
 	for (const auto& kp : mPushConstants)
 		commandBuffer->PushConstant(shader, kp.first, &kp.second);
 	
@@ -0,0 +1,227 @@
+#include <Scene/TransformHierarchy.hpp>
+#include <Scene/Scene.hpp>
+#include <Util/Profiler.hpp>
+
+using namespace std;
+
+// Updating a node composes its TRS and multiplies by the parent's matrix, tens of nanoseconds.
+// Below 512 dirty nodes a level takes a few microseconds, about what waking the workers and waiting for them costs
+#define TRANSFORM_PARALLEL_MIN_DIRTY 512
+// Nodes per job, enough that each job runs for a few microseconds
+#define TRANSFORM_PARALLEL_BATCH 128
+
+template<typename T>
+inline void Permute(vector<T>& v, const vector<uint32_t>& order) {
+	vector<T> r(v.size());
+	for (uint32_t i = 0; i < order.size(); i++)
+		r[i] = v[order[i]];
+	v.swap(r);
+}
+
+TransformHierarchy::TransformHierarchy() : mSorted(true) {
+	mLevels.push_back(0);
+}
+TransformHierarchy::~TransformHierarchy() {
+	for (Object* o : mObjects)
+		o->mHierarchy = nullptr;
+}
+
+void TransformHierarchy::Add(Object* object) {
+	if (object->mHierarchy == this) return;
+	if (object->mHierarchy) object->mHierarchy->Remove(object);
+
+	object->mHierarchy = this;
+	object->mHierarchyNode = (uint32_t)mObjects.size();
+	object->mHierarchyUpdated = false;
+	object->mTransformDirty = true;
+
+	mObjects.push_back(object);
+	mParents.push_back(NODE_NONE);
+	mFlags.push_back(NODE_DIRTY | NODE_LOCAL_DIRTY | NODE_ENABLED);
+	mLocalPosition.push_back(object->mLocalPosition);
+	mLocalRotation.push_back(object->mLocalRotation);
+	mLocalScale.push_back(object->mLocalScale);
+	mObjectToParent.push_back(float4x4(1));
+	mParentToObject.push_back(float4x4(1));
+	mWorldRotation.push_back(quaternion(0, 0, 0, 1));
+	mObjectToWorld.push_back(float4x4(1));
+	mWorldToObject.push_back(float4x4(1));
+	mSorted = false;
+}
+void TransformHierarchy::Remove(Object* object) {
+	if (object->mHierarchy != this) return;
+
+	// Move the last node into the removed one, the next Sort() restores the order
+	uint32_t node = object->mHierarchyNode;
+	uint32_t last = (uint32_t)mObjects.size() - 1;
+	if (node != last) {
+		mObjects[node] = mObjects[last];
+		mFlags[node] = mFlags[last];
+		mLocalPosition[node] = mLocalPosition[last];
+		mLocalRotation[node] = mLocalRotation[last];
+		mLocalScale[node] = mLocalScale[last];
+		mObjectToParent[node] = mObjectToParent[last];
+		mParentToObject[node] = mParentToObject[last];
+		mWorldRotation[node] = mWorldRotation[last];
+		mObjectToWorld[node] = mObjectToWorld[last];
+		mWorldToObject[node] = mWorldToObject[last];
+		mObjects[node]->mHierarchyNode = node;
+	}
+	mObjects.pop_back();
+	mParents.pop_back();
+	mFlags.pop_back();
+	mLocalPosition.pop_back();
+	mLocalRotation.pop_back();
+	mLocalScale.pop_back();
+	mObjectToParent.pop_back();
+	mParentToObject.pop_back();
+	mWorldRotation.pop_back();
+	mObjectToWorld.pop_back();
+	mWorldToObject.pop_back();
+
+	object->mHierarchy = nullptr;
+	object->mHierarchyUpdated = false;
+	object->mTransformDirty = true;
+	mSorted = false;
+}
+
+void TransformHierarchy::Sort() {
+	PROFILER_BEGIN("Sort Transforms");
+	uint32_t count = NodeCount();
+
+	vector<uint32_t> depth(count);
+	uint32_t maxDepth = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t d = 0;
+		for (Object* p = mObjects[i]->mParent; p && p->mHierarchy == this; p = p->mParent) d++;
+		depth[i] = d;
+		maxDepth = max(maxDepth, d);
+	}
+
+	// Counting sort by depth keeps the existing order within each level
+	mLevels.assign(maxDepth + 2, 0);
+	for (uint32_t i = 0; i < count; i++) mLevels[depth[i] + 1]++;
+	for (uint32_t i = 1; i < mLevels.size(); i++) mLevels[i] += mLevels[i - 1];
+	vector<uint32_t> offsets(mLevels.begin(), mLevels.end() - 1);
+	vector<uint32_t> order(count);
+	for (uint32_t i = 0; i < count; i++) order[offsets[depth[i]]++] = i;
+
+	Permute(mObjects, order);
+	Permute(mFlags, order);
+	Permute(mLocalPosition, order);
+	Permute(mLocalRotation, order);
+	Permute(mLocalScale, order);
+	Permute(mObjectToParent, order);
+	Permute(mParentToObject, order);
+	Permute(mWorldRotation, order);
+	Permute(mObjectToWorld, order);
+	Permute(mWorldToObject, order);
+
+	for (uint32_t i = 0; i < count; i++)
+		mObjects[i]->mHierarchyNode = i;
+	for (uint32_t i = 0; i < count; i++) {
+		Object* p = mObjects[i]->mParent;
+		mParents[i] = p && p->mHierarchy == this ? p->mHierarchyNode : NODE_NONE;
+		if (p && p->mHierarchy != this)
+			mFlags[i] |= NODE_EXTERNAL_PARENT;
+		else
+			mFlags[i] &= ~NODE_EXTERNAL_PARENT;
+	}
+
+	mSorted = true;
+	PROFILER_END;
+}
+
+void TransformHierarchy::UpdateNode(uint32_t node) {
+	Object* o = mObjects[node];
+	if (mFlags[node] & NODE_LOCAL_DIRTY) {
+		mObjectToParent[node] = float4x4::TRS(mLocalPosition[node], mLocalRotation[node], mLocalScale[node]);
+		mParentToObject[node] = float4x4::InverseTRS(mLocalPosition[node], mLocalRotation[node], mLocalScale[node]);
+		o->mObjectToParent = mObjectToParent[node];
+		o->mParentToObject = mParentToObject[node];
+	}
+	const float4x4& objectToParent = mObjectToParent[node];
+	const float4x4& parentToObject = mParentToObject[node];
+
+	uint32_t p = mParents[node];
+	if (p != NODE_NONE) {
+		mObjectToWorld[node] = mObjectToWorld[p] * objectToParent;
+		mWorldToObject[node] = parentToObject * mWorldToObject[p];
+		mWorldRotation[node] = mWorldRotation[p] * mLocalRotation[node];
+	} else if (mFlags[node] & NODE_EXTERNAL_PARENT) {
+		mObjectToWorld[node] = o->mParent->ObjectToWorld() * objectToParent;
+		mWorldToObject[node] = parentToObject * o->mParent->WorldToObject();
+		mWorldRotation[node] = o->mParent->WorldRotation() * mLocalRotation[node];
+	} else {
+		mObjectToWorld[node] = objectToParent;
+		mWorldToObject[node] = parentToObject;
+		mWorldRotation[node] = mLocalRotation[node];
+	}
+
+	// Write the results back to the handle, the next UpdateTransform() picks them up
+	const float4x4& objectToWorld = mObjectToWorld[node];
+	o->mObjectToWorld = objectToWorld;
+	o->mWorldToObject = mWorldToObject[node];
+	o->mWorldPosition = objectToWorld[3].xyz;
+	o->mWorldRotation = mWorldRotation[node];
+	o->mWorldScale = float3(length(objectToWorld[0].xyz), length(objectToWorld[1].xyz), length(objectToWorld[2].xyz));
+	o->mBounds = AABB(o->mWorldPosition, o->mWorldPosition);
+	o->mTransformDirty = true;
+	o->mHierarchyUpdated = true;
+}
+
+void TransformHierarchy::Update(JobSystem* jobSystem) {
+	if (!mSorted) Sort();
+
+	// Parents come first, so one pass propagates dirty and enabled flags down the whole hierarchy
+	mLevelDirty.assign(mLevels.size() - 1, 0);
+	uint32_t level = 0;
+	for (uint32_t i = 0; i < mObjects.size(); i++) {
+		while (i >= mLevels[level + 1]) level++;
+
+		Object* o = mObjects[i];
+		uint32_t p = mParents[i];
+		uint8_t flags = mFlags[i] & (NODE_DIRTY | NODE_LOCAL_DIRTY | NODE_EXTERNAL_PARENT);
+
+		bool parentEnabled;
+		if (p != NODE_NONE) parentEnabled = (mFlags[p] & NODE_ENABLED) != 0;
+		else if (flags & NODE_EXTERNAL_PARENT) parentEnabled = o->mParent->EnabledHierarchy();
+		else parentEnabled = true;
+		if (parentEnabled && o->mEnabled) flags |= NODE_ENABLED;
+
+		if (p != NODE_NONE && (mFlags[p] & NODE_DIRTY)) {
+			if (!(flags & NODE_DIRTY) && o->mScene && o->LayerMask()) o->mScene->BvhDirty(o);
+			flags |= NODE_DIRTY;
+		}
+		mFlags[i] = flags;
+
+		if (flags & NODE_EXTERNAL_PARENT) {
+			// The parent may have moved without this hierarchy knowing
+			mFlags[i] |= NODE_DIRTY;
+			if (o->mScene && o->LayerMask()) o->mScene->BvhDirty(o);
+			UpdateNode(i);
+		} else if (flags & NODE_DIRTY)
+			mLevelDirty[level]++;
+	}
+
+	for (uint32_t l = 0; l < mLevelDirty.size(); l++) {
+		if (!mLevelDirty[l]) continue;
+		uint32_t begin = mLevels[l];
+		auto update = [&](uint32_t b, uint32_t e) {
+			for (uint32_t i = begin + b; i < begin + e; i++)
+				if ((mFlags[i] & (NODE_DIRTY | NODE_EXTERNAL_PARENT)) == NODE_DIRTY)
+					UpdateNode(i);
+		};
+		if (jobSystem && mLevelDirty[l] >= TRANSFORM_PARALLEL_MIN_DIRTY)
+			jobSystem->ParallelFor(mLevels[l + 1] - begin, update, TRANSFORM_PARALLEL_BATCH);
+		else
+			update(0, mLevels[l + 1] - begin);
+	}
+
+	// Let subclasses update anything derived from the transform
+	for (uint32_t i = 0; i < mObjects.size(); i++)
+		if (mFlags[i] & NODE_DIRTY) {
+			mObjects[i]->UpdateTransform();
+			mFlags[i] &= ~(NODE_DIRTY | NODE_LOCAL_DIRTY);
+		}
+}
\ No newline at end of file
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <Core/JobSystem.hpp>
+#include <Scene/Object.hpp>
+
+/// Stores the transforms of a scene graph in contiguous arrays, sorted by depth so every node comes after its parent.
+/// Moving an object only flags its own node, and Update() propagates the flags to descendants in one linear pass,
+/// then computes the world matrices of the dirty nodes one depth level at a time, in parallel.
+/// Attached objects are handles onto their node: Update() writes their world transforms back to them.
+/// Descendants of an object that moved are only marked dirty by the next Update(), and EnabledHierarchy() sees
+/// the ancestors' mEnabled as of the last Update()
+class TransformHierarchy {
+public:
+	ENGINE_EXPORT TransformHierarchy();
+	ENGINE_EXPORT ~TransformHierarchy();
+
+	/// Attaches object to a new node. Its parent is found when the hierarchy is next sorted
+	ENGINE_EXPORT void Add(Object* object);
+	ENGINE_EXPORT void Remove(Object* object);
+	/// Called when the parent of an attached object changes
+	inline void Reparent() { mSorted = false; }
+
+	/// Copies the local transform of a node and flags it dirty
+	inline void Dirty(uint32_t node, const float3& position, const quaternion& rotation, const float3& scale) {
+		mLocalPosition[node] = position;
+		mLocalRotation[node] = rotation;
+		mLocalScale[node] = scale;
+		mFlags[node] |= NODE_DIRTY | NODE_LOCAL_DIRTY;
+	}
+
+	/// True if no node was added or reparented since the last Update(), so parent indices are valid
+	inline bool Sorted() const { return mSorted; }
+	inline uint32_t NodeCount() const { return (uint32_t)mObjects.size(); }
+	/// True if every ancestor of the node was enabled at the last Update(). Only valid while Sorted()
+	inline bool ParentsEnabled(uint32_t node) const { return mParents[node] == NODE_NONE || (mFlags[mParents[node]] & NODE_ENABLED); }
+
+	/// Propagates dirty flags, computes the world transforms of dirty nodes and writes them back to their objects.
+	/// Levels with enough dirty nodes are split across jobSystem, which may be null
+	ENGINE_EXPORT void Update(JobSystem* jobSystem);
+
+private:
+	enum NodeFlags : uint8_t {
+		NODE_DIRTY = 1,
+		NODE_ENABLED = 2,
+		// The parent is not in this hierarchy. The node is updated on the calling thread every Update(), reading its parent through the Object
+		NODE_EXTERNAL_PARENT = 4,
+		// The local transform changed, so the cached local matrices are recomputed. Nodes that are only dirty because an ancestor moved reuse them
+		NODE_LOCAL_DIRTY = 8,
+	};
+	static constexpr uint32_t NODE_NONE = ~0u;
+
+	/// Orders the nodes by depth and recomputes parent indices and level ranges
+	ENGINE_EXPORT void Sort();
+	/// Computes the world transform of one dirty node from its parent's
+	ENGINE_EXPORT void UpdateNode(uint32_t node);
+
+	bool mSorted;
+	// Nodes with parents before children, mLevels[i] is the first node at depth i and the last entry is NodeCount()
+	std::vector<uint32_t> mLevels;
+
+	std::vector<Object*> mObjects;
+	std::vector<uint32_t> mParents;
+	std::vector<uint8_t> mFlags;
+	std::vector<float3> mLocalPosition;
+	std::vector<quaternion> mLocalRotation;
+	std::vector<float3> mLocalScale;
+	std::vector<float4x4> mObjectToParent;
+	std::vector<float4x4> mParentToObject;
+	std::vector<quaternion> mWorldRotation;
+	std::vector<float4x4> mObjectToWorld;
+	std::vector<float4x4> mWorldToObject;
+	// Dirty nodes at each depth in the current Update()
+	std::vector<uint32_t> mLevelDirty;
+};
\ No newline at end of file
@@ -29,105 +29,40 @@ void TriangleBvh2::Build(const void* vertices, uint32_t baseVertex, uint32_t ver
 		aabbs.push_back(AABB(min(min(v0, v1), v2) - 1e-3f, max(max(v0, v1), v2) + 1e-3f));
 	}
 
-	struct BuildTask {
-		uint32_t mParentOffset;
-		uint32_t mStart;
-		uint32_t mEnd;
-	};
+	vector<uint32_t> order;
+	BvhBuilder::Build(aabbs.data(), (uint32_t)aabbs.size(), mSettings, mNodes, order);
 
-	BuildTask todo[1024];
-	uint32_t stackptr = 0;
-	const uint32_t untouched = 0xffffffff;
-	const uint32_t touchedTwice = 0xfffffffd;
-
-	uint32_t nNodes = 0;
-	uint32_t nLeafs = 0;
-
-	Node node;
-
-	todo[stackptr].mStart = 0;
-	todo[stackptr].mEnd = mTriangles.size();
-	todo[stackptr].mParentOffset = 0xfffffffc;
-	stackptr++;
-
-	while (stackptr > 0) {
-		// Pop the next item off of the stack
-		BuildTask& bnode(todo[--stackptr]);
-		uint32_t start = bnode.mStart;
-		uint32_t end = bnode.mEnd;
-		uint32_t nPrims = end - start;
-
-		nNodes++;
-		node.mStartIndex = start;
-		node.mCount = nPrims;
-		node.mRightOffset = untouched;
-
-		// Calculate the bounding box for this node
-		AABB bb(aabbs[start]);
-		AABB bc(aabbs[start].Center(), aabbs[start].Center());
-		for (uint32_t p = start + 1; p < end; ++p) {
-			bb.Encapsulate(aabbs[p]);
-			bc.Encapsulate(aabbs[p].Center());
-		}
-		node.mBounds = bb;
+	vector<uint3> triangles(mTriangles.size());
+	for (uint32_t i = 0; i < order.size(); i++)
+		triangles[i] = mTriangles[order[i]];
+	mTriangles.swap(triangles);
 
-		// If the number of primitives at this point is less than the leaf
-		// size, then this will become a leaf. (Signified by rightOffset == 0)
-		if (nPrims <= mLeafSize) {
-			node.mRightOffset = 0;
-			nLeafs++;
-		}
-
-		mNodes.push_back(node);
+	CollapseWide();
+}
 
-		// Child touches parent...
-		// Special case: Don't do this for the root.
-		if (bnode.mParentOffset != 0xfffffffc) {
-			mNodes[bnode.mParentOffset].mRightOffset--;
+void TriangleBvh2::Assign(const Node* nodes, uint32_t nodeCount, const uint3* triangles, uint32_t triangleCount, const void* vertices, uint32_t vertexCount, size_t vertexStride) {
+	mNodes.assign(nodes, nodes + nodeCount);
+	mTriangles.assign(triangles, triangles + triangleCount);
 
-			// When this is the second touch, this is the right child.
-			// The right child sets up the offset for the flat tree.
-			if (mNodes[bnode.mParentOffset].mRightOffset == touchedTwice) {
-				mNodes[bnode.mParentOffset].mRightOffset = nNodes - 1 - bnode.mParentOffset;
-			}
-		}
+	mVertices.resize(vertexCount);
+	for (uint32_t i = 0; i < vertexCount; i++)
+		mVertices[i] = *(float3*)((uint8_t*)vertices + vertexStride * i);
 
-		// If this is a leaf, no need to subdivide.
-		if (node.mRightOffset == 0) continue;
-
-		// Set the split dimensions
-		uint32_t split_dim = 0;
-		float3 ext = bc.Extents();
-		if (ext.y > ext.x) {
-			split_dim = 1;
-			if (ext.z > ext.y) split_dim = 2;
-		} else
-			if (ext.z > ext.x) split_dim = 2;
-
-		// Split on the center of the longest axis
-		float split_coord = bc.Center()[split_dim];
-
-		// Partition the list of objects on this split
-		uint32_t mid = start;
-		for (uint32_t i = start; i < end; ++i)
-			if (aabbs[i].Center()[split_dim] < split_coord) {
-				swap(mTriangles[i], mTriangles[mid]);
-				swap(aabbs[i], aabbs[mid]);
-				mid++;
-			}
+	CollapseWide();
+}
 
-		// If we get a bad split, just choose the center...
-		if (mid == start || mid == end)
-			mid = start + (end - start) / 2;
-
-		todo[stackptr].mStart = mid;
-		todo[stackptr].mEnd = end;
-		todo[stackptr].mParentOffset = nNodes - 1;
-		stackptr++;
-		todo[stackptr].mStart = start;
-		todo[stackptr].mEnd = mid;
-		todo[stackptr].mParentOffset = nNodes - 1;
-		stackptr++;
+void TriangleBvh2::CollapseWide() {
+	mWidth = mSettings.mWidth;
+	switch (mWidth) {
+	case 4:
+		mBvh4.Collapse(mNodes);
+		break;
+	case 8:
+		mBvh8.Collapse(mNodes);
+		break;
+	default:
+		mWidth = 2;
+		break;
 	}
 }
 
@@ -138,45 +73,57 @@ bool TriangleBvh2::Intersect(const Ray& ray, float* t, bool any) {
 	float2 bary = 0;
 	int hitIndex = -1;
 
-	uint32_t todo[256];
-	int stackptr = 0;
-
-	todo[stackptr] = 0;
-
-	while (stackptr >= 0) {
-		uint32_t ni = todo[stackptr];
-		stackptr--;
-		const Node& node = mNodes[ni];
-
-		if (node.mRightOffset == 0) {
-			for (uint32_t o = 0; o < node.mCount; ++o) {
-				uint3 tri = mTriangles[node.mStartIndex + o];
-
-				float3 tuv;
-				bool h = ray.Intersect(mVertices[tri.x], mVertices[tri.y], mVertices[tri.z], &tuv);
-
-				if (h && tuv.x > 0 && tuv.x < ht) {
-					ht = tuv.x;
-					bary.x = tuv.y;
-					bary.y = tuv.z;
-					hitIndex = node.mStartIndex + o;
-					if (any) {
-						if (t) *t = ht;
-						return hitIndex;
-					}
-				}
+	// Returns true to stop traversal
+	auto leaf = [&](uint32_t start, uint32_t count, float& tmax) {
+		for (uint32_t o = 0; o < count; ++o) {
+			uint3 tri = mTriangles[start + o];
+
+			float3 tuv;
+			bool h = ray.Intersect(mVertices[tri.x], mVertices[tri.y], mVertices[tri.z], &tuv);
+
+			if (h && tuv.x > 0 && tuv.x < ht) {
+				ht = tuv.x;
+				tmax = tuv.x;
+				bary.x = tuv.y;
+				bary.y = tuv.z;
+				hitIndex = start + o;
+				if (any) return true;
 			}
-		} else {
-			uint32_t n0 = ni + 1;
-			uint32_t n1 = ni + node.mRightOffset;
+		}
+		return false;
+	};
+
+	if (mWidth == 4)
+		mBvh4.Intersect(ray, ht, leaf);
+	else if (mWidth == 8)
+		mBvh8.Intersect(ray, ht, leaf);
+	else {
+		float3 invDirection = 1.f / ray.mDirection;
+
+		uint32_t todo[256];
+		int stackptr = 0;
 
-			float2 t0;
-			float2 t1;
-			bool h0 = ray.Intersect(mNodes[n0].mBounds, t0);
-			bool h1 = ray.Intersect(mNodes[n1].mBounds, t1);
+		todo[stackptr] = 0;
 
-			if (h0 && t0.y < ht) todo[++stackptr] = n0;
-			if (h1 && t1.y < ht) todo[++stackptr] = n1;
+		while (stackptr >= 0) {
+			uint32_t ni = todo[stackptr];
+			stackptr--;
+			const Node& node = mNodes[ni];
+
+			if (node.mRightOffset == 0) {
+				if (leaf(node.mStartIndex, node.mCount, ht)) break;
+			} else {
+				uint32_t n0 = ni + 1;
+				uint32_t n1 = ni + node.mRightOffset;
+
+				float2 t0;
+				float2 t1;
+				bool h0 = ray.Intersect(mNodes[n0].mBounds, invDirection, t0);
+				bool h1 = ray.Intersect(mNodes[n1].mBounds, invDirection, t1);
+
+				if (h0 && t0.x < ht) todo[++stackptr] = n0;
+				if (h1 && t1.x < ht) todo[++stackptr] = n1;
+			}
 		}
 	}
 
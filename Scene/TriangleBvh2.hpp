@@ -1,41 +1,53 @@
 #pragma once
 
-#include <Util/Util.hpp>
+#include <Scene/BvhBuilder.hpp>
+#include <Scene/WideBvh.hpp>
 
 class TriangleBvh2 {
 public:
 	struct Primitive {
 		uint3 mTriangle;
 	};
-	struct Node {
-		AABB mBounds;
-		// index of the first primitive inside this node
-		uint32_t mStartIndex;
-		// number of primitives inside this node
-		uint32_t mCount;
-		uint32_t mRightOffset; // 1st child is at node[index + 1], 2nd child is at node[index + mRightOffset]
-	};
+	typedef Bvh2Node Node;
 
-	inline TriangleBvh2(uint32_t leafSize = 4) : mLeafSize(leafSize) {};
+	inline TriangleBvh2(uint32_t leafSize = 4) : mSettings(BvhBuildSettings(leafSize)), mWidth(2) {};
+	inline TriangleBvh2(const BvhBuildSettings& settings) : mSettings(settings), mWidth(2) {};
 	inline ~TriangleBvh2() {}
 
 	const std::vector<Node>& Nodes() const { return mNodes; }
 
 	float3 GetVertex(uint32_t index) const { return mVertices[index]; }
+	const std::vector<float3>& Vertices() const { return mVertices; }
 	uint3 GetTriangle(uint32_t index) const { return mTriangles[index]; }
 	uint32_t TriangleCount() const { return mTriangles.size(); }
+	/// Triangles in the order the leaf nodes reference them
+	const std::vector<uint3>& Triangles() const { return mTriangles; }
 
 	inline AABB Bounds() { return mNodes.size() ? mNodes[0].mBounds : AABB(); }
 
+	/// Settings used by the next Build()
+	inline BvhBuildSettings& Settings() { return mSettings; }
+	/// Computes quality metrics for the current tree
+	inline BvhStats Stats() const { return BvhBuilder::ComputeStats(mNodes, mSettings); }
+
 	ENGINE_EXPORT void Build(const void* vertices, uint32_t baseVertex, uint32_t vertexCount, size_t vertexStride, const void* indices, uint32_t indexCount, VkIndexType indexType);
+	/// Restores a tree produced by an earlier Build() from its nodes and triangles (see Nodes() and Triangles()) without rebuilding it
+	ENGINE_EXPORT void Assign(const Node* nodes, uint32_t nodeCount, const uint3* triangles, uint32_t triangleCount, const void* vertices, uint32_t vertexCount, size_t vertexStride);
 
 	ENGINE_EXPORT bool Intersect(const Ray& ray, float* t, bool any);
 
 private:
+	ENGINE_EXPORT void CollapseWide();
+
 	std::vector<Node> mNodes;
 
 	std::vector<uint3> mTriangles;
 	std::vector<float3> mVertices;
 
-	uint32_t mLeafSize;
+	BvhBuildSettings mSettings;
+
+	// Width the wide trees were collapsed with, 2 if only the binary tree is valid
+	uint32_t mWidth;
+	Bvh4 mBvh4;
+	Bvh8 mBvh8;
 };
\ No newline at end of file
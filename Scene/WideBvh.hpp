@@ -0,0 +1,236 @@
+#pragma once
+
+#include <Math/Simd.hpp>
+#include <Scene/BvhBuilder.hpp>
+
+/// A 4- or 8-wide BVH collapsed from a binary Bvh2Node tree. Child bounds are stored in SoA layout so all children of a node are tested at once.
+/// Leaves reference the primitive ranges of the binary tree it was collapsed from, so the primitive arrays are shared.
+template<uint32_t Width>
+class WideBvh {
+public:
+	typedef typename simd_float<Width>::type simdf;
+
+	struct alignas(32) Node {
+		float mMinX[Width];
+		float mMinY[Width];
+		float mMinZ[Width];
+		float mMaxX[Width];
+		float mMaxY[Width];
+		float mMaxZ[Width];
+		// Index of the child node, or of the first primitive if the child is a leaf
+		uint32_t mChild[Width];
+		// Number of primitives if the child is a leaf, 0 if the child is a node
+		uint32_t mCount[Width];
+		uint32_t mChildCount;
+	};
+
+	inline WideBvh() : mMaxDepth(0), mStackSize(0) {}
+
+	inline const std::vector<Node>& Nodes() const { return mNodes; }
+	inline uint32_t MaxDepth() const { return mMaxDepth; }
+
+	/// Collapses a binary tree by repeatedly opening the interior child with the largest surface area until each node has Width children
+	inline void Collapse(const std::vector<Bvh2Node>& binary) {
+		mNodes.clear();
+		mSlots.assign(binary.size(), 0xFFFFFFFF);
+		mMaxDepth = 0;
+		mStackSize = 0;
+		if (binary.empty()) return;
+
+		struct CollapseTask {
+			uint32_t mBinary;
+			uint32_t mWide;
+			uint32_t mDepth;
+		};
+		std::vector<CollapseTask> todo;
+		todo.push_back({ 0, 0, 0 });
+		mNodes.push_back(Node());
+
+		uint32_t children[Width];
+		while (todo.size()) {
+			CollapseTask task = todo.back();
+			todo.pop_back();
+			mMaxDepth = std::max(mMaxDepth, task.mDepth);
+
+			uint32_t childCount = 0;
+			const Bvh2Node& bn = binary[task.mBinary];
+			if (bn.mRightOffset == 0) {
+				// The root is a leaf
+				children[childCount++] = task.mBinary;
+			} else {
+				children[childCount++] = task.mBinary + 1;
+				children[childCount++] = task.mBinary + bn.mRightOffset;
+				while (childCount < Width) {
+					int32_t best = -1;
+					float bestArea = -1.f;
+					for (uint32_t i = 0; i < childCount; i++) {
+						const Bvh2Node& c = binary[children[i]];
+						if (c.mRightOffset == 0) continue;
+						float area = BvhBuilder::SurfaceArea(c.mBounds);
+						if (area > bestArea) {
+							bestArea = area;
+							best = (int32_t)i;
+						}
+					}
+					if (best == -1) break;
+					uint32_t ci = children[best];
+					children[best] = ci + 1;
+					children[childCount++] = ci + binary[ci].mRightOffset;
+				}
+			}
+
+			for (uint32_t i = 0; i < childCount; i++) {
+				const Bvh2Node& c = binary[children[i]];
+				uint32_t child = c.mStartIndex;
+				uint32_t count = c.mCount;
+				if (c.mRightOffset) {
+					child = (uint32_t)mNodes.size();
+					count = 0;
+					mNodes.push_back(Node());
+					todo.push_back({ children[i], child, task.mDepth + 1 });
+				}
+				Node& n = mNodes[task.mWide];
+				SetBounds(n, i, c.mBounds);
+				n.mChild[i] = child;
+				n.mCount[i] = count;
+				mSlots[children[i]] = task.mWide * Width + i;
+			}
+			Node& n = mNodes[task.mWide];
+			for (uint32_t i = childCount; i < Width; i++) {
+				SetBounds(n, i, AABB());
+				n.mChild[i] = 0;
+				n.mCount[i] = 0;
+			}
+			n.mChildCount = childCount;
+		}
+
+		mStackSize = (Width - 1) * (mMaxDepth + 1) + 1;
+	}
+
+	/// Copies refit bounds of a node in the binary tree this was collapsed from
+	inline void UpdateBounds(uint32_t binaryIndex, const AABB& bounds) {
+		if (binaryIndex >= mSlots.size() || mSlots[binaryIndex] == 0xFFFFFFFF) return;
+		SetBounds(mNodes[mSlots[binaryIndex] / Width], mSlots[binaryIndex] % Width, bounds);
+	}
+
+	/// Traverses children front-to-back. leaf(start, count, tmax) should intersect primitives [start, start + count) and shrink tmax on a hit.
+	/// Traversal stops when leaf returns true.
+	template<typename LeafFunc>
+	inline void Intersect(const Ray& ray, float tmax, LeafFunc leaf) const {
+		if (mNodes.empty()) return;
+
+		struct StackEntry {
+			uint32_t mChild;
+			uint32_t mCount;
+			float mT;
+		};
+		StackEntry localStack[128];
+		std::vector<StackEntry> heapStack;
+		StackEntry* stack = localStack;
+		if (mStackSize > 128) {
+			heapStack.resize(mStackSize);
+			stack = heapStack.data();
+		}
+
+		float3 invDir = 1.f / ray.mDirection;
+		float3 oid = ray.mOrigin * invDir;
+		simdf idx(invDir.x), idy(invDir.y), idz(invDir.z);
+		simdf oidx(oid.x), oidy(oid.y), oidz(oid.z);
+		simdf zero(0.f);
+
+		float tnear[Width];
+		uint32_t order[Width];
+
+		int32_t stackptr = 0;
+		stack[0] = { 0, 0, 0.f };
+		while (stackptr >= 0) {
+			StackEntry e = stack[stackptr--];
+			if (e.mT >= tmax) continue;
+			if (e.mCount) {
+				if (leaf(e.mChild, e.mCount, tmax)) return;
+				continue;
+			}
+
+			const Node& n = mNodes[e.mChild];
+			simdf t0x = simdf::Load(n.mMinX) * idx - oidx;
+			simdf t1x = simdf::Load(n.mMaxX) * idx - oidx;
+			simdf t0y = simdf::Load(n.mMinY) * idy - oidy;
+			simdf t1y = simdf::Load(n.mMaxY) * idy - oidy;
+			simdf t0z = simdf::Load(n.mMinZ) * idz - oidz;
+			simdf t1z = simdf::Load(n.mMaxZ) * idz - oidz;
+			simdf tn = max(max(min(t0x, t1x), min(t0y, t1y)), min(t0z, t1z));
+			simdf tf = min(min(max(t0x, t1x), max(t0y, t1y)), max(t0z, t1z));
+			uint32_t mask = movemask((tn <= tf) & (tf >= zero) & (tn < simdf(tmax))) & ((1u << n.mChildCount) - 1);
+			if (!mask) continue;
+			tn.StoreUnaligned(tnear);
+
+			// Sort hit children far to near, so the nearest is popped first
+			uint32_t hitCount = 0;
+			for (uint32_t i = 0; i < Width; i++) {
+				if ((mask & (1u << i)) == 0) continue;
+				uint32_t j = hitCount++;
+				while (j > 0 && tnear[order[j - 1]] < tnear[i]) {
+					order[j] = order[j - 1];
+					j--;
+				}
+				order[j] = i;
+			}
+			for (uint32_t i = 0; i < hitCount; i++)
+				stack[++stackptr] = { n.mChild[order[i]], n.mCount[order[i]], tnear[order[i]] };
+		}
+	}
+
+	/// Calls leaf(start, count) for every leaf whose bounds intersect the frustum
+	template<typename LeafFunc>
+	inline void FrustumCheck(const float4 frustum[6], LeafFunc leaf) const {
+		if (mNodes.empty()) return;
+
+		uint32_t localStack[128];
+		std::vector<uint32_t> heapStack;
+		uint32_t* stack = localStack;
+		if (mStackSize > 128) {
+			heapStack.resize(mStackSize);
+			stack = heapStack.data();
+		}
+
+		simdf half(.5f);
+
+		int32_t stackptr = 0;
+		stack[0] = 0;
+		while (stackptr >= 0) {
+			const Node& n = mNodes[stack[stackptr--]];
+			simdf mnx = simdf::Load(n.mMinX), mny = simdf::Load(n.mMinY), mnz = simdf::Load(n.mMinZ);
+			simdf mxx = simdf::Load(n.mMaxX), mxy = simdf::Load(n.mMaxY), mxz = simdf::Load(n.mMaxZ);
+			simdf cx = (mxx + mnx) * half, cy = (mxy + mny) * half, cz = (mxz + mnz) * half;
+			simdf ex = (mxx - mnx) * half, ey = (mxy - mny) * half, ez = (mxz - mnz) * half;
+
+			uint32_t mask = (1u << n.mChildCount) - 1;
+			for (uint32_t p = 0; p < 6 && mask; p++) {
+				simdf r = ex * simdf(fabsf(frustum[p].x)) + ey * simdf(fabsf(frustum[p].y)) + ez * simdf(fabsf(frustum[p].z));
+				simdf d = cx * simdf(frustum[p].x) + cy * simdf(frustum[p].y) + cz * simdf(frustum[p].z) - simdf(frustum[p].w);
+				mask &= movemask(d > simdf(0.f) - r);
+			}
+
+			for (uint32_t i = 0; i < Width; i++) {
+				if ((mask & (1u << i)) == 0) continue;
+				if (n.mCount[i]) leaf(n.mChild[i], n.mCount[i]);
+				else stack[++stackptr] = n.mChild[i];
+			}
+		}
+	}
+
+private:
+	std::vector<Node> mNodes;
+	// Wide node and lane of each node in the binary tree, 0xFFFFFFFF if the node was collapsed
+	std::vector<uint32_t> mSlots;
+	uint32_t mMaxDepth;
+	uint32_t mStackSize;
+
+	inline static void SetBounds(Node& n, uint32_t i, const AABB& b) {
+		n.mMinX[i] = b.mMin.x; n.mMinY[i] = b.mMin.y; n.mMinZ[i] = b.mMin.z;
+		n.mMaxX[i] = b.mMax.x; n.mMaxY[i] = b.mMax.y; n.mMaxZ[i] = b.mMax.z;
+	}
+};
+
+typedef WideBvh<4> Bvh4;
+typedef WideBvh<8> Bvh8;
\ No newline at end of file
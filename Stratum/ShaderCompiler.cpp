@@ -1,16 +1,23 @@
+#include <atomic>
 #include <chrono>
 #include <iostream>
 #include <sstream>
 #include <unordered_map>
 
 #include "ShaderCompiler.hpp"
+#include <Core/JobSystem.hpp>
 #include <shaderc/shaderc.hpp>
 #include <../spirv_cross.hpp>
 
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
 using namespace std;
 using namespace shaderc;
 
 CompileOptions options;
+shaderc_optimization_level optimizationLevel = shaderc_optimization_level_zero;
 
 class Includer : public CompileOptions::IncluderInterface {
 public:
@@ -27,6 +34,8 @@ public:
 		string fullpath = folder.string() + "/" + requested_source;
 
 		shaderc_include_result* response = new shaderc_include_result();
+		// Stages are compiled on several threads, which share this includer
+		lock_guard<mutex> lock(mMutex);
 		string& data = mFiles[fullpath];
 		if (data.empty() && !ReadFile(fullpath, data)) {
 			char* err = new char[128];
@@ -57,173 +66,242 @@ public:
 
 private:
 	string mIncludePath;
+	mutex mMutex;
 
 	unordered_map<string, string> mFiles;
 	unordered_map<string, string> mFullPaths;
 };
 
-bool CompileStage(Compiler* compiler, const CompileOptions& options, const string& source, const string& filename, shaderc_shader_kind stage, const string& entryPoint,
-	CompiledVariant& dest, CompiledShader& destShader) {
-	
+// Increment when a change to the compiler invalidates cached SPIR-V
+#define SHADER_CACHE_VERSION 1
+#define SPIRV_MAGIC 0x07230203
+
+JobSystem* jobSystem;
+// One compiler per JobSystem thread
+vector<Compiler*> compilers;
+// SPIR-V is cached here by a hash of the preprocessed source and options. Empty disables the cache
+string cacheDirectory;
+
+/// One stage of one variant
+struct StageJob {
+	uint32_t mVariant;
+	shaderc_shader_kind mStage;
+	string mEntryPoint;
+	CompileOptions mOptions;
+	// Hash of the preprocessed source, stage, entry point and options. Stages with the same key compile to the same module
+	uint64_t mKey;
+	uint32_t mModule;
+};
+
+inline string CachePath(uint64_t key) {
+	char name[32];
+	snprintf(name, 32, "%016llx.spv", (unsigned long long)key);
+	return cacheDirectory + "/" + name;
+}
+bool ReadCache(uint64_t key, SpirvModule& dest) {
+	if (cacheDirectory.empty()) return false;
+	ifstream file(CachePath(key), ios::binary | ios::ate);
+	if (!file.is_open()) return false;
+	size_t size = (size_t)file.tellg();
+	if (size < sizeof(uint32_t) || size % sizeof(uint32_t)) return false;
+	dest.mSpirv.resize(size / sizeof(uint32_t));
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(dest.mSpirv.data()), size);
+	return file.good() && dest.mSpirv[0] == SPIRV_MAGIC;
+}
+void WriteCache(uint64_t key, const SpirvModule& src) {
+	if (cacheDirectory.empty()) return;
+	// Other ShaderCompiler processes may be writing the same entry, write to a temporary file and rename it into place.
+	// The process id and a counter make the temporary file unique to this write
+	static atomic<uint32_t> tmpCounter(0);
+	#ifdef WINDOWS
+	uint32_t processId = (uint32_t)GetCurrentProcessId();
+	#else
+	uint32_t processId = (uint32_t)getpid();
+	#endif
+	string path = CachePath(key);
+	string tmp = path + "." + to_string(processId) + "." + to_string(tmpCounter++) + ".tmp";
+	error_code ec;
+	{
+		ofstream file(tmp, ios::binary);
+		if (!file.is_open()) return;
+		file.write(reinterpret_cast<const char*>(src.mSpirv.data()), src.mSpirv.size() * sizeof(uint32_t));
+		file.close();
+		if (file.fail()) {
+			fs::remove(tmp, ec);
+			return;
+		}
+	}
+	fs::rename(tmp, path, ec);
+	if (ec) fs::remove(tmp, ec);
+}
+
+/// Hashes the preprocessed source, so edits to included files and different defines change the key
+bool StageKey(Compiler* compiler, const string& source, const string& filename, uint64_t seed, StageJob& job) {
+	PreprocessedSourceCompilationResult result = compiler->PreprocessGlsl(source, job.mStage, filename.c_str(), job.mOptions);
+	if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
+		fprintf_color(COLOR_RED, stderr, "%s\n", result.GetErrorMessage().c_str());
+		return false;
+	}
+	string preprocessed(result.cbegin(), result.cend());
+	uint64_t key = HashBytes(preprocessed.data(), preprocessed.size(), seed);
+	key = HashBytes(job.mEntryPoint.data(), job.mEntryPoint.size(), key);
+	job.mKey = HashBytes(&job.mStage, sizeof(job.mStage), key);
+	return true;
+}
+
+bool CompileStage(Compiler* compiler, const CompileOptions& options, const string& source, const string& filename, shaderc_shader_kind stage, const string& entryPoint, SpirvModule& dest) {
 	SpvCompilationResult result = compiler->CompileGlslToSpv(source, stage, filename.c_str(), entryPoint.c_str(), options);
 	
 	string error = result.GetErrorMessage();
 	if (error.size()) fprintf_color(COLOR_RED, stderr, "%s\n", error.c_str());
 
-	switch (result.GetCompilationStatus()) {
-	case shaderc_compilation_status_success:
-		// store SPIRV module
-		destShader.mModules.push_back({});
-		SpirvModule& m = destShader.mModules.back();
-		for (auto d = result.cbegin(); d != result.cend(); d++)
-			m.mSpirv.push_back(*d);
-
-		// assign SPIRV module
-		VkShaderStageFlagBits vkstage;
-		switch (stage) {
-		case shaderc_vertex_shader:
-			dest.mModules[0] = (uint32_t)destShader.mModules.size() - 1;
-			vkstage = VK_SHADER_STAGE_VERTEX_BIT;
-			break;
-		case shaderc_fragment_shader:
-			dest.mModules[1] = (uint32_t)destShader.mModules.size() - 1;
-			vkstage = VK_SHADER_STAGE_FRAGMENT_BIT;
-			break;
-		case shaderc_compute_shader:
-			dest.mModules[0] = (uint32_t)destShader.mModules.size() - 1;
-			vkstage = VK_SHADER_STAGE_COMPUTE_BIT;
-			break;
-		}
+	if (result.GetCompilationStatus() != shaderc_compilation_status_success) return false;
+	dest.mSpirv.assign(result.cbegin(), result.cend());
+	return true;
+}
 
-		spirv_cross::Compiler comp(m.mSpirv.data(), m.mSpirv.size());
-		spirv_cross::ShaderResources res = comp.get_shader_resources();
-		
-		#pragma region register resource bindings
-		auto registerResource = [&](const spirv_cross::Resource& res, VkDescriptorType type) {
-			auto& binding = dest.mDescriptorBindings[res.name];
-
-			binding.first = comp.get_decoration(res.id, spv::DecorationDescriptorSet);
-
-			binding.second.stageFlags |= vkstage;
-			binding.second.binding = comp.get_decoration(res.id, spv::DecorationBinding);
-			binding.second.descriptorCount = 1;
-			binding.second.descriptorType = type;
-		};
-
-		for (const auto& r : res.sampled_images)
-			registerResource(r, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-		for (const auto& r : res.separate_images)
-			if (comp.get_type(r.type_id).image.dim == spv::DimBuffer)
-				registerResource(r, VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER);
-			else
-				registerResource(r, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE);
-		for (const auto& r : res.storage_images)
-			if (comp.get_type(r.type_id).image.dim == spv::DimBuffer)
-				registerResource(r, VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER);
-			else
-				registerResource(r, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
-		for (const auto& r : res.storage_buffers)
-			registerResource(r, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-		for (const auto& r : res.separate_samplers)
-			registerResource(r, VK_DESCRIPTOR_TYPE_SAMPLER);
-		for (const auto& r : res.uniform_buffers)
-			registerResource(r, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-
-		for (const auto& r : res.push_constant_buffers) {
-			uint32_t index = 0;
-
-			const auto& type = comp.get_type(r.base_type_id);
-
-			if (type.basetype == spirv_cross::SPIRType::Struct) {
-				for (uint32_t i = 0; i < type.member_types.size(); i++) {
-					const auto& mtype = comp.get_type(type.member_types[i]);
-
-					const string name = comp.get_member_name(r.base_type_id, index);
-					
-					VkPushConstantRange range = {};
-					range.stageFlags = vkstage == VK_SHADER_STAGE_COMPUTE_BIT ? VK_SHADER_STAGE_COMPUTE_BIT : (VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
-					range.offset = comp.type_struct_member_offset(type, index);
-
-					switch (mtype.basetype) {
-					case spirv_cross::SPIRType::Boolean:
-					case spirv_cross::SPIRType::SByte:
-					case spirv_cross::SPIRType::UByte:
-						range.size = 1;
-						break;
-					case spirv_cross::SPIRType::Short:
-					case spirv_cross::SPIRType::UShort:
-					case spirv_cross::SPIRType::Half:
-						range.size = 2;
-						break;
-					case spirv_cross::SPIRType::Int:
-					case spirv_cross::SPIRType::UInt:
-					case spirv_cross::SPIRType::Float:
-						range.size = 4;
-						break;
-					case spirv_cross::SPIRType::Int64:
-					case spirv_cross::SPIRType::UInt64:
-					case spirv_cross::SPIRType::Double:
-						range.size = 8;
-						break;
-					case spirv_cross::SPIRType::Struct:
-						range.size = (uint32_t)comp.get_declared_struct_size(mtype);
-						break;
-					case spirv_cross::SPIRType::Unknown:
-					case spirv_cross::SPIRType::Void:
-					case spirv_cross::SPIRType::AtomicCounter:
-					case spirv_cross::SPIRType::Image:
-					case spirv_cross::SPIRType::SampledImage:
-					case spirv_cross::SPIRType::Sampler:
-					case spirv_cross::SPIRType::AccelerationStructureNV:
-						fprintf(stderr, "Unknown type for push constant: %s\n", name.c_str());
-						range.size = 0;
-						break;
-					}
+/// Adds the resources a stage uses to a variant
+void ReflectStage(const SpirvModule& m, shaderc_shader_kind stage, const string& entryPoint, CompiledVariant& dest) {
+	VkShaderStageFlagBits vkstage;
+	switch (stage) {
+	case shaderc_vertex_shader:
+		vkstage = VK_SHADER_STAGE_VERTEX_BIT;
+		break;
+	case shaderc_fragment_shader:
+		vkstage = VK_SHADER_STAGE_FRAGMENT_BIT;
+		break;
+	default:
+		vkstage = VK_SHADER_STAGE_COMPUTE_BIT;
+		break;
+	}
 
-					range.size *= mtype.columns * mtype.vecsize;
+	spirv_cross::Compiler comp(m.mSpirv.data(), m.mSpirv.size());
+	spirv_cross::ShaderResources res = comp.get_shader_resources();
+	
+	#pragma region register resource bindings
+	auto registerResource = [&](const spirv_cross::Resource& res, VkDescriptorType type) {
+		auto& binding = dest.mDescriptorBindings[res.name];
+
+		binding.first = comp.get_decoration(res.id, spv::DecorationDescriptorSet);
+
+		binding.second.stageFlags |= vkstage;
+		binding.second.binding = comp.get_decoration(res.id, spv::DecorationBinding);
+		binding.second.descriptorCount = 1;
+		binding.second.descriptorType = type;
+	};
+
+	for (const auto& r : res.sampled_images)
+		registerResource(r, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+	for (const auto& r : res.separate_images)
+		if (comp.get_type(r.type_id).image.dim == spv::DimBuffer)
+			registerResource(r, VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER);
+		else
+			registerResource(r, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE);
+	for (const auto& r : res.storage_images)
+		if (comp.get_type(r.type_id).image.dim == spv::DimBuffer)
+			registerResource(r, VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER);
+		else
+			registerResource(r, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+	for (const auto& r : res.storage_buffers)
+		registerResource(r, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+	for (const auto& r : res.separate_samplers)
+		registerResource(r, VK_DESCRIPTOR_TYPE_SAMPLER);
+	for (const auto& r : res.uniform_buffers)
+		registerResource(r, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
 
-					vector<pair<string, VkPushConstantRange>> ranges;
-					ranges.push_back(make_pair(name, range));
+	for (const auto& r : res.push_constant_buffers) {
+		uint32_t index = 0;
 
-					for (uint32_t dim : mtype.array) {
-						for (auto& r : ranges)
-							r.second.size *= dim;
-						// TODO: support individual element ranges
-						//uint32_t sz = ranges.size();
-						//for (uint32_t j = 0; j < sz; j++)
-						//	for (uint32_t c = 0; c < dim; c++)
-						//		ranges.push_back(make_pair(ranges[j].first + "[" + to_string(c) + "]", range));
-					}
+		const auto& type = comp.get_type(r.base_type_id);
 
-					for (auto& r : ranges)
-						dest.mPushConstants[r.first] = r.second;
+		if (type.basetype == spirv_cross::SPIRType::Struct) {
+			for (uint32_t i = 0; i < type.member_types.size(); i++) {
+				const auto& mtype = comp.get_type(type.member_types[i]);
 
-					index++;
+				const string name = comp.get_member_name(r.base_type_id, index);
+				
+				VkPushConstantRange range = {};
+				range.stageFlags = vkstage == VK_SHADER_STAGE_COMPUTE_BIT ? VK_SHADER_STAGE_COMPUTE_BIT : (VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+				range.offset = comp.type_struct_member_offset(type, index);
+
+				switch (mtype.basetype) {
+				case spirv_cross::SPIRType::Boolean:
+				case spirv_cross::SPIRType::SByte:
+				case spirv_cross::SPIRType::UByte:
+					range.size = 1;
+					break;
+				case spirv_cross::SPIRType::Short:
+				case spirv_cross::SPIRType::UShort:
+				case spirv_cross::SPIRType::Half:
+					range.size = 2;
+					break;
+				case spirv_cross::SPIRType::Int:
+				case spirv_cross::SPIRType::UInt:
+				case spirv_cross::SPIRType::Float:
+					range.size = 4;
+					break;
+				case spirv_cross::SPIRType::Int64:
+				case spirv_cross::SPIRType::UInt64:
+				case spirv_cross::SPIRType::Double:
+					range.size = 8;
+					break;
+				case spirv_cross::SPIRType::Struct:
+					range.size = (uint32_t)comp.get_declared_struct_size(mtype);
+					break;
+				case spirv_cross::SPIRType::Unknown:
+				case spirv_cross::SPIRType::Void:
+				case spirv_cross::SPIRType::AtomicCounter:
+				case spirv_cross::SPIRType::Image:
+				case spirv_cross::SPIRType::SampledImage:
+				case spirv_cross::SPIRType::Sampler:
+				case spirv_cross::SPIRType::AccelerationStructureNV:
+					fprintf(stderr, "Unknown type for push constant: %s\n", name.c_str());
+					range.size = 0;
+					break;
 				}
-			} else
-				fprintf(stderr, "Push constant data is not a struct! Reflection will not work.\n");
-		}
-		#pragma endregion
-		
-		if (vkstage == VK_SHADER_STAGE_COMPUTE_BIT) {
-			auto entryPoints = comp.get_entry_points_and_stages();
-			for (const auto& e : entryPoints) {
-				if (e.name == entryPoint) {
-					auto& ep = comp.get_entry_point(e.name, e.execution_model);
-					dest.mWorkgroupSize[0] = ep.workgroup_size.x;
-					dest.mWorkgroupSize[1] = ep.workgroup_size.y;
-					dest.mWorkgroupSize[2] = ep.workgroup_size.z;
+
+				range.size *= mtype.columns * mtype.vecsize;
+
+				vector<pair<string, VkPushConstantRange>> ranges;
+				ranges.push_back(make_pair(name, range));
+
+				for (uint32_t dim : mtype.array) {
+					for (auto& r : ranges)
+						r.second.size *= dim;
+					// TODO: support individual element ranges
+					//uint32_t sz = ranges.size();
+					//for (uint32_t j = 0; j < sz; j++)
+					//	for (uint32_t c = 0; c < dim; c++)
+					//		ranges.push_back(make_pair(ranges[j].first + "[" + to_string(c) + "]", range));
 				}
+
+				for (auto& r : ranges)
+					dest.mPushConstants[r.first] = r.second;
+
+				index++;
 			}
 		} else
-			dest.mWorkgroupSize = 0;
-
-		return true;
+			fprintf(stderr, "Push constant data is not a struct! Reflection will not work.\n");
 	}
-	return false;
+	#pragma endregion
+	
+	if (vkstage == VK_SHADER_STAGE_COMPUTE_BIT) {
+		auto entryPoints = comp.get_entry_points_and_stages();
+		for (const auto& e : entryPoints) {
+			if (e.name == entryPoint) {
+				auto& ep = comp.get_entry_point(e.name, e.execution_model);
+				dest.mWorkgroupSize[0] = ep.workgroup_size.x;
+				dest.mWorkgroupSize[1] = ep.workgroup_size.y;
+				dest.mWorkgroupSize[2] = ep.workgroup_size.z;
+			}
+		}
+	} else
+		dest.mWorkgroupSize = 0;
 }
 
-CompiledShader* Compile(shaderc::Compiler* compiler, const string& filename) {
+/// Compiles every variant of a shader. Stages are preprocessed, compiled and reflected in parallel, and stages that compile to identical SPIR-V share one module
+CompiledShader* Compile(const CompileOptions& options, const string& filename) {
 	string source;
 	if (!ReadFile(filename, source)) {
 		fprintf_color(COLOR_RED, stderr, "Failed to read %s!\n", filename.c_str());
@@ -428,6 +506,41 @@ CompiledShader* Compile(shaderc::Compiler* compiler, const string& filename) {
 		}
 	}
 
+	/// applies array and static_sampler pragmas
+	auto UpdateBindings = [&](CompiledVariant& input) {
+		for (auto& b : input.mDescriptorBindings) {
+			for (const auto& s : staticSamplers)
+				if (s.first == b.first) {
+					input.mStaticSamplers.emplace(s.first, s.second);
+					break;
+				}
+			for (const auto& s : arrays)
+				if (s.first == b.first) {
+					b.second.second.descriptorCount = s.second;
+					break;
+				}
+		}
+	};
+
+	set<string> allKeywords;
+	for (const auto& variant : variants)
+		for (const auto& kw : variant)
+			if (!kw.empty()) allKeywords.insert(kw);
+	if (allKeywords.size() > STM_MAX_KEYWORDS) {
+		fprintf_color(COLOR_RED, stderr, "Too many keywords (%u), shaders can have at most %u\n", (uint32_t)allKeywords.size(), STM_MAX_KEYWORDS);
+		return nullptr;
+	}
+
+	vector<StageJob> stages;
+	auto AddStage = [&](const CompileOptions& stageOptions, shaderc_shader_kind stage, const string& entryPoint) {
+		StageJob s;
+		s.mVariant = (uint32_t)result->mVariants.size();
+		s.mStage = stage;
+		s.mEntryPoint = entryPoint;
+		s.mOptions = stageOptions;
+		stages.push_back(s);
+	};
+
 	for (const auto& variant : variants) {
 		auto variantOptions = options;
 
@@ -438,22 +551,6 @@ CompiledShader* Compile(shaderc::Compiler* compiler, const string& filename) {
 			variantOptions.AddMacroDefinition(kw);
 		}
 
-		/// applies array and static_sampler pragmas
-		auto UpdateBindings = [&](CompiledVariant& input) {
-			for (auto& b : input.mDescriptorBindings) {
-				for (const auto& s : staticSamplers)
-					if (s.first == b.first) {
-						input.mStaticSamplers.emplace(s.first, s.second);
-						break;
-					}
-				for (const auto& s : arrays)
-					if (s.first == b.first) {
-						b.second.second.descriptorCount = s.second;
-						break;
-					}
-			}
-		};
-
 		if (kernels.size()) {
 			auto stageOptions = variantOptions;
 			stageOptions.AddMacroDefinition("SHADER_STAGE_COMPUTE");
@@ -463,13 +560,10 @@ CompiledShader* Compile(shaderc::Compiler* compiler, const string& filename) {
 				v.mPass = (PassType)0;
 				v.mKeywords = keywords;
 				v.mEntryPoints[0] = k;
-				if (!CompileStage(compiler, stageOptions, source, filename, shaderc_compute_shader, k, v, *result)) return nullptr;
-				UpdateBindings(v);
+				AddStage(stageOptions, shaderc_compute_shader, k);
 				result->mVariants.push_back(v);
 			}
 		} else {
-			unordered_map<string, uint32_t> compiled;
-
 			for (auto& stagep : passes) {
 				auto vsOptions = variantOptions;
 				auto fsOptions = variantOptions;
@@ -492,12 +586,12 @@ CompiledShader* Compile(shaderc::Compiler* compiler, const string& filename) {
 
 				if (vs == "" && passes.count(PASS_MAIN)) vs = passes.at(PASS_MAIN).first;
 				if (vs == "") {
-					fprintf_color(COLOR_RED, stderr, "No vertex shader entry point found for fragment shader entry point: \n", fs.c_str());
+					fprintf_color(COLOR_RED, stderr, "No vertex shader entry point found for fragment shader entry point: %s\n", fs.c_str());
 					return nullptr;
 				}
 				if (fs == "" && passes.count(PASS_MAIN)) fs = passes.at(PASS_MAIN).second;
 				if (fs == "") {
-					fprintf_color(COLOR_RED, stderr, "No fragment shader entry point found for vertex shader entry point: \n", vs.c_str());
+					fprintf_color(COLOR_RED, stderr, "No fragment shader entry point found for vertex shader entry point: %s\n", vs.c_str());
 					return nullptr;
 				}
 
@@ -506,70 +600,144 @@ CompiledShader* Compile(shaderc::Compiler* compiler, const string& filename) {
 				v.mPass = stagep.first;
 				v.mEntryPoints[0] = vs;
 				v.mEntryPoints[1] = fs;
-
-				// Don't recompile shared stages
-				//if (compiled.count(vs)) {
-				//	v.mModules[0] = compiled.at(vs);
-				//} else {
-					if (!CompileStage(compiler, vsOptions, source, filename, shaderc_vertex_shader, vs, v, *result)) return nullptr;
-				//	compiled.emplace(vs, v.mModules[0]);
-				//}
-				
-				//if (compiled.count(fs)) {
-				//	v.mModules[1] = compiled.at(fs);
-				//} else {
-					if (!CompileStage(compiler, fsOptions, source, filename, shaderc_fragment_shader, fs, v, *result)) return nullptr;
-				//	compiled.emplace(fs, v.mModules[1]);
-				//}
-
-				UpdateBindings(v);
-
+				AddStage(vsOptions, shaderc_vertex_shader, vs);
+				AddStage(fsOptions, shaderc_fragment_shader, fs);
 				result->mVariants.push_back(v);
 			}
 		}
 	}
+
+	atomic<bool> failed(false);
+
+	// Key every stage by its preprocessed source. Keywords that don't affect a stage give it the same key
+	uint64_t seed = HashBytes(&optimizationLevel, sizeof(optimizationLevel), SHADER_CACHE_VERSION);
+	seed = HashBytes(filename.data(), filename.size(), seed);
+	jobSystem->ParallelFor((uint32_t)stages.size(), [&](uint32_t i) {
+		if (!StageKey(compilers[jobSystem->ThreadIndex()], source, filename, seed, stages[i])) failed = true;
+	});
+	if (failed) { delete result; return nullptr; }
+
+	// Compile each unique stage once, or read it from the cache
+	unordered_map<uint64_t, uint32_t> keyModules;
+	vector<uint32_t> uniqueStages;
+	for (uint32_t i = 0; i < stages.size(); i++)
+		if (keyModules.emplace(stages[i].mKey, (uint32_t)uniqueStages.size()).second)
+			uniqueStages.push_back(i);
+	vector<SpirvModule> modules(uniqueStages.size());
+	jobSystem->ParallelFor((uint32_t)uniqueStages.size(), [&](uint32_t i) {
+		const StageJob& s = stages[uniqueStages[i]];
+		if (ReadCache(s.mKey, modules[i])) return;
+		if (!CompileStage(compilers[jobSystem->ThreadIndex()], s.mOptions, source, filename, s.mStage, s.mEntryPoint, modules[i])) {
+			failed = true;
+			return;
+		}
+		WriteCache(s.mKey, modules[i]);
+	});
+	if (failed) { delete result; return nullptr; }
+
+	// Different preprocessed sources can still compile to the same SPIR-V, so modules are deduplicated by content
+	unordered_map<uint64_t, vector<uint32_t>> moduleHashes;
+	vector<uint32_t> moduleRemap(modules.size());
+	for (uint32_t i = 0; i < modules.size(); i++) {
+		const vector<uint32_t>& spirv = modules[i].mSpirv;
+		vector<uint32_t>& candidates = moduleHashes[HashBytes(spirv.data(), spirv.size() * sizeof(uint32_t))];
+		uint32_t m = 0;
+		for (; m < candidates.size(); m++)
+			if (result->mModules[candidates[m]].mSpirv == spirv) break;
+		if (m == candidates.size()) {
+			candidates.push_back((uint32_t)result->mModules.size());
+			result->mModules.push_back(move(modules[i]));
+		}
+		moduleRemap[i] = candidates[m];
+	}
+	for (StageJob& s : stages) {
+		s.mModule = moduleRemap[keyModules.at(s.mKey)];
+		CompiledVariant& v = result->mVariants[s.mVariant];
+		v.mModules[s.mStage == shaderc_fragment_shader ? 1 : 0] = s.mModule;
+	}
+
+	// Reflect variants in parallel, each variant is only written by one job
+	jobSystem->ParallelFor((uint32_t)result->mVariants.size(), [&](uint32_t i) {
+		for (const StageJob& s : stages)
+			if (s.mVariant == i)
+				ReflectStage(result->mModules[s.mModule], s.mStage, s.mEntryPoint, result->mVariants[i]);
+		UpdateBindings(result->mVariants[i]);
+	});
+
 	return result;
 }
 
 int main(int argc, char* argv[]) {
-	const char* inputFile;
-	const char* outputFile;
-	const char* include;
+	uint32_t threadCount = 0;
+	vector<pair<string, string>> files; // input, output
+	vector<const char*> positional;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-O") == 0)
+			optimizationLevel = shaderc_optimization_level_performance;
+		else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			threadCount = (uint32_t)atoi(argv[++i]);
+		else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+			cacheDirectory = argv[++i];
+		else
+			positional.push_back(argv[i]);
+	}
 
-	if (argc < 3) {
-		fprintf(stderr, "Usage: %s <input> <output> <global include path>\n", argv[0]);
+	if (positional.size() < 3 || positional.size() % 2 == 0) {
+		fprintf(stderr, "Usage: %s [-O] [-j <worker threads>] [--cache <directory>] <input> <output> [<input> <output> ...] <global include path>\n", argv[0]);
 		return EXIT_FAILURE;
-	} else {
-		inputFile = argv[1];
-		outputFile = argv[2];
-		include = argv[3];
+	}
+	for (uint32_t i = 0; i + 1 < positional.size(); i += 2)
+		files.push_back(make_pair(positional[i], positional[i + 1]));
+	const char* include = positional.back();
+
+	if (cacheDirectory.size()) {
+		error_code ec;
+		fs::create_directories(cacheDirectory, ec);
+		if (ec) {
+			fprintf_color(COLOR_YELLOW, stderr, "Failed to create shader cache %s, compiling without it\n", cacheDirectory.c_str());
+			cacheDirectory.clear();
+		}
 	}
 
-	printf("Compiling %s\n", inputFile);
-	
-	if (fs::path(inputFile).extension().string() == ".hlsl")
-		options.SetSourceLanguage(shaderc_source_language_hlsl);
-	else
-		options.SetSourceLanguage(shaderc_source_language_glsl);
-	
 	options.SetIncluder(make_unique<Includer>(include));
-	options.SetOptimizationLevel(shaderc_optimization_level_zero);
+	options.SetOptimizationLevel(optimizationLevel);
 	options.SetAutoBindUniforms(false);
 	options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_1);
 
-	Compiler* compiler = new Compiler();
-	CompiledShader* shader = Compile(compiler, inputFile);
-	
-	if (!shader) return EXIT_FAILURE;
+	jobSystem = new JobSystem(threadCount);
+	for (uint32_t i = 0; i <= jobSystem->WorkerCount(); i++)
+		compilers.push_back(new Compiler());
+
+	atomic<bool> failed(false);
+	jobSystem->ParallelFor((uint32_t)files.size(), [&](uint32_t i) {
+		const string& inputFile = files[i].first;
+		const string& outputFile = files[i].second;
+		printf("Compiling %s\n", inputFile.c_str());
+
+		auto fileOptions = options;
+		if (fs::path(inputFile).extension().string() == ".hlsl")
+			fileOptions.SetSourceLanguage(shaderc_source_language_hlsl);
+		else
+			fileOptions.SetSourceLanguage(shaderc_source_language_glsl);
+
+		CompiledShader* shader = Compile(fileOptions, inputFile);
+		if (!shader) {
+			fprintf_color(COLOR_RED, stderr, "Failed to compile %s\n", inputFile.c_str());
+			failed = true;
+			return;
+		}
 
-	// write shader
-	ofstream output(outputFile, ios::binary);
-	shader->Write(output);
-	output.close();
+		// write shader
+		ofstream output(outputFile, ios::binary);
+		shader->Write(output);
+		output.close();
 
-	delete shader;
+		delete shader;
+	});
 
-	delete compiler;
+	for (Compiler* c : compilers) delete c;
+	delete jobSystem;
 
-	return EXIT_SUCCESS;
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
\ No newline at end of file
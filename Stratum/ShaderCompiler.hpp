@@ -3,21 +3,110 @@
 #include <fstream>
 #include <Util/Util.hpp>
 
+/// Layout of a compiled .stm file:
+///   StmHeader
+///   keyword table: every keyword used by any variant in alphabetical order, as a uint32_t length followed by the characters.
+///     Keyword i is bit i of the keyword masks variants are identified by
+///   module table: StmModuleEntry[mModuleCount], then the SPIR-V of each module
+///   variant table: StmVariantEntry[mVariantCount] sorted by mKey, then each variant as written by CompiledVariant::Write
+/// Tables start at multiples of 8 bytes, so the file can be mapped and its tables used in place. Variants are only parsed when they are requested,
+/// see ShaderFile
+struct StmHeader {
+	uint32_t mMagic;
+	uint32_t mVersion;
+	uint32_t mKeywordCount;
+	uint32_t mModuleCount;
+	uint32_t mVariantCount;
+	uint32_t mRenderQueue;
+	VkColorComponentFlags mColorMask;
+	VkCullModeFlags mCullMode;
+	VkPolygonMode mFillMode;
+	BlendMode mBlendMode;
+	VkPipelineDepthStencilStateCreateInfo mDepthStencilState;
+	uint64_t mKeywordTable;
+	uint64_t mModuleTable;
+	uint64_t mVariantTable;
+};
+struct StmModuleEntry {
+	uint64_t mOffset;
+	uint64_t mSize; // in words
+};
+struct StmVariantEntry {
+	uint64_t mKey; // StmVariantKey() of the variant
+	uint64_t mKeywords; // keyword mask
+	uint64_t mOffset;
+	uint64_t mSize;
+	PassType mPass;
+	uint32_t mPadding;
+};
+
+#define STM_MAGIC 0x324D5453 // STM2
+// Increment when the layout of .stm files changes
+#define STM_VERSION 3
+// Keyword masks are 64 bits
+#define STM_MAX_KEYWORDS 64
+
+/// Sorts keywords and appends a space to each, which is how variants are identified
+inline std::string StmKeywordString(const std::set<std::string>& keywords) {
+	std::string kw = "";
+	for (const auto& k : keywords)
+		kw += k + " ";
+	return kw;
+}
+/// Variants are looked up by this hash of their pass, kernel (compute variants only) and keyword mask
+inline uint64_t StmVariantKey(PassType pass, const std::string& kernel, uint64_t keywords) {
+	uint64_t key = HashBytes(&pass, sizeof(PassType));
+	key = HashBytes(kernel.data(), kernel.size(), key);
+	return HashBytes(&keywords, sizeof(uint64_t), key);
+}
+
+/// Appends values to a byte array
+struct StmWriter {
+	std::vector<uint8_t>& mData;
+
+	inline StmWriter(std::vector<uint8_t>& data) : mData(data) {}
+
+	inline void Write(const void* data, size_t size) {
+		if (size) mData.insert(mData.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+	}
+	template<typename T>
+	inline void Write(const T& value) { Write(&value, sizeof(T)); }
+	inline void Write(const std::string& str) {
+		Write((uint32_t)str.length());
+		Write(str.data(), str.length());
+	}
+	inline void Align(size_t alignment) { mData.resize(AlignUp(mData.size(), alignment)); }
+	inline uint64_t Offset() const { return mData.size(); }
+};
+/// Reads values from a byte range. Reads past the end fail and leave the reader invalid
+struct StmReader {
+	const uint8_t* mData;
+	const uint8_t* mEnd;
+	bool mValid;
+
+	inline StmReader(const uint8_t* data, size_t size) : mData(data), mEnd(data + size), mValid(true) {}
+
+	inline bool Read(void* dst, size_t size) {
+		if (!mValid || (size_t)(mEnd - mData) < size) return mValid = false;
+		if (size) memcpy(dst, mData, size);
+		mData += size;
+		return true;
+	}
+	template<typename T>
+	inline bool Read(T& value) { return Read(&value, sizeof(T)); }
+	inline bool Read(std::string& str) {
+		uint32_t l;
+		if (!Read(l) || (size_t)(mEnd - mData) < l) return mValid = false;
+		str.assign((const char*)mData, l);
+		mData += l;
+		return true;
+	}
+};
+
 struct SpirvModule {
 	std::vector<uint32_t> mSpirv;
 
 	inline SpirvModule() {}
-	inline void Read(std::ifstream& file) {
-		uint32_t l;
-		file.read(reinterpret_cast<char*>(&l), sizeof(uint32_t));
-		mSpirv.resize(l);
-		file.read(reinterpret_cast<char*>(mSpirv.data()), mSpirv.size() * sizeof(uint32_t));
-	}
-	inline void Write(std::ofstream& file) {
-		uint32_t l = (uint32_t)mSpirv.size();
-		file.write(reinterpret_cast<char*>(&l), sizeof(uint32_t));
-		file.write(reinterpret_cast<char*>(mSpirv.data()), mSpirv.size() * sizeof(uint32_t));
-	}
 };
 
 struct CompiledVariant {
@@ -35,127 +124,83 @@ struct CompiledVariant {
 	std::vector<std::string> mKeywords;
 
 	inline CompiledVariant() {}
-	inline void Read(std::ifstream& file) {
+
+	/// The keyword string this variant is identified by, see StmKeywordString()
+	inline std::string KeywordString() const { return StmKeywordString(std::set<std::string>(mKeywords.begin(), mKeywords.end())); }
+
+	/// Returns false if the data ends early
+	inline bool Read(StmReader& file) {
 		uint32_t c;
-		file.read(reinterpret_cast<char*>(&c), sizeof(uint32_t));
-		for (uint32_t i = 0; i < c; i++) {
+		file.Read(c);
+		for (uint32_t i = 0; i < c && file.mValid; i++) {
 			std::string name;
 			uint32_t set;
 			VkDescriptorSetLayoutBinding binding;
-
-			uint32_t l;
-			file.read(reinterpret_cast<char*>(&l), sizeof(uint32_t));
-			name.resize(l);
-			file.read(name.data(), l);
-
-			file.read(reinterpret_cast<char*>(&set), sizeof(uint32_t));
-			file.read(reinterpret_cast<char*>(&binding), sizeof(VkDescriptorSetLayoutBinding));
-
+			file.Read(name);
+			file.Read(set);
+			file.Read(binding);
 			mDescriptorBindings.emplace(name, std::make_pair(set, binding));
 		}
 
-		file.read(reinterpret_cast<char*>(&c), sizeof(uint32_t));
-		for (uint32_t i = 0; i < c; i++) {
+		file.Read(c);
+		for (uint32_t i = 0; i < c && file.mValid; i++) {
 			std::string name;
 			VkPushConstantRange range;
-
-			uint32_t l;
-			file.read(reinterpret_cast<char*>(&l), sizeof(uint32_t));
-			name.resize(l);
-			file.read(name.data(), l);
-
-			file.read(reinterpret_cast<char*>(&range), sizeof(VkPushConstantRange));
-
+			file.Read(name);
+			file.Read(range);
 			mPushConstants.emplace(name, range);
 		}
 
-		file.read(reinterpret_cast<char*>(&c), sizeof(uint32_t));
-		for (uint32_t i = 0; i < c; i++) {
+		file.Read(c);
+		for (uint32_t i = 0; i < c && file.mValid; i++) {
 			std::string name;
-			VkSamplerCreateInfo range;
-
-			uint32_t l;
-			file.read(reinterpret_cast<char*>(&l), sizeof(uint32_t));
-			name.resize(l);
-			file.read(name.data(), l);
-
-			file.read(reinterpret_cast<char*>(&range), sizeof(VkSamplerCreateInfo));
-
-			mStaticSamplers.emplace(name, range);
-		}
-
-		uint32_t kl;
-		file.read(reinterpret_cast<char*>(&kl), sizeof(uint32_t));
-		mEntryPoints[0].resize(kl);
-		if (kl) file.read(mEntryPoints[0].data(), kl);
-
-		file.read(reinterpret_cast<char*>(&kl), sizeof(uint32_t));
-		mEntryPoints[1].resize(kl);
-		if (kl) file.read(mEntryPoints[1].data(), kl);
-
-		file.read(reinterpret_cast<char*>(&mPass), sizeof(PassType));
-		file.read(reinterpret_cast<char*>(&mWorkgroupSize), sizeof(uint3));
-		file.read(reinterpret_cast<char*>(&mModules), 2*sizeof(uint32_t));
-
-		uint32_t kwc;
-		file.read(reinterpret_cast<char*>(&kwc), sizeof(uint32_t));
-		mKeywords.resize(kwc);
-		for (uint32_t i = 0; i < kwc; i++) {
-			uint32_t l;
-			file.read(reinterpret_cast<char*>(&l), sizeof(uint32_t));
-			mKeywords[i].resize(l);
-			if (l) file.read(const_cast<char*>(mKeywords[i].data()), l);
+			VkSamplerCreateInfo sampler;
+			file.Read(name);
+			file.Read(sampler);
+			mStaticSamplers.emplace(name, sampler);
 		}
 
+		file.Read(mEntryPoints[0]);
+		file.Read(mEntryPoints[1]);
+		file.Read(mPass);
+		file.Read(mWorkgroupSize);
+		file.Read(mModules);
+
+		file.Read(c);
+		if (file.mValid) mKeywords.resize(c);
+		for (uint32_t i = 0; i < c && file.mValid; i++)
+			file.Read(mKeywords[i]);
+		return file.mValid;
 	}
-	inline void Write(std::ofstream& file) {
-		uint32_t c = (uint32_t)mDescriptorBindings.size();
-		file.write(reinterpret_cast<char*>(&c), sizeof(uint32_t));
+	inline void Write(StmWriter& file) const {
+		file.Write((uint32_t)mDescriptorBindings.size());
 		for (auto& p : mDescriptorBindings) {
-			uint32_t l = (uint32_t)p.first.length();
-			file.write(reinterpret_cast<char*>(&l), sizeof(uint32_t));
-			file.write(p.first.data(), p.first.length());
-			file.write(reinterpret_cast<char*>(&p.second.first), sizeof(uint32_t));
-			file.write(reinterpret_cast<char*>(&p.second.second), sizeof(VkDescriptorSetLayoutBinding));
+			file.Write(p.first);
+			file.Write(p.second.first);
+			file.Write(p.second.second);
 		}
 
-		c = (uint32_t)mPushConstants.size();
-		file.write(reinterpret_cast<char*>(&c), sizeof(uint32_t));
+		file.Write((uint32_t)mPushConstants.size());
 		for (auto& p : mPushConstants) {
-			uint32_t l = (uint32_t)p.first.length();
-			file.write(reinterpret_cast<char*>(&l), sizeof(uint32_t));
-			file.write(p.first.data(), p.first.length());
-			file.write(reinterpret_cast<char*>(&p.second), sizeof(VkPushConstantRange));
+			file.Write(p.first);
+			file.Write(p.second);
 		}
 
-		c = (uint32_t)mStaticSamplers.size();
-		file.write(reinterpret_cast<char*>(&c), sizeof(uint32_t));
+		file.Write((uint32_t)mStaticSamplers.size());
 		for (auto& p : mStaticSamplers) {
-			uint32_t l = (uint32_t)p.first.length();
-			file.write(reinterpret_cast<char*>(&l), sizeof(uint32_t));
-			file.write(p.first.data(), p.first.length());
-			file.write(reinterpret_cast<char*>(&p.second), sizeof(VkSamplerCreateInfo));
+			file.Write(p.first);
+			file.Write(p.second);
 		}
 
-		uint32_t kl = (uint32_t)mEntryPoints[0].length();
-		file.write(reinterpret_cast<char*>(&kl), sizeof(uint32_t));
-		if (kl) file.write(mEntryPoints[0].data(), mEntryPoints[0].length());
-
-		kl = (uint32_t)mEntryPoints[1].length();
-		file.write(reinterpret_cast<char*>(&kl), sizeof(uint32_t));
-		if (kl) file.write(mEntryPoints[1].data(), mEntryPoints[1].length());
+		file.Write(mEntryPoints[0]);
+		file.Write(mEntryPoints[1]);
+		file.Write(mPass);
+		file.Write(mWorkgroupSize);
+		file.Write(mModules);
 
-		file.write(reinterpret_cast<char*>(&mPass), sizeof(PassType));
-		file.write(reinterpret_cast<char*>(&mWorkgroupSize), sizeof(uint3));
-		file.write(reinterpret_cast<char*>(mModules), 2*sizeof(uint32_t));
-
-		uint32_t kwc = (uint32_t)mKeywords.size();
-		file.write(reinterpret_cast<char*>(&kwc), sizeof(uint32_t));
-		for (std::string& kw : mKeywords) {
-			uint32_t l = (uint32_t)kw.length();
-			file.write(reinterpret_cast<char*>(&l), sizeof(uint32_t));
-			if (l) file.write(kw.data(), kw.length());
-		}
+		file.Write((uint32_t)mKeywords.size());
+		for (const std::string& kw : mKeywords)
+			file.Write(kw);
 	}
 };
 
@@ -171,43 +216,73 @@ struct CompiledShader {
 	VkPipelineDepthStencilStateCreateInfo mDepthStencilState;
 
 	inline CompiledShader() {}
-	inline CompiledShader(std::ifstream& file) {
-		uint32_t mc;
-		file.read(reinterpret_cast<char*>(&mc), sizeof(uint32_t));
-		mModules.resize(mc);
-		for (uint32_t i = 0; i < mc; i++)
-			mModules[i].Read(file);
-
-		uint32_t vc;
-		file.read(reinterpret_cast<char*>(&vc), sizeof(uint32_t));
-		mVariants.resize(vc);
-		for (uint32_t i = 0; i < vc; i++)
-			mVariants[i].Read(file);
-
-		file.read(reinterpret_cast<char*>(&mRenderQueue), sizeof(uint32_t));
-		file.read(reinterpret_cast<char*>(&mColorMask), sizeof(VkColorComponentFlags));
-		file.read(reinterpret_cast<char*>(&mCullMode), sizeof(VkCullModeFlags));
-		file.read(reinterpret_cast<char*>(&mFillMode), sizeof(VkPolygonMode));
-		file.read(reinterpret_cast<char*>(&mBlendMode), sizeof(BlendMode));
-		file.read(reinterpret_cast<char*>(&mDepthStencilState), sizeof(VkPipelineDepthStencilStateCreateInfo));
-	}
 
-	inline void Write(std::ofstream& file) {
-		uint32_t mc = (uint32_t)mModules.size();
-		file.write(reinterpret_cast<char*>(&mc), sizeof(uint32_t));
-		for (SpirvModule& m : mModules)
-			m.Write(file);
+	/// Appends the .stm file to data
+	inline void Write(std::vector<uint8_t>& data) const {
+		StmWriter file(data);
+		uint64_t base = file.Offset();
+
+		StmHeader header = {};
+		header.mMagic = STM_MAGIC;
+		header.mVersion = STM_VERSION;
+		header.mModuleCount = (uint32_t)mModules.size();
+		header.mVariantCount = (uint32_t)mVariants.size();
+		header.mRenderQueue = mRenderQueue;
+		header.mColorMask = mColorMask;
+		header.mCullMode = mCullMode;
+		header.mFillMode = mFillMode;
+		header.mBlendMode = mBlendMode;
+		header.mDepthStencilState = mDepthStencilState;
+		file.Write(header);
+
+		std::set<std::string> keywords;
+		for (const CompiledVariant& v : mVariants)
+			keywords.insert(v.mKeywords.begin(), v.mKeywords.end());
+		header.mKeywordCount = (uint32_t)keywords.size();
+		file.Align(8);
+		header.mKeywordTable = file.Offset() - base;
+		std::unordered_map<std::string, uint32_t> keywordBits;
+		for (const std::string& kw : keywords) {
+			keywordBits.emplace(kw, (uint32_t)keywordBits.size());
+			file.Write(kw);
+		}
 
-		uint32_t vc = (uint32_t)mVariants.size();
-		file.write(reinterpret_cast<char*>(&vc), sizeof(uint32_t));
-		for (CompiledVariant& v : mVariants)
+		std::vector<StmModuleEntry> modules(mModules.size());
+		file.Align(8);
+		header.mModuleTable = file.Offset() - base;
+		file.Write(modules.data(), modules.size() * sizeof(StmModuleEntry));
+		for (uint32_t i = 0; i < mModules.size(); i++) {
+			modules[i].mOffset = file.Offset() - base;
+			modules[i].mSize = mModules[i].mSpirv.size();
+			file.Write(mModules[i].mSpirv.data(), mModules[i].mSpirv.size() * sizeof(uint32_t));
+		}
+		memcpy(data.data() + base + header.mModuleTable, modules.data(), modules.size() * sizeof(StmModuleEntry));
+
+		std::vector<StmVariantEntry> variants(mVariants.size());
+		file.Align(8);
+		header.mVariantTable = file.Offset() - base;
+		file.Write(variants.data(), variants.size() * sizeof(StmVariantEntry));
+		for (uint32_t i = 0; i < mVariants.size(); i++) {
+			const CompiledVariant& v = mVariants[i];
+			variants[i] = {};
+			for (const std::string& kw : v.mKeywords)
+				if (keywordBits.at(kw) < STM_MAX_KEYWORDS)
+					variants[i].mKeywords |= 1ull << keywordBits.at(kw);
+			variants[i].mKey = StmVariantKey(v.mPass, v.mPass ? "" : v.mEntryPoints[0], variants[i].mKeywords);
+			variants[i].mPass = v.mPass;
+			variants[i].mOffset = file.Offset() - base;
 			v.Write(file);
+			variants[i].mSize = file.Offset() - base - variants[i].mOffset;
+		}
+		// Stable, so the last of several variants with the same keywords is still found last, like when they were read in order
+		std::stable_sort(variants.begin(), variants.end(), [](const StmVariantEntry& a, const StmVariantEntry& b) { return a.mKey < b.mKey; });
+		memcpy(data.data() + base + header.mVariantTable, variants.data(), variants.size() * sizeof(StmVariantEntry));
 
-		file.write(reinterpret_cast<char*>(&mRenderQueue), sizeof(uint32_t));
-		file.write(reinterpret_cast<char*>(&mColorMask), sizeof(VkColorComponentFlags));
-		file.write(reinterpret_cast<char*>(&mCullMode), sizeof(VkCullModeFlags));
-		file.write(reinterpret_cast<char*>(&mFillMode), sizeof(VkPolygonMode));
-		file.write(reinterpret_cast<char*>(&mBlendMode), sizeof(BlendMode));
-		file.write(reinterpret_cast<char*>(&mDepthStencilState), sizeof(VkPipelineDepthStencilStateCreateInfo));
+		memcpy(data.data() + base, &header, sizeof(StmHeader));
+	}
+	inline void Write(std::ofstream& file) const {
+		std::vector<uint8_t> data;
+		Write(data);
+		file.write(reinterpret_cast<const char*>(data.data()), data.size());
 	}
 };
\ No newline at end of file
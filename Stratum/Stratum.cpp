@@ -22,6 +22,7 @@ private:
 	Instance* mInstance;
 	InputManager* mInputManager;
 	PluginManager* mPluginManager;
+	JobSystem* mJobSystem;
 	AssetManager* mAssetManager;
 	Scene* mScene;
 
@@ -78,10 +79,11 @@ public:
 		mPluginManager->LoadPlugins();
 		mInstance = new Instance(argc, argv, mPluginManager);
 		mInputManager = new InputManager();
-		mAssetManager = new AssetManager(mInstance->Device());
+		mJobSystem = new JobSystem();
+		mAssetManager = new AssetManager(mInstance->Device(), mJobSystem);
 		printf("Initialized.\n");
 
-		mScene = new Scene(mInstance, mAssetManager, mInputManager, mPluginManager);
+		mScene = new Scene(mInstance, mAssetManager, mInputManager, mPluginManager, mJobSystem);
 		Gizmos::Initialize(mInstance->Device(), mAssetManager);
 		GUI::Initialize(mInstance->Device(), mAssetManager);
 		mInputManager->RegisterInputDevice(mInstance->Window()->mInput);
@@ -90,6 +92,15 @@ public:
 	Stratum* Loop() {
 		mPluginManager->InitPlugins(mScene);
 
+		#ifdef PROFILER_ENABLE
+		// --trace <file> records every profiler sample and writes a Chrome trace on exit
+		string traceFile;
+		const vector<string>& args = mInstance->CommandLineArguments();
+		for (uint32_t i = 0; i + 1 < args.size(); i++)
+			if (args[i] == "--trace") traceFile = args[i + 1];
+		if (!traceFile.empty()) Profiler::BeginCapture();
+		#endif
+
 		while (true) {
 			#ifdef PROFILER_ENABLE
 			Profiler::FrameStart();
@@ -108,6 +119,8 @@ public:
 			mInstance->Window()->AcquireNextImage();
 			PROFILER_END;
 
+			mAssetManager->Update();
+
 			PROFILER_BEGIN("Get CommandBuffer");
 			shared_ptr<CommandBuffer> commandBuffer = mScene->Instance()->Device()->GetCommandBuffer();
 			PROFILER_END;
@@ -129,6 +142,11 @@ public:
 
 		mInstance->Device()->Flush();
 
+		#ifdef PROFILER_ENABLE
+		if (!traceFile.empty() && Profiler::EndCapture(traceFile))
+			printf("Wrote trace to %s\n", traceFile.c_str());
+		#endif
+
 		mPluginManager->UnloadPlugins();
 
 		return this;
@@ -140,6 +158,7 @@ public:
 		safe_delete(mScene);
 
 		safe_delete(mAssetManager);
+		safe_delete(mJobSystem);
 		safe_delete(mInputManager);
 		safe_delete(mInstance);
 	}
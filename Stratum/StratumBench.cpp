@@ -0,0 +1,2026 @@
+#include <chrono>
+#include <functional>
+#include <random>
+
+#include <Content/Animation.hpp>
+#include <Content/Font.hpp>
+#include <Content/Material.hpp>
+#include <Content/Mesh.hpp>
+#include <Content/MeshCache.hpp>
+#include <Content/ShaderFile.hpp>
+#include <Content/Texture.hpp>
+#include <Content/TextureFile.hpp>
+#include <Core/JobSystem.hpp>
+#include <Core/PipelineCacheFile.hpp>
+#include <Scene/FrustumCuller.hpp>
+#include <Scene/ObjectBvh2.hpp>
+#include <Scene/OcclusionCuller.hpp>
+#include <Scene/Renderer.hpp>
+#include <Scene/TransformHierarchy.hpp>
+#include <Scene/TriangleBvh2.hpp>
+#include <ThirdParty/json11.h>
+#include <Util/BlockCompression.hpp>
+#include <Util/DescriptorCache.hpp>
+#include <Util/IdPool.hpp>
+#include <Util/LinearAllocator.hpp>
+#include <Util/PropertyID.hpp>
+#include <Util/RadixSort.hpp>
+#include <Util/RingAllocator.hpp>
+#include <Util/TlsfAllocator.hpp>
+#include <Util/Tokenizer.hpp>
+#include <Util/Util.hpp>
+
+using namespace std;
+
+// Benchmarks add their results here so the compiler can't remove the work being measured
+volatile uint64_t gSink = 0;
+inline void Consume(uint64_t v) { gSink = gSink + v; }
+inline void Consume(float v) { uint32_t u; memcpy(&u, &v, sizeof(u)); Consume((uint64_t)u); }
+
+struct BenchSettings {
+	string mFilter;
+	string mAssets;
+	uint32_t mWarmup;
+	uint32_t mSamples;
+	// Samples are taken until both mSamples and mMinTime are reached
+	double mMinTime;
+};
+
+struct BenchResult {
+	string mName;
+	// Work done by one call, used to report time per item
+	uint32_t mItems;
+	vector<double> mSamples; // nanoseconds per call, sorted
+
+	inline double Percentile(double p) const {
+		if (mSamples.empty()) return 0;
+		double i = p * (mSamples.size() - 1);
+		uint32_t i0 = (uint32_t)i;
+		uint32_t i1 = min(i0 + 1, (uint32_t)mSamples.size() - 1);
+		return mSamples[i0] + (mSamples[i1] - mSamples[i0]) * (i - i0);
+	}
+	inline double Mean() const {
+		double s = 0;
+		for (double v : mSamples) s += v;
+		return mSamples.size() ? s / mSamples.size() : 0;
+	}
+	inline double StdDev() const {
+		double m = Mean(), s = 0;
+		for (double v : mSamples) s += (v - m) * (v - m);
+		return mSamples.size() > 1 ? sqrt(s / (mSamples.size() - 1)) : 0;
+	}
+
+	inline json11::Json to_json() const {
+		return json11::Json::object {
+			{ "name", mName },
+			{ "items", (int)mItems },
+			{ "samples", (int)mSamples.size() },
+			{ "min_ns", mSamples.front() },
+			{ "median_ns", Percentile(.5) },
+			{ "p90_ns", Percentile(.9) },
+			{ "p99_ns", Percentile(.99) },
+			{ "max_ns", mSamples.back() },
+			{ "mean_ns", Mean() },
+			{ "stddev_ns", StdDev() },
+			{ "median_ns_per_item", Percentile(.5) / mItems },
+		};
+	}
+};
+
+/// The conditions of a pass/fail check. Each condition that fails is kept with the number of times it failed, so a failing check says what broke.
+/// Not thread-safe: jobs should record results in atomics that are expected on the thread that waits for them
+struct BenchExpectations {
+	vector<pair<string, uint32_t>> mFailures;
+
+	/// Returns condition
+	inline bool Expect(bool condition, const char* text) {
+		if (condition) return true;
+		for (auto& f : mFailures)
+			if (f.first == text) {
+				f.second++;
+				return false;
+			}
+		mFailures.push_back(make_pair(string(text), 1u));
+		return false;
+	}
+	inline uint32_t FailureCount() const {
+		uint32_t n = 0;
+		for (const auto& f : mFailures) n += f.second;
+		return n;
+	}
+};
+/// Adds condition to a BenchExpectations, recording its source text if it is false
+#define BENCH_EXPECT(expectations, condition) (expectations).Expect((condition), #condition)
+
+class Bench {
+public:
+	inline Bench(const BenchSettings& settings) : mSettings(settings) {}
+
+	inline const vector<BenchResult>& Results() const { return mResults; }
+	inline const vector<json11::Json>& Checks() const { return mChecks; }
+	inline bool Failed() const { return mFailed; }
+	inline const BenchSettings& Settings() const { return mSettings; }
+
+	inline bool Enabled(const string& name) const {
+		return mSettings.mFilter.empty() || name.find(mSettings.mFilter) != string::npos;
+	}
+
+	/// Times func() after mWarmup untimed calls. setup() runs before every call and isn't timed
+	inline void Run(const string& name, uint32_t items, const function<void()>& func, const function<void()>& setup = nullptr) {
+		if (!Enabled(name)) return;
+
+		for (uint32_t i = 0; i < mSettings.mWarmup; i++) {
+			if (setup) setup();
+			func();
+		}
+
+		BenchResult result;
+		result.mName = name;
+		result.mItems = max(items, 1u);
+
+		double total = 0;
+		while (result.mSamples.size() < mSettings.mSamples || total < mSettings.mMinTime * 1e9) {
+			if (setup) setup();
+			auto t0 = chrono::high_resolution_clock::now();
+			func();
+			auto t1 = chrono::high_resolution_clock::now();
+			double ns = (double)chrono::duration_cast<chrono::nanoseconds>(t1 - t0).count();
+			result.mSamples.push_back(ns);
+			total += ns;
+		}
+		sort(result.mSamples.begin(), result.mSamples.end());
+
+		printf("%-40s %12.3f us %12.3f us %12.3f us %10.2f ns/item  (%u samples)\n", name.c_str(),
+			result.Percentile(.5) * 1e-3, result.Percentile(.9) * 1e-3, result.Percentile(.99) * 1e-3,
+			result.Percentile(.5) / result.mItems, (uint32_t)result.mSamples.size());
+		mResults.push_back(result);
+	}
+
+	/// Records a precision check, which fails when error exceeds tolerance
+	inline void Check(const string& name, double error, double tolerance) {
+		if (!Enabled(name)) return;
+		bool pass = error <= tolerance;
+		if (pass)
+			printf("%-40s %12g error (tolerance %g)\n", name.c_str(), error, tolerance);
+		else {
+			fprintf_color(COLOR_RED, stderr, "%-40s %12g error (tolerance %g)\n", name.c_str(), error, tolerance);
+			mFailed = true;
+		}
+		mChecks.push_back(json11::Json::object {
+			{ "name", name },
+			{ "error", error },
+			{ "tolerance", tolerance },
+			{ "pass", pass },
+		});
+	}
+	/// Records a pass/fail check, which fails if any of its conditions failed. Prints the failed conditions
+	inline void Check(const string& name, const BenchExpectations& expectations) {
+		if (!Enabled(name)) return;
+		bool pass = expectations.mFailures.empty();
+		vector<json11::Json> failures;
+		if (pass)
+			printf("%-40s %12s\n", name.c_str(), "pass");
+		else {
+			fprintf_color(COLOR_RED, stderr, "%-40s %12s\n", name.c_str(), "FAIL");
+			for (const auto& f : expectations.mFailures) {
+				fprintf_color(COLOR_RED, stderr, "    %s (failed %u times)\n", f.first.c_str(), f.second);
+				failures.push_back(json11::Json::object { { "condition", f.first }, { "count", (int)f.second } });
+			}
+			mFailed = true;
+		}
+		mChecks.push_back(json11::Json::object {
+			{ "name", name },
+			{ "error", (double)expectations.FailureCount() },
+			{ "tolerance", 0.0 },
+			{ "pass", pass },
+			{ "failures", failures },
+		});
+	}
+
+private:
+	BenchSettings mSettings;
+	vector<BenchResult> mResults;
+	vector<json11::Json> mChecks;
+	bool mFailed = false;
+};
+
+/// An object with fixed bounds, so ObjectBvh2 can be benchmarked without a Scene
+class BenchObject : public Object {
+public:
+	AABB mBox;
+	inline BenchObject(const AABB& box) : Object("BenchObject"), mBox(box) { LayerMask(1); }
+	inline AABB Bounds() override { return mBox; }
+};
+
+/// A visible renderer with a fixed material and mesh, standing in for MeshRenderer in render list sorts
+class BenchRenderer : public Renderer {
+public:
+	AABB mBox;
+	uint32_t mQueue;
+	uint32_t mMaterial;
+	uint32_t mMesh;
+	inline BenchRenderer(const AABB& box, uint32_t queue, uint32_t material, uint32_t mesh) : Object("BenchRenderer"), mBox(box), mQueue(queue), mMaterial(material), mMesh(mesh) {}
+	inline AABB Bounds() override { return mBox; }
+	inline bool Visible() override { return true; }
+	inline uint32_t RenderQueue() override { return mQueue; }
+	inline uint32_t BatchKey() override { return (mMaterial << 16) | mMesh; }
+	inline void Draw(CommandBuffer* commandBuffer, Camera* camera, PassType pass) override {}
+};
+
+/// Planes of a frustum at the origin looking down +z, facing inwards
+inline void BenchFrustum(float fovx, float fovy, float near, float far, float4 frustum[6]) {
+	float sx = sinf(fovx * .5f), cx = cosf(fovx * .5f);
+	float sy = sinf(fovy * .5f), cy = cosf(fovy * .5f);
+	frustum[0] = float4(0, 0, 1, near);
+	frustum[1] = float4(0, 0, -1, -far);
+	frustum[2] = float4(-cx, 0, sx, 0);
+	frustum[3] = float4(cx, 0, sx, 0);
+	frustum[4] = float4(0, -cy, sy, 0);
+	frustum[5] = float4(0, cy, sy, 0);
+}
+
+inline vector<AABB> RandomBoxes(mt19937& rng, uint32_t count, float extent, float size) {
+	uniform_real_distribution<float> position(-extent, extent);
+	uniform_real_distribution<float> scale(size * .1f, size);
+	vector<AABB> boxes(count);
+	for (AABB& b : boxes) {
+		float3 c(position(rng), position(rng), position(rng));
+		float3 e(scale(rng), scale(rng), scale(rng));
+		b = AABB(c - e, c + e);
+	}
+	return boxes;
+}
+
+void BenchBvh(Bench& bench, mt19937& rng) {
+	vector<AABB> boxes = RandomBoxes(rng, 100000, 500.f, 2.f);
+	vector<Bvh2Node> nodes;
+	vector<uint32_t> order;
+	bench.Run("BvhBuilder::Build SAH 100k", (uint32_t)boxes.size(), [&]() {
+		BvhBuilder::Build(boxes.data(), (uint32_t)boxes.size(), BvhBuildSettings(1, BVH_SPLIT_SAH), nodes, order);
+		Consume((uint64_t)nodes.size());
+	});
+	bench.Run("BvhBuilder::Build median 100k", (uint32_t)boxes.size(), [&]() {
+		BvhBuilder::Build(boxes.data(), (uint32_t)boxes.size(), BvhBuildSettings(1, BVH_SPLIT_MEDIAN), nodes, order);
+		Consume((uint64_t)nodes.size());
+	});
+
+	// SAH splits should never make a worse tree than median splits, by the cost SAH minimizes. The ratio is at most 1
+	for (uint32_t leafSize : { 1u, 4u }) {
+		string name = "BvhBuilder SAH/median cost, leaf size " + to_string(leafSize);
+		if (!bench.Enabled(name)) continue;
+		BvhBuildSettings sah(leafSize, BVH_SPLIT_SAH), median(leafSize, BVH_SPLIT_MEDIAN);
+		BvhBuilder::Build(boxes.data(), (uint32_t)boxes.size(), sah, nodes, order);
+		BvhStats sahStats = BvhBuilder::ComputeStats(nodes, sah);
+		BvhBuilder::Build(boxes.data(), (uint32_t)boxes.size(), median, nodes, order);
+		BvhStats medianStats = BvhBuilder::ComputeStats(nodes, median);
+		bench.Check(name, medianStats.mSahCost > 0 ? sahStats.mSahCost / medianStats.mSahCost : 2.0, 1.0);
+	}
+
+	// Heightfield grid, 2 * 255 * 255 triangles
+	const uint32_t res = 256;
+	vector<float3> vertices(res * res);
+	vector<uint32_t> indices;
+	for (uint32_t y = 0; y < res; y++)
+		for (uint32_t x = 0; x < res; x++)
+			vertices[x + y * res] = float3((float)x, sinf(x * .1f) * cosf(y * .13f) * 4.f, (float)y);
+	for (uint32_t y = 0; y + 1 < res; y++)
+		for (uint32_t x = 0; x + 1 < res; x++) {
+			uint32_t i = x + y * res;
+			uint32_t tri[6] { i, i + res, i + 1, i + 1, i + res, i + res + 1 };
+			indices.insert(indices.end(), tri, tri + 6);
+		}
+
+	for (uint32_t width : { 2u, 4u, 8u }) {
+		TriangleBvh2 bvh(BvhBuildSettings(4, BVH_SPLIT_SAH, 16, width));
+		bench.Run("TriangleBvh2::Build width " + to_string(width), (uint32_t)indices.size() / 3, [&]() {
+			bvh.Build(vertices.data(), 0, (uint32_t)vertices.size(), sizeof(float3), indices.data(), (uint32_t)indices.size(), VK_INDEX_TYPE_UINT32);
+		});
+		if (!bench.Enabled("TriangleBvh2::Intersect width " + to_string(width))) continue;
+		if (bvh.Nodes().empty())
+			bvh.Build(vertices.data(), 0, (uint32_t)vertices.size(), sizeof(float3), indices.data(), (uint32_t)indices.size(), VK_INDEX_TYPE_UINT32);
+
+		mt19937 rayRng(1);
+		uniform_real_distribution<float> u(0.f, (float)res);
+		uniform_real_distribution<float> d(-.5f, .5f);
+		vector<Ray> rays(4096);
+		for (Ray& r : rays) r = Ray(float3(u(rayRng), 20.f, u(rayRng)), normalize(float3(d(rayRng), -1.f, d(rayRng))));
+
+		bench.Run("TriangleBvh2::Intersect width " + to_string(width), (uint32_t)rays.size(), [&]() {
+			uint32_t hits = 0;
+			for (const Ray& r : rays) {
+				float t;
+				if (bvh.Intersect(r, &t, false)) hits++;
+			}
+			Consume((uint64_t)hits);
+		});
+	}
+
+	vector<AABB> objectBoxes = RandomBoxes(rng, 20000, 500.f, 4.f);
+	vector<Object*> objects;
+	for (const AABB& b : objectBoxes) objects.push_back(new BenchObject(b));
+	float4 frustum[6];
+	BenchFrustum(radians(90.f), radians(60.f), .1f, 400.f, frustum);
+
+	for (uint32_t width : { 2u, 4u, 8u }) {
+		ObjectBvh2 bvh(BvhBuildSettings(1, BVH_SPLIT_SAH, 16, width));
+		bench.Run("ObjectBvh2::Build width " + to_string(width), (uint32_t)objects.size(), [&]() {
+			bvh.Build(objects.data(), (uint32_t)objects.size());
+		});
+		if (!bench.Enabled("ObjectBvh2::FrustumCheck width " + to_string(width))) continue;
+		if (bvh.Nodes().empty()) bvh.Build(objects.data(), (uint32_t)objects.size());
+
+		vector<Object*> visible;
+		bench.Run("ObjectBvh2::FrustumCheck width " + to_string(width), (uint32_t)objects.size(), [&]() {
+			visible.clear();
+			bvh.FrustumCheck(frustum, visible, ~0u);
+			Consume((uint64_t)visible.size());
+		});
+	}
+
+	// A camera and seven shadow cameras, as frusta rotated around the origin
+	float4 frusta[8][6];
+	for (uint32_t f = 0; f < 8; f++) {
+		quaternion r(f * radians(45.f), float3(0, 1, 0));
+		for (uint32_t p = 0; p < 6; p++)
+			frusta[f][p] = float4(r * frustum[p].xyz, frustum[p].w);
+	}
+	ObjectBvh2 bvh(BvhBuildSettings(1, BVH_SPLIT_SAH, 16, 8));
+	bvh.Build(objects.data(), (uint32_t)objects.size());
+	FrustumCuller culler;
+	vector<Object*> visible;
+	for (uint32_t frustumCount : { 1u, 8u }) {
+		bench.Run("ObjectBvh2::FrustumCheck " + to_string(frustumCount) + " frusta", (uint32_t)objects.size(), [&]() {
+			size_t total = 0;
+			for (uint32_t f = 0; f < frustumCount; f++) {
+				visible.clear();
+				bvh.FrustumCheck(frusta[f], visible, ~0u);
+				total += visible.size();
+			}
+			Consume((uint64_t)total);
+		});
+		bench.Run("FrustumCuller " + to_string(frustumCount) + " frusta", (uint32_t)objects.size(), [&]() {
+			culler.Gather(bvh);
+			culler.ClearFrusta();
+			for (uint32_t f = 0; f < frustumCount; f++)
+				culler.AddFrustum(frusta[f]);
+			culler.Cull(nullptr);
+			size_t total = 0;
+			for (uint32_t f = 0; f < frustumCount; f++) {
+				visible.clear();
+				culler.Collect(f, ~0u, visible);
+				total += visible.size();
+			}
+			Consume((uint64_t)total);
+		});
+	}
+	{
+		culler.Gather(bvh);
+		culler.ClearFrusta();
+		for (uint32_t f = 0; f < 8; f++) culler.AddFrustum(frusta[f]);
+		culler.Cull(nullptr);
+		// Objects one method finds visible and the other doesn't
+		uint32_t mismatches = 0;
+		vector<Object*> expected;
+		for (uint32_t f = 0; f < 8; f++) {
+			visible.clear();
+			expected.clear();
+			culler.Collect(f, ~0u, visible);
+			bvh.FrustumCheck(frusta[f], expected, ~0u);
+			sort(visible.begin(), visible.end());
+			sort(expected.begin(), expected.end());
+			vector<Object*> difference;
+			set_symmetric_difference(visible.begin(), visible.end(), expected.begin(), expected.end(), back_inserter(difference));
+			mismatches += (uint32_t)difference.size();
+		}
+		bench.Check("FrustumCuller matches ObjectBvh2", mismatches, 0);
+	}
+
+	for (Object* o : objects) delete o;
+}
+
+void BenchOcclusion(Bench& bench, mt19937& rng) {
+	// A camera at the origin looking down +z, and a wall at z = 20 covering the left half of the view
+	float fovy = radians(60.f);
+	float fovx = 2 * atanf(tanf(fovy * .5f) * 2.f);
+	float4x4 viewProjection = float4x4::PerspectiveFov(fovy, 2.f, .1f, 500.f) * float4x4::Look(0, float3(0, 0, 1), float3(0, 1, 0));
+	float4 frustum[6];
+	BenchFrustum(fovx, fovy, .1f, 500.f, frustum);
+	float3 wall[4] { float3(-1000, -1000, 20), float3(0, -1000, 20), float3(0, 1000, 20), float3(-1000, 1000, 20) };
+	uint3 wallTriangles[2] { uint3(0, 1, 2), uint3(0, 2, 3) };
+
+	// Boxes scattered through the view
+	uniform_real_distribution<float> u(-1.f, 1.f);
+	vector<Object*> objects(20000);
+	for (Object*& o : objects) {
+		float z = 1 + (u(rng) * .5f + .5f) * 100;
+		float3 c(u(rng) * z, u(rng) * z * .5f, z);
+		o = new BenchObject(AABB(c - .5f, c + .5f));
+	}
+	ObjectBvh2 bvh;
+	bvh.Build(objects.data(), (uint32_t)objects.size());
+
+	// A wall split into 20k triangles
+	const uint32_t n = 100;
+	vector<float3> gridVertices;
+	vector<uint3> gridTriangles;
+	for (uint32_t y = 0; y <= n; y++)
+		for (uint32_t x = 0; x <= n; x++)
+			gridVertices.push_back(float3(x * .4f - 20, y * .4f - 20, 15));
+	for (uint32_t y = 0; y < n; y++)
+		for (uint32_t x = 0; x < n; x++) {
+			uint32_t i = y * (n + 1) + x;
+			gridTriangles.push_back(uint3(i, i + 1, i + n + 2));
+			gridTriangles.push_back(uint3(i, i + n + 2, i + n + 1));
+		}
+
+	OcclusionCuller culler;
+	bench.Run("OcclusionCuller render 20k triangles", (uint32_t)gridTriangles.size(), [&]() {
+		culler.Begin(viewProjection);
+		culler.RenderTriangles(gridVertices.data(), (uint32_t)gridVertices.size(), gridTriangles.data(), (uint32_t)gridTriangles.size(), float4x4(1));
+		culler.End();
+		Consume((uint64_t)culler.TriangleCount());
+	});
+
+	vector<Object*> visible;
+	bench.Run("ObjectBvh2::FrustumCheck 20k", (uint32_t)objects.size(), [&]() {
+		visible.clear();
+		bvh.FrustumCheck(frustum, visible, ~0u);
+		Consume((uint64_t)visible.size());
+	});
+	bench.Run("OcclusionCuller::Cull 20k", (uint32_t)objects.size(), [&]() {
+		culler.Begin(viewProjection);
+		culler.RenderTriangles(wall, 4, wallTriangles, 2, float4x4(1));
+		culler.End();
+		visible.clear();
+		culler.Cull(bvh, frustum, visible, ~0u);
+		Consume((uint64_t)visible.size());
+	});
+
+	// Boxes in front of the wall or to its right must be visible, and boxes entirely behind it must be culled
+	culler.Begin(viewProjection);
+	culler.RenderTriangles(wall, 4, wallTriangles, 2, float4x4(1));
+	culler.End();
+	uint32_t hiddenInFront = 0;
+	uint32_t visibleBehind = 0;
+	for (uint32_t i = 0; i < 200000; i++) {
+		float z = 1 + (u(rng) * .5f + .5f) * 60;
+		float3 c(u(rng) * z, u(rng) * z * .5f, z);
+		float e = .1f + (u(rng) * .5f + .5f) * 2;
+		AABB box(c - e, c + e);
+		bool behind = box.mMin.z > 20 && box.mMax.x < 0;
+		if (culler.Visible(box) != !behind) {
+			if (behind) visibleBehind++;
+			else hiddenInFront++;
+		}
+	}
+	bench.Check("OcclusionCuller hides no visible boxes", hiddenInFront, 0);
+	bench.Check("OcclusionCuller culls boxes behind a wall", visibleBehind, 0);
+
+	for (Object* o : objects) delete o;
+}
+
+void BenchMath(Bench& bench, mt19937& rng) {
+	vector<AABB> boxes = RandomBoxes(rng, 100000, 500.f, 4.f);
+	float4 frustum[6];
+	BenchFrustum(radians(90.f), radians(60.f), .1f, 400.f, frustum);
+	bench.Run("AABB::Intersects frustum", (uint32_t)boxes.size(), [&]() {
+		uint32_t visible = 0;
+		for (const AABB& b : boxes)
+			if (b.Intersects(frustum)) visible++;
+		Consume((uint64_t)visible);
+	});
+
+	uniform_real_distribution<float> u(-1.f, 1.f);
+	vector<float3> translations(4096);
+	vector<quaternion> trsRotations(4096);
+	vector<float3> scales(4096);
+	vector<float4x4> matrices(4096);
+	for (uint32_t i = 0; i < matrices.size(); i++) {
+		translations[i] = float3(u(rng), u(rng), u(rng)) * 100.f;
+		trsRotations[i] = normalize(quaternion(u(rng), u(rng), u(rng), u(rng)));
+		scales[i] = float3(u(rng), u(rng), u(rng)) + 1.5f;
+		matrices[i] = float4x4::TRS(translations[i], trsRotations[i], scales[i]);
+	}
+	bench.Run("float4x4 inverse", (uint32_t)matrices.size(), [&]() {
+		float s = 0;
+		for (const float4x4& m : matrices) s += inverse(m)[3].x;
+		Consume(s);
+	});
+	bench.Run("float4x4::InverseTRS", (uint32_t)matrices.size(), [&]() {
+		float s = 0;
+		for (uint32_t i = 0; i < matrices.size(); i++) s += float4x4::InverseTRS(translations[i], trsRotations[i], scales[i])[3].x;
+		Consume(s);
+	});
+	{
+		// Largest difference from the general inverse, relative to the matrix's largest element
+		double error = 0;
+		for (uint32_t i = 0; i < matrices.size(); i++) {
+			float4x4 a = inverse(matrices[i]);
+			float4x4 b = float4x4::InverseTRS(translations[i], trsRotations[i], scales[i]);
+			double scale = 0, e = 0;
+			for (uint32_t c = 0; c < 4; c++)
+				for (uint32_t r = 0; r < 4; r++) {
+					scale = max(scale, (double)fabsf(a[c][r]));
+					e = max(e, (double)fabsf(a[c][r] - b[c][r]));
+				}
+			error = max(error, e / scale);
+		}
+		bench.Check("float4x4::InverseTRS precision", error, 1e-5);
+	}
+	bench.Run("float4x4 multiply", (uint32_t)matrices.size(), [&]() {
+		float4x4 r(1.f);
+		for (const float4x4& m : matrices) r = r * m;
+		Consume(r[3].x);
+	});
+	bench.Run("float4x4 transform float4", (uint32_t)matrices.size(), [&]() {
+		float4 r(1.f);
+		for (const float4x4& m : matrices) r = normalize(m * r);
+		Consume(r.x);
+	});
+
+	vector<quaternion> rotations(4096);
+	for (quaternion& q : rotations) q = normalize(quaternion(u(rng), u(rng), u(rng), u(rng)));
+	bench.Run("quaternion multiply", (uint32_t)rotations.size(), [&]() {
+		quaternion r;
+		for (const quaternion& q : rotations) r = normalize(r * q);
+		Consume(r.x);
+	});
+	bench.Run("quaternion slerp", (uint32_t)rotations.size() - 1, [&]() {
+		float s = 0;
+		for (uint32_t i = 0; i + 1 < rotations.size(); i++) s += slerp(rotations[i], rotations[i + 1], .3f).w;
+		Consume(s);
+	});
+}
+
+void BenchTransforms(Bench& bench, mt19937& rng) {
+	// Two identical forests of 64 rigs, one updated per object and one by a TransformHierarchy
+	const uint32_t rigCount = 64, boneCount = 256;
+	vector<Object*> objects, nodes;
+	for (uint32_t r = 0; r < rigCount; r++)
+		for (uint32_t b = 0; b < boneCount; b++) {
+			objects.push_back(new Object("Bone"));
+			nodes.push_back(new Object("Bone"));
+			if (b) {
+				uint32_t parent = r * boneCount + (b - 1) / 2;
+				objects[parent]->AddChild(objects.back());
+				nodes[parent]->AddChild(nodes.back());
+			}
+		}
+	TransformHierarchy hierarchy;
+	for (Object* o : nodes) hierarchy.Add(o);
+	JobSystem jobSystem;
+
+	uniform_real_distribution<float> u(-1.f, 1.f);
+	vector<quaternion> rotations(objects.size());
+	for (quaternion& q : rotations) q = normalize(quaternion(u(rng), u(rng), u(rng), u(rng)));
+
+	// Every bone of every rig moves, as in an animated crowd
+	bench.Run("Object transforms animate", (uint32_t)objects.size(), [&]() {
+		for (uint32_t i = 0; i < objects.size(); i++) objects[i]->LocalRotation(rotations[i]);
+		Object::UpdateTransforms(objects.data(), (uint32_t)objects.size());
+	});
+	bench.Run("TransformHierarchy animate", (uint32_t)nodes.size(), [&]() {
+		for (uint32_t i = 0; i < nodes.size(); i++) nodes[i]->LocalRotation(rotations[i]);
+		hierarchy.Update(nullptr);
+	});
+	bench.Run("TransformHierarchy animate parallel", (uint32_t)nodes.size(), [&]() {
+		for (uint32_t i = 0; i < nodes.size(); i++) nodes[i]->LocalRotation(rotations[i]);
+		hierarchy.Update(&jobSystem);
+	});
+	// Only the roots move, the rest follow
+	bench.Run("Object transforms move roots", rigCount, [&]() {
+		for (uint32_t r = 0; r < rigCount; r++) objects[r * boneCount]->LocalRotation(rotations[r]);
+		Object::UpdateTransforms(objects.data(), (uint32_t)objects.size());
+	});
+	bench.Run("TransformHierarchy move roots", rigCount, [&]() {
+		for (uint32_t r = 0; r < rigCount; r++) nodes[r * boneCount]->LocalRotation(rotations[r]);
+		hierarchy.Update(&jobSystem);
+	});
+
+	{
+		double error = 0;
+		for (uint32_t i = 0; i < objects.size(); i++) {
+			float4x4 a = objects[i]->ObjectToWorld();
+			float4x4 b = nodes[i]->ObjectToWorld();
+			for (uint32_t c = 0; c < 4; c++)
+				for (uint32_t r = 0; r < 4; r++)
+					error = max(error, (double)fabsf(a[c][r] - b[c][r]));
+		}
+		bench.Check("TransformHierarchy matches Object", error, 1e-4);
+	}
+
+	for (Object* o : objects) delete o;
+	for (Object* o : nodes) delete o;
+}
+
+void BenchRenderSort(Bench& bench, mt19937& rng) {
+	uniform_int_distribution<uint32_t> material(1, 64);
+	uniform_int_distribution<uint32_t> mesh(1, 32);
+	for (uint32_t count : { 1000u, 10000u, 50000u }) {
+		vector<AABB> boxes = RandomBoxes(rng, count, 500.f, 4.f);
+		vector<Object*> renderers(count);
+		for (uint32_t i = 0; i < count; i++)
+			renderers[i] = new BenchRenderer(boxes[i], rng() % 4 ? 1000 : 3000, material(rng), mesh(rng));
+		vector<Object*> list;
+		auto reset = [&]() { list = renderers; };
+
+		// The comparator Scene::Render used before sort keys
+		bench.Run("Render list std::sort " + to_string(count), count, [&]() {
+			sort(list.begin(), list.end(), [](Object* oa, Object* ob) {
+				Renderer* a = dynamic_cast<Renderer*>(oa);
+				Renderer* b = dynamic_cast<Renderer*>(ob);
+				uint32_t qa = a->Visible() ? a->RenderQueue() : 0xFFFFFFFF;
+				uint32_t qb = b->Visible() ? b->RenderQueue() : 0xFFFFFFFF;
+				if (qa == qb && qa != 0xFFFFFFFF) {
+					BenchRenderer* ma = dynamic_cast<BenchRenderer*>(a);
+					BenchRenderer* mb = dynamic_cast<BenchRenderer*>(b);
+					if (ma && mb)
+						if (ma->mMaterial == mb->mMaterial)
+							return ma->mMesh < mb->mMesh;
+						else
+							return ma->mMaterial < mb->mMaterial;
+				}
+				return qa < qb;
+			});
+			Consume((uint64_t)(size_t)list[0]);
+		}, reset);
+
+		vector<pair<uint64_t, Object*>> entries(count), scratch(count);
+		bench.Run("Render list radix sort " + to_string(count), count, [&]() {
+			for (uint32_t i = 0; i < count; i++)
+				entries[i] = make_pair(dynamic_cast<Renderer*>(list[i])->SortKey(float3(0)), list[i]);
+			RadixSort(entries.data(), scratch.data(), entries.size(), [](const pair<uint64_t, Object*>& e) { return e.first; });
+			for (uint32_t i = 0; i < count; i++)
+				list[i] = entries[i].second;
+			Consume((uint64_t)(size_t)list[0]);
+		}, reset);
+
+		for (Object* o : renderers) delete o;
+	}
+
+	if (bench.Enabled("Render sort keys")) {
+		BenchExpectations e;
+		// Opaque renderers sort front to back within a batch, transparent ones back to front regardless of their batch
+		vector<unique_ptr<BenchRenderer>> opaque, transparent;
+		for (uint32_t i = 0; i < 16; i++) {
+			AABB box(float3(0, 0, 1.f + i * 3.f), float3(1, 1, 2.f + i * 3.f));
+			opaque.emplace_back(make_unique<BenchRenderer>(box, 1000, 1, 1));
+			transparent.emplace_back(make_unique<BenchRenderer>(box, RENDER_QUEUE_TRANSPARENT, 1 + i % 3, 1 + i % 2));
+		}
+		for (uint32_t i = 0; i + 1 < 16; i++) {
+			BENCH_EXPECT(e, opaque[i]->SortKey(float3(0)) < opaque[i + 1]->SortKey(float3(0)));
+			BENCH_EXPECT(e, transparent[i]->SortKey(float3(0)) > transparent[i + 1]->SortKey(float3(0)));
+		}
+		BENCH_EXPECT(e, opaque.back()->SortKey(float3(0)) < transparent.back()->SortKey(float3(0)));
+
+		// Released sort ids are handed out again, so ids packed into 16 bits stay unique while fewer than 65536 objects are alive
+		IdPool ids;
+		vector<uint32_t> live;
+		for (uint32_t i = 0; i < 70500; i++) {
+			live.push_back(ids.Acquire());
+			if (live.size() == 1000) {
+				for (uint32_t id : live) ids.Release(id);
+				live.clear();
+			}
+		}
+		uint32_t maxId = 0;
+		for (uint32_t id : live) maxId = max(maxId, id);
+		BENCH_EXPECT(e, maxId <= 1000);
+		sort(live.begin(), live.end());
+		BENCH_EXPECT(e, unique(live.begin(), live.end()) == live.end());
+		bench.Check("Render sort keys", e);
+	}
+}
+
+void BenchAnimation(Bench& bench, mt19937& rng) {
+	uniform_real_distribution<float> u(-1.f, 1.f);
+	vector<AnimationKeyframe> keyframes(64);
+	for (uint32_t i = 0; i < keyframes.size(); i++) {
+		keyframes[i].mTime = i * .25f;
+		keyframes[i].mValue = u(rng);
+		keyframes[i].mTangentIn = keyframes[i].mTangentOut = 0;
+		keyframes[i].mTangentModeIn = keyframes[i].mTangentModeOut = ANIMATION_TANGENT_SMOOTH;
+	}
+	AnimationChannel channel(keyframes, EXTRAPOLATE_CYCLE, EXTRAPOLATE_CYCLE);
+
+	vector<float> times(100000);
+	uniform_real_distribution<float> t(-4.f, keyframes.back().mTime + 4.f);
+	for (float& f : times) f = t(rng);
+	bench.Run("AnimationChannel::Sample", (uint32_t)times.size(), [&]() {
+		float s = 0;
+		for (float f : times) s += channel.Sample(f);
+		Consume(s);
+	});
+}
+
+void BenchTokenizer(Bench& bench, mt19937& rng) {
+	uniform_real_distribution<float> u(-1000.f, 1000.f);
+	string text;
+	for (uint32_t i = 0; i < 100000; i++)
+		text += to_string(u(rng)) + ((i % 3) == 2 ? "\n" : " ");
+
+	bench.Run("Tokenizer floats", 100000, [&]() {
+		Tokenizer tokenizer(text, { ' ', '\n' });
+		float f, s = 0;
+		while (tokenizer.Next(f)) s += f;
+		Consume(s);
+	});
+	bench.Run("Tokenizer strings", 100000, [&]() {
+		Tokenizer tokenizer(text, { ' ', '\n' });
+		string token;
+		uint64_t n = 0;
+		while (tokenizer.Next(token)) n += token.size();
+		Consume(n);
+	});
+}
+
+void BenchAllocator(Bench& bench, mt19937& rng) {
+	// A fixed sequence of allocations and frees, replayed by every sample
+	const uint32_t operationCount = 20000;
+	uniform_int_distribution<uint32_t> size(256, 256 * 1024);
+	uniform_int_distribution<uint32_t> coin(0, 2);
+	vector<pair<uint32_t, uint32_t>> operations; // size (0 to free), index of the allocation to free
+	uint32_t live = 0;
+	for (uint32_t i = 0; i < operationCount; i++) {
+		if (live && coin(rng) == 0) {
+			operations.push_back(make_pair(0u, uniform_int_distribution<uint32_t>(0, live - 1)(rng)));
+			live--;
+		} else {
+			operations.push_back(make_pair(size(rng), 0u));
+			live++;
+		}
+	}
+
+	TlsfAllocator* allocator = nullptr;
+	vector<uint32_t> blocks;
+	auto setup = [&]() {
+		safe_delete(allocator);
+		allocator = new TlsfAllocator(4ull * 1024 * 1024 * 1024);
+		blocks.clear();
+		blocks.reserve(operationCount);
+	};
+	bench.Run("TlsfAllocator Allocate/Free", operationCount, [&]() {
+		for (const auto& op : operations) {
+			if (op.first) {
+				uint64_t offset;
+				uint32_t block;
+				if (allocator->Allocate(op.first, 256, offset, block)) blocks.push_back(block);
+			} else if (blocks.size()) {
+				uint32_t i = op.second % blocks.size();
+				allocator->Free(blocks[i]);
+				blocks[i] = blocks.back();
+				blocks.pop_back();
+			}
+		}
+		Consume(allocator->Used());
+	}, setup);
+	safe_delete(allocator);
+
+	if (bench.Enabled("TlsfAllocator ranges and coalescing")) {
+		// Random allocations and frees with random alignments, checking the live ranges as they go
+		BenchExpectations e;
+		// Its own generator, so filtering this check out doesn't change the inputs of later benchmarks
+		mt19937 random(0x7157u);
+		const uint64_t capacity = 64ull * 1024 * 1024;
+		TlsfAllocator tlsf(capacity);
+		struct Range { uint64_t mOffset; uint64_t mSize; uint64_t mAlignment; uint32_t mBlock; };
+		vector<Range> live;
+		uniform_int_distribution<uint32_t> rangeSize(1, 64 * 1024);
+		uniform_int_distribution<uint32_t> alignmentLog2(0, 12);
+		for (uint32_t i = 0; i < 20000; i++) {
+			if (live.size() && coin(random) == 0) {
+				uint32_t j = uniform_int_distribution<uint32_t>(0, (uint32_t)live.size() - 1)(random);
+				tlsf.Free(live[j].mBlock);
+				live[j] = live.back();
+				live.pop_back();
+			} else {
+				Range r = {};
+				r.mSize = rangeSize(random);
+				r.mAlignment = 1ull << alignmentLog2(random);
+				if (tlsf.Allocate(r.mSize, r.mAlignment, r.mOffset, r.mBlock)) live.push_back(r);
+			}
+			if (i % 1000 != 999) continue;
+			sort(live.begin(), live.end(), [](const Range& a, const Range& b) { return a.mOffset < b.mOffset; });
+			uint64_t liveSize = 0;
+			for (uint32_t j = 0; j < live.size(); j++) {
+				BENCH_EXPECT(e, live[j].mOffset % live[j].mAlignment == 0);
+				BENCH_EXPECT(e, live[j].mOffset + live[j].mSize <= capacity);
+				if (j + 1 < live.size()) BENCH_EXPECT(e, live[j].mOffset + live[j].mSize <= live[j + 1].mOffset);
+				liveSize += live[j].mSize;
+			}
+			BENCH_EXPECT(e, tlsf.AllocationCount() == live.size());
+			BENCH_EXPECT(e, tlsf.Used() >= liveSize && tlsf.Used() <= capacity);
+		}
+		uint64_t offset;
+		uint32_t block;
+		BENCH_EXPECT(e, !tlsf.Allocate(capacity + 1, 1, offset, block));
+
+		// Freeing everything merges the free space back into one block
+		shuffle(live.begin(), live.end(), random);
+		for (const Range& r : live) tlsf.Free(r.mBlock);
+		TlsfStats stats = tlsf.Stats();
+		BENCH_EXPECT(e, tlsf.Empty() && tlsf.Used() == 0);
+		BENCH_EXPECT(e, stats.mFreeBlockCount == 1);
+		BENCH_EXPECT(e, stats.mLargestFreeBlock == capacity);
+		BENCH_EXPECT(e, tlsf.Allocate(capacity, 1, offset, block) && offset == 0);
+		bench.Check("TlsfAllocator ranges and coalescing", e);
+	}
+
+	// Per-frame memory: every thread bumps the same allocator, which is reset once per frame
+	vector<uint32_t> sizes(operationCount);
+	uniform_int_distribution<uint32_t> frameSize(64, 4096);
+	for (uint32_t& s : sizes) s = frameSize(rng);
+	const uint64_t alignment = 256;
+	LinearAllocator frameAllocator(64ull * 1024 * 1024);
+	vector<uint64_t> offsets(operationCount);
+	JobSystem jobSystem;
+	bench.Run("LinearAllocator Allocate", operationCount, [&]() {
+		for (uint32_t i = 0; i < operationCount; i++)
+			frameAllocator.Allocate(sizes[i], alignment, offsets[i]);
+		Consume(frameAllocator.Used());
+	}, [&]() { frameAllocator.Reset(); });
+	bench.Run("LinearAllocator Allocate parallel", operationCount, [&]() {
+		jobSystem.ParallelFor(operationCount, [&](uint32_t i) {
+			frameAllocator.Allocate(sizes[i], alignment, offsets[i]);
+		}, 256);
+		Consume(frameAllocator.Used());
+	}, [&]() { frameAllocator.Reset(); });
+
+	if (bench.Enabled("LinearAllocator allocations are disjoint")) {
+		// Parallel allocations of its own, so the check doesn't depend on a benchmark that --filter may skip
+		BenchExpectations e;
+		frameAllocator.Reset();
+		vector<uint8_t> allocated(operationCount, 0);
+		jobSystem.ParallelFor(operationCount, [&](uint32_t i) {
+			allocated[i] = frameAllocator.Allocate(sizes[i], alignment, offsets[i]);
+		}, 256);
+		bool all = true;
+		for (uint8_t a : allocated) all = all && a;
+		BENCH_EXPECT(e, all);
+
+		// The parallel allocations must be aligned, in bounds and disjoint
+		vector<uint32_t> order(operationCount);
+		for (uint32_t i = 0; i < operationCount; i++) order[i] = i;
+		sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return offsets[a] < offsets[b]; });
+		for (uint32_t i = 0; i < operationCount; i++) {
+			uint32_t a = order[i];
+			BENCH_EXPECT(e, offsets[a] % alignment == 0);
+			BENCH_EXPECT(e, offsets[a] + sizes[a] <= frameAllocator.Used());
+			if (i + 1 < operationCount) BENCH_EXPECT(e, offsets[a] + sizes[a] <= offsets[order[i + 1]]);
+		}
+		bench.Check("LinearAllocator allocations are disjoint", e);
+	}
+
+	if (bench.Enabled("LinearAllocator full and reset")) {
+		// A full allocator fails until it is reset
+		BenchExpectations e;
+		LinearAllocator small(1024);
+		uint64_t offset;
+		BENCH_EXPECT(e, small.Allocate(1000, 16, offset) && offset == 0);
+		BENCH_EXPECT(e, !small.Allocate(24, 16, offset));
+		BENCH_EXPECT(e, small.Allocate(24, 8, offset) && offset == 1000);
+		small.Reset();
+		BENCH_EXPECT(e, small.Allocate(1024, 16, offset) && offset == 0 && small.Used() == 1024);
+		bench.Check("LinearAllocator full and reset", e);
+	}
+}
+
+void BenchRingAllocator(Bench& bench, mt19937& rng) {
+	// Staging uploads: batches of allocations, each retired two batches later like a frame in flight
+	const uint32_t operationCount = 20000;
+	const uint32_t batchSize = 64;
+	const uint64_t ringSize = 64ull * 1024 * 1024;
+	uniform_int_distribution<uint32_t> size(256, 256 * 1024);
+	vector<uint32_t> sizes(operationCount);
+	for (uint32_t& s : sizes) s = size(rng);
+	vector<uint64_t> offsets(operationCount);
+
+	RingAllocator ring(ringSize);
+	bench.Run("RingAllocator Allocate/Retire", operationCount, [&]() {
+		uint64_t batch = 1;
+		for (uint32_t i = 0; i < operationCount; i++) {
+			// A full ring submits the open batch and waits for everything in flight
+			if (!ring.Allocate(sizes[i], 256, offsets[i])) {
+				ring.Close(batch++);
+				ring.Retire(batch - 1);
+				ring.Allocate(sizes[i], 256, offsets[i]);
+			}
+			if (i % batchSize == batchSize - 1) {
+				ring.Close(batch++);
+				if (batch > 3) ring.Retire(batch - 3);
+			}
+		}
+		Consume(ring.Used());
+	}, [&]() { ring.Reset(ringSize); });
+
+	if (bench.Enabled("RingAllocator allocations are disjoint")) {
+		// Allocations must be aligned, in bounds, and disjoint from every batch that hasn't been retired
+		BenchExpectations e;
+		// Its own generator, so filtering this check out doesn't change the inputs of later benchmarks
+		mt19937 random(0x5121u);
+		RingAllocator small(1000);
+		vector<pair<uint64_t, vector<pair<uint64_t, uint64_t>>>> live; // batch, offset and size of its allocations
+		vector<pair<uint64_t, uint64_t>> current;
+		uint64_t batch = 1;
+		uniform_int_distribution<uint32_t> op(0, 9);
+		for (uint32_t i = 0; i < operationCount; i++) {
+			uint32_t o = op(random);
+			if (o < 5) {
+				uint64_t s = 1 + random() % 300, alignment = 1ull << (random() % 5), offset;
+				if (!small.Allocate(s, alignment, offset)) continue;
+				BENCH_EXPECT(e, offset % alignment == 0);
+				BENCH_EXPECT(e, offset + s <= small.Size());
+				for (const auto& b : live)
+					for (const auto& a : b.second)
+						BENCH_EXPECT(e, offset >= a.first + a.second || a.first >= offset + s);
+				for (const auto& a : current)
+					BENCH_EXPECT(e, offset >= a.first + a.second || a.first >= offset + s);
+				current.push_back(make_pair(offset, s));
+			} else if (o < 7) {
+				small.Close(batch);
+				live.push_back(make_pair(batch++, current));
+				current.clear();
+			} else if (live.size()) {
+				uint64_t b = live.front().first;
+				small.Retire(b);
+				live.erase(live.begin());
+			}
+		}
+		// Retiring everything starts again at the beginning, and allocations never wrap around the end
+		small.Close(batch);
+		small.Retire(batch);
+		uint64_t offset;
+		BENCH_EXPECT(e, small.Empty());
+		BENCH_EXPECT(e, small.Allocate(600, 8, offset) && offset == 0);
+		small.Close(++batch);
+		BENCH_EXPECT(e, !small.Allocate(500, 8, offset));
+		small.Retire(batch);
+		BENCH_EXPECT(e, small.Allocate(500, 8, offset) && offset == 0);
+		bench.Check("RingAllocator allocations are disjoint", e);
+	}
+}
+
+void BenchDescriptorCache(Bench& bench, mt19937& rng) {
+	// Keys like the instance batches of a scene: fake layout, instance buffer range, light buffer and shadow atlas handles
+	const uint32_t keyCount = 4096;
+	uniform_int_distribution<uint32_t> layout(1, 8);
+	vector<DescriptorKey> keys;
+	for (uint32_t i = 0; i < keyCount; i++) {
+		DescriptorKey key(layout(rng));
+		key.AddBuffer(2, 0, 7, 0x1000, 1, i * 1024, 1024);
+		key.AddBuffer(3, 0, 7, 0x2000, 2, 0, 65536);
+		key.AddImage(4, 0, 2, 0x3000, 3, 0, 5);
+		keys.push_back(key);
+	}
+
+	DescriptorCache<uint32_t> cache(8, keyCount);
+	vector<uint32_t> evicted;
+	bench.Run("DescriptorCache Find", keyCount, [&]() {
+		uint64_t found = 0;
+		for (uint32_t i = 0; i < keyCount; i++)
+			if (uint32_t* v = cache.Find(keys[i])) found += *v;
+			else cache.Insert(keys[i], i);
+		cache.Advance(evicted);
+		Consume(found);
+	});
+
+	if (bench.Enabled("DescriptorCache hits and evictions")) {
+		BenchExpectations e;
+		DescriptorCache<uint32_t> c(2, 2);
+		evicted.clear();
+		DescriptorKey a(1), b(1), a2(1);
+		a.AddBuffer(0, 0, 7, 0x1000, 1, 0, 256);
+		b.AddBuffer(0, 0, 7, 0x1000, 1, 256, 256);
+		a2.AddBuffer(0, 0, 7, 0x1000, 1, 0, 256);
+		// Same handle, new resource
+		DescriptorKey reused(1);
+		reused.AddBuffer(0, 0, 7, 0x1000, 4, 0, 256);
+
+		BENCH_EXPECT(e, !c.Find(a));
+		c.Insert(a, 1);
+		BENCH_EXPECT(e, c.Find(a2) && *c.Find(a2) == 1);
+		BENCH_EXPECT(e, !c.Find(b));
+		BENCH_EXPECT(e, !c.Find(reused));
+		c.Insert(b, 2);
+		c.Insert(reused, 3);
+		// Over capacity, but every entry was used this frame
+		c.Advance(evicted);
+		BENCH_EXPECT(e, evicted.empty() && c.Size() == 3);
+		// The least recently used entry goes first when over capacity
+		c.Find(a);
+		c.Find(reused);
+		c.Advance(evicted);
+		BENCH_EXPECT(e, evicted.size() == 1 && evicted[0] == 2 && c.Size() == 2);
+		// Unused entries are evicted after maxAge frames
+		evicted.clear();
+		c.Advance(evicted);
+		c.Advance(evicted);
+		BENCH_EXPECT(e, evicted.size() == 2 && c.Size() == 0);
+		DescriptorCacheStats stats = c.Stats();
+		BENCH_EXPECT(e, stats.mEvictions == 3);
+		BENCH_EXPECT(e, stats.mHits == 4);
+		bench.Check("DescriptorCache hits and evictions", e);
+	}
+}
+
+void BenchPropertyHandles(Bench& bench, mt19937& rng) {
+	// A variant with the push constants and descriptors of a pbr shader, and a material setting most of them
+	const char* pushConstantNames[] = { "Color", "Roughness", "Metallic", "TextureST", "Emission", "BumpStrength", "Time", "LightCount", "ShadowTexelSize", "StereoEye", "StereoClipTransform", "AlphaCutoff" };
+	const char* descriptorNames[] = { "Camera", "Instances", "Lights", "Shadows", "ShadowAtlas", "MainTexture", "NormalTexture", "MaskTexture", "EnvironmentTexture", "Sampler" };
+	// Draws alternate between a few variants, each missing one of the push constants
+	vector<ShaderVariant> variants(4);
+	for (uint32_t v = 0; v < variants.size(); v++) {
+		uint32_t offset = 0;
+		for (uint32_t i = 0; i < 12; i++) {
+			if (i == v) continue;
+			variants[v].mPushConstants.emplace(pushConstantNames[i], VkPushConstantRange { VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, offset, 16 });
+			offset += 16;
+		}
+		for (uint32_t i = 0; i < 10; i++) {
+			VkDescriptorSetLayoutBinding b = {};
+			b.binding = i;
+			b.descriptorCount = 1;
+			variants[v].mDescriptorBindings.emplace(descriptorNames[i], make_pair(i < 4 ? (uint32_t)PER_CAMERA : (uint32_t)PER_MATERIAL, b));
+		}
+		variants[v].ResolveProperties();
+	}
+
+	uniform_real_distribution<float> value(0, 1);
+	unordered_map<string, MaterialParameter> stringParameters;
+	unordered_map<PropertyID, MaterialParameter> idParameters;
+	for (uint32_t i = 0; i < 8; i++) {
+		float4 v(value(rng), value(rng), value(rng), value(rng));
+		stringParameters.emplace(pushConstantNames[i], v);
+		idParameters.emplace(PropertyToID(pushConstantNames[i]), v);
+	}
+
+	const uint32_t draws = 1024;
+	// What Material::SetPushConstantParameters does for every draw
+	bench.Run("Material push constants by name", draws, [&]() {
+		uint64_t found = 0;
+		for (uint32_t i = 0; i < draws; i++) {
+			const ShaderVariant& variant = variants[i % variants.size()];
+			for (const auto& p : stringParameters) {
+				auto it = variant.mPushConstants.find(p.first);
+				if (it != variant.mPushConstants.end()) found += it->second.offset;
+			}
+		}
+		Consume(found);
+	});
+	bench.Run("Material push constants by PropertyID", draws, [&]() {
+		uint64_t found = 0;
+		for (uint32_t i = 0; i < draws; i++) {
+			const ShaderVariant& variant = variants[i % variants.size()];
+			for (const auto& p : idParameters)
+				if (const VkPushConstantRange* range = variant.PushConstantRange(p.first)) found += range->offset;
+		}
+		Consume(found);
+	});
+	bench.Run("Material::SetParameter by name", draws, [&]() {
+		for (uint32_t i = 0; i < draws; i++)
+			stringParameters[pushConstantNames[i % 8]] = (float)i;
+		Consume((uint64_t)stringParameters.size());
+	});
+	bench.Run("Material::SetParameter by PropertyID", draws, [&]() {
+		PropertyID ids[8];
+		for (uint32_t i = 0; i < 8; i++) ids[i] = PropertyToID(pushConstantNames[i]);
+		for (uint32_t i = 0; i < draws; i++)
+			idParameters[ids[i % 8]] = (float)i;
+		Consume((uint64_t)idParameters.size());
+	});
+	bench.Run("PropertyToID", draws, [&]() {
+		uint64_t ids = 0;
+		for (uint32_t i = 0; i < draws; i++)
+			ids += PropertyToID(pushConstantNames[i % 12]);
+		Consume(ids);
+	});
+
+	if (bench.Enabled("PropertyID tables match the named tables")) {
+		BenchExpectations e;
+		const ShaderVariant& variant = variants[0];
+		BENCH_EXPECT(e, variant.mPushConstantIDs.size() == variant.mPushConstants.size());
+		BENCH_EXPECT(e, variant.mDescriptorBindingIDs.size() == variant.mDescriptorBindings.size());
+		for (const auto& p : variant.mPushConstants) {
+			PropertyID id = PropertyToID(p.first);
+			const VkPushConstantRange* range = variant.PushConstantRange(id);
+			BENCH_EXPECT(e, PropertyToID(p.first) == id);
+			BENCH_EXPECT(e, PropertyName(id) == p.first);
+			BENCH_EXPECT(e, range && range->offset == p.second.offset);
+		}
+		for (const auto& b : variant.mDescriptorBindings) {
+			const auto* found = variant.DescriptorBinding(PropertyToID(b.first));
+			BENCH_EXPECT(e, found && found->first == b.second.first && found->second.binding == b.second.second.binding);
+		}
+		PropertyID unused = PropertyToID("StratumBench unused property");
+		BENCH_EXPECT(e, !variant.PushConstantRange(unused));
+		BENCH_EXPECT(e, !variant.DescriptorBinding(unused));
+		BENCH_EXPECT(e, unused < PropertyCount());
+		BENCH_EXPECT(e, PropertyToID("Color") != PropertyToID("Roughness"));
+		bench.Check("PropertyID tables match the named tables", e);
+	}
+}
+
+void BenchPipelineCache(Bench& bench, mt19937& rng) {
+	VkPhysicalDeviceProperties properties = {};
+	properties.vendorID = 0x10DE;
+	properties.deviceID = 0x1E87;
+	properties.driverVersion = 0x1B4A8000;
+	for (uint32_t i = 0; i < VK_UUID_SIZE; i++) properties.pipelineCacheUUID[i] = (uint8_t)(i * 37);
+	PipelineCacheHeader device = PipelineCacheFile::Header(properties);
+
+	uniform_int_distribution<uint32_t> byte(0, 255);
+	vector<uint8_t> data(1024 * 1024);
+	for (uint8_t& b : data) b = (uint8_t)byte(rng);
+	vector<uint8_t> file = PipelineCacheFile::Encode(device, data.data(), data.size());
+
+	bench.Run("PipelineCacheFile::Decode 1MB", 1, [&]() {
+		const uint8_t* cache;
+		size_t size;
+		if (PipelineCacheFile::Decode(device, file.data(), file.size(), cache, size)) Consume((uint64_t)size);
+	});
+
+	if (bench.Enabled("PipelineCacheFile rejects mismatched files")) {
+		BenchExpectations e;
+		const uint8_t* cache;
+		size_t size;
+		BENCH_EXPECT(e, PipelineCacheFile::Decode(device, file.data(), file.size(), cache, size) && size == data.size() && memcmp(cache, data.data(), size) == 0);
+
+		vector<uint8_t> corrupted = file;
+		corrupted[sizeof(PipelineCacheHeader) + 1000] ^= 1;
+		BENCH_EXPECT(e, !PipelineCacheFile::Decode(device, corrupted.data(), corrupted.size(), cache, size));
+		BENCH_EXPECT(e, !PipelineCacheFile::Decode(device, file.data(), file.size() - 1, cache, size));
+		BENCH_EXPECT(e, !PipelineCacheFile::Decode(device, file.data(), sizeof(PipelineCacheHeader) - 1, cache, size));
+
+		PipelineCacheHeader otherDevice = device;
+		otherDevice.mDeviceID++;
+		BENCH_EXPECT(e, !PipelineCacheFile::Decode(otherDevice, file.data(), file.size(), cache, size));
+		PipelineCacheHeader otherDriver = device;
+		otherDriver.mDriverVersion++;
+		BENCH_EXPECT(e, !PipelineCacheFile::Decode(otherDriver, file.data(), file.size(), cache, size));
+		PipelineCacheHeader otherUUID = device;
+		otherUUID.mPipelineCacheUUID[VK_UUID_SIZE - 1] ^= 1;
+		BENCH_EXPECT(e, !PipelineCacheFile::Decode(otherUUID, file.data(), file.size(), cache, size));
+
+		string filename = (fs::temp_directory_path() / "StratumBench.cache").string();
+		vector<uint8_t> read;
+		BENCH_EXPECT(e, PipelineCacheFile::Write(filename, device, data.data(), data.size()));
+		BENCH_EXPECT(e, !fs::exists(filename + ".tmp"));
+		BENCH_EXPECT(e, PipelineCacheFile::Read(filename, device, read) && read == data);
+		BENCH_EXPECT(e, !PipelineCacheFile::Read(filename, otherDevice, read) && read.empty());
+		// Writing again replaces the old file
+		BENCH_EXPECT(e, PipelineCacheFile::Write(filename, device, data.data(), data.size() / 2));
+		BENCH_EXPECT(e, PipelineCacheFile::Read(filename, device, read) && read.size() == data.size() / 2);
+		fs::remove(filename);
+		bench.Check("PipelineCacheFile rejects mismatched files", e);
+	}
+
+	if (bench.Enabled("PipelineKey round trip")) {
+		BenchExpectations e;
+		PipelineKey key = {};
+		key.mShader = "Shaders/pbr.stm";
+		key.mPass = 1;
+		key.mKeywords = "ENABLE_SCATTERING NORMAL_MAP ";
+		key.mRenderPass = 0xF00DCAFE12345678ull;
+		key.mBindings = { { 0, 48, VK_VERTEX_INPUT_RATE_VERTEX } };
+		key.mAttributes = { { 0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0 }, { 1, 0, VK_FORMAT_R32G32B32_SFLOAT, 12 }, { 2, 0, VK_FORMAT_R32G32B32A32_SFLOAT, 24 } };
+		key.mTopology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+		key.mCullMode = VK_CULL_MODE_FLAG_BITS_MAX_ENUM;
+		key.mBlendMode = BLEND_MODE_MAX_ENUM;
+		key.mPolygonMode = VK_POLYGON_MODE_MAX_ENUM;
+		PipelineKey noInput = key;
+		noInput.mKeywords = "";
+		noInput.mBindings.clear();
+		noInput.mAttributes.clear();
+
+		string filename = (fs::temp_directory_path() / "StratumBench.keys").string();
+		vector<PipelineKey> keys;
+		BENCH_EXPECT(e, PipelineCacheFile::WriteKeys(filename, { key, noInput }));
+		BENCH_EXPECT(e, PipelineCacheFile::ReadKeys(filename, keys) && keys.size() == 2);
+		if (keys.size() == 2) {
+			BENCH_EXPECT(e, keys[0].Serialize() == key.Serialize());
+			BENCH_EXPECT(e, keys[1].Serialize() == noInput.Serialize());
+			BENCH_EXPECT(e, keys[0].mRenderPass == key.mRenderPass && keys[0].mCullMode == key.mCullMode);
+			BENCH_EXPECT(e, keys[0].mAttributes.size() == 3 && keys[0].mAttributes[2].offset == 24);
+			BENCH_EXPECT(e, keys[1].mKeywords.empty() && keys[1].mBindings.empty());
+		}
+		fs::remove(filename);
+		PipelineKey parsed;
+		BENCH_EXPECT(e, !PipelineKey::Parse("Shaders/pbr.stm|1|", parsed));
+		BENCH_EXPECT(e, !PipelineKey::Parse("Shaders/pbr.stm|x|||0 0 0 0||", parsed));
+		bench.Check("PipelineKey round trip", e);
+	}
+}
+
+void BenchShaderFile(Bench& bench, mt19937& rng) {
+	// A shader with a large multi_compile matrix: every combination of 8 keywords in two passes, plus a few compute kernels
+	const uint32_t keywordCount = 8;
+	const uint32_t moduleCount = 64;
+	CompiledShader shader;
+	shader.mRenderQueue = 1000;
+	shader.mColorMask = 0xF;
+	shader.mCullMode = VK_CULL_MODE_BACK_BIT;
+	shader.mFillMode = VK_POLYGON_MODE_FILL;
+	shader.mBlendMode = BLEND_MODE_OPAQUE;
+	shader.mDepthStencilState = {};
+
+	uniform_int_distribution<uint32_t> word;
+	shader.mModules.resize(moduleCount);
+	for (SpirvModule& m : shader.mModules) {
+		m.mSpirv.resize(512);
+		for (uint32_t& w : m.mSpirv) w = word(rng);
+	}
+	auto keywords = [&](uint32_t mask) {
+		vector<string> kw;
+		for (uint32_t k = 0; k < keywordCount; k++)
+			if (mask & (1 << k)) kw.push_back("KEYWORD_" + to_string(k));
+		return kw;
+	};
+	for (PassType pass : { PASS_MAIN, PASS_DEPTH })
+		for (uint32_t mask = 0; mask < (1u << keywordCount); mask++) {
+			CompiledVariant v;
+			v.mPass = pass;
+			v.mEntryPoints[0] = "vsmain";
+			v.mEntryPoints[1] = "fsmain";
+			v.mModules[0] = (mask * 2) % moduleCount;
+			v.mModules[1] = (mask * 2 + 1) % moduleCount;
+			v.mKeywords = keywords(mask);
+			v.mPushConstants.emplace("Mask", VkPushConstantRange { VK_SHADER_STAGE_VERTEX_BIT, 0, mask });
+			shader.mVariants.push_back(v);
+		}
+	for (uint32_t k = 0; k < 4; k++) {
+		CompiledVariant v;
+		v.mPass = (PassType)0;
+		v.mEntryPoints[0] = "Kernel" + to_string(k);
+		v.mModules[0] = k;
+		v.mModules[1] = 0;
+		v.mWorkgroupSize = uint3(64, 1, 1);
+		shader.mVariants.push_back(v);
+	}
+
+	vector<uint8_t> data;
+	shader.Write(data);
+
+	bench.Run("ShaderFile::Open 516 variants", 1, [&]() {
+		ShaderFile file;
+		if (file.Open(data.data(), data.size())) Consume((uint64_t)file.VariantCount());
+	});
+
+	ShaderFile file;
+	file.Open(data.data(), data.size());
+	const uint32_t lookups = 1024;
+	uniform_int_distribution<uint32_t> mask(0, (1u << keywordCount) - 1);
+	vector<uint64_t> lookupKeywords(lookups);
+	for (uint64_t& kw : lookupKeywords) {
+		vector<string> k = keywords(mask(rng));
+		kw = file.KeywordMask(set<string>(k.begin(), k.end()));
+	}
+	bench.Run("ShaderFile::FindVariant", lookups, [&]() {
+		uint64_t found = 0;
+		CompiledVariant v;
+		for (uint32_t i = 0; i < lookups; i++)
+			if (file.FindVariant(PASS_MAIN, "", lookupKeywords[i], v)) found += v.mModules[0];
+		Consume(found);
+	});
+
+	if (bench.Enabled("ShaderFile lookups match the compiled variants")) {
+		BenchExpectations e;
+		BENCH_EXPECT(e, file.Valid());
+		BENCH_EXPECT(e, file.VariantCount() == shader.mVariants.size() && file.ModuleCount() == moduleCount && file.Keywords().size() == keywordCount);
+		BENCH_EXPECT(e, file.PassMask() == (PASS_MAIN | PASS_DEPTH));
+		BENCH_EXPECT(e, file.Header().mRenderQueue == 1000 && file.Header().mCullMode == VK_CULL_MODE_BACK_BIT);
+		for (const CompiledVariant& expected : shader.mVariants) {
+			CompiledVariant v;
+			uint64_t expectedMask = file.KeywordMask(set<string>(expected.mKeywords.begin(), expected.mKeywords.end()));
+			bool found = file.FindVariant(expected.mPass, expected.mPass ? "" : expected.mEntryPoints[0], expectedMask, v);
+			BENCH_EXPECT(e, found);
+			if (!found) continue;
+			BENCH_EXPECT(e, v.mModules[0] == expected.mModules[0] && v.mEntryPoints[0] == expected.mEntryPoints[0]);
+			BENCH_EXPECT(e, v.KeywordString() == expected.KeywordString());
+			BENCH_EXPECT(e, v.mPushConstants.size() == expected.mPushConstants.size());
+			if (v.mPushConstants.size() && expected.mPushConstants.size())
+				BENCH_EXPECT(e, v.mPushConstants.at("Mask").size == expected.mPushConstants.at("Mask").size);
+		}
+		for (uint32_t m = 0; m < moduleCount; m++) {
+			BENCH_EXPECT(e, file.ModuleSize(m) == shader.mModules[m].mSpirv.size());
+			BENCH_EXPECT(e, memcmp(file.ModuleCode(m), shader.mModules[m].mSpirv.data(), min<size_t>(file.ModuleSize(m), shader.mModules[m].mSpirv.size()) * sizeof(uint32_t)) == 0);
+		}
+
+		CompiledVariant v;
+		BENCH_EXPECT(e, !file.KeywordBit("UNKNOWN"));
+		BENCH_EXPECT(e, file.KeywordMask({ "UNKNOWN", "KEYWORD_1" }) == file.KeywordBit("KEYWORD_1"));
+		BENCH_EXPECT(e, !file.FindVariant(PASS_MAIN, "", 1ull << 40, v));
+		BENCH_EXPECT(e, file.ParseKeywords("KEYWORD_1 KEYWORD_0 ") == file.KeywordMask({ "KEYWORD_0", "KEYWORD_1" }));
+		BENCH_EXPECT(e, !file.FindVariant((PassType)0, "Kernel9", 0, v));
+		BENCH_EXPECT(e, file.FindVariant((PassType)0, "Kernel2", 0, v) && v.mModules[0] == 2);
+
+		ShaderFile invalid;
+		BENCH_EXPECT(e, !invalid.Open(data.data(), data.size() - 1));
+		vector<uint8_t> corrupted = data;
+		corrupted[0] ^= 1;
+		BENCH_EXPECT(e, !invalid.Open(corrupted.data(), corrupted.size()));
+
+		string filename = (fs::temp_directory_path() / "StratumBench.stm").string();
+		{
+			ofstream f(filename, ios::binary);
+			shader.Write(f);
+		}
+		{
+			ShaderFile mapped;
+			BENCH_EXPECT(e, mapped.Open(filename) && mapped.FindVariant(PASS_DEPTH, "", lookupKeywords[0], v));
+		}
+		fs::remove(filename);
+		bench.Check("ShaderFile lookups match the compiled variants", e);
+	}
+}
+
+void BenchVariantResolution(Bench& bench, mt19937& rng) {
+	// multi_compile groups like a material shader's: each group picks one of its keywords or none
+	const uint32_t groupCount = 6;
+	const uint32_t groupSize = 3;
+	const uint32_t variantCount = 4096; // (groupSize + 1) ^ groupCount
+	auto keywords = [&](uint32_t index) {
+		set<string> kw;
+		for (uint32_t g = 0; g < groupCount; g++, index /= groupSize + 1)
+			if (index % (groupSize + 1))
+				kw.insert("GROUP" + to_string(g) + "_KEYWORD" + to_string(index % (groupSize + 1) - 1));
+		return kw;
+	};
+
+	CompiledShader shader;
+	shader.mRenderQueue = 1000;
+	shader.mColorMask = 0xF;
+	shader.mCullMode = VK_CULL_MODE_BACK_BIT;
+	shader.mFillMode = VK_POLYGON_MODE_FILL;
+	shader.mBlendMode = BLEND_MODE_OPAQUE;
+	shader.mDepthStencilState = {};
+	shader.mModules.resize(2);
+	for (SpirvModule& m : shader.mModules) m.mSpirv.resize(16);
+	for (uint32_t i = 0; i < variantCount; i++) {
+		CompiledVariant v;
+		v.mPass = PASS_MAIN;
+		v.mEntryPoints[0] = "vsmain";
+		v.mEntryPoints[1] = "fsmain";
+		v.mModules[0] = 0;
+		v.mModules[1] = 1;
+		set<string> kw = keywords(i);
+		v.mKeywords.assign(kw.begin(), kw.end());
+		shader.mVariants.push_back(v);
+	}
+	vector<uint8_t> data;
+	shader.Write(data);
+	ShaderFile file;
+	file.Open(data.data(), data.size());
+
+	// The variant caches of Shader, keyed by keyword string before keyword masks, and by mask now
+	unordered_map<string, uint32_t> stringCache;
+	unordered_map<uint64_t, uint32_t> maskCache;
+	for (uint32_t i = 0; i < variantCount; i++) {
+		stringCache.emplace(StmKeywordString(keywords(i)), i);
+		maskCache.emplace(file.KeywordMask(keywords(i)), i);
+	}
+
+	const uint32_t lookups = 1024;
+	uniform_int_distribution<uint32_t> variant(0, variantCount - 1);
+	vector<set<string>> lookupKeywords(lookups);
+	vector<uint64_t> lookupMasks(lookups);
+	for (uint32_t i = 0; i < lookups; i++) {
+		lookupKeywords[i] = keywords(variant(rng));
+		lookupMasks[i] = file.KeywordMask(lookupKeywords[i]);
+	}
+
+	bench.Run("Variant resolution, keyword strings", lookups, [&]() {
+		uint64_t found = 0;
+		for (uint32_t i = 0; i < lookups; i++)
+			found += stringCache.at(StmKeywordString(lookupKeywords[i]));
+		Consume(found);
+	});
+	bench.Run("Variant resolution, keyword set to mask", lookups, [&]() {
+		uint64_t found = 0;
+		for (uint32_t i = 0; i < lookups; i++)
+			found += maskCache.at(file.KeywordMask(lookupKeywords[i]));
+		Consume(found);
+	});
+	// Materials keep the mask of their keywords, so drawing only does this
+	bench.Run("Variant resolution, keyword mask", lookups, [&]() {
+		uint64_t found = 0;
+		for (uint32_t i = 0; i < lookups; i++)
+			found += maskCache.at(lookupMasks[i]);
+		Consume(found);
+	});
+
+	if (bench.Enabled("Keyword masks resolve every variant")) {
+		BenchExpectations e;
+		BENCH_EXPECT(e, file.Keywords().size() == groupCount * groupSize);
+		BENCH_EXPECT(e, maskCache.size() == variantCount);
+		for (uint32_t i = 0; i < variantCount; i++) {
+			set<string> kw = keywords(i);
+			uint64_t mask = file.KeywordMask(kw);
+			CompiledVariant v;
+			BENCH_EXPECT(e, file.FindVariant(PASS_MAIN, "", mask, v) && v.mKeywords == vector<string>(kw.begin(), kw.end()));
+			// GraphicsShader::mKeywords, printed and recorded in PipelineKeys, is the keyword string of the variant's mask
+			BENCH_EXPECT(e, file.KeywordString(mask) == StmKeywordString(kw));
+			BENCH_EXPECT(e, file.ParseKeywords(StmKeywordString(kw)) == mask);
+		}
+		bench.Check("Keyword masks resolve every variant", e);
+	}
+}
+
+void BenchTextureCompression(Bench& bench, mt19937& rng) {
+	// A 512x512 image like a material texture: smooth gradients, hard edges and some noise, with an alpha mask
+	const uint32_t size = 512;
+	uniform_int_distribution<int> noise(-6, 6);
+	vector<uint8_t> image((size_t)size * size * 4);
+	for (uint32_t y = 0; y < size; y++)
+		for (uint32_t x = 0; x < size; x++) {
+			uint8_t* p = image.data() + 4 * ((size_t)y * size + x);
+			bool tile = ((x / 24) + (y / 24)) & 1;
+			p[0] = (uint8_t)clamp((int)(x * 255 / size) + noise(rng), 0, 255);
+			p[1] = (uint8_t)clamp((int)(128 + 100 * sinf(y * .03f)) + noise(rng), 0, 255);
+			p[2] = (uint8_t)clamp((tile ? 200 : 60) + noise(rng), 0, 255);
+			p[3] = (uint8_t)((x - size / 2) * (x - size / 2) + (y - size / 2) * (y - size / 2) < size * size / 8 ? 255 : 40);
+		}
+
+	struct FormatCheck { VkFormat mFormat; const char* mName; uint32_t mChannels; double mTolerance; };
+	const FormatCheck formats[] {
+		{ VK_FORMAT_BC1_RGB_UNORM_BLOCK, "BC1", 3, 5 },
+		{ VK_FORMAT_BC3_UNORM_BLOCK, "BC3", 4, 5 },
+		{ VK_FORMAT_BC4_UNORM_BLOCK, "BC4", 1, 2 },
+		{ VK_FORMAT_BC5_UNORM_BLOCK, "BC5", 2, 2 },
+		{ VK_FORMAT_BC7_UNORM_BLOCK, "BC7", 4, 4 },
+	};
+	vector<uint8_t> blocks, decoded(image.size());
+	for (const FormatCheck& f : formats) {
+		blocks.resize(BlockCompression::ImageSize(f.mFormat, size, size));
+		BlockCompression::Encode(f.mFormat, image.data(), size, size, blocks.data());
+		double error = BlockCompression::Decode(f.mFormat, blocks.data(), size, size, decoded.data()) ?
+			BlockCompression::RmsError(image.data(), decoded.data(), (size_t)size * size, f.mChannels) : 255;
+		bench.Check(string(f.mName) + " round trip RMS error", error, f.mTolerance);
+	}
+
+	JobSystem jobSystem;
+	blocks.resize(BlockCompression::ImageSize(VK_FORMAT_BC7_UNORM_BLOCK, size, size));
+	bench.Run("BlockCompression BC1 512x512", size * size / 16, [&]() {
+		BlockCompression::Encode(VK_FORMAT_BC1_RGB_UNORM_BLOCK, image.data(), size, size, blocks.data());
+		Consume((uint64_t)blocks[0]);
+	});
+	bench.Run("BlockCompression BC7 512x512", size * size / 16, [&]() {
+		BlockCompression::Encode(VK_FORMAT_BC7_UNORM_BLOCK, image.data(), size, size, blocks.data());
+		Consume((uint64_t)blocks[0]);
+	});
+	bench.Run("BlockCompression BC7 512x512 JobSystem", size * size / 16, [&]() {
+		BlockCompression::Encode(VK_FORMAT_BC7_UNORM_BLOCK, image.data(), size, size, blocks.data(), &jobSystem);
+		Consume((uint64_t)blocks[0]);
+	});
+
+	if (bench.Enabled("BlockCompression JobSystem matches")) {
+		BenchExpectations e;
+		// Threads write whole rows of blocks, so the result doesn't depend on the JobSystem
+		vector<uint8_t> threaded(blocks.size());
+		BlockCompression::Encode(VK_FORMAT_BC7_UNORM_BLOCK, image.data(), size, size, blocks.data());
+		BlockCompression::Encode(VK_FORMAT_BC7_UNORM_BLOCK, image.data(), size, size, threaded.data(), &jobSystem);
+		BENCH_EXPECT(e, threaded == blocks);
+		bench.Check("BlockCompression JobSystem matches", e);
+	}
+
+	// Compress a texture with an odd size, used by the file and decompression checks below
+	TextureData data = {};
+	data.mWidth = 100;
+	data.mHeight = 36;
+	data.mArrayLayers = 2;
+	data.mMipLevels = 1;
+	data.mChannels = 4;
+	data.mChannelSize = 1;
+	data.mFormat = VK_FORMAT_R8G8B8A8_SRGB;
+	data.mPixels.resize((size_t)data.mWidth * data.mHeight * 4 * data.mArrayLayers);
+	for (uint32_t layer = 0; layer < data.mArrayLayers; layer++)
+		for (uint32_t y = 0; y < data.mHeight; y++)
+			memcpy(data.mPixels.data() + 4 * ((size_t)(layer * data.mHeight + y) * data.mWidth), image.data() + 4 * (size_t)(y + layer * 64) * size, data.mWidth * 4);
+	bool compressed = Texture::Compress(data, &jobSystem);
+	const uint64_t sourceHash = 0x0123456789ABCDEFull;
+	vector<uint8_t> file = TextureFile::EncodeKtx2(data, sourceHash);
+
+	if (bench.Enabled("TextureFile KTX2 and DDS round trip")) {
+		BenchExpectations e;
+		BENCH_EXPECT(e, compressed);
+		BENCH_EXPECT(e, data.mFormat == VK_FORMAT_BC7_SRGB_BLOCK);
+		BENCH_EXPECT(e, data.mMipLevels == 7);
+		size_t total = 0;
+		for (uint32_t level = 0; level < data.mMipLevels; level++) total += data.LevelSize(level);
+		BENCH_EXPECT(e, total == data.mPixels.size());
+
+		TextureData read;
+		uint64_t hash;
+		BENCH_EXPECT(e, TextureFile::DecodeKtx2(file.data(), file.size(), read, hash));
+		BENCH_EXPECT(e, hash == sourceHash);
+		BENCH_EXPECT(e, read.mWidth == data.mWidth && read.mHeight == data.mHeight);
+		BENCH_EXPECT(e, read.mArrayLayers == data.mArrayLayers && read.mMipLevels == data.mMipLevels);
+		BENCH_EXPECT(e, read.mFormat == data.mFormat);
+		BENCH_EXPECT(e, read.mPixels == data.mPixels);
+		BENCH_EXPECT(e, !TextureFile::DecodeKtx2(file.data(), file.size() - 1, read, hash));
+		vector<uint8_t> supercompressed = file;
+		supercompressed[44] = 1;
+		BENCH_EXPECT(e, !TextureFile::DecodeKtx2(supercompressed.data(), supercompressed.size(), read, hash));
+		string ktx2 = (fs::temp_directory_path() / "StratumBench.ktx2").string();
+		BENCH_EXPECT(e, TextureFile::Write(ktx2, data, sourceHash));
+		BENCH_EXPECT(e, !fs::exists(ktx2 + ".tmp"));
+		BENCH_EXPECT(e, TextureFile::Read(ktx2, read, hash) && read.mPixels == data.mPixels);
+		fs::remove(ktx2);
+
+		// A DDS cubemap with the DX10 header stores each face's mip chain in turn
+		vector<uint8_t> dds(148);
+		auto put = [&](size_t offset, uint32_t v) { memcpy(dds.data() + offset, &v, sizeof(v)); };
+		put(0, 0x20534444); // "DDS "
+		put(4, 124);
+		put(8, 0x1007 | 0x20000);
+		put(12, 8);
+		put(16, 8);
+		put(28, 2);
+		put(76, 32);
+		put(80, 0x4);
+		put(84, 0x30315844); // "DX10"
+		put(128, 71); // DXGI_FORMAT_BC1_UNORM
+		put(132, 3);
+		put(136, 0x4);
+		put(140, 1);
+		for (uint32_t face = 0; face < 6; face++)
+			for (uint32_t level = 0; level < 2; level++)
+				for (uint32_t block = 0; block < (level ? 1u : 4u); block++)
+					for (uint32_t i = 0; i < 8; i++) dds.push_back((uint8_t)(face * 16 + level * 8 + i));
+		TextureData cube;
+		BENCH_EXPECT(e, TextureFile::DecodeDds(dds.data(), dds.size(), cube));
+		BENCH_EXPECT(e, cube.mFormat == VK_FORMAT_BC1_RGBA_UNORM_BLOCK);
+		BENCH_EXPECT(e, cube.mArrayLayers == 6 && cube.mMipLevels == 2);
+		// Level 1 follows all 6 faces of level 0
+		BENCH_EXPECT(e, cube.LevelSize(0) == 6 * 32 && cube.LevelSize(1) == 6 * 8);
+		if (BENCH_EXPECT(e, cube.mPixels.size() == 6 * 40))
+			for (uint32_t face = 0; face < 6; face++) {
+				BENCH_EXPECT(e, cube.mPixels[face * 32] == face * 16);
+				BENCH_EXPECT(e, cube.mPixels[6 * 32 + face * 8] == face * 16 + 8);
+			}
+		bench.Check("TextureFile KTX2 and DDS round trip", e);
+	}
+
+	if (bench.Enabled("TextureFile rejects malformed headers")) {
+		BenchExpectations e;
+		// Forged sizes must fail before anything is allocated, and leave no pixels behind
+		auto rejectKtx2 = [&](const vector<uint8_t>& bytes) {
+			TextureData read;
+			uint64_t hash;
+			return !TextureFile::DecodeKtx2(bytes.data(), bytes.size(), read, hash) && read.mPixels.empty();
+		};
+		auto rejectDds = [&](const vector<uint8_t>& bytes) {
+			TextureData read;
+			return !TextureFile::DecodeDds(bytes.data(), bytes.size(), read) && read.mPixels.empty();
+		};
+		auto put = [](vector<uint8_t>& bytes, size_t offset, auto v) { memcpy(bytes.data() + offset, &v, sizeof(v)); };
+
+		vector<uint8_t> huge = file;
+		put(huge, 20, 1u << 30);
+		put(huge, 24, 1u << 30);
+		BENCH_EXPECT(e, rejectKtx2(huge));
+		// Within the dimension limit, but the levels don't fit in the file
+		put(huge, 20, 65536u);
+		put(huge, 24, 65536u);
+		BENCH_EXPECT(e, rejectKtx2(huge));
+		vector<uint8_t> layers = file;
+		put(layers, 32, 0x80000000u);
+		put(layers, 36, 6u);
+		BENCH_EXPECT(e, rejectKtx2(layers));
+		vector<uint8_t> levelOffset = file;
+		put(levelOffset, 80, (uint64_t)file.size());
+		BENCH_EXPECT(e, rejectKtx2(levelOffset));
+		vector<uint8_t> levelLength = file;
+		put(levelLength, 80 + 8, ~0ull);
+		BENCH_EXPECT(e, rejectKtx2(levelLength));
+
+		vector<uint8_t> dds(148 + 4096);
+		put(dds, 0, 0x20534444u); // "DDS "
+		put(dds, 4, 124u);
+		put(dds, 8, 0x1007u);
+		put(dds, 12, 0x40000000u);
+		put(dds, 16, 0x40000000u);
+		put(dds, 76, 32u);
+		put(dds, 80, 0x4u);
+		put(dds, 84, 0x30315844u); // "DX10"
+		put(dds, 128, 71u); // DXGI_FORMAT_BC1_UNORM
+		put(dds, 132, 3u);
+		put(dds, 140, 1u);
+		BENCH_EXPECT(e, rejectDds(dds));
+		put(dds, 12, 8u);
+		put(dds, 16, 8u);
+		put(dds, 140, 0x40000000u);
+		BENCH_EXPECT(e, rejectDds(dds));
+		put(dds, 136, 0x4u);
+		put(dds, 140, 0x20000000u);
+		BENCH_EXPECT(e, rejectDds(dds));
+		bench.Check("TextureFile rejects malformed headers", e);
+	}
+
+	if (bench.Enabled("Texture::Decompress matches BlockCompression::Decode")) {
+		BenchExpectations e;
+		// Devices without BC support get the same pixels the GPU would decode, level by level and layer by layer
+		TextureData decompressed = data;
+		if (BENCH_EXPECT(e, Texture::Decompress(decompressed))) {
+			BENCH_EXPECT(e, decompressed.mFormat == VK_FORMAT_R8G8B8A8_SRGB);
+			BENCH_EXPECT(e, decompressed.mChannels == 4 && decompressed.mChannelSize == 1);
+			BENCH_EXPECT(e, decompressed.mMipLevels == data.mMipLevels && decompressed.mArrayLayers == data.mArrayLayers);
+			size_t total = 0, offset = 0, decodedOffset = 0;
+			for (uint32_t level = 0; level < decompressed.mMipLevels; level++) total += decompressed.LevelSize(level);
+			BENCH_EXPECT(e, decompressed.mPixels.size() == total);
+			for (uint32_t level = 0; level < data.mMipLevels && decompressed.mPixels.size() == total; level++) {
+				uint32_t width = max(data.mWidth >> level, 1u), height = max(data.mHeight >> level, 1u);
+				vector<uint8_t> expected((size_t)width * height * 4);
+				for (uint32_t layer = 0; layer < data.mArrayLayers; layer++) {
+					BENCH_EXPECT(e, BlockCompression::Decode(data.mFormat, data.mPixels.data() + offset, width, height, expected.data()));
+					BENCH_EXPECT(e, !memcmp(decompressed.mPixels.data() + decodedOffset, expected.data(), expected.size()));
+					offset += BlockCompression::ImageSize(data.mFormat, width, height);
+					decodedOffset += expected.size();
+				}
+			}
+		}
+
+		TextureData bc1 = {};
+		bc1.mWidth = bc1.mHeight = 8;
+		bc1.mArrayLayers = bc1.mMipLevels = 1;
+		bc1.mFormat = VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+		bc1.mPixels.resize(bc1.LevelSize(0));
+		BlockCompression::Encode(bc1.mFormat, image.data(), 8, 8, bc1.mPixels.data());
+		BENCH_EXPECT(e, Texture::Decompress(bc1));
+		BENCH_EXPECT(e, bc1.mFormat == VK_FORMAT_R8G8B8A8_UNORM && bc1.mPixels.size() == 8 * 8 * 4);
+
+		// Formats DecodeBlock doesn't handle are left alone
+		TextureData bc2 = {};
+		bc2.mWidth = bc2.mHeight = 8;
+		bc2.mArrayLayers = bc2.mMipLevels = 1;
+		bc2.mFormat = VK_FORMAT_BC2_UNORM_BLOCK;
+		bc2.mPixels.resize(bc2.LevelSize(0));
+		BENCH_EXPECT(e, !Texture::Decompress(bc2));
+		BENCH_EXPECT(e, bc2.mFormat == VK_FORMAT_BC2_UNORM_BLOCK && bc2.mPixels.size() == 64);
+		bench.Check("Texture::Decompress matches BlockCompression::Decode", e);
+	}
+}
+
+void BenchJobSystem(Bench& bench, mt19937& rng) {
+	// Always run with workers, even on machines with one hardware thread
+	JobSystem jobSystem(3);
+
+	if (bench.Enabled("JobSystem::ParallelFor covers every index")) {
+		BenchExpectations e;
+		for (uint32_t count : { 1u, 100u, 4099u }) {
+			for (uint32_t batchSize : { 1u, 7u, 64u, count + 1 }) {
+				vector<atomic<uint32_t>> calls(count);
+				for (auto& c : calls) c = 0;
+				jobSystem.ParallelFor(count, [&](uint32_t i) { calls[i]++; }, batchSize);
+				bool once = true;
+				for (auto& c : calls) once = once && c == 1;
+				BENCH_EXPECT(e, once);
+
+				for (auto& c : calls) c = 0;
+				atomic<bool> inBounds(true);
+				jobSystem.ParallelFor(count, [&](uint32_t begin, uint32_t end) {
+					if (begin >= end || end > count || end - begin > batchSize) inBounds = false;
+					for (uint32_t i = begin; i < min(end, count); i++) calls[i]++;
+				}, batchSize);
+				BENCH_EXPECT(e, inBounds);
+				once = true;
+				for (auto& c : calls) once = once && c == 1;
+				BENCH_EXPECT(e, once);
+			}
+		}
+		bench.Check("JobSystem::ParallelFor covers every index", e);
+	}
+
+	if (bench.Enabled("JobSystem nested Wait")) {
+		BenchExpectations e;
+		// Jobs that ParallelFor and Wait themselves, so workers wait on work only other threads can finish
+		const uint32_t jobCount = 16, count = 1000;
+		vector<atomic<uint32_t>> calls(jobCount * count);
+		for (auto& c : calls) c = 0;
+		JobCounter counter;
+		// Expect() isn't thread-safe, so jobs only record whether their inner jobs finished
+		atomic<bool> innerDone(true);
+		for (uint32_t j = 0; j < jobCount; j++)
+			jobSystem.Schedule([&, j]() {
+				JobCounter inner;
+				for (uint32_t k = 0; k < 4; k++)
+					jobSystem.Schedule([&, j, k]() {
+						jobSystem.ParallelFor(count / 4, [&](uint32_t i) { calls[j * count + k * (count / 4) + i]++; }, 16);
+					}, &inner);
+				jobSystem.Wait(&inner);
+				if (!inner.Done()) innerDone = false;
+			}, &counter);
+		jobSystem.Wait(&counter);
+		BENCH_EXPECT(e, counter.Done());
+		BENCH_EXPECT(e, innerDone);
+		bool once = true;
+		for (auto& c : calls) once = once && c == 1;
+		BENCH_EXPECT(e, once);
+
+		// A job with a dependency starts after every job it depends on
+		JobCounter first, second;
+		atomic<uint32_t> finished(0);
+		atomic<bool> ordered(true);
+		for (uint32_t j = 0; j < 8; j++)
+			jobSystem.Schedule([&]() { this_thread::sleep_for(chrono::microseconds(200)); finished++; }, &first);
+		jobSystem.Schedule([&]() { if (finished != 8) ordered = false; }, &second, &first);
+		jobSystem.Wait(&second);
+		BENCH_EXPECT(e, ordered);
+		BENCH_EXPECT(e, first.Done());
+		bench.Check("JobSystem nested Wait", e);
+	}
+
+	if (bench.Enabled("ObjectBvh2::MarkDirty from jobs")) {
+		BenchExpectations e;
+		// Thread-safe FixedUpdates move objects, and mark them dirty, from jobs
+		vector<AABB> boxes = RandomBoxes(rng, 20000, 500, 5);
+		vector<unique_ptr<BenchObject>> objects;
+		vector<Object*> pointers;
+		for (const AABB& b : boxes) {
+			objects.emplace_back(make_unique<BenchObject>(b));
+			pointers.push_back(objects.back().get());
+		}
+		ObjectBvh2 bvh;
+		bvh.Build(pointers.data(), (uint32_t)pointers.size());
+		BenchObject outside(AABB(float3(0), float3(1)));
+
+		atomic<uint32_t> notFound(0);
+		jobSystem.ParallelFor((uint32_t)objects.size() * 2, [&](uint32_t i) {
+			BenchObject* object = objects[i / 2].get();
+			object->mBox = AABB(object->mBox.mMin + float3(1, 0, 0), object->mBox.mMax + float3(1, 0, 0));
+			if (!bvh.MarkDirty(object)) notFound++;
+		}, 32);
+		BENCH_EXPECT(e, notFound == 0);
+		BENCH_EXPECT(e, bvh.DirtyCount() == objects.size());
+		BENCH_EXPECT(e, !bvh.MarkDirty(&outside));
+
+		bvh.Refit();
+		BENCH_EXPECT(e, !bvh.RefitPending());
+		// Every moved object is inside its refit leaf and the root
+		auto contains = [](const AABB& a, const AABB& b) {
+			return a.mMin.x <= b.mMin.x && a.mMin.y <= b.mMin.y && a.mMin.z <= b.mMin.z && a.mMax.x >= b.mMax.x && a.mMax.y >= b.mMax.y && a.mMax.z >= b.mMax.z;
+		};
+		bool inLeaf = true, inRoot = true;
+		for (uint32_t i = 0; i < bvh.PrimitiveCount(); i++) {
+			AABB object = bvh.GetObject(i)->Bounds();
+			inLeaf = inLeaf && contains(bvh.Nodes()[bvh.LeafIndex(i)].mBounds, object);
+			inRoot = inRoot && contains(bvh.Nodes()[0].mBounds, object);
+		}
+		BENCH_EXPECT(e, inLeaf);
+		BENCH_EXPECT(e, inRoot);
+		bench.Check("ObjectBvh2::MarkDirty from jobs", e);
+	}
+}
+
+void BenchMeshCache(Bench& bench, mt19937& rng) {
+	if (bench.Enabled("MeshCache round trip")) {
+		BenchExpectations e;
+		// A grid of quads with bone weights
+		const uint32_t side = 64;
+		MeshData data;
+		uniform_real_distribution<float> height(-1.f, 1.f);
+		for (uint32_t y = 0; y < side; y++)
+			for (uint32_t x = 0; x < side; x++) {
+				StdVertex v = {};
+				v.position = float3((float)x, height(rng), (float)y);
+				v.normal = float3(0, 1, 0);
+				v.tangent = float4(1, 0, 0, 1);
+				v.uv = float2((float)x, (float)y) / (float)side;
+				data.mVertexStorage.push_back(v);
+				VertexWeight w = {};
+				w.Weights = float4(1, 0, 0, 0);
+				w.Indices = uint4(x % 4, 0, 0, 0);
+				data.mWeightStorage.push_back(w);
+				data.mBounds.Encapsulate(v.position);
+			}
+		for (uint32_t y = 0; y + 1 < side; y++)
+			for (uint32_t x = 0; x + 1 < side; x++) {
+				uint16_t i = (uint16_t)(y * side + x);
+				for (uint16_t index : { i, (uint16_t)(i + side), (uint16_t)(i + 1), (uint16_t)(i + 1), (uint16_t)(i + side), (uint16_t)(i + side + 1) })
+					data.mIndexStorage16.push_back(index);
+			}
+		data.mVertices = data.mVertexStorage.data();
+		data.mVertexCount = (uint32_t)data.mVertexStorage.size();
+		data.mIndices = data.mIndexStorage16.data();
+		data.mIndexCount = (uint32_t)data.mIndexStorage16.size();
+		data.mIndexType = VK_INDEX_TYPE_UINT16;
+		data.mWeights = data.mWeightStorage.data();
+		data.mBvh = new TriangleBvh2();
+		data.mBvh->Build(data.mVertices, 0, data.mVertexCount, sizeof(StdVertex), data.mIndices, data.mIndexCount, data.mIndexType);
+
+		string file = (fs::temp_directory_path() / "StratumBench.meshcache").string();
+		BENCH_EXPECT(e, MeshCache::Write(file, 1234, 2.f, data));
+		BENCH_EXPECT(e, !fs::exists(file + ".tmp"));
+		{
+			MeshData read;
+			BENCH_EXPECT(e, MeshCache::Read(file, 1234, 2.f, read));
+			BENCH_EXPECT(e, read.mVertexCount == data.mVertexCount && read.mIndexCount == data.mIndexCount && read.mIndexType == data.mIndexType);
+			BENCH_EXPECT(e, read.mVertices && memcmp(read.mVertices, data.mVertices, data.mVertexCount * sizeof(StdVertex)) == 0);
+			BENCH_EXPECT(e, read.mIndices && memcmp(read.mIndices, data.mIndices, data.mIndexCount * sizeof(uint16_t)) == 0);
+			BENCH_EXPECT(e, read.mWeights && memcmp(read.mWeights, data.mWeights, data.mVertexCount * sizeof(VertexWeight)) == 0);
+			BENCH_EXPECT(e, memcmp(&read.mBounds, &data.mBounds, sizeof(AABB)) == 0);
+			BENCH_EXPECT(e, read.mBvh && read.mBvh->Nodes().size() == data.mBvh->Nodes().size() && read.mBvh->Triangles().size() == data.mBvh->Triangles().size());
+			if (read.mBvh && read.mBvh->Nodes().size() == data.mBvh->Nodes().size() && read.mBvh->Triangles().size() == data.mBvh->Triangles().size()) {
+				BENCH_EXPECT(e, memcmp(read.mBvh->Nodes().data(), data.mBvh->Nodes().data(), data.mBvh->Nodes().size() * sizeof(TriangleBvh2::Node)) == 0);
+				BENCH_EXPECT(e, memcmp(read.mBvh->Triangles().data(), data.mBvh->Triangles().data(), data.mBvh->Triangles().size() * sizeof(uint3)) == 0);
+			}
+		}
+		{
+			// Stale and mismatched caches are rejected
+			MeshData read;
+			BENCH_EXPECT(e, !MeshCache::Read(file, 4321, 2.f, read));
+			BENCH_EXPECT(e, !MeshCache::Read(file, 1234, 1.f, read));
+		}
+		{
+			// So are truncated ones
+			uintmax_t size = fs::file_size(file);
+			fs::resize_file(file, size - 16);
+			MeshData read;
+			BENCH_EXPECT(e, !MeshCache::Read(file, 1234, 2.f, read));
+		}
+		{
+			// And ones with a matching hash whose offsets, indices or nodes point outside their arrays
+			BENCH_EXPECT(e, MeshCache::Write(file, 1234, 2.f, data));
+			ifstream in(file, ios::binary);
+			vector<uint8_t> bytes((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+			in.close();
+			MeshCacheHeader header;
+			memcpy(&header, bytes.data(), sizeof(header));
+			auto rejects = [&](const function<void(vector<uint8_t>&)>& edit) {
+				vector<uint8_t> corrupt = bytes;
+				edit(corrupt);
+				ofstream(file, ios::binary).write((const char*)corrupt.data(), corrupt.size());
+				MeshData read;
+				return !MeshCache::Read(file, 1234, 2.f, read);
+			};
+			BENCH_EXPECT(e, rejects([&](vector<uint8_t>& b) {
+				uint64_t offset = ~(uint64_t)15;
+				memcpy(b.data() + offsetof(MeshCacheHeader, mVertexOffset), &offset, sizeof(offset));
+			}));
+			BENCH_EXPECT(e, rejects([&](vector<uint8_t>& b) {
+				uint16_t index = (uint16_t)data.mVertexCount;
+				memcpy(b.data() + header.mIndexOffset + 2 * sizeof(uint16_t), &index, sizeof(index));
+			}));
+			BENCH_EXPECT(e, rejects([&](vector<uint8_t>& b) {
+				uint32_t vertex = data.mVertexCount;
+				memcpy(b.data() + header.mTriangleOffset + sizeof(uint3) + sizeof(uint32_t), &vertex, sizeof(vertex));
+			}));
+			BENCH_EXPECT(e, rejects([&](vector<uint8_t>& b) {
+				TriangleBvh2::Node* nodes = (TriangleBvh2::Node*)(b.data() + header.mNodeOffset);
+				for (uint32_t i = 0; i < header.mNodeCount; i++)
+					if (nodes[i].mRightOffset == 0) {
+						nodes[i].mStartIndex = header.mTriangleCount - nodes[i].mCount + 1;
+						break;
+					}
+			}));
+			BENCH_EXPECT(e, rejects([&](vector<uint8_t>& b) {
+				TriangleBvh2::Node* nodes = (TriangleBvh2::Node*)(b.data() + header.mNodeOffset);
+				nodes[0].mRightOffset = header.mNodeCount;
+			}));
+			BENCH_EXPECT(e, rejects([&](vector<uint8_t>& b) {
+				// Both children of the root are the same node
+				TriangleBvh2::Node* nodes = (TriangleBvh2::Node*)(b.data() + header.mNodeOffset);
+				nodes[0].mRightOffset = 1;
+			}));
+			BENCH_EXPECT(e, !rejects([](vector<uint8_t>&) {}));
+		}
+		fs::remove(file);
+
+		// Editing the buffer a .gltf references changes its hash
+		fs::path gltf = fs::temp_directory_path() / "StratumBench.gltf";
+		fs::path bin = fs::temp_directory_path() / "StratumBench buffer.bin";
+		ofstream(gltf.string()) << "{ \"buffers\": [ { \"byteLength\": 4, \"uri\": \"StratumBench%20buffer.bin\" } ] }";
+		ofstream(bin.string(), ios::binary) << "abcd";
+		uint64_t hash = MeshCache::HashSource(gltf.string());
+		ofstream(bin.string(), ios::binary) << "abce";
+		BENCH_EXPECT(e, hash != 0 && MeshCache::HashSource(gltf.string()) != hash);
+		fs::remove(bin);
+		BENCH_EXPECT(e, MeshCache::HashSource(gltf.string()) != hash);
+		fs::remove(gltf);
+		BENCH_EXPECT(e, MeshCache::HashSource(gltf.string()) == 0);
+
+		bench.Check("MeshCache round trip", e);
+	}
+}
+
+void BenchAssets(Bench& bench) {
+	string assets = bench.Settings().mAssets;
+	string mesh = assets + "/Models/cornellbox.gltf";
+	string texture = assets + "/Textures/grid.png";
+	string font = assets + "/Fonts/OpenSans-Regular.ttf";
+
+	if (fs::exists(mesh)) {
+		// Keep the cache out of the assets directory
+		string cache = (fs::temp_directory_path() / "cornellbox.gltf.meshcache").string();
+		fs::remove(cache);
+		bench.Run("Mesh::Import cornellbox", 1, [&]() {
+			MeshData data;
+			if (Mesh::Import(mesh, 1.f, data)) Consume((uint64_t)data.mIndexCount);
+		});
+		// The first Decode writes the mesh cache, the timed ones read it
+		bench.Run("Mesh::Decode cornellbox (cached)", 1, [&]() {
+			MeshData data;
+			if (Mesh::Decode(mesh, 1.f, data, cache)) Consume((uint64_t)data.mIndexCount);
+		});
+		fs::remove(cache);
+	} else if (bench.Enabled("Mesh::"))
+		fprintf_color(COLOR_YELLOW, stderr, "Skipping mesh benchmarks: %s not found\n", mesh.c_str());
+
+	if (fs::exists(texture)) {
+		bench.Run("Texture::Decode grid.png", 1, [&]() {
+			TextureData data;
+			if (Texture::Decode(texture, true, data)) Consume((uint64_t)data.mPixels.size());
+		});
+	} else if (bench.Enabled("Texture::"))
+		fprintf_color(COLOR_YELLOW, stderr, "Skipping texture benchmarks: %s not found\n", texture.c_str());
+
+	if (fs::exists(font)) {
+		bench.Run("Font::Decode OpenSans 24px", 1, [&]() {
+			FontData* data = new FontData();
+			if (Font::Decode(font, 24.f, 1.f / 24.f, *data)) Consume(data->mPixelSize);
+			delete data;
+		});
+	} else if (bench.Enabled("Font::"))
+		fprintf_color(COLOR_YELLOW, stderr, "Skipping font benchmarks: %s not found\n", font.c_str());
+}
+
+int main(int argc, char* argv[]) {
+	BenchSettings settings;
+	settings.mAssets = "Assets";
+	settings.mWarmup = 3;
+	settings.mSamples = 30;
+	settings.mMinTime = .25;
+	string output;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+			settings.mFilter = argv[++i];
+		else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+			output = argv[++i];
+		else if (strcmp(argv[i], "--assets") == 0 && i + 1 < argc)
+			settings.mAssets = argv[++i];
+		else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+			settings.mWarmup = (uint32_t)atoi(argv[++i]);
+		else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc)
+			settings.mSamples = max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+			settings.mMinTime = atof(argv[++i]);
+		else {
+			fprintf(stderr, "Usage: %s [--filter <substring>] [--output <file.json>] [--assets <directory>] [--warmup <calls>] [--samples <count>] [--min-time <seconds>]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+#if !defined(MATH_SIMD)
+	const char* mathBackend = "scalar";
+#elif defined(SIMD_AVX)
+	const char* mathBackend = "avx";
+#elif defined(SIMD_SSE)
+	const char* mathBackend = "sse";
+#else
+	const char* mathBackend = "neon";
+#endif
+
+	Bench bench(settings);
+	printf("Math backend: %s\n", mathBackend);
+	printf("%-40s %15s %15s %15s\n", "Benchmark", "median", "p90", "p99");
+
+	// Every run generates the same inputs
+	mt19937 rng(0x5717A7u);
+	BenchBvh(bench, rng);
+	BenchOcclusion(bench, rng);
+	BenchMath(bench, rng);
+	BenchTransforms(bench, rng);
+	BenchRenderSort(bench, rng);
+	BenchAnimation(bench, rng);
+	BenchTokenizer(bench, rng);
+	BenchAllocator(bench, rng);
+	BenchRingAllocator(bench, rng);
+	BenchDescriptorCache(bench, rng);
+	BenchPropertyHandles(bench, rng);
+	BenchPipelineCache(bench, rng);
+	BenchShaderFile(bench, rng);
+	BenchVariantResolution(bench, rng);
+	BenchTextureCompression(bench, rng);
+	BenchJobSystem(bench, rng);
+	BenchMeshCache(bench, rng);
+	BenchAssets(bench);
+
+	if (output.size()) {
+		json11::Json json = json11::Json::object {
+			{ "math_backend", mathBackend },
+			{ "warmup", (int)settings.mWarmup },
+			{ "samples", (int)settings.mSamples },
+			{ "min_time", settings.mMinTime },
+			{ "results", bench.Results() },
+			{ "checks", bench.Checks() },
+		};
+		ofstream file(output);
+		if (!file.is_open()) {
+			fprintf_color(COLOR_RED, stderr, "Failed to write %s\n", output.c_str());
+			return EXIT_FAILURE;
+		}
+		file << json.dump() << endl;
+	}
+
+	return bench.Failed() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,522 @@
+#include <Util/BlockCompression.hpp>
+#include <Core/JobSystem.hpp>
+#include <Math/Simd.hpp>
+
+#include <cfloat>
+
+using namespace std;
+
+// BC7 interpolation weights for 4-bit indices, out of 64
+static const uint32_t gBc7Weights[16] { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// Reads and writes bit fields of a block, least significant bit first
+struct BitWriter {
+	uint8_t* mData;
+	uint32_t mPosition;
+	inline void Write(uint32_t value, uint32_t bits) {
+		for (uint32_t i = 0; i < bits; i++, mPosition++)
+			if ((value >> i) & 1) mData[mPosition >> 3] |= 1 << (mPosition & 7);
+	}
+};
+struct BitReader {
+	const uint8_t* mData;
+	uint32_t mPosition;
+	inline uint32_t Read(uint32_t bits) {
+		uint32_t value = 0;
+		for (uint32_t i = 0; i < bits; i++, mPosition++)
+			value |= ((mData[mPosition >> 3] >> (mPosition & 7)) & 1) << i;
+		return value;
+	}
+};
+
+// Fits a line through the first channels channels of the pixels along their principal axis, found by power iteration on their covariance.
+// lo and hi are the extremes of the pixels projected onto the line
+inline void FitLine(const float* const* planes, uint32_t channels, float* lo, float* hi) {
+	float mean[4] {};
+	for (uint32_t c = 0; c < channels; c++) {
+		for (uint32_t i = 0; i < 16; i++) mean[c] += planes[c][i];
+		mean[c] /= 16.f;
+	}
+	float covariance[4][4] {};
+	for (uint32_t i = 0; i < 16; i++)
+		for (uint32_t a = 0; a < channels; a++)
+			for (uint32_t b = 0; b < channels; b++)
+				covariance[a][b] += (planes[a][i] - mean[a]) * (planes[b][i] - mean[b]);
+
+	// Start from the row of the channel that varies most, which can't be orthogonal to the principal axis
+	uint32_t k = 0;
+	for (uint32_t c = 1; c < channels; c++)
+		if (covariance[c][c] > covariance[k][k]) k = c;
+	float axis[4] {};
+	for (uint32_t c = 0; c < channels; c++) axis[c] = covariance[k][c];
+	for (uint32_t iteration = 0; iteration < 8; iteration++) {
+		float next[4] {};
+		float scale = 0;
+		for (uint32_t a = 0; a < channels; a++) {
+			for (uint32_t b = 0; b < channels; b++) next[a] += covariance[a][b] * axis[b];
+			scale = max(scale, fabsf(next[a]));
+		}
+		if (scale == 0) break;
+		for (uint32_t c = 0; c < channels; c++) axis[c] = next[c] / scale;
+	}
+	float length = 0;
+	for (uint32_t c = 0; c < channels; c++) length += axis[c] * axis[c];
+	if (length < 1e-12f) {
+		for (uint32_t c = 0; c < channels; c++) lo[c] = hi[c] = mean[c];
+		return;
+	}
+	length = sqrtf(length);
+	for (uint32_t c = 0; c < channels; c++) axis[c] /= length;
+
+	float tmin = FLT_MAX, tmax = -FLT_MAX;
+	for (uint32_t i = 0; i < 16; i++) {
+		float t = 0;
+		for (uint32_t c = 0; c < channels; c++) t += (planes[c][i] - mean[c]) * axis[c];
+		tmin = min(tmin, t);
+		tmax = max(tmax, t);
+	}
+	for (uint32_t c = 0; c < channels; c++) {
+		lo[c] = clamp(mean[c] + axis[c] * tmin, 0.f, 255.f);
+		hi[c] = clamp(mean[c] + axis[c] * tmax, 0.f, 255.f);
+	}
+}
+
+// Least squares endpoints for the pixels, given each pixel's weight along the line from lo (0) to hi (1). Returns false if every weight is the same
+inline bool RefitLine(const float* const* planes, uint32_t channels, const float* weights, float* lo, float* hi) {
+	float aa = 0, bb = 0, ab = 0;
+	float ax[4] {}, bx[4] {};
+	for (uint32_t i = 0; i < 16; i++) {
+		float b = weights[i];
+		float a = 1 - b;
+		aa += a * a;
+		bb += b * b;
+		ab += a * b;
+		for (uint32_t c = 0; c < channels; c++) {
+			ax[c] += a * planes[c][i];
+			bx[c] += b * planes[c][i];
+		}
+	}
+	float det = aa * bb - ab * ab;
+	if (fabsf(det) < 1e-6f) return false;
+	for (uint32_t c = 0; c < channels; c++) {
+		lo[c] = clamp((ax[c] * bb - bx[c] * ab) / det, 0.f, 255.f);
+		hi[c] = clamp((bx[c] * aa - ax[c] * ab) / det, 0.f, 255.f);
+	}
+	return true;
+}
+
+// Finds the closest palette entry to each pixel, comparing 4 pixels at a time. Returns the summed squared error
+inline float SelectIndices(const float* const* planes, uint32_t channels, const float (*palette)[4], uint32_t paletteSize, uint32_t* indices) {
+	float error = 0;
+	for (uint32_t p = 0; p < 16; p += 4) {
+		simd4f pixels[4];
+		for (uint32_t c = 0; c < channels; c++) pixels[c] = simd4f::LoadUnaligned(planes[c] + p);
+		simd4f best(FLT_MAX);
+		simd4f bestIndex(0.f);
+		for (uint32_t i = 0; i < paletteSize; i++) {
+			simd4f distance(0.f);
+			for (uint32_t c = 0; c < channels; c++) {
+				simd4f d = pixels[c] - simd4f(palette[i][c]);
+				distance = distance + d * d;
+			}
+			bestIndex = select(distance < best, simd4f((float)i), bestIndex);
+			best = min(distance, best);
+		}
+		float e[4], index[4];
+		best.StoreUnaligned(e);
+		bestIndex.StoreUnaligned(index);
+		for (uint32_t i = 0; i < 4; i++) {
+			indices[p + i] = (uint32_t)index[i];
+			error += e[i];
+		}
+	}
+	return error;
+}
+
+inline uint16_t To565(const float* c) {
+	uint32_t r = (uint32_t)clamp(c[0] * 31.f / 255.f + .5f, 0.f, 31.f);
+	uint32_t g = (uint32_t)clamp(c[1] * 63.f / 255.f + .5f, 0.f, 63.f);
+	uint32_t b = (uint32_t)clamp(c[2] * 31.f / 255.f + .5f, 0.f, 31.f);
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+inline void From565(uint16_t v, uint32_t* c) {
+	uint32_t r = v >> 11, g = (v >> 5) & 63, b = v & 31;
+	c[0] = (r << 3) | (r >> 2);
+	c[1] = (g << 2) | (g >> 4);
+	c[2] = (b << 3) | (b >> 2);
+	c[3] = 255;
+}
+// Colors of a BC1 block. Blocks with c0 <= c1 have 3 colors and transparent black, unless fourColors is set as for the color block of BC3
+inline void Bc1Palette(uint16_t c0, uint16_t c1, bool fourColors, uint32_t palette[4][4]) {
+	From565(c0, palette[0]);
+	From565(c1, palette[1]);
+	for (uint32_t c = 0; c < 3; c++) {
+		uint32_t a = palette[0][c], b = palette[1][c];
+		if (c0 > c1 || fourColors) {
+			palette[2][c] = (2 * a + b) / 3;
+			palette[3][c] = (a + 2 * b) / 3;
+		} else {
+			palette[2][c] = (a + b) / 2;
+			palette[3][c] = 0;
+		}
+	}
+	palette[2][3] = 255;
+	palette[3][3] = (c0 > c1 || fourColors) ? 255 : 0;
+}
+
+// Always writes c0 > c1, or c0 == c1 with every index 0, so the block decodes the same as the color block of BC3
+inline void EncodeBc1(const float* const* planes, uint8_t* block) {
+	float lo[4], hi[4];
+	FitLine(planes, 3, lo, hi);
+
+	float bestError = FLT_MAX;
+	uint16_t best0 = 0, best1 = 0;
+	uint32_t bestIndices[16] {};
+	for (uint32_t pass = 0; pass < 2; pass++) {
+		uint16_t c0 = To565(hi), c1 = To565(lo);
+		if (c0 < c1) {
+			swap(c0, c1);
+			swap(lo, hi);
+		}
+		uint32_t colors[4][4];
+		Bc1Palette(c0, c1, true, colors);
+		float palette[4][4];
+		for (uint32_t i = 0; i < 4; i++)
+			for (uint32_t c = 0; c < 4; c++) palette[i][c] = (float)colors[i][c];
+
+		uint32_t indices[16];
+		float error = SelectIndices(planes, 3, palette, c0 == c1 ? 1 : 4, indices);
+		if (error < bestError) {
+			bestError = error;
+			best0 = c0;
+			best1 = c1;
+			memcpy(bestIndices, indices, sizeof(indices));
+		}
+		if (c0 == c1 || pass == 1) break;
+
+		// Move the endpoints to the least squares fit of the chosen indices, hi is c0
+		static const float weights[4] { 1.f, 0.f, 2.f / 3.f, 1.f / 3.f };
+		float w[16];
+		for (uint32_t i = 0; i < 16; i++) w[i] = weights[indices[i]];
+		if (!RefitLine(planes, 3, w, lo, hi)) break;
+	}
+
+	uint32_t bits = 0;
+	for (uint32_t i = 0; i < 16; i++) bits |= bestIndices[i] << (2 * i);
+	memcpy(block, &best0, 2);
+	memcpy(block + 2, &best1, 2);
+	memcpy(block + 4, &bits, 4);
+}
+inline void DecodeBc1(const uint8_t* block, bool fourColors, bool alpha, uint8_t* rgba) {
+	uint16_t c0, c1;
+	uint32_t bits;
+	memcpy(&c0, block, 2);
+	memcpy(&c1, block + 2, 2);
+	memcpy(&bits, block + 4, 4);
+	uint32_t palette[4][4];
+	Bc1Palette(c0, c1, fourColors, palette);
+	for (uint32_t i = 0; i < 16; i++) {
+		uint32_t index = (bits >> (2 * i)) & 3;
+		for (uint32_t c = 0; c < 3; c++) rgba[4 * i + c] = (uint8_t)palette[index][c];
+		rgba[4 * i + 3] = alpha ? (uint8_t)palette[index][3] : 255;
+	}
+}
+
+// Always uses 8 values, e0 > e1
+inline void EncodeBc4(const float* values, uint8_t* block) {
+	float lo = 255, hi = 0;
+	for (uint32_t i = 0; i < 16; i++) {
+		lo = min(lo, values[i]);
+		hi = max(hi, values[i]);
+	}
+	uint32_t e0 = (uint32_t)(hi + .5f), e1 = (uint32_t)(lo + .5f);
+	uint32_t indices[16] {};
+	if (e0 != e1) {
+		float palette[8][4] {};
+		palette[0][0] = (float)e0;
+		palette[1][0] = (float)e1;
+		for (uint32_t i = 1; i < 7; i++) palette[i + 1][0] = (float)(((7 - i) * e0 + i * e1) / 7);
+		const float* planes[1] { values };
+		SelectIndices(planes, 1, palette, 8, indices);
+	}
+	uint64_t bits = 0;
+	for (uint32_t i = 0; i < 16; i++) bits |= (uint64_t)indices[i] << (3 * i);
+	block[0] = (uint8_t)e0;
+	block[1] = (uint8_t)e1;
+	for (uint32_t i = 0; i < 6; i++) block[2 + i] = (uint8_t)(bits >> (8 * i));
+}
+inline void DecodeBc4(const uint8_t* block, uint8_t* values, uint32_t stride) {
+	uint32_t e0 = block[0], e1 = block[1];
+	uint32_t palette[8] { e0, e1 };
+	if (e0 > e1)
+		for (uint32_t i = 1; i < 7; i++) palette[i + 1] = ((7 - i) * e0 + i * e1) / 7;
+	else {
+		for (uint32_t i = 1; i < 5; i++) palette[i + 1] = ((5 - i) * e0 + i * e1) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+	uint64_t bits = 0;
+	for (uint32_t i = 0; i < 6; i++) bits |= (uint64_t)block[2 + i] << (8 * i);
+	for (uint32_t i = 0; i < 16; i++)
+		values[stride * i] = (uint8_t)palette[(bits >> (3 * i)) & 7];
+}
+
+// Mode 6: one RGBA line with 7-bit endpoints, a p-bit per endpoint and 4-bit indices
+inline void EncodeBc7(const float* const* planes, uint8_t* block) {
+	float lo[4], hi[4];
+	FitLine(planes, 4, lo, hi);
+
+	float bestError = FLT_MAX;
+	uint32_t best[2][4] {};
+	uint32_t bestP[2] {};
+	uint32_t bestIndices[16] {};
+	for (uint32_t pass = 0; pass < 2; pass++) {
+		uint32_t indices[16];
+		// Try every combination of p-bits, which make the endpoints 8-bit
+		for (uint32_t p = 0; p < 4; p++) {
+			uint32_t p0 = p & 1, p1 = p >> 1;
+			uint32_t q[2][4], e[2][4];
+			for (uint32_t c = 0; c < 4; c++) {
+				q[0][c] = (uint32_t)clamp((lo[c] - p0) / 2.f + .5f, 0.f, 127.f);
+				q[1][c] = (uint32_t)clamp((hi[c] - p1) / 2.f + .5f, 0.f, 127.f);
+				e[0][c] = (q[0][c] << 1) | p0;
+				e[1][c] = (q[1][c] << 1) | p1;
+			}
+			float palette[16][4];
+			for (uint32_t i = 0; i < 16; i++)
+				for (uint32_t c = 0; c < 4; c++)
+					palette[i][c] = (float)(((64 - gBc7Weights[i]) * e[0][c] + gBc7Weights[i] * e[1][c] + 32) >> 6);
+			float error = SelectIndices(planes, 4, palette, 16, indices);
+			if (error < bestError) {
+				bestError = error;
+				memcpy(best, q, sizeof(q));
+				bestP[0] = p0;
+				bestP[1] = p1;
+				memcpy(bestIndices, indices, sizeof(indices));
+			}
+		}
+		if (pass == 1) break;
+
+		// Move the endpoints to the least squares fit of the best indices
+		float w[16];
+		for (uint32_t i = 0; i < 16; i++) w[i] = gBc7Weights[bestIndices[i]] / 64.f;
+		if (!RefitLine(planes, 4, w, lo, hi)) break;
+	}
+
+	// The first index is stored without its top bit, so it must be below 8
+	if (bestIndices[0] & 8) {
+		for (uint32_t c = 0; c < 4; c++) swap(best[0][c], best[1][c]);
+		swap(bestP[0], bestP[1]);
+		for (uint32_t i = 0; i < 16; i++) bestIndices[i] = 15 - bestIndices[i];
+	}
+
+	memset(block, 0, 16);
+	BitWriter writer { block, 0 };
+	writer.Write(1 << 6, 7);
+	for (uint32_t c = 0; c < 4; c++) {
+		writer.Write(best[0][c], 7);
+		writer.Write(best[1][c], 7);
+	}
+	writer.Write(bestP[0], 1);
+	writer.Write(bestP[1], 1);
+	writer.Write(bestIndices[0], 3);
+	for (uint32_t i = 1; i < 16; i++) writer.Write(bestIndices[i], 4);
+}
+inline bool DecodeBc7(const uint8_t* block, uint8_t* rgba) {
+	if ((block[0] & 0x7F) != 0x40) return false;
+	BitReader reader { block, 7 };
+	uint32_t e[2][4];
+	for (uint32_t c = 0; c < 4; c++) {
+		e[0][c] = reader.Read(7) << 1;
+		e[1][c] = reader.Read(7) << 1;
+	}
+	uint32_t p0 = reader.Read(1), p1 = reader.Read(1);
+	for (uint32_t c = 0; c < 4; c++) {
+		e[0][c] |= p0;
+		e[1][c] |= p1;
+	}
+	for (uint32_t i = 0; i < 16; i++) {
+		uint32_t w = gBc7Weights[reader.Read(i ? 4 : 3)];
+		for (uint32_t c = 0; c < 4; c++)
+			rgba[4 * i + c] = (uint8_t)(((64 - w) * e[0][c] + w * e[1][c] + 32) >> 6);
+	}
+	return true;
+}
+
+uint32_t BlockCompression::BlockSize(VkFormat format) {
+	switch (format) {
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+	case VK_FORMAT_BC4_SNORM_BLOCK:
+		return 8;
+	case VK_FORMAT_BC2_UNORM_BLOCK:
+	case VK_FORMAT_BC2_SRGB_BLOCK:
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC5_SNORM_BLOCK:
+	case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+	case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		return 16;
+	default:
+		return 0;
+	}
+}
+size_t BlockCompression::ImageSize(VkFormat format, uint32_t width, uint32_t height) {
+	if (uint32_t blockSize = BlockSize(format))
+		return (size_t)((width + 3) / 4) * (size_t)((height + 3) / 4) * blockSize;
+	return (size_t)FormatSize(format) * width * height;
+}
+bool BlockCompression::CanEncode(VkFormat format) {
+	switch (format) {
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		return true;
+	default:
+		return false;
+	}
+}
+
+void BlockCompression::EncodeBlock(VkFormat format, const uint8_t* rgba, uint8_t* block) {
+	float pixels[4][16];
+	for (uint32_t i = 0; i < 16; i++)
+		for (uint32_t c = 0; c < 4; c++)
+			pixels[c][i] = rgba[4 * i + c];
+	const float* planes[4] { pixels[0], pixels[1], pixels[2], pixels[3] };
+
+	switch (format) {
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+		EncodeBc1(planes, block);
+		break;
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+		EncodeBc4(planes[3], block);
+		EncodeBc1(planes, block + 8);
+		break;
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+		EncodeBc4(planes[0], block);
+		break;
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+		EncodeBc4(planes[0], block);
+		EncodeBc4(planes[1], block + 8);
+		break;
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		EncodeBc7(planes, block);
+		break;
+	default:
+		memset(block, 0, BlockSize(format));
+		break;
+	}
+}
+bool BlockCompression::DecodeBlock(VkFormat format, const uint8_t* block, uint8_t* rgba) {
+	switch (format) {
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+		DecodeBc1(block, false, false, rgba);
+		return true;
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+		DecodeBc1(block, false, true, rgba);
+		return true;
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+		DecodeBc1(block + 8, true, false, rgba);
+		DecodeBc4(block, rgba + 3, 4);
+		return true;
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+		memset(rgba, 0, 64);
+		DecodeBc4(block, rgba, 4);
+		for (uint32_t i = 0; i < 16; i++) rgba[4 * i + 3] = 255;
+		return true;
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+		memset(rgba, 0, 64);
+		DecodeBc4(block, rgba, 4);
+		DecodeBc4(block + 8, rgba + 1, 4);
+		for (uint32_t i = 0; i < 16; i++) rgba[4 * i + 3] = 255;
+		return true;
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		return DecodeBc7(block, rgba);
+	default:
+		return false;
+	}
+}
+
+void BlockCompression::Encode(VkFormat format, const uint8_t* rgba, uint32_t width, uint32_t height, uint8_t* blocks, JobSystem* jobSystem) {
+	uint32_t blockSize = BlockSize(format);
+	uint32_t blocksX = (width + 3) / 4;
+	uint32_t blocksY = (height + 3) / 4;
+	auto encodeRow = [&](uint32_t by) {
+		uint8_t pixels[64];
+		for (uint32_t bx = 0; bx < blocksX; bx++) {
+			for (uint32_t y = 0; y < 4; y++) {
+				uint32_t sy = min(by * 4 + y, height - 1);
+				for (uint32_t x = 0; x < 4; x++) {
+					uint32_t sx = min(bx * 4 + x, width - 1);
+					memcpy(pixels + 4 * (4 * y + x), rgba + 4 * ((size_t)sy * width + sx), 4);
+				}
+			}
+			EncodeBlock(format, pixels, blocks + ((size_t)by * blocksX + bx) * blockSize);
+		}
+	};
+	if (jobSystem)
+		jobSystem->ParallelFor(blocksY, encodeRow, 4);
+	else
+		for (uint32_t by = 0; by < blocksY; by++) encodeRow(by);
+}
+bool BlockCompression::Decode(VkFormat format, const uint8_t* blocks, uint32_t width, uint32_t height, uint8_t* rgba) {
+	uint32_t blockSize = BlockSize(format);
+	uint32_t blocksX = (width + 3) / 4;
+	uint32_t blocksY = (height + 3) / 4;
+	uint8_t pixels[64];
+	for (uint32_t by = 0; by < blocksY; by++)
+		for (uint32_t bx = 0; bx < blocksX; bx++) {
+			if (!DecodeBlock(format, blocks + ((size_t)by * blocksX + bx) * blockSize, pixels)) return false;
+			for (uint32_t y = 0; y < 4 && by * 4 + y < height; y++)
+				for (uint32_t x = 0; x < 4 && bx * 4 + x < width; x++)
+					memcpy(rgba + 4 * ((size_t)(by * 4 + y) * width + bx * 4 + x), pixels + 4 * (4 * y + x), 4);
+		}
+	return true;
+}
+
+void BlockCompression::Downsample(const uint8_t* rgba, uint32_t width, uint32_t height, uint8_t* dst) {
+	uint32_t w = max(width / 2, 1u);
+	uint32_t h = max(height / 2, 1u);
+	for (uint32_t y = 0; y < h; y++) {
+		const uint8_t* row0 = rgba + 4 * (size_t)min(2 * y, height - 1) * width;
+		const uint8_t* row1 = rgba + 4 * (size_t)min(2 * y + 1, height - 1) * width;
+		for (uint32_t x = 0; x < w; x++) {
+			uint32_t x0 = 4 * min(2 * x, width - 1);
+			uint32_t x1 = 4 * min(2 * x + 1, width - 1);
+			for (uint32_t c = 0; c < 4; c++)
+				dst[4 * ((size_t)y * w + x) + c] = (uint8_t)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+		}
+	}
+}
+double BlockCompression::RmsError(const uint8_t* a, const uint8_t* b, size_t pixelCount, uint32_t channels) {
+	if (!pixelCount || !channels) return 0;
+	double sum = 0;
+	for (size_t i = 0; i < pixelCount; i++)
+		for (uint32_t c = 0; c < channels; c++) {
+			double d = (double)a[4 * i + c] - (double)b[4 * i + c];
+			sum += d * d;
+		}
+	return sqrt(sum / (double)(pixelCount * channels));
+}
\ No newline at end of file
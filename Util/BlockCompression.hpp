@@ -0,0 +1,34 @@
+#pragma once
+
+#include <Util/Util.hpp>
+
+class JobSystem;
+
+/// CPU encoder and decoder for BC1, BC3, BC4, BC5 and BC7 textures. Pixels are 8-bit RGBA in row order; every format stores 4x4 pixel blocks,
+/// and blocks that overhang the edge of an image repeat its last row and column. Independent of any VkDevice
+class BlockCompression {
+public:
+	/// Bytes per 4x4 block, or 0 if format isn't block compressed. Covers every BC format, including BC2 and BC6H which can't be encoded here
+	ENGINE_EXPORT static uint32_t BlockSize(VkFormat format);
+	inline static bool IsBlockCompressed(VkFormat format) { return BlockSize(format) != 0; }
+	/// Bytes in one width x height image of format, block compressed or not. 0 if the size of format is unknown
+	ENGINE_EXPORT static size_t ImageSize(VkFormat format, uint32_t width, uint32_t height);
+	/// True for the formats EncodeBlock() and DecodeBlock() handle: BC1, BC3, BC4 and BC5 UNORM, and BC7, in UNORM and SRGB
+	ENGINE_EXPORT static bool CanEncode(VkFormat format);
+
+	/// Encodes 16 RGBA pixels. BC1 ignores alpha and always writes opaque blocks. BC7 only uses mode 6, a single RGBA line with 4-bit indices
+	ENGINE_EXPORT static void EncodeBlock(VkFormat format, const uint8_t* rgba, uint8_t* block);
+	/// Decodes a block to 16 RGBA pixels, with missing channels set to 0 and missing alpha to 255.
+	/// Returns false for BC7 blocks in modes other than 6, which only the GPU decodes
+	ENGINE_EXPORT static bool DecodeBlock(VkFormat format, const uint8_t* block, uint8_t* rgba);
+
+	/// Encodes a width x height image into ImageSize(format, width, height) bytes of blocks. Rows of blocks are spread over jobSystem if it isn't nullptr
+	ENGINE_EXPORT static void Encode(VkFormat format, const uint8_t* rgba, uint32_t width, uint32_t height, uint8_t* blocks, JobSystem* jobSystem = nullptr);
+	/// Decodes blocks to a width x height image. Returns false if a block couldn't be decoded
+	ENGINE_EXPORT static bool Decode(VkFormat format, const uint8_t* blocks, uint32_t width, uint32_t height, uint8_t* rgba);
+
+	/// Halves an image with a box filter, to make mip levels for formats the GPU can't blit. dst holds max(width/2, 1) x max(height/2, 1) pixels
+	ENGINE_EXPORT static void Downsample(const uint8_t* rgba, uint32_t width, uint32_t height, uint8_t* dst);
+	/// Root mean square difference of the first channels channels of two images of pixelCount RGBA pixels
+	ENGINE_EXPORT static double RmsError(const uint8_t* a, const uint8_t* b, size_t pixelCount, uint32_t channels = 4);
+};
\ No newline at end of file
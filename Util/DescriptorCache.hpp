@@ -0,0 +1,154 @@
+#pragma once
+
+#include <list>
+
+#include <Util/Util.hpp>
+
+/// The contents of a descriptor set: its layout and what is bound to each descriptor.
+/// Handles are stored as integers, so keys can be built from any handle type, or from fake handles. Each resource also has an id, because
+/// handles of destroyed resources can be reused by new ones
+struct DescriptorKey {
+	struct Entry {
+		uint32_t mBinding;
+		uint32_t mIndex;
+		uint32_t mType;
+		uint32_t mImageLayout;
+		uint64_t mHandle; // buffer or image view
+		uint64_t mId;
+		uint64_t mSampler;
+		uint64_t mOffset;
+		uint64_t mRange;
+
+		inline bool operator==(const Entry& e) const {
+			return mBinding == e.mBinding && mIndex == e.mIndex && mType == e.mType && mImageLayout == e.mImageLayout &&
+				mHandle == e.mHandle && mId == e.mId && mSampler == e.mSampler && mOffset == e.mOffset && mRange == e.mRange;
+		}
+	};
+
+	uint64_t mLayout;
+	std::vector<Entry> mEntries;
+	size_t mHash;
+
+	inline DescriptorKey(uint64_t layout = 0) : mLayout(layout), mHash(0) { hash_combine(mHash, layout); }
+
+	inline void AddBuffer(uint32_t binding, uint32_t index, uint32_t type, uint64_t buffer, uint64_t id, uint64_t offset, uint64_t range) {
+		Add({ binding, index, type, 0, buffer, id, 0, offset, range });
+	}
+	inline void AddImage(uint32_t binding, uint32_t index, uint32_t type, uint64_t view, uint64_t id, uint64_t sampler, uint32_t layout) {
+		Add({ binding, index, type, layout, view, id, sampler, 0, 0 });
+	}
+
+	/// Entries must be added in the same order for keys to match
+	inline void Add(const Entry& e) {
+		mEntries.push_back(e);
+		hash_combine(mHash, e.mBinding);
+		hash_combine(mHash, e.mIndex);
+		hash_combine(mHash, e.mType);
+		hash_combine(mHash, e.mImageLayout);
+		hash_combine(mHash, e.mHandle);
+		hash_combine(mHash, e.mId);
+		hash_combine(mHash, e.mSampler);
+		hash_combine(mHash, e.mOffset);
+		hash_combine(mHash, e.mRange);
+	}
+
+	inline bool operator==(const DescriptorKey& k) const { return mHash == k.mHash && mLayout == k.mLayout && mEntries == k.mEntries; }
+};
+namespace std {
+	template<>
+	struct hash<DescriptorKey> {
+		inline std::size_t operator()(const DescriptorKey& k) const { return k.mHash; }
+	};
+}
+
+/// Statistics for one or more DescriptorCaches
+struct DescriptorCacheStats {
+	uint64_t mHits;
+	uint64_t mMisses;
+	uint64_t mEvictions;
+	uint32_t mSize;
+
+	inline DescriptorCacheStats() : mHits(0), mMisses(0), mEvictions(0), mSize(0) {}
+
+	inline float HitRate() const { return mHits + mMisses ? (float)((double)mHits / (double)(mHits + mMisses)) : 0.f; }
+
+	inline DescriptorCacheStats& operator +=(const DescriptorCacheStats& s) {
+		mHits += s.mHits;
+		mMisses += s.mMisses;
+		mEvictions += s.mEvictions;
+		mSize += s.mSize;
+		return *this;
+	}
+};
+
+/// Maps DescriptorKeys to values, such as descriptor sets already written with the key's contents, and evicts the least recently used ones.
+/// Entries are only evicted by Advance(), so a value found during a frame stays valid until the end of that frame.
+/// Not thread safe
+template<typename T>
+class DescriptorCache {
+public:
+	/// Entries unused for maxAge calls to Advance() are evicted, and the least recently used entries are evicted while there are more than capacity
+	inline DescriptorCache(uint32_t maxAge = 8, uint32_t capacity = 4096) : mMaxAge(maxAge), mCapacity(capacity), mFrame(0) {}
+
+	/// Returns the value cached for key and marks it used this frame, or nullptr
+	inline T* Find(const DescriptorKey& key) {
+		auto it = mEntries.find(key);
+		if (it == mEntries.end()) {
+			mStats.mMisses++;
+			return nullptr;
+		}
+		mStats.mHits++;
+		it->second->mLastUsed = mFrame;
+		mLru.splice(mLru.begin(), mLru, it->second);
+		return &it->second->mValue;
+	}
+	/// Caches value for key, which must not be in the cache yet
+	inline void Insert(const DescriptorKey& key, const T& value) {
+		mLru.push_front({ key, value, mFrame });
+		mEntries.emplace(key, mLru.begin());
+	}
+
+	/// Starts a new frame, appending the values of the evicted entries to evicted, least recently used first.
+	/// Entries used in the frame that just ended are never evicted
+	inline void Advance(std::vector<T>& evicted) {
+		while (mLru.size()) {
+			Node& n = mLru.back();
+			if (n.mLastUsed == mFrame || (mFrame - n.mLastUsed < mMaxAge && mLru.size() <= mCapacity)) break;
+			evicted.push_back(n.mValue);
+			mEntries.erase(n.mKey);
+			mLru.pop_back();
+			mStats.mEvictions++;
+		}
+		mFrame++;
+	}
+
+	/// Returns the values of every entry and empties the cache
+	inline void Clear(std::vector<T>& evicted) {
+		for (const Node& n : mLru) evicted.push_back(n.mValue);
+		mLru.clear();
+		mEntries.clear();
+	}
+
+	inline uint32_t Size() const { return (uint32_t)mLru.size(); }
+	inline DescriptorCacheStats Stats() const {
+		DescriptorCacheStats s = mStats;
+		s.mSize = Size();
+		return s;
+	}
+	inline void ResetStats() { mStats = DescriptorCacheStats(); }
+
+private:
+	struct Node {
+		DescriptorKey mKey;
+		T mValue;
+		uint64_t mLastUsed;
+	};
+
+	uint32_t mMaxAge;
+	uint32_t mCapacity;
+	uint64_t mFrame;
+	// Most recently used first
+	std::list<Node> mLru;
+	std::unordered_map<DescriptorKey, typename std::list<Node>::iterator> mEntries;
+	DescriptorCacheStats mStats;
+};
\ No newline at end of file
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <Util/Util.hpp>
+
+/// Hands out small integer ids, reusing the ids of released objects first, so ids stay below the number of live objects.
+/// Used for sort ids that are packed into a few bits of a sort key. Thread safe
+class IdPool {
+public:
+	/// first is the smallest id handed out, ids below it are reserved
+	inline IdPool(uint32_t first = 1) : mNext(first) {}
+
+	inline uint32_t Acquire() {
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (mFree.empty()) return mNext++;
+		uint32_t id = mFree.back();
+		mFree.pop_back();
+		return id;
+	}
+	inline void Release(uint32_t id) {
+		std::lock_guard<std::mutex> lock(mMutex);
+		mFree.push_back(id);
+	}
+
+private:
+	std::mutex mMutex;
+	std::vector<uint32_t> mFree;
+	uint32_t mNext;
+};
\ No newline at end of file
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <atomic>
+
+#include <Util/Util.hpp>
+
+/// Bump allocator over an abstract range [0, size). Like TlsfAllocator it only hands out offsets, so it can manage any kind of memory.
+/// Allocate() is lock-free and can be called from any thread; allocations are never freed individually, Reset() frees all of them at once
+class LinearAllocator {
+public:
+	inline LinearAllocator(uint64_t size = 0) : mSize(size), mOffset(0) {}
+
+	/// Finds space for size bytes at a multiple of alignment, which must be a power of two. Returns false if the allocator is full
+	inline bool Allocate(uint64_t size, uint64_t alignment, uint64_t& offset) {
+		uint64_t current = mOffset.load(std::memory_order_relaxed);
+		do {
+			offset = AlignUp(current, alignment);
+			if (offset + size > mSize) return false;
+		} while (!mOffset.compare_exchange_weak(current, offset + size, std::memory_order_relaxed));
+		return true;
+	}
+	/// Frees every allocation. Not thread safe
+	inline void Reset() { mOffset.store(0, std::memory_order_relaxed); }
+	/// Frees every allocation and changes the size of the range. Not thread safe
+	inline void Reset(uint64_t size) { mSize = size; Reset(); }
+
+	inline uint64_t Size() const { return mSize; }
+	/// Bytes allocated since the last Reset(), including alignment padding
+	inline uint64_t Used() const { return mOffset.load(std::memory_order_relaxed); }
+
+private:
+	uint64_t mSize;
+	std::atomic<uint64_t> mOffset;
+};
\ No newline at end of file
@@ -0,0 +1,47 @@
+#include <Util/MappedFile.hpp>
+
+#ifndef WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#ifdef WINDOWS
+MappedFile::MappedFile(const string& filename) : mData(nullptr), mSize(0), mFile(INVALID_HANDLE_VALUE), mMapping(NULL) {
+	mFile = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (mFile == INVALID_HANDLE_VALUE) return;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(mFile, &size) || size.QuadPart == 0) return;
+	mSize = (size_t)size.QuadPart;
+
+	mMapping = CreateFileMappingA(mFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mMapping) return;
+	mData = (const uint8_t*)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+}
+MappedFile::~MappedFile() {
+	if (mData) UnmapViewOfFile(mData);
+	if (mMapping) CloseHandle(mMapping);
+	if (mFile != INVALID_HANDLE_VALUE) CloseHandle(mFile);
+}
+#else
+MappedFile::MappedFile(const string& filename) : mData(nullptr), mSize(0), mFile(-1) {
+	mFile = open(filename.c_str(), O_RDONLY);
+	if (mFile < 0) return;
+
+	struct stat st;
+	if (fstat(mFile, &st) != 0 || st.st_size == 0) return;
+	mSize = (size_t)st.st_size;
+
+	void* data = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, mFile, 0);
+	if (data == MAP_FAILED) return;
+	mData = (const uint8_t*)data;
+}
+MappedFile::~MappedFile() {
+	if (mData) munmap((void*)mData, mSize);
+	if (mFile >= 0) close(mFile);
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <Util/Util.hpp>
+
+/// Maps a whole file into memory, read-only. The mapping is released when the MappedFile is destroyed
+class MappedFile {
+public:
+	/// Data() is nullptr if the file couldn't be opened or mapped
+	ENGINE_EXPORT MappedFile(const std::string& filename);
+	ENGINE_EXPORT ~MappedFile();
+
+	inline bool Valid() const { return mData != nullptr; }
+	inline const uint8_t* Data() const { return mData; }
+	inline size_t Size() const { return mSize; }
+
+private:
+	const uint8_t* mData;
+	size_t mSize;
+
+	#ifdef WINDOWS
+	HANDLE mFile;
+	HANDLE mMapping;
+	#else
+	int mFile;
+	#endif
+};
\ No newline at end of file
@@ -4,44 +4,299 @@
 
 using namespace std;
 
-ProfilerSample  Profiler::mFrames[PROFILER_FRAME_COUNT];
-ProfilerSample* Profiler::mCurrentSample = nullptr;
+ProfilerSample Profiler::mFrames[PROFILER_FRAME_COUNT];
+vector<ProfilerCounter> Profiler::mFrameCounters[PROFILER_FRAME_COUNT];
 uint64_t Profiler::mCurrentFrame = 0;
 const std::chrono::high_resolution_clock Profiler::mTimer;
+Profiler::ThreadBuffer* Profiler::mMainThread = nullptr;
 
-void Profiler::BeginSample(const string& label) {
-	mCurrentSample->mChildren.push_back({});
-	ProfilerSample* s = &mCurrentSample->mChildren.back();
-	memset(s, 0, sizeof(ProfilerSample));
-	
-	strncpy(s->mLabel, label.c_str(), PROFILER_LABEL_SIZE);
-	s->mParent = mCurrentSample;
-	s->mStartTime = mTimer.now();
-	s->mChildren = {};
+mutex Profiler::mThreadMutex;
+vector<Profiler::ThreadBuffer*> Profiler::mThreads;
+unordered_map<uint32_t, string> Profiler::mThreadNames;
+uint32_t Profiler::mThreadCount = 0;
+
+mutex Profiler::mLabelMutex;
+vector<string> Profiler::mLabels;
+unordered_map<string, uint32_t> Profiler::mLabelIds;
+
+mutex Profiler::mCounterMutex;
+vector<pair<uint32_t, int64_t>> Profiler::mCounters;
+
+bool Profiler::mCapturing = false;
+vector<pair<Profiler::Event, uint32_t>> Profiler::mCapture;
+vector<pair<uint64_t, ProfilerCounter>> Profiler::mCaptureCounters;
+
+// Flags the calling thread's buffer when the thread exits, so FrameEnd() can free it
+struct ProfilerThreadBufferRef {
+	Profiler::ThreadBuffer* mBuffer = nullptr;
+	inline ~ProfilerThreadBufferRef() { if (mBuffer) mBuffer->mExited.store(true, memory_order_release); }
+};
+static thread_local ProfilerThreadBufferRef gThreadBuffer;
+// Events dropped because the buffer was full, including everything nested inside a dropped sample
+static thread_local uint32_t gDroppedDepth = 0;
+
+inline uint64_t ProfilerTime(chrono::high_resolution_clock::time_point t) {
+	return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(t.time_since_epoch()).count();
+}
+inline chrono::high_resolution_clock::time_point ProfilerTimePoint(uint64_t t) {
+	return chrono::high_resolution_clock::time_point(chrono::duration_cast<chrono::high_resolution_clock::duration>(chrono::nanoseconds(t)));
+}
+
+uint32_t Profiler::Label(const string& label) {
+	lock_guard<mutex> lock(mLabelMutex);
+	auto it = mLabelIds.find(label);
+	if (it != mLabelIds.end()) return it->second;
+	uint32_t id = (uint32_t)mLabels.size();
+	mLabels.push_back(label);
+	mLabelIds.emplace(label, id);
+	return id;
+}
+
+Profiler::ThreadBuffer* Profiler::CurrentThreadBuffer() {
+	if (!gThreadBuffer.mBuffer) {
+		ThreadBuffer* b = new ThreadBuffer();
+		b->mWrite = 0;
+		b->mRead = 0;
+		b->mExited = false;
+
+		lock_guard<mutex> lock(mThreadMutex);
+		b->mIndex = mThreadCount++;
+		mThreads.push_back(b);
+		gThreadBuffer.mBuffer = b;
+	}
+	return gThreadBuffer.mBuffer;
+}
+
+void Profiler::Record(uint32_t label, bool end) {
+	ThreadBuffer* b = CurrentThreadBuffer();
+	uint64_t write = b->mWrite.load(memory_order_relaxed);
 
-	mCurrentSample =  s;
+	// Once a begin event is dropped, drop everything until its end event so the rest stays balanced
+	if (gDroppedDepth || write - b->mRead.load(memory_order_acquire) >= PROFILER_EVENT_BUFFER_SIZE) {
+		if (!end) gDroppedDepth++;
+		else if (gDroppedDepth) gDroppedDepth--;
+		return;
+	}
+
+	Event& e = b->mEvents[write % PROFILER_EVENT_BUFFER_SIZE];
+	e.mTime = ProfilerTime(mTimer.now());
+	e.mLabel = label;
+	e.mEnd = end ? 1 : 0;
+	b->mWrite.store(write + 1, memory_order_release);
+}
+
+void Profiler::BeginSample(uint32_t label) {
+	Record(label, false);
+}
+void Profiler::BeginSample(const string& label) {
+	Record(Label(label), false);
 }
 void Profiler::EndSample() {
-	if (!mCurrentSample->mParent) {
-		fprintf_color(COLOR_RED, stderr, "Error: Attempt to end nonexistant Profiler sample!");
-		throw;
+	Record(0, true);
+}
+void Profiler::Count(uint32_t label, int64_t value) {
+	lock_guard<mutex> lock(mCounterMutex);
+	for (auto& c : mCounters)
+		if (c.first == label) {
+			c.second += value;
+			return;
+		}
+	mCounters.push_back(make_pair(label, value));
+}
+
+void Profiler::ThreadName(const string& name) {
+	ThreadBuffer* b = CurrentThreadBuffer();
+	lock_guard<mutex> lock(mThreadMutex);
+	mThreadNames[b->mIndex] = name;
+}
+
+void Profiler::Drain(ThreadBuffer* b) {
+	uint64_t write = b->mWrite.load(memory_order_acquire);
+	uint64_t read = b->mRead.load(memory_order_relaxed);
+
+	for (; read < write; read++) {
+		const Event& e = b->mEvents[read % PROFILER_EVENT_BUFFER_SIZE];
+		if (mCapturing) mCapture.push_back(make_pair(e, b->mIndex));
+
+		if (!e.mEnd) {
+			b->mOpen.push_back({ e.mLabel, e.mTime, {} });
+			continue;
+		}
+		if (b->mOpen.empty()) continue;
+
+		OpenSample& o = b->mOpen.back();
+		ProfilerSample s;
+		strncpy(s.mLabel, mLabels[o.mLabel].c_str(), PROFILER_LABEL_SIZE);
+		s.mLabel[PROFILER_LABEL_SIZE - 1] = '\0';
+		s.mParent = nullptr;
+		s.mStartTime = ProfilerTimePoint(o.mStartTime);
+		s.mDuration = chrono::nanoseconds(e.mTime - o.mStartTime);
+		s.mChildren = move(o.mChildren);
+		b->mOpen.pop_back();
+
+		if (b->mOpen.size())
+			b->mOpen.back().mChildren.push_back(move(s));
+		else
+			b->mFinished.push_back(move(s));
+	}
+
+	b->mRead.store(read, memory_order_release);
+}
+
+inline void FixParents(ProfilerSample* sample) {
+	for (ProfilerSample& c : sample->mChildren) {
+		c.mParent = sample;
+		FixParents(&c);
 	}
-	mCurrentSample->mDuration += mTimer.now() - mCurrentSample->mStartTime;
-	mCurrentSample = mCurrentSample->mParent;
 }
 
 void Profiler::FrameStart() {
-	int i = mCurrentFrame % PROFILER_FRAME_COUNT;
-	sprintf(mFrames[i].mLabel, "Frame  %llu", mCurrentFrame);
-	mFrames[i].mParent = nullptr;
-	mFrames[i].mStartTime = mTimer.now();
-	mFrames[i].mDuration = chrono::nanoseconds::zero();
-	mFrames[i].mChildren.clear();
-	mCurrentSample = &mFrames[i];
+	static const uint32_t frameLabel = Label("Frame");
+	mMainThread = CurrentThreadBuffer();
+	{
+		lock_guard<mutex> lock(mThreadMutex);
+		mThreadNames.emplace(mMainThread->mIndex, "Main Thread");
+	}
+	BeginSample(frameLabel);
 }
 void Profiler::FrameEnd() {
-	int i = mCurrentFrame % PROFILER_FRAME_COUNT;
-	mFrames[i].mDuration = mTimer.now() - mFrames[i].mStartTime;
+	static const uint32_t frameLabel = Label("Frame");
+	EndSample();
+
+	ProfilerSample& frame = mFrames[mCurrentFrame % PROFILER_FRAME_COUNT];
+	frame.mParent = nullptr;
+	frame.mStartTime = mTimer.now();
+	frame.mDuration = chrono::nanoseconds::zero();
+	frame.mChildren.clear();
+
+	vector<ProfilerCounter>& counters = mFrameCounters[mCurrentFrame % PROFILER_FRAME_COUNT];
+	counters.clear();
+
+	lock_guard<mutex> threadLock(mThreadMutex);
+	{
+		lock_guard<mutex> labelLock(mLabelMutex);
+		for (ThreadBuffer* b : mThreads)
+			Drain(b);
+
+		lock_guard<mutex> counterLock(mCounterMutex);
+		for (const auto& c : mCounters) {
+			ProfilerCounter counter;
+			strncpy(counter.mLabel, mLabels[c.first].c_str(), PROFILER_LABEL_SIZE);
+			counter.mLabel[PROFILER_LABEL_SIZE - 1] = '\0';
+			counter.mValue = c.second;
+			counters.push_back(counter);
+		}
+		mCounters.clear();
+	}
+
+	// The main thread's last finished sample is the frame, anything else it finished is added to the frame
+	for (ProfilerSample& s : mMainThread->mFinished)
+		if (&s == &mMainThread->mFinished.back() && strcmp(s.mLabel, mLabels[frameLabel].c_str()) == 0) {
+			frame.mStartTime = s.mStartTime;
+			frame.mDuration = s.mDuration;
+			for (ProfilerSample& c : s.mChildren)
+				frame.mChildren.push_back(move(c));
+		} else
+			frame.mChildren.push_back(move(s));
+	mMainThread->mFinished.clear();
+	snprintf(frame.mLabel, PROFILER_LABEL_SIZE, "Frame  %llu", (unsigned long long)mCurrentFrame);
+
+	// Group samples from other threads under one sample per thread
+	for (auto it = mThreads.begin(); it != mThreads.end();) {
+		ThreadBuffer* b = *it;
+		if (b != mMainThread && b->mFinished.size()) {
+			ProfilerSample group;
+			auto name = mThreadNames.find(b->mIndex);
+			if (name != mThreadNames.end())
+				strncpy(group.mLabel, name->second.c_str(), PROFILER_LABEL_SIZE);
+			else
+				snprintf(group.mLabel, PROFILER_LABEL_SIZE, "Thread %u", b->mIndex);
+			group.mLabel[PROFILER_LABEL_SIZE - 1] = '\0';
+			group.mParent = nullptr;
+			group.mStartTime = b->mFinished.front().mStartTime;
+			group.mDuration = (b->mFinished.back().mStartTime + b->mFinished.back().mDuration) - group.mStartTime;
+			group.mChildren = move(b->mFinished);
+			b->mFinished.clear();
+			frame.mChildren.push_back(move(group));
+		}
+
+		if (b != mMainThread && b->mExited.load(memory_order_acquire) && b->mRead.load() == b->mWrite.load()) {
+			delete b;
+			it = mThreads.erase(it);
+		} else
+			it++;
+	}
+
+	if (mCapturing)
+		for (const ProfilerCounter& c : counters)
+			mCaptureCounters.push_back(make_pair(ProfilerTime(frame.mStartTime + frame.mDuration), c));
+
+	FixParents(&frame);
 	mCurrentFrame++;
-	mCurrentSample = nullptr;
+}
+
+void Profiler::BeginCapture() {
+	mCapture.clear();
+	mCaptureCounters.clear();
+	mCapturing = true;
+}
+bool Profiler::EndCapture(const string& filename) {
+	lock_guard<mutex> threadLock(mThreadMutex);
+	{
+		lock_guard<mutex> labelLock(mLabelMutex);
+		for (ThreadBuffer* b : mThreads)
+			Drain(b);
+	}
+	mCapturing = false;
+
+	FILE* file = fopen(filename.c_str(), "w");
+	if (!file) {
+		fprintf_color(COLOR_RED, stderr, "Failed to write %s\n", filename.c_str());
+		mCapture.clear();
+		mCaptureCounters.clear();
+		return false;
+	}
+
+	auto escape = [](const string& str) {
+		string r;
+		for (char c : str) {
+			if (c == '"' || c == '\\') r += '\\';
+			if ((uint8_t)c >= 0x20) r += c;
+		}
+		return r;
+	};
+
+	uint64_t start = mCapture.size() ? mCapture[0].first.mTime : mCaptureCounters.size() ? mCaptureCounters[0].first : 0;
+	for (const auto& e : mCapture) start = min(start, e.first.mTime);
+	for (const auto& c : mCaptureCounters) start = min(start, c.first);
+
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool first = true;
+	for (const auto& t : mThreadNames) {
+		fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", t.first, escape(t.second).c_str());
+		first = false;
+	}
+	{
+		lock_guard<mutex> labelLock(mLabelMutex);
+		for (const auto& e : mCapture) {
+			double ts = (e.first.mTime - start) * 1e-3;
+			if (e.first.mEnd)
+				fprintf(file, "%s{\"ph\":\"E\",\"ts\":%.3f,\"pid\":0,\"tid\":%u}", first ? "" : ",\n", ts, e.second);
+			else
+				fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":0,\"tid\":%u}", first ? "" : ",\n", escape(mLabels[e.first.mLabel]).c_str(), ts, e.second);
+			first = false;
+		}
+	}
+	for (const auto& c : mCaptureCounters) {
+		fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":0,\"args\":{\"value\":%lld}}", first ? "" : ",\n",
+			escape(c.second.mLabel).c_str(), (c.first - start) * 1e-3, (long long)c.second.mValue);
+		first = false;
+	}
+	fprintf(file, "\n]}\n");
+	bool ok = ferror(file) == 0;
+	fclose(file);
+
+	mCapture.clear();
+	mCaptureCounters.clear();
+	return ok;
 }
\ No newline at end of file
@@ -3,17 +3,23 @@
 #define PROFILER_ENABLE
 
 #ifdef PROFILER_ENABLE
-#define PROFILER_BEGIN(label) Profiler::BeginSample(label)
+// Interns the label once per call site, so beginning a sample doesn't allocate or lock
+#define PROFILER_BEGIN(label) Profiler::BeginSample([]() { static const uint32_t _labelId = Profiler::Label(label); return _labelId; }())
 #define PROFILER_END Profiler::EndSample()
+#define PROFILER_COUNT(label, value) Profiler::Count([]() { static const uint32_t _labelId = Profiler::Label(label); return _labelId; }(), value)
 #else
-#define PROFILER_BEGIN(label) 
+#define PROFILER_BEGIN(label)
 #define PROFILER_END
+#define PROFILER_COUNT(label, value)
 #endif
 
 #define PROFILER_FRAME_COUNT 512
 #define PROFILER_LABEL_SIZE 64
+// Events each thread can record between two calls to FrameEnd()
+#define PROFILER_EVENT_BUFFER_SIZE 16384
 
 #include <Util/Util.hpp>
+#include <atomic>
 #include <chrono>
 #include <list>
 
@@ -24,22 +30,100 @@ struct ProfilerSample {
 	std::chrono::nanoseconds mDuration;
 	std::vector<ProfilerSample> mChildren;
 };
+struct ProfilerCounter {
+	char mLabel[PROFILER_LABEL_SIZE];
+	int64_t mValue;
+};
 
+/// Records nested samples from any thread. Each thread writes begin/end events into its own lock-free ring buffer,
+/// and FrameEnd() merges them into the sample tree of the frame: the main thread's samples are children of the frame,
+/// and every other thread's samples are grouped under a child named after the thread.
+/// Counters sum values such as object counts over a frame, and are kept alongside each frame's samples.
+/// Samples can also be captured and written as Chrome Trace Event JSON, which chrome://tracing and Perfetto open
 class Profiler {
 public:
+	/// Returns the id of a label, adding it the first time it is seen
+	ENGINE_EXPORT static uint32_t Label(const std::string& label);
+
+	ENGINE_EXPORT static void BeginSample(uint32_t label);
 	ENGINE_EXPORT static void BeginSample(const std::string& label);
 	ENGINE_EXPORT static void EndSample();
+	/// Adds value to a counter of the current frame. Can be called from any thread
+	ENGINE_EXPORT static void Count(uint32_t label, int64_t value);
 
+	/// Names the calling thread in the sample tree and in captures
+	ENGINE_EXPORT static void ThreadName(const std::string& name);
+
+	/// Called by the main thread
 	ENGINE_EXPORT static void FrameStart();
+	/// Called by the main thread, merges the events every thread recorded since the last call
 	ENGINE_EXPORT static void FrameEnd();
 
+	/// Starts recording every event until EndCapture()
+	ENGINE_EXPORT static void BeginCapture();
+	/// Writes the events recorded since BeginCapture() to filename as Chrome Trace Event JSON. Returns false if the file couldn't be written
+	ENGINE_EXPORT static bool EndCapture(const std::string& filename);
+	inline static bool Capturing() { return mCapturing; }
+
 	inline static const uint64_t CurrentFrameIndex() { return (mCurrentFrame + PROFILER_FRAME_COUNT - 1) % PROFILER_FRAME_COUNT; }
 	inline static const ProfilerSample* Frames() { return mFrames; }
 	inline static const ProfilerSample* LastFrame() { return &mFrames[CurrentFrameIndex()]; }
+	/// Counters of each frame, indexed like Frames()
+	inline static const std::vector<ProfilerCounter>* FrameCounters() { return mFrameCounters; }
+	inline static const std::vector<ProfilerCounter>& LastFrameCounters() { return mFrameCounters[CurrentFrameIndex()]; }
 
 private:
+	struct Event {
+		// Nanoseconds since the clock's epoch
+		uint64_t mTime;
+		uint32_t mLabel;
+		uint32_t mEnd;
+	};
+	struct OpenSample {
+		uint32_t mLabel;
+		uint64_t mStartTime;
+		std::vector<ProfilerSample> mChildren;
+	};
+	/// Written only by its thread, read only by FrameEnd()
+	struct ThreadBuffer {
+		Event mEvents[PROFILER_EVENT_BUFFER_SIZE];
+		std::atomic<uint64_t> mWrite;
+		std::atomic<uint64_t> mRead;
+		std::atomic<bool> mExited;
+		uint32_t mIndex;
+		// Samples that haven't ended yet, owned by FrameEnd()
+		std::vector<OpenSample> mOpen;
+		// Samples that ended this frame without a parent
+		std::vector<ProfilerSample> mFinished;
+	};
+	friend struct ProfilerThreadBufferRef;
+
+	ENGINE_EXPORT static ThreadBuffer* CurrentThreadBuffer();
+	ENGINE_EXPORT static void Record(uint32_t label, bool end);
+	ENGINE_EXPORT static void Drain(ThreadBuffer* buffer);
+
 	ENGINE_EXPORT static const std::chrono::high_resolution_clock mTimer;
 	ENGINE_EXPORT static ProfilerSample mFrames[PROFILER_FRAME_COUNT];
-	ENGINE_EXPORT static ProfilerSample* mCurrentSample;
+	ENGINE_EXPORT static std::vector<ProfilerCounter> mFrameCounters[PROFILER_FRAME_COUNT];
 	ENGINE_EXPORT static uint64_t mCurrentFrame;
+	ENGINE_EXPORT static ThreadBuffer* mMainThread;
+
+	ENGINE_EXPORT static std::mutex mThreadMutex;
+	ENGINE_EXPORT static std::vector<ThreadBuffer*> mThreads;
+	ENGINE_EXPORT static std::unordered_map<uint32_t, std::string> mThreadNames;
+	ENGINE_EXPORT static uint32_t mThreadCount;
+
+	ENGINE_EXPORT static std::mutex mLabelMutex;
+	ENGINE_EXPORT static std::vector<std::string> mLabels;
+	ENGINE_EXPORT static std::unordered_map<std::string, uint32_t> mLabelIds;
+
+	ENGINE_EXPORT static std::mutex mCounterMutex;
+	// <label, value> counted since the last FrameEnd()
+	ENGINE_EXPORT static std::vector<std::pair<uint32_t, int64_t>> mCounters;
+
+	ENGINE_EXPORT static bool mCapturing;
+	// <event, thread index>
+	ENGINE_EXPORT static std::vector<std::pair<Event, uint32_t>> mCapture;
+	// <time, counter>
+	ENGINE_EXPORT static std::vector<std::pair<uint64_t, ProfilerCounter>> mCaptureCounters;
 };
\ No newline at end of file
@@ -0,0 +1,44 @@
+#include <Util/PropertyID.hpp>
+
+#include <deque>
+#include <shared_mutex>
+
+using namespace std;
+
+// Function-local, so IDs can be assigned while other translation units are initializing their statics
+struct PropertyRegistry {
+	unordered_map<string, PropertyID> mIDs;
+	// A deque so references returned by PropertyName() stay valid as names are added
+	deque<string> mNames;
+	shared_mutex mMutex;
+};
+static PropertyRegistry& Registry() {
+	static PropertyRegistry registry;
+	return registry;
+}
+
+PropertyID PropertyToID(const string& name) {
+	PropertyRegistry& r = Registry();
+	{
+		shared_lock lock(r.mMutex);
+		auto it = r.mIDs.find(name);
+		if (it != r.mIDs.end()) return it->second;
+	}
+	unique_lock lock(r.mMutex);
+	auto it = r.mIDs.find(name);
+	if (it != r.mIDs.end()) return it->second;
+	PropertyID id = (PropertyID)r.mNames.size();
+	r.mNames.push_back(name);
+	r.mIDs.emplace(name, id);
+	return id;
+}
+const string& PropertyName(PropertyID id) {
+	PropertyRegistry& r = Registry();
+	shared_lock lock(r.mMutex);
+	return r.mNames[id];
+}
+uint32_t PropertyCount() {
+	PropertyRegistry& r = Registry();
+	shared_lock lock(r.mMutex);
+	return (uint32_t)r.mNames.size();
+}
\ No newline at end of file
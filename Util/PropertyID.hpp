@@ -0,0 +1,14 @@
+#pragma once
+
+#include <Util/Util.hpp>
+
+/// Integer handle for the name of a push constant, descriptor or material parameter.
+/// Get one with PropertyToID() once, then pass it instead of the name to avoid hashing strings every draw
+typedef uint32_t PropertyID;
+
+/// Returns the ID of name, assigning the next ID the first time a name is seen. IDs last for the life of the process. Thread safe
+ENGINE_EXPORT PropertyID PropertyToID(const std::string& name);
+/// The name an ID was assigned to. id must have been returned by PropertyToID()
+ENGINE_EXPORT const std::string& PropertyName(PropertyID id);
+/// Number of IDs assigned so far
+ENGINE_EXPORT uint32_t PropertyCount();
\ No newline at end of file
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <Util/Util.hpp>
+
+/// Sorts count items by the unsigned 64-bit key(item) with a stable LSD radix sort, one byte per pass.
+/// Passes over bytes that are equal in every key are skipped, so keys with unused bits cost fewer passes.
+/// scratch must have room for count items, the sorted items end up in items
+template<typename T, typename KeyFunc>
+inline void RadixSort(T* items, T* scratch, size_t count, KeyFunc key) {
+	// The histograms cost more than a comparison sort of a short list
+	if (count < 64) {
+		std::stable_sort(items, items + count, [&](const T& a, const T& b) { return key(a) < key(b); });
+		return;
+	}
+
+	size_t histogram[8][256] = {};
+	for (size_t i = 0; i < count; i++) {
+		uint64_t k = key(items[i]);
+		for (uint32_t b = 0; b < 8; b++)
+			histogram[b][(k >> (b * 8)) & 0xFF]++;
+	}
+
+	T* src = items;
+	T* dst = scratch;
+	for (uint32_t b = 0; b < 8; b++) {
+		size_t* h = histogram[b];
+		uint32_t shift = b * 8;
+		if (h[(key(src[0]) >> shift) & 0xFF] == count) continue;
+
+		size_t offset = 0;
+		for (uint32_t i = 0; i < 256; i++) {
+			size_t c = h[i];
+			h[i] = offset;
+			offset += c;
+		}
+		for (size_t i = 0; i < count; i++)
+			dst[h[(key(src[i]) >> shift) & 0xFF]++] = src[i];
+		std::swap(src, dst);
+	}
+	if (src != items) std::copy(src, src + count, items);
+}
\ No newline at end of file
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <deque>
+
+#include <Util/Util.hpp>
+
+/// Ring allocator over an abstract range [0, size), for memory that is freed in the order it was allocated, such as staging memory.
+/// Allocations are grouped into batches with Close(); a batch's space is reclaimed once Retire() is called with its value. Not thread safe
+class RingAllocator {
+public:
+	inline RingAllocator(uint64_t size = 0) : mSize(size), mHead(0), mTail(0) {}
+
+	/// Finds size contiguous bytes at a multiple of alignment, which must be a power of two. Allocations never wrap around the end of the range.
+	/// Returns false if there isn't enough free space until older batches are retired
+	inline bool Allocate(uint64_t size, uint64_t alignment, uint64_t& offset) {
+		if (!mSize || size > mSize) return false;
+		// mHead and mTail only increase, the ring position is their remainder
+		uint64_t position = mHead % mSize;
+		offset = AlignUp(position, alignment);
+		if (offset + size > mSize) offset = 0; // skip the rest of the range
+		uint64_t head = mHead + (offset >= position ? offset - position : mSize - position + offset) + size;
+		if (head - mTail > mSize) return false;
+		mHead = head;
+		return true;
+	}
+
+	/// Ends the current batch. Retire(batch) frees everything allocated since the previous Close(). Batch values must increase
+	inline void Close(uint64_t batch) {
+		if (mBatches.size() && mBatches.back().second == mHead) mBatches.back().first = batch;
+		else mBatches.emplace_back(batch, mHead);
+	}
+	/// Frees the batches closed with a value up to batch
+	inline void Retire(uint64_t batch) {
+		while (mBatches.size() && mBatches.front().first <= batch) {
+			mTail = mBatches.front().second;
+			mBatches.pop_front();
+		}
+		// Start again at the beginning of the range, which keeps large allocations from being split by the end
+		if (mBatches.empty() && mTail == mHead) mHead = mTail = 0;
+	}
+	/// Frees every allocation and changes the size of the range
+	inline void Reset(uint64_t size) { mSize = size; mHead = mTail = 0; mBatches.clear(); }
+
+	inline uint64_t Size() const { return mSize; }
+	/// Bytes in use, including alignment padding and space skipped at the end of the range
+	inline uint64_t Used() const { return mHead - mTail; }
+	inline bool Empty() const { return mHead == mTail; }
+
+private:
+	uint64_t mSize;
+	uint64_t mHead;
+	uint64_t mTail;
+	// Batch value and the head when it was closed
+	std::deque<std::pair<uint64_t, uint64_t>> mBatches;
+};
\ No newline at end of file
@@ -0,0 +1,207 @@
+#include <Util/TlsfAllocator.hpp>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+inline uint32_t BitScanLow(uint64_t x) {
+	#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanForward64(&i, x);
+	return (uint32_t)i;
+	#else
+	return (uint32_t)__builtin_ctzll(x);
+	#endif
+}
+inline uint32_t BitScanHigh(uint64_t x) {
+	#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanReverse64(&i, x);
+	return (uint32_t)i;
+	#else
+	return 63 - (uint32_t)__builtin_clzll(x);
+	#endif
+}
+
+TlsfAllocator::TlsfAllocator(uint64_t size) : mSize(size), mUsed(0), mAllocationCount(0), mFirstLevelBitmap(0) {
+	memset(mSecondLevelBitmap, 0, sizeof(mSecondLevelBitmap));
+	for (uint32_t i = 0; i < FirstLevelCount; i++)
+		for (uint32_t j = 0; j < SecondLevelCount; j++)
+			mFreeLists[i][j] = InvalidBlock;
+	if (size) InsertFree(NewBlock(0, size));
+}
+
+void TlsfAllocator::Mapping(uint64_t size, uint32_t& fl, uint32_t& sl) {
+	if (size < SecondLevelCount) {
+		// Small sizes get one class each
+		fl = 0;
+		sl = (uint32_t)size;
+	} else {
+		uint32_t log2 = BitScanHigh(size);
+		sl = (uint32_t)(size >> (log2 - SecondLevelLog2)) ^ SecondLevelCount;
+		fl = log2 - SecondLevelLog2 + 1;
+	}
+}
+
+uint32_t TlsfAllocator::NewBlock(uint64_t offset, uint64_t size) {
+	uint32_t index;
+	if (mBlockPool.size()) {
+		index = mBlockPool.back();
+		mBlockPool.pop_back();
+	} else {
+		index = (uint32_t)mBlocks.size();
+		mBlocks.push_back({});
+	}
+	Block& b = mBlocks[index];
+	b.mOffset = offset;
+	b.mSize = size;
+	b.mPrevPhysical = b.mNextPhysical = InvalidBlock;
+	b.mPrevFree = b.mNextFree = InvalidBlock;
+	b.mFree = false;
+	return index;
+}
+
+void TlsfAllocator::InsertFree(uint32_t block) {
+	Block& b = mBlocks[block];
+	uint32_t fl, sl;
+	Mapping(b.mSize, fl, sl);
+
+	b.mFree = true;
+	b.mPrevFree = InvalidBlock;
+	b.mNextFree = mFreeLists[fl][sl];
+	if (b.mNextFree != InvalidBlock) mBlocks[b.mNextFree].mPrevFree = block;
+	mFreeLists[fl][sl] = block;
+
+	mFirstLevelBitmap |= 1ull << fl;
+	mSecondLevelBitmap[fl] |= 1u << sl;
+}
+void TlsfAllocator::RemoveFree(uint32_t block) {
+	Block& b = mBlocks[block];
+	uint32_t fl, sl;
+	Mapping(b.mSize, fl, sl);
+
+	if (b.mPrevFree != InvalidBlock) mBlocks[b.mPrevFree].mNextFree = b.mNextFree;
+	if (b.mNextFree != InvalidBlock) mBlocks[b.mNextFree].mPrevFree = b.mPrevFree;
+	if (mFreeLists[fl][sl] == block) {
+		mFreeLists[fl][sl] = b.mNextFree;
+		if (b.mNextFree == InvalidBlock) {
+			mSecondLevelBitmap[fl] &= ~(1u << sl);
+			if (!mSecondLevelBitmap[fl]) mFirstLevelBitmap &= ~(1ull << fl);
+		}
+	}
+	b.mFree = false;
+	b.mPrevFree = b.mNextFree = InvalidBlock;
+}
+
+uint32_t TlsfAllocator::FindFree(uint64_t size) {
+	// Round up to the next size class, so any block in the class found is large enough
+	if (size >= SecondLevelCount) {
+		uint64_t round = (1ull << (BitScanHigh(size) - SecondLevelLog2)) - 1;
+		if (size + round < size) return InvalidBlock;
+		size += round;
+	}
+	uint32_t fl, sl;
+	Mapping(size, fl, sl);
+	if (fl >= FirstLevelCount) return InvalidBlock;
+
+	uint32_t slMap = mSecondLevelBitmap[fl] & (~0u << sl);
+	if (!slMap) {
+		// Nothing left in this power of two range, use the smallest class of the next non-empty one
+		uint64_t flMap = fl + 1 < 64 ? mFirstLevelBitmap & (~0ull << (fl + 1)) : 0;
+		if (!flMap) return InvalidBlock;
+		fl = BitScanLow(flMap);
+		slMap = mSecondLevelBitmap[fl];
+	}
+	return mFreeLists[fl][BitScanLow(slMap)];
+}
+
+void TlsfAllocator::SplitFree(uint32_t block, uint64_t size) {
+	if (mBlocks[block].mSize - size < MinBlockSize) return;
+
+	uint32_t rest = NewBlock(mBlocks[block].mOffset + size, mBlocks[block].mSize - size);
+	Block& b = mBlocks[block];
+	Block& r = mBlocks[rest];
+	b.mSize = size;
+	r.mPrevPhysical = block;
+	r.mNextPhysical = b.mNextPhysical;
+	if (r.mNextPhysical != InvalidBlock) mBlocks[r.mNextPhysical].mPrevPhysical = rest;
+	b.mNextPhysical = rest;
+	InsertFree(rest);
+}
+
+uint32_t TlsfAllocator::Merge(uint32_t a, uint32_t b) {
+	Block& ba = mBlocks[a];
+	Block& bb = mBlocks[b];
+	ba.mSize += bb.mSize;
+	ba.mNextPhysical = bb.mNextPhysical;
+	if (ba.mNextPhysical != InvalidBlock) mBlocks[ba.mNextPhysical].mPrevPhysical = a;
+	mBlockPool.push_back(b);
+	return a;
+}
+
+bool TlsfAllocator::Allocate(uint64_t size, uint64_t alignment, uint64_t& offset, uint32_t& block) {
+	if (size == 0) size = 1;
+	alignment = max<uint64_t>(alignment, 1);
+
+	// Any block this large fits the allocation wherever it starts
+	uint64_t padded = size + alignment - 1;
+	if (padded < size) return false;
+	uint32_t b = FindFree(padded);
+	if (b == InvalidBlock) return false;
+	RemoveFree(b);
+
+	uint64_t aligned = AlignUp(mBlocks[b].mOffset, (size_t)alignment);
+	uint64_t padding = aligned - mBlocks[b].mOffset;
+	if (padding >= MinBlockSize && mBlocks[b].mSize - padding >= MinBlockSize) {
+		// Give the leading padding back as its own free block, the allocation starts at the split
+		uint32_t front = b;
+		SplitFree(front, padding);
+		b = mBlocks[front].mNextPhysical;
+		RemoveFree(b);
+		InsertFree(front);
+		padding = 0;
+	}
+	SplitFree(b, padding + size);
+
+	mUsed += mBlocks[b].mSize;
+	mAllocationCount++;
+	offset = aligned;
+	block = b;
+	return true;
+}
+
+void TlsfAllocator::Free(uint32_t block) {
+	if (block >= mBlocks.size() || mBlocks[block].mFree) return;
+	mUsed -= mBlocks[block].mSize;
+	mAllocationCount--;
+
+	uint32_t prev = mBlocks[block].mPrevPhysical;
+	if (prev != InvalidBlock && mBlocks[prev].mFree) {
+		RemoveFree(prev);
+		block = Merge(prev, block);
+	}
+	uint32_t next = mBlocks[block].mNextPhysical;
+	if (next != InvalidBlock && mBlocks[next].mFree) {
+		RemoveFree(next);
+		block = Merge(block, next);
+	}
+	InsertFree(block);
+}
+
+TlsfStats TlsfAllocator::Stats() const {
+	TlsfStats stats;
+	stats.mSize = mSize;
+	stats.mUsed = mUsed;
+	stats.mAllocationCount = mAllocationCount;
+	stats.mFreeBlockCount = (uint32_t)(mBlocks.size() - mBlockPool.size()) - mAllocationCount;
+	if (mFirstLevelBitmap) {
+		// The largest block is in the highest non-empty size class
+		uint32_t fl = BitScanHigh(mFirstLevelBitmap);
+		uint32_t sl = BitScanHigh(mSecondLevelBitmap[fl]);
+		for (uint32_t b = mFreeLists[fl][sl]; b != InvalidBlock; b = mBlocks[b].mNextFree)
+			stats.mLargestFreeBlock = max(stats.mLargestFreeBlock, mBlocks[b].mSize);
+	}
+	return stats;
+}
\ No newline at end of file
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <Util/Util.hpp>
+
+/// Statistics for one or more TlsfAllocators
+struct TlsfStats {
+	uint64_t mSize;
+	uint64_t mUsed;
+	uint64_t mLargestFreeBlock;
+	uint32_t mAllocationCount;
+	uint32_t mFreeBlockCount;
+
+	inline TlsfStats() : mSize(0), mUsed(0), mLargestFreeBlock(0), mAllocationCount(0), mFreeBlockCount(0) {}
+
+	inline uint64_t Free() const { return mSize - mUsed; }
+	/// 0 when all free space is in one block, approaching 1 as free space is split into many small blocks
+	inline float Fragmentation() const { return Free() ? 1.f - (float)((double)mLargestFreeBlock / (double)Free()) : 0.f; }
+
+	inline TlsfStats& operator +=(const TlsfStats& s) {
+		mSize += s.mSize;
+		mUsed += s.mUsed;
+		mLargestFreeBlock = std::max(mLargestFreeBlock, s.mLargestFreeBlock);
+		mAllocationCount += s.mAllocationCount;
+		mFreeBlockCount += s.mFreeBlockCount;
+		return *this;
+	}
+};
+
+/// Two-level segregated fit allocator over an abstract range [0, size). It only hands out offsets, so it can manage any kind of memory.
+/// Allocate() and Free() are O(1): free blocks are kept in lists segregated by size class, found with two bitmap scans, and merged with their neighbors when freed.
+/// Not thread safe
+class TlsfAllocator {
+public:
+	static const uint32_t InvalidBlock = ~0u;
+
+	ENGINE_EXPORT TlsfAllocator(uint64_t size);
+
+	/// Finds space for size bytes at a multiple of alignment, which must be a power of two.
+	/// Returns false if there is no free block large enough. block identifies the allocation for Free()
+	ENGINE_EXPORT bool Allocate(uint64_t size, uint64_t alignment, uint64_t& offset, uint32_t& block);
+	ENGINE_EXPORT void Free(uint32_t block);
+
+	inline uint64_t Size() const { return mSize; }
+	inline uint64_t Used() const { return mUsed; }
+	inline uint32_t AllocationCount() const { return mAllocationCount; }
+	inline bool Empty() const { return mAllocationCount == 0; }
+	/// Walks the free lists, O(number of free blocks in the largest size class)
+	ENGINE_EXPORT TlsfStats Stats() const;
+
+private:
+	// Each power of two size range is split into 2^SecondLevelLog2 linearly spaced classes
+	static const uint32_t SecondLevelLog2 = 5;
+	static const uint32_t SecondLevelCount = 1 << SecondLevelLog2;
+	static const uint32_t FirstLevelCount = 64 - SecondLevelLog2 + 1;
+	// Leading alignment padding smaller than this stays inside the allocated block
+	static const uint64_t MinBlockSize = 16;
+
+	struct Block {
+		uint64_t mOffset;
+		uint64_t mSize;
+		// Neighbors in memory
+		uint32_t mPrevPhysical;
+		uint32_t mNextPhysical;
+		// Neighbors in the free list, only valid while the block is free
+		uint32_t mPrevFree;
+		uint32_t mNextFree;
+		bool mFree;
+	};
+
+	uint64_t mSize;
+	uint64_t mUsed;
+	uint32_t mAllocationCount;
+
+	std::vector<Block> mBlocks;
+	// Unused entries in mBlocks
+	std::vector<uint32_t> mBlockPool;
+
+	uint64_t mFirstLevelBitmap;
+	uint32_t mSecondLevelBitmap[FirstLevelCount];
+	uint32_t mFreeLists[FirstLevelCount][SecondLevelCount];
+
+	ENGINE_EXPORT static void Mapping(uint64_t size, uint32_t& fl, uint32_t& sl);
+	ENGINE_EXPORT uint32_t NewBlock(uint64_t offset, uint64_t size);
+	ENGINE_EXPORT void InsertFree(uint32_t block);
+	ENGINE_EXPORT void RemoveFree(uint32_t block);
+	/// Returns a free block of at least size bytes, or InvalidBlock
+	ENGINE_EXPORT uint32_t FindFree(uint64_t size);
+	/// Splits the end of a block off into a new free block, if at least MinBlockSize remains
+	ENGINE_EXPORT void SplitFree(uint32_t block, uint64_t size);
+	/// Merges b into a, which must precede it in memory. Returns a
+	ENGINE_EXPORT uint32_t Merge(uint32_t a, uint32_t b);
+};
\ No newline at end of file
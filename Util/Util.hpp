@@ -408,6 +408,24 @@ inline bool ReadFile(const std::string& filename, std::vector<uint8_t>& dest) {
 	return true;
 }
 
+// 64-bit FNV-1a over 8-byte words, then the remaining bytes. Stable across runs, for content hashes stored in files
+inline uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 0) {
+	const uint64_t prime = 0x100000001B3ull;
+	uint64_t hash = (0xCBF29CE484222325ull ^ seed) ^ size;
+
+	const uint8_t* bytes = (const uint8_t*)data;
+	size_t words = size / sizeof(uint64_t);
+	for (size_t i = 0; i < words; i++) {
+		uint64_t w;
+		memcpy(&w, bytes + i * sizeof(uint64_t), sizeof(uint64_t));
+		hash = (hash ^ w) * prime;
+		hash ^= hash >> 32;
+	}
+	for (size_t i = words * sizeof(uint64_t); i < size; i++)
+		hash = (hash ^ bytes[i]) * prime;
+	return hash;
+}
+
 inline void ThrowIfFailed(VkResult result, const std::string& message){
 	if (result != VK_SUCCESS){
 		const char* code = "<unknown>";